@@ -0,0 +1,811 @@
+#include "art.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "util.h"
+
+/* keys up to this long are folded on the stack */
+#define _ART_KEY_BUF 256
+
+typedef struct _Art_Node  _Art_Node;
+typedef struct _Art_Leaf  _Art_Leaf;
+typedef struct _Art_Frame _Art_Frame;
+
+/* keys are kept sorted in 4 and 16 */
+struct _Art_Node4 {
+	_Art_Node h;
+	uint8_t keys[4];
+	_Art_Node* children[4];
+};
+
+struct _Art_Node16 {
+	_Art_Node h;
+	uint8_t keys[16];
+	_Art_Node* children[16];
+};
+
+/* index holds a child's slot + 1, or 0 */
+struct _Art_Node48 {
+	_Art_Node h;
+	uint8_t index[256];
+	_Art_Node* children[48];
+};
+
+struct _Art_Node256 {
+	_Art_Node h;
+	_Art_Node* children[256];
+};
+
+static const size_t _art_node_size[] = {
+    sizeof(struct _Art_Node4),
+    sizeof(struct _Art_Node16),
+    sizeof(struct _Art_Node48),
+    sizeof(struct _Art_Node256),
+};
+static const unsigned _art_capacity[] = {4, 16, 48, 256};
+
+const uint8_t* _art_key(const Art*, const char* key, unsigned* n, bool trim, uint8_t* buf);
+void _art_key_free(const uint8_t* folded, const char* key, uint8_t* buf);
+_Art_Node* _art_new_node(unsigned type, const uint8_t* prefix, unsigned prefix_len);
+_Art_Leaf* _art_new_leaf(const Art*, const uint8_t* head, unsigned head_len, int byte, const uint8_t* tail, unsigned tail_len, const void* data);
+void _art_free(_Art_Node*);
+size_t _art_bytes(const Art*, const _Art_Node*);
+void* _art_insert(Art*, const uint8_t* key, unsigned n, const void* data);
+bool _art_remove(Art*, _Art_Node** ref, const uint8_t* key, unsigned n, unsigned depth);
+void _art_compact(Art*, _Art_Node** ref);
+_Art_Node** _art_find_child(_Art_Node*, uint8_t byte);
+_Art_Node* _art_next_child(const _Art_Node*, int* pos, uint8_t* byte);
+void _art_add_child(_Art_Node** ref, uint8_t byte, _Art_Node* child);
+void _art_remove_child(_Art_Node** ref, uint8_t byte);
+_Art_Node* _art_resize(_Art_Node*, unsigned type);
+void _art_hang(const Art*, _Art_Node** ref, _Art_Leaf*, unsigned drop);
+void _art_iter_key(Art_Iter*, unsigned at, const uint8_t* bytes, unsigned len);
+static inline bool _art_is_leaf(const _Art_Node*);
+static inline _Art_Leaf* _art_leaf(const _Art_Node*);
+static inline uint8_t* _art_prefix(const _Art_Node*);
+static inline uint8_t* _art_suffix(const Art*, const _Art_Leaf*);
+
+
+void
+art_construct_(void* gen_t, const unsigned elem_size, const unsigned props) {
+	Art* t = gen_t;
+	*t     = (Art) {
+	    ._elem_size = elem_size,
+	    .props      = props,
+	};
+}
+
+void
+art_destroy(void* gen_t) {
+	Art* t = gen_t;
+	_art_free(t->_root);
+	t->_root = NULL;
+}
+
+void
+art_clear(void* gen_t) {
+	Art* t = gen_t;
+	_art_free(t->_root);
+	t->_root = NULL;
+	t->size  = 0;
+}
+
+void*
+art_nset_(void* gen_t, const char* restrict key, unsigned n, const void* data) {
+	Art*           t = gen_t;
+	uint8_t        buf[_ART_KEY_BUF];
+	const uint8_t* k   = _art_key(t, key, &n, true, buf);
+	void*          val = _art_insert(t, k, n, data);
+	_art_key_free(k, key, buf);
+	return val;
+}
+
+void*
+art_nget(const void* gen_t, const char* restrict key, unsigned n) {
+	const Art*     t = gen_t;
+	uint8_t        buf[_ART_KEY_BUF];
+	const uint8_t* k     = _art_key(t, key, &n, true, buf);
+	_Art_Node*     p     = t->_root;
+	unsigned       depth = 0;
+	void*          val   = NULL;
+
+	while (p != NULL) {
+		if (_art_is_leaf(p)) {
+			_Art_Leaf* leaf = _art_leaf(p);
+			if (leaf->suffix_len == n - depth
+			    && memcmp(_art_suffix(t, leaf), &k[depth], n - depth) == 0) {
+				val = leaf->data;
+			}
+			break;
+		}
+		if (n - depth < p->prefix_len
+		    || memcmp(_art_prefix(p), &k[depth], p->prefix_len) != 0) {
+			break;
+		}
+		depth += p->prefix_len;
+		if (depth == n) {
+			val = (p->leaf) ? p->leaf->data : NULL;
+			break;
+		}
+		_Art_Node** child = _art_find_child(p, k[depth++]);
+		p                 = (child) ? *child : NULL;
+	}
+
+	_art_key_free(k, key, buf);
+	return val;
+}
+
+void*
+art_nlongest_prefix(const void* gen_t, const char* restrict key, unsigned n, unsigned* match_len) {
+	const Art*     t = gen_t;
+	uint8_t        buf[_ART_KEY_BUF];
+	const uint8_t* k     = _art_key(t, key, &n, true, buf);
+	_Art_Node*     p     = t->_root;
+	unsigned       depth = 0;
+	void*          val   = NULL;
+	unsigned       len   = 0;
+
+	while (p != NULL) {
+		if (_art_is_leaf(p)) {
+			_Art_Leaf* leaf = _art_leaf(p);
+			if (leaf->suffix_len <= n - depth
+			    && memcmp(_art_suffix(t, leaf), &k[depth], leaf->suffix_len) == 0) {
+				val = leaf->data;
+				len = depth + leaf->suffix_len;
+			}
+			break;
+		}
+		if (n - depth < p->prefix_len
+		    || memcmp(_art_prefix(p), &k[depth], p->prefix_len) != 0) {
+			break;
+		}
+		depth += p->prefix_len;
+		if (p->leaf != NULL) {
+			val = p->leaf->data;
+			len = depth;
+		}
+		if (depth == n) {
+			break;
+		}
+		_Art_Node** child = _art_find_child(p, k[depth++]);
+		p                 = (child) ? *child : NULL;
+	}
+
+	_art_key_free(k, key, buf);
+	if (match_len != NULL) {
+		*match_len = len;
+	}
+	return val;
+}
+
+bool
+art_nremove(void* gen_t, const char* restrict key, unsigned n) {
+	Art*           t = gen_t;
+	uint8_t        buf[_ART_KEY_BUF];
+	const uint8_t* k       = _art_key(t, key, &n, true, buf);
+	bool           removed = _art_remove(t, &t->_root, k, n, 0);
+	_art_key_free(k, key, buf);
+	t->size -= removed;
+	return removed;
+}
+
+size_t
+art_bytes(const void* gen_t) {
+	const Art* t = gen_t;
+	return _art_bytes(t, t->_root);
+}
+
+Art_Iter
+art_begin(const void* gen_t) {
+	const Art* t  = gen_t;
+	Art_Iter   it = {._elem_size = t->_elem_size};
+	vec_construct(&it._stack);
+	vec_construct(&it._key);
+	if (t->_root != NULL) {
+		vec_push_back(&it._stack, ((_Art_Frame) {t->_root, 0, -1}));
+	}
+	return it;
+}
+
+Art_Iter
+art_nprefix(const void* gen_t, const char* prefix, unsigned n) {
+	const Art*     t = gen_t;
+	uint8_t        buf[_ART_KEY_BUF];
+	const uint8_t* k     = _art_key(t, prefix, &n, false, buf);
+	Art_Iter       it    = art_begin(t);
+	_Art_Node*     p     = t->_root;
+	unsigned       depth = 0;
+	vec_clear(&it._stack);
+
+	/* find the smallest subtree holding every match */
+	while (p != NULL) {
+		unsigned       left = n - depth;
+		const uint8_t* bytes;
+		unsigned       len;
+		if (_art_is_leaf(p)) {
+			bytes = _art_suffix(t, _art_leaf(p));
+			len   = _art_leaf(p)->suffix_len;
+		} else {
+			bytes = _art_prefix(p);
+			len   = p->prefix_len;
+		}
+		if (memcmp(bytes, &k[depth], (len < left) ? len : left) != 0) {
+			break;
+		}
+		if (left <= len) {
+			vec_push_back(&it._stack, ((_Art_Frame) {p, depth, -1}));
+			break;
+		}
+		if (_art_is_leaf(p)) {
+			break;
+		}
+		depth += len;
+		_Art_Node** child = _art_find_child(p, k[depth++]);
+		p                 = (child) ? *child : NULL;
+	}
+
+	/* the path so far is the prefix itself */
+	vec_resize(&it._key, depth);
+	memcpy(it._key.data, k, depth);
+	_art_key_free(k, prefix, buf);
+	return it;
+}
+
+void*
+art_iter_next(Art_Iter* it) {
+	while (it->_stack.len > 0) {
+		_Art_Frame* f = &it->_stack.data[it->_stack.len - 1];
+		_Art_Node*  p = f->node;
+
+		if (_art_is_leaf(p)) {
+			_Art_Leaf* leaf = _art_leaf(p);
+			uint8_t*   data = leaf->data;
+			unsigned   vsize = (it->_elem_size + 7) & ~7U;
+			_art_iter_key(it, f->key_len, data + vsize, leaf->suffix_len);
+			--it->_stack.len;
+			it->key     = it->_key.data;
+			it->key_len = it->_key.len;
+			return data;
+		}
+
+		/* a node's own key comes before its children's */
+		unsigned at = f->key_len + p->prefix_len;
+		if (f->next < 0) {
+			f->next = 0;
+			if (p->leaf != NULL) {
+				_art_iter_key(it, f->key_len, _art_prefix(p), p->prefix_len);
+				it->key     = it->_key.data;
+				it->key_len = it->_key.len;
+				return p->leaf->data;
+			}
+		}
+
+		uint8_t    byte;
+		_Art_Node* child = _art_next_child(p, &f->next, &byte);
+		if (child == NULL) {
+			--it->_stack.len;
+			continue;
+		}
+		_art_iter_key(it, f->key_len, _art_prefix(p), p->prefix_len);
+		_art_iter_key(it, at, &byte, 1);
+		vec_push_back(&it->_stack, ((_Art_Frame) {child, at + 1, -1}));
+	}
+	return NULL;
+}
+
+void
+art_iter_destroy(Art_Iter* it) {
+	vec_destroy(&it->_stack);
+	vec_destroy(&it->_key);
+}
+
+/* Internal */
+
+static inline bool
+_art_is_leaf(const _Art_Node* p) {
+	return (uintptr_t)p & 1;
+}
+
+static inline _Art_Leaf*
+_art_leaf(const _Art_Node* p) {
+	return (_Art_Leaf*)((uintptr_t)p & ~(uintptr_t)1);
+}
+
+static inline _Art_Node*
+_art_tag(const _Art_Leaf* leaf) {
+	return (_Art_Node*)((uintptr_t)leaf | 1);
+}
+
+static inline uint8_t*
+_art_prefix(const _Art_Node* node) {
+	return (uint8_t*)node + _art_node_size[node->type];
+}
+
+/* values are padded to 8 so leaves stay aligned */
+static inline unsigned
+_art_value_size(const Art* t) {
+	return (t->_elem_size + 7) & ~7U;
+}
+
+static inline uint8_t*
+_art_suffix(const Art* t, const _Art_Leaf* leaf) {
+	return (uint8_t*)leaf->data + _art_value_size(t);
+}
+
+static inline unsigned
+_art_common(const uint8_t* a, unsigned a_len, const uint8_t* b, unsigned b_len) {
+	unsigned len = (a_len < b_len) ? a_len : b_len;
+	unsigned i   = 0;
+	for (; i < len && a[i] == b[i]; ++i)
+		;
+	return i;
+}
+
+/**
+ * key folded and trimmed per props. It is key itself unless
+ * MAP_PROP_NOCASE needs a copy, which goes in buf if it fits.
+ */
+const uint8_t*
+_art_key(const Art* t, const char* key, unsigned* n, bool trim, uint8_t* buf) {
+	if (trim && (t->props & MAP_PROP_RTRIM)) {
+		while (*n > 0 && key[*n - 1] == ' ') {
+			--*n;
+		}
+	}
+	if (!(t->props & MAP_PROP_NOCASE)) {
+		return (const uint8_t*)key;
+	}
+
+	uint8_t* folded = (*n <= _ART_KEY_BUF) ? buf : heap_alloc(*n);
+	unsigned i      = 0;
+	for (; i < *n; ++i) {
+		folded[i] = _fold_byte(key[i]);
+	}
+	return folded;
+}
+
+void
+_art_key_free(const uint8_t* folded, const char* key, uint8_t* buf) {
+	if (folded != buf && folded != (const uint8_t*)key) {
+		heap_free(folded);
+	}
+}
+
+_Art_Node*
+_art_new_node(unsigned type, const uint8_t* prefix, unsigned prefix_len) {
+	_Art_Node* node = heap_alloc(_art_node_size[type] + prefix_len);
+	memset(node, 0, _art_node_size[type]);
+	node->type       = type;
+	node->prefix_len = prefix_len;
+	memcpy(_art_prefix(node), prefix, prefix_len);
+	return node;
+}
+
+/* Append len bytes to the iterator's key after its first at */
+void
+_art_iter_key(Art_Iter* it, unsigned at, const uint8_t* bytes, unsigned len) {
+	vec_resize(&it->_key, at + len);
+	memcpy(&it->_key.data[at], bytes, len);
+}
+
+/* A leaf whose suffix is head, then byte unless it is -1, then tail */
+_Art_Leaf*
+_art_new_leaf(const Art* t,
+              const uint8_t* head,
+              unsigned head_len,
+              int byte,
+              const uint8_t* tail,
+              unsigned tail_len,
+              const void* data) {
+	unsigned   len  = head_len + (byte >= 0) + tail_len;
+	_Art_Leaf* leaf = heap_alloc(sizeof(*leaf) + _art_value_size(t) + len);
+	leaf->suffix_len = len;
+	memcpy(leaf->data, data, t->_elem_size);
+
+	uint8_t* suffix = _art_suffix(t, leaf);
+	if (head_len > 0) {
+		memcpy(suffix, head, head_len);
+	}
+	if (byte >= 0) {
+		suffix[head_len] = byte;
+	}
+	if (tail_len > 0) {
+		memcpy(&suffix[head_len + (byte >= 0)], tail, tail_len);
+	}
+	return leaf;
+}
+
+void
+_art_free(_Art_Node* p) {
+	if (p == NULL) {
+		return;
+	}
+	if (_art_is_leaf(p)) {
+		_Art_Leaf* leaf = _art_leaf(p);
+		heap_free(leaf);
+		return;
+	}
+	int        pos = 0;
+	uint8_t    byte;
+	_Art_Node* child;
+	while ((child = _art_next_child(p, &pos, &byte)) != NULL) {
+		_art_free(child);
+	}
+	heap_free(p->leaf);
+	heap_free(p);
+}
+
+size_t
+_art_bytes(const Art* t, const _Art_Node* p) {
+	if (p == NULL) {
+		return 0;
+	}
+	if (_art_is_leaf(p)) {
+		return sizeof(_Art_Leaf) + _art_value_size(t) + _art_leaf(p)->suffix_len;
+	}
+	size_t     bytes = _art_node_size[p->type] + p->prefix_len;
+	int        pos   = 0;
+	uint8_t    byte;
+	_Art_Node* child;
+	while ((child = _art_next_child(p, &pos, &byte)) != NULL) {
+		bytes += _art_bytes(t, child);
+	}
+	if (p->leaf != NULL) {
+		bytes += sizeof(_Art_Leaf) + _art_value_size(t);
+	}
+	return bytes;
+}
+
+void*
+_art_insert(Art* t, const uint8_t* k, unsigned n, const void* data) {
+	_Art_Node** ref   = &t->_root;
+	unsigned    depth = 0;
+	for (;;) {
+		_Art_Node* p = *ref;
+		if (p == NULL) {
+			_Art_Leaf* leaf = _art_new_leaf(t, &k[depth], n - depth, -1, NULL, 0, data);
+			*ref            = _art_tag(leaf);
+			++t->size;
+			return leaf->data;
+		}
+
+		if (_art_is_leaf(p)) {
+			_Art_Leaf* leaf   = _art_leaf(p);
+			uint8_t*   suffix = _art_suffix(t, leaf);
+			unsigned   common = _art_common(suffix, leaf->suffix_len, &k[depth], n - depth);
+			if (common == leaf->suffix_len && common == n - depth) {
+				memcpy(leaf->data, data, t->_elem_size);
+				return leaf->data;
+			}
+			/* a node for the shared bytes, then go around again */
+			*ref = _art_new_node(_ART_NODE4, suffix, common);
+			_art_hang(t, ref, leaf, common);
+			continue;
+		}
+
+		uint8_t* prefix = _art_prefix(p);
+		unsigned common = _art_common(prefix, p->prefix_len, &k[depth], n - depth);
+		if (common < p->prefix_len) {
+			/* p keeps what is past common and the byte between */
+			uint8_t byte = prefix[common];
+			*ref         = _art_new_node(_ART_NODE4, prefix, common);
+			p->prefix_len -= common + 1;
+			memmove(prefix, &prefix[common + 1], p->prefix_len);
+			_art_add_child(ref, byte, p);
+			continue;
+		}
+
+		depth += common;
+		if (depth == n) {
+			if (p->leaf == NULL) {
+				p->leaf = _art_new_leaf(t, NULL, 0, -1, NULL, 0, data);
+				++t->size;
+			} else {
+				memcpy(p->leaf->data, data, t->_elem_size);
+			}
+			return p->leaf->data;
+		}
+
+		_Art_Node** child = _art_find_child(p, k[depth]);
+		if (child == NULL) {
+			_Art_Leaf* leaf = _art_new_leaf(t, &k[depth + 1], n - depth - 1, -1, NULL, 0, data);
+			_art_add_child(ref, k[depth], _art_tag(leaf));
+			++t->size;
+			return leaf->data;
+		}
+		ref = child;
+		++depth;
+	}
+}
+
+/**
+ * Put leaf under the node at ref after dropping the first drop
+ * bytes of its suffix, which the node's prefix now holds.
+ */
+void
+_art_hang(const Art* t, _Art_Node** ref, _Art_Leaf* leaf, unsigned drop) {
+	_Art_Node* node   = *ref;
+	uint8_t*   suffix = _art_suffix(t, leaf);
+	if (leaf->suffix_len == drop) {
+		leaf->suffix_len = 0;
+		node->leaf       = heap_resize(leaf, sizeof(*leaf) + _art_value_size(t));
+		return;
+	}
+	uint8_t byte = suffix[drop];
+	leaf->suffix_len -= drop + 1;
+	memmove(suffix, &suffix[drop + 1], leaf->suffix_len);
+	leaf = heap_resize(leaf, sizeof(*leaf) + _art_value_size(t) + leaf->suffix_len);
+	_art_add_child(ref, byte, _art_tag(leaf));
+}
+
+bool
+_art_remove(Art* t, _Art_Node** ref, const uint8_t* k, unsigned n, unsigned depth) {
+	_Art_Node* p = *ref;
+	if (p == NULL) {
+		return false;
+	}
+	if (_art_is_leaf(p)) {
+		_Art_Leaf* leaf = _art_leaf(p);
+		if (leaf->suffix_len != n - depth
+		    || memcmp(_art_suffix(t, leaf), &k[depth], n - depth) != 0) {
+			return false;
+		}
+		heap_free(leaf);
+		*ref = NULL;
+		return true;
+	}
+
+	if (n - depth < p->prefix_len || memcmp(_art_prefix(p), &k[depth], p->prefix_len) != 0) {
+		return false;
+	}
+	depth += p->prefix_len;
+	if (depth == n) {
+		if (p->leaf == NULL) {
+			return false;
+		}
+		heap_free(p->leaf);
+		_art_compact(t, ref);
+		return true;
+	}
+
+	_Art_Node** child = _art_find_child(p, k[depth]);
+	if (child == NULL || !_art_remove(t, child, k, n, depth + 1)) {
+		return false;
+	}
+	if (*child == NULL) {
+		_art_remove_child(ref, k[depth]);
+	}
+	_art_compact(t, ref);
+	return true;
+}
+
+/**
+ * Fold a node that no longer needs to be one into what is left
+ * of it: nothing, its leaf, or its only child.
+ */
+void
+_art_compact(Art* t, _Art_Node** ref) {
+	_Art_Node* p = *ref;
+	if (p->count == 0 && p->leaf == NULL) {
+		*ref = NULL;
+		heap_free(p);
+		return;
+	}
+	if (p->count == 0) {
+		_Art_Leaf* leaf = _art_new_leaf(t, _art_prefix(p), p->prefix_len, -1, NULL, 0, p->leaf->data);
+		*ref            = _art_tag(leaf);
+		heap_free(p->leaf);
+		heap_free(p);
+		return;
+	}
+	if (p->count > 1 || p->leaf != NULL) {
+		return;
+	}
+
+	int        pos = 0;
+	uint8_t    byte;
+	_Art_Node* child = _art_next_child(p, &pos, &byte);
+	if (_art_is_leaf(child)) {
+		_Art_Leaf* old  = _art_leaf(child);
+		_Art_Leaf* leaf = _art_new_leaf(t,
+		                                _art_prefix(p),
+		                                p->prefix_len,
+		                                byte,
+		                                _art_suffix(t, old),
+		                                old->suffix_len,
+		                                old->data);
+		*ref            = _art_tag(leaf);
+		heap_free(old);
+	} else {
+		/* the child's prefix grows by p's and the byte between */
+		unsigned add = p->prefix_len + 1;
+		child        = heap_resize(child, _art_node_size[child->type] + add + child->prefix_len);
+		uint8_t* prefix = _art_prefix(child);
+		memmove(&prefix[add], prefix, child->prefix_len);
+		memcpy(prefix, _art_prefix(p), p->prefix_len);
+		prefix[p->prefix_len] = byte;
+		child->prefix_len += add;
+		*ref = child;
+	}
+	heap_free(p);
+}
+
+_Art_Node**
+_art_find_child(_Art_Node* p, uint8_t byte) {
+	switch (p->type) {
+	case _ART_NODE4: {
+		struct _Art_Node4* node = (struct _Art_Node4*)p;
+		unsigned           i    = 0;
+		for (; i < p->count; ++i) {
+			if (node->keys[i] == byte) {
+				return &node->children[i];
+			}
+		}
+		return NULL;
+	}
+	case _ART_NODE16: {
+		struct _Art_Node16* node = (struct _Art_Node16*)p;
+#ifdef __SSE2__
+		__m128i  keys = _mm_loadu_si128((const __m128i*)node->keys);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, _mm_set1_epi8(byte)));
+		mask &= (1U << p->count) - 1;
+		return (mask) ? &node->children[__builtin_ctz(mask)] : NULL;
+#else
+		unsigned i = 0;
+		for (; i < p->count; ++i) {
+			if (node->keys[i] == byte) {
+				return &node->children[i];
+			}
+		}
+		return NULL;
+#endif
+	}
+	case _ART_NODE48: {
+		struct _Art_Node48* node = (struct _Art_Node48*)p;
+		unsigned            slot = node->index[byte];
+		return (slot) ? &node->children[slot - 1] : NULL;
+	}
+	default: {
+		struct _Art_Node256* node = (struct _Art_Node256*)p;
+		return (node->children[byte]) ? &node->children[byte] : NULL;
+	}
+	}
+}
+
+/**
+ * The first child at or after *pos in byte order, or NULL.
+ * *pos moves past it. Start with *pos at 0.
+ */
+_Art_Node*
+_art_next_child(const _Art_Node* p, int* pos, uint8_t* byte) {
+	switch (p->type) {
+	case _ART_NODE4: {
+		const struct _Art_Node4* node = (const struct _Art_Node4*)p;
+		if (*pos >= p->count) {
+			return NULL;
+		}
+		*byte = node->keys[*pos];
+		return node->children[(*pos)++];
+	}
+	case _ART_NODE16: {
+		const struct _Art_Node16* node = (const struct _Art_Node16*)p;
+		if (*pos >= p->count) {
+			return NULL;
+		}
+		*byte = node->keys[*pos];
+		return node->children[(*pos)++];
+	}
+	case _ART_NODE48: {
+		const struct _Art_Node48* node = (const struct _Art_Node48*)p;
+		for (; *pos < 256; ++*pos) {
+			if (node->index[*pos]) {
+				*byte = *pos;
+				return node->children[node->index[(*pos)++] - 1];
+			}
+		}
+		return NULL;
+	}
+	default: {
+		const struct _Art_Node256* node = (const struct _Art_Node256*)p;
+		for (; *pos < 256; ++*pos) {
+			if (node->children[*pos]) {
+				*byte = *pos;
+				return node->children[(*pos)++];
+			}
+		}
+		return NULL;
+	}
+	}
+}
+
+/* Add child under byte to the node at ref, growing it if full */
+void
+_art_add_child(_Art_Node** ref, uint8_t byte, _Art_Node* child) {
+	_Art_Node* p = *ref;
+	if (p->count == _art_capacity[p->type]) {
+		p    = _art_resize(p, p->type + 1);
+		*ref = p;
+	}
+
+	switch (p->type) {
+	case _ART_NODE4:
+	case _ART_NODE16: {
+		uint8_t*    keys     = (p->type == _ART_NODE4) ? ((struct _Art_Node4*)p)->keys
+		                                               : ((struct _Art_Node16*)p)->keys;
+		_Art_Node** children = (p->type == _ART_NODE4) ? ((struct _Art_Node4*)p)->children
+		                                               : ((struct _Art_Node16*)p)->children;
+		unsigned    i        = 0;
+		for (; i < p->count && keys[i] < byte; ++i)
+			;
+		memmove(&keys[i + 1], &keys[i], p->count - i);
+		memmove(&children[i + 1], &children[i], (p->count - i) * sizeof(*children));
+		keys[i]     = byte;
+		children[i] = child;
+		break;
+	}
+	case _ART_NODE48: {
+		struct _Art_Node48* node = (struct _Art_Node48*)p;
+		unsigned            slot = 0;
+		for (; node->children[slot] != NULL; ++slot)
+			;
+		node->children[slot] = child;
+		node->index[byte]    = slot + 1;
+		break;
+	}
+	default:
+		((struct _Art_Node256*)p)->children[byte] = child;
+	}
+	++p->count;
+}
+
+/* Take byte's child off the node at ref, shrinking it if sparse */
+void
+_art_remove_child(_Art_Node** ref, uint8_t byte) {
+	_Art_Node* p = *ref;
+	switch (p->type) {
+	case _ART_NODE4:
+	case _ART_NODE16: {
+		uint8_t*    keys     = (p->type == _ART_NODE4) ? ((struct _Art_Node4*)p)->keys
+		                                               : ((struct _Art_Node16*)p)->keys;
+		_Art_Node** children = (p->type == _ART_NODE4) ? ((struct _Art_Node4*)p)->children
+		                                               : ((struct _Art_Node16*)p)->children;
+		unsigned    i        = 0;
+		for (; keys[i] != byte; ++i)
+			;
+		memmove(&keys[i], &keys[i + 1], p->count - i - 1);
+		memmove(&children[i], &children[i + 1], (p->count - i - 1) * sizeof(*children));
+		break;
+	}
+	case _ART_NODE48: {
+		struct _Art_Node48* node = (struct _Art_Node48*)p;
+		node->children[node->index[byte] - 1] = NULL;
+		node->index[byte]                     = 0;
+		break;
+	}
+	default:
+		((struct _Art_Node256*)p)->children[byte] = NULL;
+	}
+	--p->count;
+
+	/* well below the next size down, so add and remove do not flap */
+	static const unsigned shrink_at[] = {0, 3, 12, 40};
+	if (p->type != _ART_NODE4 && p->count <= shrink_at[p->type]) {
+		*ref = _art_resize(p, p->type - 1);
+	}
+}
+
+/* p as a node of another type. p is freed. */
+_Art_Node*
+_art_resize(_Art_Node* p, unsigned type) {
+	_Art_Node* node = _art_new_node(type, _art_prefix(p), p->prefix_len);
+	node->leaf      = p->leaf;
+
+	int        pos = 0;
+	uint8_t    byte;
+	_Art_Node* child;
+	while ((child = _art_next_child(p, &pos, &byte)) != NULL) {
+		_art_add_child(&node, byte, child);
+	}
+	heap_free(p);
+	return node;
+}
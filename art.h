@@ -0,0 +1,135 @@
+#ifndef ART_H
+#define ART_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "map.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Art is an adaptive radix tree: a trie over key bytes whose
+ * nodes hold 4, 16, 48 or 256 children and grow or shrink
+ * between those sizes as children come and go. A run of bytes
+ * every key below a node shares is kept once, in that node,
+ * and a leaf keeps only the bytes past its parent. So keys
+ * with long common prefixes (paths, URLs) are not stored in
+ * full as they are in a Map's _keybuf.
+ *
+ * MAP_PROP_NOCASE and MAP_PROP_RTRIM mean what they do for
+ * Map. Keys are stored folded and trimmed, and walked in
+ * byte order, a key before the keys it is a prefix of.
+ *
+ * Child pointers with the low bit set are leaves. A key that
+ * ends inside a node's children hangs off the node's leaf.
+ */
+#define _ART_NODE4   0
+#define _ART_NODE16  1
+#define _ART_NODE48  2
+#define _ART_NODE256 3
+
+struct _Art_Node {
+	uint8_t type;
+	uint16_t count;      /* children, not counting leaf */
+	uint32_t prefix_len; /* bytes after the header's type struct */
+	struct _Art_Leaf* leaf;
+};
+
+/* The value, then the key bytes past the leaf's parent */
+struct _Art_Leaf {
+	uint32_t suffix_len;
+	uint8_t data[] __attribute__((aligned(8)));
+};
+
+#define Art(T_)                                        \
+	struct {                                       \
+		struct _Art_Node* _root; /* may be a leaf */ \
+		T_* _type; /* never set, see typeof */ \
+		size_t size;                           \
+		unsigned _elem_size;                   \
+		unsigned props;                        \
+	}
+typedef Art(uint8_t) Art;
+
+/**
+ * Walks keys in order. After art_iter_next returns a value,
+ * key and key_len hold its key as stored. Iterators and the
+ * pointers they hand out are good until the tree changes.
+ * An iterator holds memory, so art_iter_destroy it.
+ */
+struct _Art_Frame {
+	struct _Art_Node* node;
+	uint32_t key_len; /* of the key up to node */
+	int next;         /* -1 before node's leaf */
+};
+
+struct Art_Iter {
+	Vec(struct _Art_Frame) _stack;
+	Vec(char) _key;
+	unsigned _elem_size;
+	const char* key; /* not nul-terminated */
+	unsigned key_len;
+};
+typedef struct Art_Iter Art_Iter;
+
+void art_construct_(void*, const unsigned elem_size, const unsigned props);
+#define art_construct(T_, PROPS_) art_construct_(T_, sizeof(*(T_)->_type), PROPS_)
+void art_destroy(void*);
+void art_clear(void*);
+
+/**
+ * Add or replace key's value with a copy of data. Returns a
+ * pointer to the value in the tree.
+ */
+void* art_nset_(void*, const char* key, unsigned key_len, const void* data);
+#define art_nset(T_, KEY_, KL_, ITEM_)                 \
+	{                                              \
+		__typeof__(*(T_)->_type) item_ = ITEM_; \
+		art_nset_(T_, KEY_, KL_, &item_);       \
+	}
+#define art_set(T_, KEY_, ITEM_) art_nset(T_, KEY_, strlen(KEY_), ITEM_)
+
+/**
+ * Return NULL if no match or pointer to value. The pointer is
+ * good until the tree changes.
+ */
+void* art_nget(const void*, const char* key, unsigned key_len);
+#define art_get(T_, KEY_) art_nget(T_, KEY_, strlen(KEY_))
+
+/**
+ * Value of the longest key in the tree that key starts with,
+ * or NULL if there is none. If match_len is not NULL, it gets
+ * the length of that key.
+ */
+void* art_nlongest_prefix(const void*, const char* key, unsigned key_len, unsigned* match_len);
+#define art_longest_prefix(T_, KEY_, LEN_) art_nlongest_prefix(T_, KEY_, strlen(KEY_), LEN_)
+
+/**
+ * Remove key and its value. Returns false if key was not there.
+ */
+bool art_nremove(void*, const char* key, unsigned key_len);
+#define art_remove(T_, KEY_) art_nremove(T_, KEY_, strlen(KEY_))
+
+#define art_size(T_) ((T_)->size)
+
+/* bytes held by nodes and leaves, not counting malloc's own */
+size_t art_bytes(const void*);
+
+/**
+ * art_begin walks every key. art_nprefix walks the keys that
+ * start with prefix without looking at any other. Trailing
+ * spaces in prefix count even with MAP_PROP_RTRIM.
+ */
+Art_Iter art_begin(const void*);
+Art_Iter art_nprefix(const void*, const char* prefix, unsigned len);
+#define art_prefix(T_, PREFIX_) art_nprefix(T_, PREFIX_, strlen(PREFIX_))
+
+/* The next value or NULL at the end */
+void* art_iter_next(Art_Iter*);
+void art_iter_destroy(Art_Iter*);
+
+#endif /* ART_H */
@@ -0,0 +1,176 @@
+/**
+ * Art vs Map on path-like keys with long shared prefixes, the
+ * kind of keys Art is for: memory held, inserts, hits and
+ * misses, then prefix queries, which a Map can only answer by
+ * scanning every key.
+ *
+ * usage: bench/art [log2 keys] [prefix queries]
+ */
+
+#include "bench.h"
+#include "art.h"
+#include "map.h"
+
+typedef Map(uint32_t) U32_Map;
+typedef Art(uint32_t) U32_Art;
+
+static const char* hosts[] = {
+    "https://www.example.com/",
+    "https://static.example.com/assets/",
+    "https://api.example.org/v2/",
+    "http://mirror.example.net/pub/",
+};
+static const char* dirs[] = {
+    "users/", "products/", "orders/", "images/", "docs/", "search/", "cart/", "reviews/",
+};
+
+/* n keys like host/dir/dir/number, back to back in keys */
+static char*
+path_keys(size_t n, unsigned* lens, uint64_t seed) {
+	char*  keys = heap_alloc(n * 96);
+	size_t i    = 0;
+	for (; i < n; ++i) {
+		uint64_t r = bench_rand(&seed);
+		lens[i]    = sprintf(&keys[i * 96],
+                                  "%s%s%s%lu",
+                                  hosts[r & 3],
+                                  dirs[(r >> 2) & 7],
+                                  dirs[(r >> 5) & 7],
+                                  (unsigned long)(r >> 40));
+	}
+	return keys;
+}
+
+int
+main(int argc, char** argv) {
+	unsigned  log2_n  = (argc > 1) ? atoi(argv[1]) : 20;
+	unsigned  queries = (argc > 2) ? atoi(argv[2]) : 64;
+	size_t    n       = (size_t)1 << log2_n;
+	unsigned* lens    = heap_alloc(n * sizeof(*lens));
+	unsigned* mlens   = heap_alloc(n * sizeof(*mlens));
+	char*     keys    = path_keys(n, lens, 8);
+	char*     misses  = path_keys(n, mlens, 9);
+	size_t    stride  = 7919;
+	size_t    i       = 0;
+
+	U32_Map m;
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	double start = bench_now();
+	for (i = 0; i < n; ++i) {
+		map_nset(&m, &keys[i * 96], lens[i], i);
+	}
+	double   map_insert = bench_now() - start;
+	uint64_t sum        = 0;
+	start               = bench_now();
+	for (i = 0; i < n; ++i) {
+		size_t k = (i * stride) % n;
+		sum += *(uint32_t*)map_nget(&m, &keys[k * 96], lens[k]);
+	}
+	double map_hit = bench_now() - start;
+	start          = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(map_nget(&m, &misses[i * 96], mlens[i]));
+	}
+	double map_miss = bench_now() - start;
+
+	/* bytes in use, as art_bytes counts them */
+	const struct _Table* table     = &m._table;
+	size_t               map_bytes = table->_entries.len * sizeof(_Entry)
+	                   + ((table->_ctrl) ? table->_entries.len + _GROUP_WIDTH : 0)
+	                   + table->_keybuf_head + m.values.len * sizeof(uint32_t)
+	                   + table->_rev.len * sizeof(uint32_t);
+
+	U32_Art t;
+	art_construct(&t, MAP_PROP_DEFAULT);
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		art_nset(&t, &keys[i * 96], lens[i], i);
+	}
+	double art_insert = bench_now() - start;
+	start             = bench_now();
+	for (i = 0; i < n; ++i) {
+		size_t k = (i * stride) % n;
+		sum += *(uint32_t*)art_nget(&t, &keys[k * 96], lens[k]);
+	}
+	double art_hit = bench_now() - start;
+	start          = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(art_nget(&t, &misses[i * 96], mlens[i]));
+	}
+	double art_miss  = bench_now() - start;
+	size_t tree_bytes = art_bytes(&t);
+
+	/* prefixes are a key cut after its last dir and a digit */
+	char     prefix[96];
+	unsigned prefix_len;
+	size_t   art_found = 0;
+	size_t   map_found = 0;
+	double   map_scan  = 0;
+	double   art_scan  = 0;
+	for (i = 0; i < queries; ++i) {
+		size_t      k   = (i * stride) % n;
+		const char* key = &keys[k * 96];
+		prefix_len      = strrchr(key, '/') - key + 2;
+		memcpy(prefix, key, prefix_len);
+
+		size_t j = 0;
+		start    = bench_now();
+		for (; j < table->size; ++j) {
+			const _Entry* e = _rev_entry(table, j);
+			if (e->key_len >= prefix_len
+			    && memcmp(_entry_key(table, e), prefix, prefix_len) == 0) {
+				sum += m.values.data[j];
+				++map_found;
+			}
+		}
+		map_scan += bench_now() - start;
+
+		start       = bench_now();
+		Art_Iter it = art_nprefix(&t, prefix, prefix_len);
+		uint32_t* val;
+		while ((val = art_iter_next(&it)) != NULL) {
+			sum += *val;
+			++art_found;
+		}
+		art_iter_destroy(&it);
+		art_scan += bench_now() - start;
+	}
+	if (art_found != map_found) {
+		fprintf(stderr, "art: wrong prefix count\n");
+		return 1;
+	}
+	bench_consume(&sum);
+
+	size_t key_bytes = 0;
+	for (i = 0; i < n; ++i) {
+		key_bytes += lens[i];
+	}
+	printf("%zu keys (%zu unique), %.1f bytes per key on average\n",
+	       n,
+	       (size_t)art_size(&t),
+	       (double)key_bytes / n);
+	printf("%-6s %10s %10s %10s %10s\n", "", "bytes/key", "insert", "hit", "miss");
+	printf("%-6s %10.1f %10.1f %10.1f %10.1f\n",
+	       "map",
+	       (double)map_bytes / table->size,
+	       map_insert * 1e9 / n,
+	       map_hit * 1e9 / n,
+	       map_miss * 1e9 / n);
+	printf("%-6s %10.1f %10.1f %10.1f %10.1f\n",
+	       "art",
+	       (double)tree_bytes / art_size(&t),
+	       art_insert * 1e9 / n,
+	       art_hit * 1e9 / n,
+	       art_miss * 1e9 / n);
+	printf("prefix query, %.1f matches each: %.1f us art, %.1f us map scan\n",
+	       (double)art_found / queries,
+	       art_scan * 1e6 / queries,
+	       map_scan * 1e6 / queries);
+
+	art_destroy(&t);
+	map_destroy(&m);
+	free(misses);
+	free(keys);
+	free(mlens);
+	free(lens);
+}
@@ -0,0 +1,50 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Small helpers shared by the benchmarks. Everything is static
+ * so each benchmark stays a single translation unit.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util.h"
+
+static inline double
+bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* splitmix64 */
+static inline uint64_t
+bench_rand(uint64_t* state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15UL);
+	z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z          = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+/* n random alpha-numeric keys of key_len bytes, back to back */
+static inline char*
+bench_keys(size_t n, unsigned key_len, uint64_t seed) {
+	static const char chars[] =
+	    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	char*  keys = heap_alloc(n * key_len);
+	size_t i    = 0;
+	for (; i < n * key_len; ++i) {
+		keys[i] = chars[bench_rand(&seed) % (sizeof(chars) - 1)];
+	}
+	return keys;
+}
+
+/* prevent the compiler from dropping a result */
+static inline void
+bench_consume(const void* p) {
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+#endif /* BENCH_H */
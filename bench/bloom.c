@@ -0,0 +1,94 @@
+/**
+ * set_nhas on a Set with and without a Bloom filter in front,
+ * for lookups that mostly miss, and the standalone filter on
+ * its own. Lookups go in random order.
+ *
+ * usage: bench/bloom [log2 keys] [miss percent] [fp rate]
+ */
+
+#include "bench.h"
+#include "bloom.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+static double
+lookups(const Set* s, const char* probes, size_t n, size_t* hits) {
+	double start = bench_now();
+	size_t i     = 0;
+	*hits        = 0;
+	for (; i < n; ++i) {
+		*hits += set_nhas(s, &probes[i * KEY_LEN], KEY_LEN);
+	}
+	return (bench_now() - start) / n * 1e9;
+}
+
+static void
+run(unsigned props, const char* name, const char* keys, size_t n, const char* probes, double fp_rate) {
+	Set    s;
+	size_t i = 0;
+	set_construct(&s, 16, props);
+	for (; i < n; ++i) {
+		set_nadd(&s, &keys[i * KEY_LEN], KEY_LEN);
+	}
+
+	size_t plain_hits  = 0;
+	size_t filter_hits = 0;
+	double plain       = lookups(&s, probes, n, &plain_hits);
+	set_filter(&s, fp_rate);
+	double filtered = lookups(&s, probes, n, &filter_hits);
+	if (plain_hits != filter_hits) {
+		fprintf(stderr, "filter changed the answer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-16s %10.1f %10.1f %8.2f %10.1f\n",
+	       name,
+	       plain,
+	       filtered,
+	       plain / filtered,
+	       bloom_bytes(s._filter) * 8.0 / n);
+	set_destroy(&s);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n       = (argc > 1) ? atoi(argv[1]) : 20;
+	unsigned miss_percent = (argc > 2) ? atoi(argv[2]) : 95;
+	double   fp_rate      = (argc > 3) ? atof(argv[3]) : .01;
+	size_t   n            = (size_t)1 << log2_n;
+	char*    keys         = bench_keys(n, KEY_LEN, 7);
+	char*    others       = bench_keys(n, KEY_LEN, 8);
+
+	/* miss_percent of the probes are keys never added */
+	char*    probes = heap_alloc(n * KEY_LEN);
+	uint64_t seed   = 3;
+	size_t   i      = 0;
+	for (; i < n; ++i) {
+		uint64_t    r   = bench_rand(&seed);
+		const char* src = (r % 100 < miss_percent) ? others : keys;
+		memcpy(&probes[i * KEY_LEN], &src[(r >> 8) % n * KEY_LEN], KEY_LEN);
+	}
+
+	printf("%zu keys, %u%% misses, fp rate %g, ns per set_nhas\n", n, miss_percent, fp_rate);
+	printf("%-16s %10s %10s %8s %10s\n", "layout", "plain", "filtered", "speedup", "bits/key");
+	run(MAP_PROP_DEFAULT, "linear", keys, n, probes, fp_rate);
+	run(MAP_PROP_GROUP, "group", keys, n, probes, fp_rate);
+	run(MAP_PROP_GROUP | MAP_PROP_FASTHASH, "group+fasthash", keys, n, probes, fp_rate);
+
+	/* standalone: dedup a stream with repeats */
+	Bloom  b;
+	size_t repeats = 0;
+	bloom_construct(&b, n, fp_rate);
+	double start = bench_now();
+	for (i = 0; i < n; ++i) {
+		repeats += bloom_nadd(&b, &probes[i * KEY_LEN], KEY_LEN);
+	}
+	double add = (bench_now() - start) / n * 1e9;
+	printf("bloom_nadd %.1f ns, %zu of %zu reported seen\n", add, repeats, n);
+	bloom_destroy(&b);
+
+	free(probes);
+	free(others);
+	free(keys);
+}
@@ -0,0 +1,126 @@
+/**
+ * Btree vs Map on the same keys: inserts, hits and misses in
+ * random order, then what only the Btree can do, an ordered
+ * walk of every key and short range scans.
+ *
+ * usage: bench/btree [log2 keys] [keys per range]
+ */
+
+#include "bench.h"
+#include "btree.h"
+#include "map.h"
+#include "slice.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+typedef Btree(uint32_t) U32_Btree;
+
+static int
+cmp_slice(const void* a, const void* b) {
+	return slice_compare(a, b);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 20;
+	unsigned span   = (argc > 2) ? atoi(argv[2]) : 100;
+	size_t   n      = (size_t)1 << log2_n;
+	char*    keys   = bench_keys(n, KEY_LEN, 6);
+	char*    misses = bench_keys(n, KEY_LEN, 7);
+
+	/* stride through the keys so hits are not in insertion order */
+	size_t stride = 7919;
+	size_t i      = 0;
+
+	U32_Map m;
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	double start = bench_now();
+	for (i = 0; i < n; ++i) {
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+	double   map_insert = bench_now() - start;
+	uint64_t sum        = 0;
+	start               = bench_now();
+	for (i = 0; i < n; ++i) {
+		sum += *(uint32_t*)map_nget(&m, &keys[(i * stride) % n * KEY_LEN], KEY_LEN);
+	}
+	double map_hit = bench_now() - start;
+	start          = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(map_nget(&m, &misses[i * KEY_LEN], KEY_LEN));
+	}
+	double map_miss = bench_now() - start;
+
+	/* the ordered walk without a Btree: copy the keys out and sort */
+	start         = bench_now();
+	Slice* sorted = heap_alloc(n * sizeof(*sorted));
+	for (i = 0; i < n; ++i) {
+		const _Entry* e = _rev_entry(&m._table, i);
+		sorted[i]       = (Slice) {(void*)_entry_key(&m._table, e), e->key_len};
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp_slice);
+	double map_sort = bench_now() - start;
+	free(sorted);
+	map_destroy(&m);
+
+	U32_Btree t;
+	btree_construct(&t, MAP_PROP_DEFAULT);
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		btree_nset(&t, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+	double tree_insert = bench_now() - start;
+	start              = bench_now();
+	for (i = 0; i < n; ++i) {
+		sum += *(uint32_t*)btree_nget(&t, &keys[(i * stride) % n * KEY_LEN], KEY_LEN);
+	}
+	double tree_hit = bench_now() - start;
+	start           = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(btree_nget(&t, &misses[i * KEY_LEN], KEY_LEN));
+	}
+	double tree_miss = bench_now() - start;
+
+	start         = bench_now();
+	Btree_Iter it = btree_begin(&t);
+	uint32_t*  val;
+	while ((val = btree_iter_next(&it)) != NULL) {
+		sum += *val;
+	}
+	double walk = bench_now() - start;
+
+	/* ranges start at a random key and stop after span keys */
+	size_t ranges = n / span;
+	start         = bench_now();
+	for (i = 0; i < ranges; ++i) {
+		it         = btree_nlower_bound(&t, &misses[i * KEY_LEN], KEY_LEN);
+		unsigned j = 0;
+		for (; j < span && (val = btree_iter_next(&it)) != NULL; ++j) {
+			sum += *val;
+		}
+	}
+	double range = bench_now() - start;
+	bench_consume(&sum);
+	btree_destroy(&t);
+
+	printf("%zu keys, ns per key\n", n);
+	printf("%-6s %10s %10s %10s\n", "", "insert", "hit", "miss");
+	printf("%-6s %10.1f %10.1f %10.1f\n",
+	       "map",
+	       map_insert * 1e9 / n,
+	       map_hit * 1e9 / n,
+	       map_miss * 1e9 / n);
+	printf("%-6s %10.1f %10.1f %10.1f\n",
+	       "btree",
+	       tree_insert * 1e9 / n,
+	       tree_hit * 1e9 / n,
+	       tree_miss * 1e9 / n);
+	printf("ordered walk: %.1f ns per key, %.1f to copy and sort a Map's keys\n",
+	       walk * 1e9 / n,
+	       map_sort * 1e9 / n);
+	printf("range of %u: %.1f ns per range\n", span, range * 1e9 / ranges);
+
+	free(misses);
+	free(keys);
+}
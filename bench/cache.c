@@ -0,0 +1,206 @@
+/**
+ * Hit rate and throughput of a read-through cache: get a key,
+ * put it on a miss. Keys are drawn from a Zipf-like law over
+ * the key space with the given exponent. Compares the usual
+ * LRU, a Map of Nodes from node.c, with Cache, then
+ * Shard_Cache over thread count.
+ *
+ * usage: bench/cache [log2 keys] [capacity %] [skew] [max threads]
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include "bench.h"
+#include "cache.h"
+#include "node.h"
+#include "shardcache.h"
+
+#define KEY_LEN 16
+#define OPS     (1 << 22)
+
+typedef Cache(uint64_t) U64_Cache;
+typedef Shard_Cache(uint64_t) U64_Shard_Cache;
+
+/* LRU the way it is usually written: newest at head */
+struct lru_item {
+	const char* key;
+	uint64_t val;
+};
+
+struct lru {
+	Map(Node*) map;
+	Node* head;
+	Node* tail;
+	size_t capacity;
+};
+
+static uint64_t*
+lru_get(struct lru* l, const char* key) {
+	Node** found = map_nget(&l->map, key, KEY_LEN);
+	if (found == NULL) {
+		return NULL;
+	}
+	Node* node = *found;
+	if (node != l->head) {
+		if (node == l->tail) {
+			l->tail = node->prev;
+		}
+		node_export(node);
+		node_push_import(&l->head, node);
+	}
+	return &((struct lru_item*)node->data)->val;
+}
+
+static void
+lru_put(struct lru* l, const char* key, uint64_t val) {
+	if ((size_t)l->map.values.len >= l->capacity) {
+		Node* old = l->tail;
+		l->tail   = old->prev;
+		node_export(old);
+		struct lru_item* item = old->data;
+		map_nremove(&l->map, item->key, KEY_LEN);
+		free(item);
+		free(old);
+	}
+	struct lru_item* item = heap_alloc(sizeof(*item));
+	*item                 = (struct lru_item) {key, val};
+	Node* node            = node_push(&l->head, item);
+	if (l->tail == NULL) {
+		l->tail = node;
+	}
+	map_nset(&l->map, key, KEY_LEN, node);
+}
+
+/* a rank in [0, n) from the inverse CDF of rank^-s */
+static size_t
+zipf(double u, size_t n, double s) {
+	double r;
+	if (s == 0) {
+		r = u * n;
+	} else if (fabs(s - 1) < 1e-9) {
+		r = exp(u * log(n + 1.0)) - 1;
+	} else {
+		double e = 1 - s;
+		r        = pow(u * (pow(n + 1.0, e) - 1) + 1, 1 / e) - 1;
+	}
+	return (r < n) ? (size_t)r : n - 1;
+}
+
+/* ranks are scattered over the keys so hot keys are not adjacent */
+static const char**
+zipf_stream(const char* keys, size_t n_keys, double skew, uint64_t seed) {
+	const char** stream = heap_alloc(OPS * sizeof(*stream));
+	size_t       i      = 0;
+	for (; i < OPS; ++i) {
+		double u  = (bench_rand(&seed) >> 11) * (1.0 / (1UL << 53));
+		size_t r  = zipf(u, n_keys, skew);
+		stream[i] = &keys[(r * 7919) % n_keys * KEY_LEN];
+	}
+	return stream;
+}
+
+struct worker {
+	U64_Shard_Cache* c;
+	const char** stream;
+	pthread_t thread;
+};
+
+static void*
+run_sharded(void* arg) {
+	struct worker* w = arg;
+	size_t         i = 0;
+	for (; i < OPS; ++i) {
+		uint64_t val;
+		if (!shardcache_nget(w->c, w->stream[i], KEY_LEN, &val)) {
+			shardcache_nput(w->c, w->stream[i], KEY_LEN, (uint64_t)i);
+		}
+		bench_consume(&val);
+	}
+	return NULL;
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n      = (argc > 1) ? atoi(argv[1]) : 20;
+	double   percent     = (argc > 2) ? atof(argv[2]) : 10;
+	double   skew        = (argc > 3) ? atof(argv[3]) : 0.9;
+	unsigned max_threads = (argc > 4) ? atoi(argv[4]) : 8;
+	size_t   n_keys      = (size_t)1 << log2_n;
+	size_t   capacity    = n_keys * percent / 100;
+	char*    keys        = bench_keys(n_keys, KEY_LEN, 10);
+	size_t   i           = 0;
+
+	const char** streams[64];
+	unsigned     t = 0;
+	for (; t < max_threads && t < 64; ++t) {
+		streams[t] = zipf_stream(keys, n_keys, skew, t + 1);
+	}
+
+	struct lru l = {.capacity = capacity};
+	map_construct(&l.map, capacity, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	size_t lru_hits = 0;
+	double start    = bench_now();
+	for (i = 0; i < OPS; ++i) {
+		uint64_t* val = lru_get(&l, streams[0][i]);
+		if (val != NULL) {
+			++lru_hits;
+			bench_consume(val);
+		} else {
+			lru_put(&l, streams[0][i], i);
+		}
+	}
+	double lru_time = bench_now() - start;
+	while (l.head != NULL) {
+		free(node_pop(&l.head));
+	}
+	map_destroy(&l.map);
+
+	U64_Cache c;
+	cache_construct(&c, capacity, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	start = bench_now();
+	for (i = 0; i < OPS; ++i) {
+		uint64_t* val = cache_nget(&c, streams[0][i], KEY_LEN);
+		if (val != NULL) {
+			bench_consume(val);
+		} else {
+			cache_nput(&c, streams[0][i], KEY_LEN, (uint64_t)i);
+		}
+	}
+	double cache_time = bench_now() - start;
+	double cache_hits = (double)c.hits / OPS;
+	cache_destroy(&c);
+
+	printf("%zu keys, capacity %zu, skew %.2f, %d ops per thread\n", n_keys, capacity, skew, OPS);
+	printf("%-16s %10s %10s\n", "", "hit %", "Mops/s");
+	printf("%-16s %10.1f %10.2f\n", "map + node lru", 100.0 * lru_hits / OPS, OPS / lru_time / 1e6);
+	printf("%-16s %10.1f %10.2f\n", "cache", 100 * cache_hits, OPS / cache_time / 1e6);
+
+	unsigned threads = 1;
+	for (; threads <= max_threads; threads *= 2) {
+		U64_Shard_Cache sc;
+		struct worker   workers[64];
+		shardcache_construct(&sc, 64, capacity, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+		start = bench_now();
+		for (t = 0; t < threads; ++t) {
+			workers[t] = (struct worker) {&sc, streams[t], 0};
+			pthread_create(&workers[t].thread, NULL, run_sharded, &workers[t]);
+		}
+		for (t = 0; t < threads; ++t) {
+			pthread_join(workers[t].thread, NULL);
+		}
+		double time = bench_now() - start;
+
+		char name[32];
+		sprintf(name, "sharded %ut", threads);
+		printf("%-16s %10.1f %10.2f\n",
+		       name,
+		       100.0 * shardcache_hits(&sc) / ((double)threads * OPS),
+		       threads * OPS / time / 1e6);
+		shardcache_destroy(&sc);
+	}
+
+	for (t = 0; t < max_threads && t < 64; ++t) {
+		free(streams[t]);
+	}
+	free(keys);
+}
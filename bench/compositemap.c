@@ -0,0 +1,130 @@
+/**
+ * Three field keys: join the fields into a fresh string and use
+ * Map (what callers did before) vs Compositemap.
+ *
+ * usage: bench/compositemap [log2 rows] [log2 distinct keys]
+ */
+
+#include <string.h>
+#include "bench.h"
+#include "map.h"
+
+#define FIELDS    3
+#define FIELD_LEN 8
+
+typedef Map(uint32_t) U32_Map;
+typedef Compositemap(uint32_t) U32_Compositemap;
+
+static char*
+join(const Const_Char_Slice* fields) {
+	size_t   len = 0;
+	unsigned i   = 0;
+	for (; i < FIELDS; ++i) {
+		len += fields[i].len + 1;
+	}
+	char* key = heap_alloc(len);
+	char* dest = key;
+	for (i = 0; i < FIELDS; ++i) {
+		memcpy(dest, fields[i].data, fields[i].len);
+		dest += fields[i].len;
+		*dest++ = '\x1f';
+	}
+	dest[-1] = '\0';
+	return key;
+}
+
+static void
+run(unsigned props,
+    const char* joined,
+    const char* composite,
+    const Const_Char_Slice* rowf,
+    size_t rows,
+    size_t n_keys) {
+	uint64_t sum = 0;
+	size_t   i   = 0;
+
+	{
+		U32_Map m;
+		map_construct(&m, n_keys, props);
+		double start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			char*     key = join(&rowf[i * FIELDS]);
+			uint32_t* val = map_get(&m, key);
+			if (val == NULL) {
+				map_set(&m, key, 1);
+			} else {
+				++*val;
+			}
+			free(key);
+		}
+		double upsert = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			char* key = join(&rowf[i * FIELDS]);
+			sum += *(uint32_t*)map_get(&m, key);
+			free(key);
+		}
+		double lookup = bench_now() - start;
+		printf("%-22s %10.1f %10.1f\n", joined, upsert * 1e9 / rows, lookup * 1e9 / rows);
+		map_destroy(&m);
+	}
+
+	{
+		U32_Compositemap m;
+		compositemap_construct(&m, n_keys, props);
+		double start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			uint32_t* val = compositemap_nget(&m, &rowf[i * FIELDS], FIELDS);
+			if (val == NULL) {
+				compositemap_nset(&m, &rowf[i * FIELDS], FIELDS, 1);
+			} else {
+				++*val;
+			}
+		}
+		double upsert = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			sum += *(uint32_t*)compositemap_nget(&m, &rowf[i * FIELDS], FIELDS);
+		}
+		double lookup = bench_now() - start;
+		printf("%-22s %10.1f %10.1f\n", composite, upsert * 1e9 / rows, lookup * 1e9 / rows);
+		compositemap_destroy(&m);
+	}
+
+	bench_consume(&sum);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_rows = (argc > 1) ? atoi(argv[1]) : 22;
+	unsigned log2_keys = (argc > 2) ? atoi(argv[2]) : 18;
+	size_t   rows      = (size_t)1 << log2_rows;
+	size_t   n_keys    = (size_t)1 << log2_keys;
+	char*    bytes     = bench_keys(n_keys * FIELDS, FIELD_LEN, 12);
+	uint64_t seed      = 13;
+	size_t   i         = 0;
+
+	Const_Char_Slice* rowf = heap_alloc(rows * FIELDS * sizeof(*rowf));
+	for (; i < rows; ++i) {
+		size_t   k = bench_rand(&seed) % n_keys;
+		unsigned j = 0;
+		for (; j < FIELDS; ++j) {
+			rowf[i * FIELDS + j] = (Const_Char_Slice) {&bytes[(k * FIELDS + j) * FIELD_LEN], FIELD_LEN};
+		}
+	}
+
+	printf("%zu rows, %zu keys, %d fields, NOCASE | RTRIM, ns/row\n", rows, n_keys, FIELDS);
+	printf("%-22s %10s %10s\n", "map", "upsert", "lookup");
+	run(MAP_PROP_NOCASE | MAP_PROP_RTRIM, "joined Map", "Compositemap", rowf, rows, n_keys);
+	run(MAP_PROP_NOCASE | MAP_PROP_RTRIM | MAP_PROP_FASTHASH,
+	    "joined Map fast",
+	    "Compositemap fast",
+	    rowf,
+	    rows,
+	    n_keys);
+
+	free(rowf);
+	free(bytes);
+}
@@ -0,0 +1,103 @@
+/**
+ * Lookups on a live Map vs the Frozen_Map made from it, and the
+ * memory each takes. Keys are looked up in random order.
+ *
+ * usage: bench/frozenmap [log2 keys]
+ */
+
+#include "bench.h"
+#include "frozenmap.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+typedef Frozen_Map(uint32_t) U32_Frozen_Map;
+
+static void
+run(unsigned props, const char* name, const char* keys, size_t n, const size_t* order) {
+	U32_Map        m;
+	U32_Frozen_Map f;
+	size_t         i = 0;
+
+	map_construct(&m, 16, props);
+	for (; i < n; ++i) {
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+
+	double start = bench_now();
+	if (map_freeze(&f, &m)) {
+		fprintf(stderr, "map_freeze failed\n");
+		exit(EXIT_FAILURE);
+	}
+	double freeze = bench_now() - start;
+
+	uint64_t sum = 0;
+	start        = bench_now();
+	for (i = 0; i < n; ++i) {
+		sum += *(uint32_t*)map_nget(&m, &keys[order[i] * KEY_LEN], KEY_LEN);
+	}
+	double live = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		sum += *(uint32_t*)frozenmap_nget(&f, &keys[order[i] * KEY_LEN], KEY_LEN);
+	}
+	double frozen = bench_now() - start;
+	bench_consume(&sum);
+
+	const _Table* t          = &m._table;
+	size_t        live_bytes = t->_entries.len * sizeof(_Entry) + t->_keybuf.len
+	                    + t->_rev._cap * sizeof(uint32_t) + m.values._cap * sizeof(uint32_t);
+	if (t->_ctrl != NULL) {
+		live_bytes += t->_entries.len + _GROUP_WIDTH;
+	}
+	size_t frozen_bytes = f._frozen._buckets * sizeof(uint32_t) + (n + 1) * sizeof(uint32_t)
+	                      + (size_t)f._frozen._offsets[n] * 8;
+
+	printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	       name,
+	       live * 1e9 / n,
+	       frozen * 1e9 / n,
+	       (double)live_bytes / n,
+	       (double)frozen_bytes / n,
+	       freeze * 1e9 / n);
+
+	frozenmap_destroy(&f);
+	map_destroy(&m);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 22;
+	size_t   n      = (size_t)1 << log2_n;
+	char*    keys   = bench_keys(n, KEY_LEN, 14);
+	size_t*  order  = heap_alloc(n * sizeof(*order));
+	uint64_t seed   = 15;
+	size_t   i      = 0;
+
+	for (; i < n; ++i) {
+		order[i] = i;
+	}
+	for (i = n - 1; i > 0; --i) {
+		size_t j = bench_rand(&seed) % (i + 1);
+		size_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	printf("%zu keys of %d bytes, uint32_t values\n", n, KEY_LEN);
+	printf("%-12s %10s %10s %10s %10s %10s\n",
+	       "map",
+	       "live ns",
+	       "frozen ns",
+	       "live B/key",
+	       "frozen B",
+	       "freeze ns");
+	run(MAP_PROP_DEFAULT, "linear", keys, n, order);
+	run(MAP_PROP_GROUP, "group", keys, n, order);
+	run(MAP_PROP_GROUP | MAP_PROP_FASTHASH, "group fast", keys, n, order);
+
+	free(order);
+	free(keys);
+}
@@ -0,0 +1,109 @@
+/**
+ * Sum of a value per key over a stream of rows: one Map on one
+ * thread vs Group_By over thread count. Keys are drawn from a
+ * Zipf-like law with the given exponent; 0 is uniform and
+ * larger values pile more rows onto fewer keys.
+ *
+ * usage: bench/groupby [log2 rows] [log2 keys] [skew] [max threads]
+ */
+
+#include <math.h>
+#include "bench.h"
+#include "groupby.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint64_t) U64_Map;
+typedef Group_By(uint64_t) U64_Group_By;
+
+static void
+add_u64(void* acc, const void* val) {
+	*(uint64_t*)acc += *(const uint64_t*)val;
+}
+
+/* a rank in [0, n) from the inverse CDF of rank^-s */
+static size_t
+zipf(double u, size_t n, double s) {
+	double r;
+	if (s == 0) {
+		r = u * n;
+	} else if (fabs(s - 1) < 1e-9) {
+		r = exp(u * log(n + 1.0)) - 1;
+	} else {
+		double e = 1 - s;
+		r        = pow(u * (pow(n + 1.0, e) - 1) + 1, 1 / e) - 1;
+	}
+	return (r < n) ? (size_t)r : n - 1;
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n      = (argc > 1) ? atoi(argv[1]) : 22;
+	unsigned log2_keys   = (argc > 2) ? atoi(argv[2]) : 16;
+	double   skew        = (argc > 3) ? atof(argv[3]) : 0;
+	unsigned max_threads = (argc > 4) ? atoi(argv[4]) : 8;
+	size_t   n           = (size_t)1 << log2_n;
+	size_t   n_keys      = (size_t)1 << log2_keys;
+	char*    keys        = bench_keys(n_keys, KEY_LEN, 5);
+
+	const char** rows   = heap_alloc(n * sizeof(*rows));
+	unsigned*    lens   = heap_alloc(n * sizeof(*lens));
+	uint64_t*    values = heap_alloc(n * sizeof(*values));
+	uint64_t     seed   = 3;
+	size_t       i      = 0;
+	for (; i < n; ++i) {
+		double u  = (bench_rand(&seed) >> 11) * (1.0 / (1UL << 53));
+		rows[i]   = &keys[zipf(u, n_keys, skew) * KEY_LEN];
+		lens[i]   = KEY_LEN;
+		values[i] = i;
+	}
+
+	U64_Map m;
+	double  start = bench_now();
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	for (i = 0; i < n; ++i) {
+		map_idx idx = _map_declare(&m, rows[i], lens[i]);
+		if (idx == _NONE) {
+			vec_push_back(&m.values, values[i]);
+		} else {
+			m.values.data[idx] += values[i];
+		}
+	}
+	double map_time = bench_now() - start;
+
+	printf("%zu rows, %zu groups, skew %.2f\n", n, (size_t)m._table.size, skew);
+	printf("%-14s %10s %10s\n", "", "ms", "Mrows/s");
+	printf("%-14s %10.1f %10.1f\n", "map", map_time * 1e3, n / map_time / 1e6);
+
+	unsigned threads = 1;
+	for (; threads <= max_threads; threads *= 2) {
+		U64_Group_By g;
+		start = bench_now();
+		groupby_construct(&g, threads, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+		groupby_run(&g, rows, lens, values, n, add_u64);
+		double time = bench_now() - start;
+
+		/* check a few groups against the Map */
+		for (i = 0; i < 16; ++i) {
+			const char* key = &keys[i * KEY_LEN];
+			uint64_t*   got = groupby_nget(&g, key, KEY_LEN);
+			uint64_t*   want = map_nget(&m, key, KEY_LEN);
+			if ((got == NULL) != (want == NULL) || (got && *got != *want)) {
+				fprintf(stderr, "groupby: wrong sum\n");
+				return 1;
+			}
+		}
+
+		char name[32];
+		sprintf(name, "groupby %ut", threads);
+		printf("%-14s %10.1f %10.1f\n", name, time * 1e3, n / time / 1e6);
+		groupby_destroy(&g);
+	}
+
+	map_destroy(&m);
+	free(values);
+	free(lens);
+	free(rows);
+	free(keys);
+}
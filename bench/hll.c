@@ -0,0 +1,69 @@
+/**
+ * Distinct count of a stream with repeats: a Set read for its
+ * size vs HyperLogLog sketches, for time, memory and error.
+ *
+ * usage: bench/hll [log2 stream length] [repeats per key]
+ */
+
+#include <math.h>
+#include "bench.h"
+#include "hll.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n  = (argc > 1) ? atoi(argv[1]) : 22;
+	unsigned repeats = (argc > 2) ? atoi(argv[2]) : 4;
+	size_t   n       = (size_t)1 << log2_n;
+	size_t   n_keys  = n / repeats;
+	char*    keys    = bench_keys(n_keys, KEY_LEN, 9);
+
+	size_t*  stream = heap_alloc(n * sizeof(*stream));
+	uint64_t seed   = 1;
+	size_t   i      = 0;
+	for (; i < n; ++i) {
+		stream[i] = bench_rand(&seed) % n_keys;
+	}
+
+	Set    s;
+	double start = bench_now();
+	set_construct(&s, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	for (i = 0; i < n; ++i) {
+		set_nadd(&s, &keys[stream[i] * KEY_LEN], KEY_LEN);
+	}
+	double set_time = bench_now() - start;
+	size_t exact    = set_size(&s);
+	size_t set_mem  = s._table._entries.len * (sizeof(_Entry) + 1) + s._table._keybuf.len;
+	set_destroy(&s);
+
+	printf("%zu keys, %zu distinct\n", n, exact);
+	printf("%-12s %10s %12s %10s\n", "", "ms", "bytes", "error%");
+	printf("%-12s %10.1f %12zu %10.3f\n", "set", set_time * 1e3, set_mem, 0.0);
+
+	unsigned precisions[] = {10, 12, 14, 16};
+	unsigned p            = 0;
+	for (; p < ARRAY_LEN(precisions); ++p) {
+		Hll h;
+		hll_construct(&h, precisions[p], MAP_PROP_DEFAULT);
+		start = bench_now();
+		for (i = 0; i < n; ++i) {
+			hll_nadd(&h, &keys[stream[i] * KEY_LEN], KEY_LEN);
+		}
+		double count = hll_count(&h);
+		double time  = bench_now() - start;
+
+		char name[16];
+		sprintf(name, "hll p=%u", precisions[p]);
+		printf("%-12s %10.1f %12zu %10.3f\n",
+		       name,
+		       time * 1e3,
+		       hll_bytes(&h),
+		       100 * fabs(count - exact) / exact);
+		hll_destroy(&h);
+	}
+
+	free(stream);
+	free(keys);
+}
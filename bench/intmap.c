@@ -0,0 +1,112 @@
+/**
+ * Integer ids: Map keyed by the id's decimal string vs by its
+ * 8 raw bytes vs Int32_Map/Int64_Map. Bytes per entry counts
+ * slots, keys and the value index, not the values.
+ *
+ * usage: bench/intmap [log2 ids]
+ */
+
+#include "bench.h"
+#include "intmap.h"
+#include "map.h"
+
+typedef Map(uint32_t) U32_Map;
+typedef Int32_Map(uint32_t) U32_Int32_Map;
+typedef Int64_Map(uint32_t) U32_Int64_Map;
+
+static void
+report(const char* name, size_t n, double insert, double hit, size_t bytes) {
+	printf("%-10s %10.1f %10.1f %10.1f\n", name, insert * 1e9 / n, hit * 1e9 / n, (double)bytes / n);
+}
+
+static void
+run_map(const uint64_t* ids, size_t n, const size_t* order, bool text) {
+	U32_Map m;
+	char    buf[24];
+	size_t  i = 0;
+
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+
+	double start = bench_now();
+	for (; i < n; ++i) {
+		if (text) {
+			map_nset(&m, buf, sprintf(buf, "%lu", ids[i]), i);
+		} else {
+			map_nset(&m, (const char*)&ids[i], sizeof(ids[i]), i);
+		}
+	}
+	double insert = bench_now() - start;
+
+	uint64_t sum = 0;
+	start        = bench_now();
+	for (i = 0; i < n; ++i) {
+		uint64_t id = ids[order[i]];
+		if (text) {
+			sum += *(uint32_t*)map_nget(&m, buf, sprintf(buf, "%lu", id));
+		} else {
+			sum += *(uint32_t*)map_nget(&m, (const char*)&id, sizeof(id));
+		}
+	}
+	double hit = bench_now() - start;
+	bench_consume(&sum);
+
+	size_t bytes = m._table._entries.len * (sizeof(_Entry) + 1) + m._table._keybuf.len
+	               + m._table._rev._cap * sizeof(uint32_t);
+	report(text ? "Map text" : "Map bytes", n, insert, hit, bytes);
+	map_destroy(&m);
+}
+
+#define RUN_INTMAP(TYPE_, NAME_)                                                    \
+	{                                                                           \
+		TYPE_  m;                                                           \
+		size_t i = 0;                                                       \
+		intmap_construct(&m, 16);                                           \
+		double start = bench_now();                                         \
+		for (; i < n; ++i) {                                                \
+			intmap_set(&m, ids[i], i);                                  \
+		}                                                                   \
+		double   insert = bench_now() - start;                              \
+		uint64_t sum    = 0;                                                \
+		start           = bench_now();                                      \
+		for (i = 0; i < n; ++i) {                                           \
+			sum += *(uint32_t*)intmap_get(&m, ids[order[i]]);           \
+		}                                                                   \
+		double hit = bench_now() - start;                                   \
+		bench_consume(&sum);                                                \
+		size_t bytes = m._table._len * m._table._key_size * 2               \
+		               + m._table._rev._cap * sizeof(uint32_t);            \
+		report(NAME_, n, insert, hit, bytes);                               \
+		intmap_destroy(&m);                                                 \
+	}
+
+int
+main(int argc, char** argv) {
+	unsigned  log2_n = (argc > 1) ? atoi(argv[1]) : 22;
+	size_t    n      = (size_t)1 << log2_n;
+	uint64_t* ids    = heap_alloc(n * sizeof(*ids));
+	size_t*   order  = heap_alloc(n * sizeof(*order));
+	uint64_t  seed   = 9;
+	size_t    i      = 0;
+
+	/* random ids below 2^32 so every map sees the same keys */
+	for (; i < n; ++i) {
+		ids[i]   = bench_rand(&seed) >> 32;
+		order[i] = i;
+	}
+	for (i = n - 1; i > 0; --i) {
+		size_t j = bench_rand(&seed) % (i + 1);
+		size_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	printf("%zu ids, ns/op\n", n);
+	printf("%-10s %10s %10s %10s\n", "map", "insert", "hit", "bytes/key");
+	run_map(ids, n, order, true);
+	run_map(ids, n, order, false);
+	RUN_INTMAP(U32_Int64_Map, "Int64_Map");
+	RUN_INTMAP(U32_Int32_Map, "Int32_Map");
+
+	free(ids);
+	free(order);
+}
@@ -0,0 +1,91 @@
+/**
+ * map_nget one key at a time vs map_nget_batch on a table much
+ * larger than cache. Keys are looked up in random order.
+ *
+ * usage: bench/map_batch [log2 keys] [batch size]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static void
+run(unsigned layout, const char* name, const char* keys, size_t n, const char** order, size_t batch) {
+	U32_Map  m;
+	uint32_t i = 0;
+
+	map_construct(&m, n, layout);
+	for (i = 0; i < n; ++i) {
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+
+	uint64_t sum   = 0;
+	double   start = bench_now();
+	for (i = 0; i < n; ++i) {
+		uint32_t* val = map_nget(&m, order[i], KEY_LEN);
+		sum += *val;
+	}
+	double single = bench_now() - start;
+
+	unsigned*  lens = heap_alloc(batch * sizeof(*lens));
+	uint32_t** vals = heap_alloc(batch * sizeof(*vals));
+	for (i = 0; i < batch; ++i) {
+		lens[i] = KEY_LEN;
+	}
+
+	start = bench_now();
+	size_t j = 0;
+	for (; j < n; j += batch) {
+		size_t width = (n - j < batch) ? n - j : batch;
+		map_nget_batch(&m, &order[j], lens, width, vals);
+		for (i = 0; i < width; ++i) {
+			sum += *vals[i];
+		}
+	}
+	double batched = bench_now() - start;
+	bench_consume(&sum);
+
+	printf("%-10s %10.1f %10.1f %8.2f\n",
+	       name,
+	       single * 1e9 / n,
+	       batched * 1e9 / n,
+	       single / batched);
+
+	free(lens);
+	free(vals);
+	map_destroy(&m);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned     log2_n = (argc > 1) ? atoi(argv[1]) : 22;
+	size_t       batch  = (argc > 2) ? atoi(argv[2]) : 256;
+	size_t       n      = (size_t)1 << log2_n;
+	char*        keys   = bench_keys(n, KEY_LEN, 7);
+	const char** order  = heap_alloc(n * sizeof(*order));
+	uint64_t     seed   = 8;
+	size_t       i      = 0;
+
+	/* shuffled so neither way walks memory in order */
+	for (; i < n; ++i) {
+		order[i] = &keys[i * KEY_LEN];
+	}
+	for (i = n - 1; i > 0; --i) {
+		size_t      j   = bench_rand(&seed) % (i + 1);
+		const char* tmp = order[i];
+		order[i]        = order[j];
+		order[j]        = tmp;
+	}
+
+	printf("%zu keys, batches of %zu, ns/lookup\n", n, batch);
+	printf("%-10s %10s %10s %8s\n", "layout", "single", "batch", "speedup");
+	run(MAP_PROP_DEFAULT, "linear", keys, n, order, batch);
+	run(MAP_PROP_GROUP, "group", keys, n, order, batch);
+	run(MAP_PROP_GROUP | MAP_PROP_FASTHASH, "group fast", keys, n, order, batch);
+
+	free(order);
+	free(keys);
+}
@@ -0,0 +1,78 @@
+/**
+ * Insert/remove churn at a steady map size. Each round removes a
+ * quarter of the keys, inserts as many new ones and then looks up
+ * every live key in a scattered order. Time per op should not
+ * creep up over the rounds.
+ *
+ * usage: bench/map_churn [log2 size] [rounds]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static void
+run(unsigned layout, size_t n, unsigned rounds) {
+	/* live keys are the window [head - n, head) of an endless sequence */
+	size_t   total = n + (n / 4) * rounds;
+	char*    keys  = bench_keys(total, KEY_LEN, 3);
+	size_t   head  = 0;
+	U32_Map  m;
+	uint32_t i = 0;
+
+	map_construct(&m, n, layout);
+	for (; head < n; ++head) {
+		map_nset(&m, &keys[head * KEY_LEN], KEY_LEN, head);
+	}
+
+	printf("%s\n", (layout & MAP_PROP_GROUP) ? "group" : "linear");
+	printf("%6s %10s %10s %10s %10s %10s\n", "round", "remove", "insert", "hit", "slots", "keybuf");
+
+	unsigned round = 0;
+	for (; round < rounds; ++round) {
+		size_t batch = n / 4;
+		size_t tail  = head - n;
+
+		double start = bench_now();
+		for (i = 0; i < batch; ++i) {
+			map_nremove(&m, &keys[(tail + i) * KEY_LEN], KEY_LEN);
+		}
+		double remove = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < batch; ++i, ++head) {
+			map_nset(&m, &keys[head * KEY_LEN], KEY_LEN, head);
+		}
+		double insert = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < n; ++i) {
+			size_t k = head - n + (i * 7919UL) % n;
+			bench_consume(map_nget(&m, &keys[k * KEY_LEN], KEY_LEN));
+		}
+		double hit = bench_now() - start;
+
+		printf("%6u %10.1f %10.1f %10.1f %10zd %10zd\n",
+		       round,
+		       remove * 1e9 / batch,
+		       insert * 1e9 / batch,
+		       hit * 1e9 / n,
+		       m._table._entries.len,
+		       m._table._keybuf.len);
+	}
+
+	map_destroy(&m);
+	free(keys);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 20;
+	unsigned rounds = (argc > 2) ? atoi(argv[2]) : 12;
+
+	run(MAP_PROP_DEFAULT, (size_t)1 << log2_n, rounds);
+	run(MAP_PROP_GROUP, (size_t)1 << log2_n, rounds);
+}
@@ -0,0 +1,121 @@
+/**
+ * A burst of keys, then most of them removed: what the map
+ * still holds, and what map_shrink_to_fit and map_compact give
+ * back. map_compact runs a fixed number of slots per call and
+ * reports its longest call, which bounds the pause it adds to
+ * a running process. Resident memory is from /proc.
+ *
+ * usage: bench/map_compact [log2 keys] [percent kept] [slots per call]
+ */
+
+#include <unistd.h>
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint64_t) U64_Map;
+
+static double
+rss_mb(void) {
+	FILE* f     = fopen("/proc/self/statm", "r");
+	long  pages = 0;
+	long  rss   = 0;
+	if (f != NULL) {
+		if (fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+			rss = 0;
+		}
+		fclose(f);
+	}
+	return rss * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+static double
+held_mb(const U64_Map* m) {
+	const _Table* t     = &m->_table;
+	size_t        ctrl  = (t->_ctrl != NULL) ? 1 : 0;
+	size_t        bytes = (t->_entries.len + t->_old_entries.len) * (sizeof(_Entry) + ctrl)
+	               + t->_keybuf.len + t->_old_keybuf.len + t->_next_entries.len * sizeof(_Entry)
+	               + (size_t)m->values._cap * sizeof(uint64_t)
+	               + (size_t)t->_rev._cap * sizeof(uint32_t);
+	return bytes / (double)(1 << 20);
+}
+
+static void
+burst(U64_Map* m, const char* keys, size_t n, double percent) {
+	map_construct(m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	size_t i = 0;
+	for (; i < n; ++i) {
+		map_nset(m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+	size_t kept = n * percent / 100;
+	for (i = kept; i < n; ++i) {
+		map_nremove(m, &keys[i * KEY_LEN], KEY_LEN);
+	}
+}
+
+static void
+report(const char* name, const U64_Map* m, double ms, double max_ms) {
+	printf("%-20s %10zu %10.1f %10.1f %10.1f %10.2f\n",
+	       name,
+	       (size_t)m->values.len,
+	       held_mb(m),
+	       rss_mb(),
+	       ms,
+	       max_ms);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n  = (argc > 1) ? atoi(argv[1]) : 22;
+	double   percent = (argc > 2) ? atof(argv[2]) : 1;
+	size_t   slots   = (argc > 3) ? atol(argv[3]) : 4096;
+	size_t   n       = (size_t)1 << log2_n;
+	char*    keys    = bench_keys(n, KEY_LEN, 12);
+
+	printf("%zu keys, %.1f%% kept, %zu slots per map_compact call\n", n, percent, slots);
+	printf("%-20s %10s %10s %10s %10s %10s\n", "", "keys", "held MB", "rss MB", "ms", "max ms");
+
+	U64_Map m;
+	burst(&m, keys, n, percent);
+	report("after removes", &m, 0, 0);
+	double start = bench_now();
+	map_shrink_to_fit(&m);
+	double ms = (bench_now() - start) * 1e3;
+	report("map_shrink_to_fit", &m, ms, ms);
+	map_destroy(&m);
+
+	burst(&m, keys, n, percent);
+	double max_ms = 0;
+	size_t calls  = 0;
+	start         = bench_now();
+	for (;; ++calls) {
+		double call = bench_now();
+		bool   done = map_compact(&m, slots);
+		call        = (bench_now() - call) * 1e3;
+		max_ms      = (call > max_ms) ? call : max_ms;
+		if (done) {
+			break;
+		}
+	}
+	ms = (bench_now() - start) * 1e3;
+	report("map_compact", &m, ms, max_ms);
+	printf("%-20s %10zu calls\n", "", calls + 1);
+
+	/* the keys left still hit */
+	uint64_t sum = 0;
+	size_t   i   = 0;
+	for (; i < (size_t)(n * percent / 100); ++i) {
+		sum += *(uint64_t*)map_nget(&m, &keys[i * KEY_LEN], KEY_LEN);
+	}
+	bench_consume(&sum);
+
+	map_clear(&m);
+	report("map_clear", &m, 0, 0);
+	start = bench_now();
+	map_shrink_to_fit(&m);
+	ms = (bench_now() - start) * 1e3;
+	report("  then shrink", &m, ms, ms);
+	map_destroy(&m);
+	free(keys);
+}
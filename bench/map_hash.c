@@ -0,0 +1,69 @@
+/**
+ * Hash throughput per key length, FNV-1 vs MAP_PROP_FASTHASH.
+ *
+ * usage: bench/map_hash [total MB hashed per cell]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+struct hash_case {
+	const char* name;
+	hash_fn     fnv;
+	hash_fn     fast;
+};
+
+static double
+run(hash_fn hash__, const char* keys, unsigned key_len, size_t n) {
+	uint64_t sum   = 0;
+	size_t   i     = 0;
+	double   start = bench_now();
+	for (; i < n; ++i) {
+		unsigned len = key_len;
+		sum += hash__(&keys[(i & 1023) * key_len], &len, 42);
+	}
+	double elapsed = bench_now() - start;
+	bench_consume(&sum);
+	return elapsed;
+}
+
+int
+main(int argc, char** argv) {
+	size_t mb = (argc > 1) ? atoi(argv[1]) : 256;
+
+	struct hash_case cases[] = {
+	    {"default", _hash, _hash_fast},
+	    {"nocase", _hash_nocase, _hash_fast_nocase},
+	    {"rtrim", _hash_rtrim, _hash_fast_rtrim},
+	    {"nocase_rtrim", _hash_nocase_rtrim, _hash_fast_nocase_rtrim},
+	};
+	unsigned lens[] = {4, 8, 16, 32, 64, 128, 256, 1024};
+
+	printf("%-13s %6s %11s %11s %11s %11s\n",
+	       "variant",
+	       "len",
+	       "fnv GB/s",
+	       "fast GB/s",
+	       "fnv ns",
+	       "fast ns");
+
+	unsigned i = 0;
+	for (; i < ARRAY_LEN(cases); ++i) {
+		unsigned j = 0;
+		for (; j < ARRAY_LEN(lens); ++j) {
+			/* 1024 keys stay in cache so this measures hashing only */
+			char*  keys = bench_keys(1024, lens[j], lens[j]);
+			size_t n    = (mb << 20) / lens[j];
+			double fnv  = run(cases[i].fnv, keys, lens[j], n);
+			double fast = run(cases[i].fast, keys, lens[j], n);
+			printf("%-13s %6u %11.2f %11.2f %11.2f %11.2f\n",
+			       cases[i].name,
+			       lens[j],
+			       (double)(mb << 20) / fnv / 1e9,
+			       (double)(mb << 20) / fast / 1e9,
+			       fnv * 1e9 / n,
+			       fast * 1e9 / n);
+			free(keys);
+		}
+	}
+}
@@ -0,0 +1,79 @@
+/**
+ * Hits, misses and memory by key length, to see what keeping
+ * short keys in the entry buys. Build it three ways to compare:
+ * make bench INLINE_KEY=0 for every key in _keybuf (the old
+ * layout), plain make bench for keys up to 8 bytes inline, and
+ * INLINE_KEY=16 for keys up to 16 bytes in 32 byte entries.
+ * Bytes per key count slots, control bytes and _keybuf, not
+ * the values.
+ *
+ * usage: bench/map_inline [log2 keys]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+typedef Map(uint32_t) U32_Map;
+
+static void
+run(const char* name, unsigned props, unsigned key_len, size_t n) {
+	char* keys   = bench_keys(n, key_len, key_len);
+	char* misses = bench_keys(n, key_len, key_len + 100);
+
+	U32_Map m;
+	map_construct(&m, n, props);
+	size_t i = 0;
+	for (; i < n; ++i) {
+		map_nset(&m, &keys[i * key_len], key_len, i);
+	}
+
+	/* stride through the keys so each hit lands somewhere new */
+	uint64_t sum   = 0;
+	double   start = bench_now();
+	for (i = 0; i < n; ++i) {
+		sum += *(uint32_t*)map_nget(&m, &keys[(i * 7919) % n * key_len], key_len);
+	}
+	double hit = bench_now() - start;
+	bench_consume(&sum);
+
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(map_nget(&m, &misses[i * key_len], key_len));
+	}
+	double miss = bench_now() - start;
+
+	const _Table* t     = &m._table;
+	size_t        ctrl  = (t->_ctrl != NULL) ? 1 : 0;
+	size_t        bytes = t->_entries.len * (sizeof(_Entry) + ctrl) + t->_keybuf_head;
+	printf("%-18s %8u %10.1f %10.1f %10.1f\n",
+	       name,
+	       key_len,
+	       hit * 1e9 / n,
+	       miss * 1e9 / n,
+	       (double)bytes / n);
+
+	map_destroy(&m);
+	free(keys);
+	free(misses);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 22;
+	size_t   n      = (size_t)1 << log2_n;
+
+	unsigned    lens[]    = {6, 8, 12, 16, 24};
+	unsigned    layouts[] = {MAP_PROP_DEFAULT, MAP_PROP_GROUP | MAP_PROP_FASTHASH};
+	const char* names[]   = {"linear", "group, fasthash"};
+
+	printf("%zu keys, MAP_INLINE_KEY %d, %zu byte entries\n", n, MAP_INLINE_KEY, sizeof(_Entry));
+	printf("%-18s %8s %10s %10s %10s\n", "", "key len", "hit ns", "miss ns", "bytes/key");
+
+	unsigned l = 0;
+	for (; l < ARRAY_LEN(layouts); ++l) {
+		unsigned k = 0;
+		for (; k < ARRAY_LEN(lens); ++k) {
+			run(names[l], layouts[l], lens[k], n);
+		}
+	}
+}
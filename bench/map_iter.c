@@ -0,0 +1,105 @@
+/**
+ * A full walk of a Map: every key and value read once. Slots
+ * is the walk there was before map_iter, over _entries skipping
+ * empty slots and reading each value through val_idx. map_iter
+ * reads values and _rev in order instead. map_scan splits the
+ * walk over threads. Keys of 8 bytes are kept in the entry,
+ * keys of 16 are in _keybuf (see MAP_INLINE_KEY).
+ *
+ * usage: bench/map_iter [log2 keys] [threads]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+typedef Map(uint64_t) U64_Map;
+
+struct sums {
+	uint64_t sum[64];
+};
+
+static uint64_t
+walk_slots(const U64_Map* m) {
+	const _Table* t   = &m->_table;
+	uint64_t      sum = 0;
+	ssize_t       i   = 0;
+	for (; i < t->_entries.len; ++i) {
+		const _Entry* e = &t->_entries.data[i];
+		if (e->val_idx == _NONE) {
+			continue;
+		}
+		sum += _entry_key(t, e)[0] + e->key_len + m->values.data[e->val_idx];
+	}
+	return sum;
+}
+
+static uint64_t
+walk_iter(Map_Iter* it) {
+	uint64_t  sum = 0;
+	uint64_t* val = NULL;
+	while ((val = map_iter_next(it)) != NULL) {
+		sum += (uint8_t)it->key[0] + it->key_len + *val;
+	}
+	return sum;
+}
+
+static void
+scan_fn(Map_Iter* it, unsigned range, void* data) {
+	((struct sums*)data)->sum[range] = walk_iter(it);
+}
+
+static void
+run(const char* name, unsigned key_len, size_t n, unsigned threads) {
+	char*   keys = bench_keys(n, key_len, key_len);
+	U64_Map m;
+	map_construct(&m, n, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	size_t i = 0;
+	for (; i < n; ++i) {
+		map_nset(&m, &keys[i * key_len], key_len, i);
+	}
+
+	double   start = bench_now();
+	uint64_t want  = walk_slots(&m);
+	double   slots = bench_now() - start;
+
+	start         = bench_now();
+	Map_Iter it   = map_iter(&m);
+	uint64_t sum  = walk_iter(&it);
+	double   iter = bench_now() - start;
+
+	struct sums sums = {{0}};
+	start            = bench_now();
+	unsigned ranges  = map_scan(&m, threads, scan_fn, &sums);
+	double   scan    = bench_now() - start;
+
+	uint64_t scan_sum = 0;
+	unsigned r        = 0;
+	for (; r < ranges; ++r) {
+		scan_sum += sums.sum[r];
+	}
+	if (sum != want || scan_sum != want) {
+		fprintf(stderr, "map_iter: sums differ\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-12s %8u %10.1f %10.1f %10.1f\n",
+	       name,
+	       key_len,
+	       slots * 1e9 / n,
+	       iter * 1e9 / n,
+	       scan * 1e9 / n);
+	map_destroy(&m);
+	free(keys);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n  = (argc > 1) ? atoi(argv[1]) : 22;
+	unsigned threads = (argc > 2) ? atoi(argv[2]) : 4;
+	size_t   n       = (size_t)1 << log2_n;
+
+	printf("%zu keys, ns per key, map_scan on %u threads\n", n, threads);
+	printf("%-12s %8s %10s %10s %10s\n", "", "key len", "slots", "map_iter", "map_scan");
+	run("inline", 8, n, threads);
+	run("_keybuf", 16, n, threads);
+}
@@ -0,0 +1,71 @@
+/**
+ * Per-insert latency percentiles while a map grows from empty,
+ * stop-the-world growth vs MAP_PROP_INCREMENTAL.
+ *
+ * usage: bench/map_latency [log2 inserts]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static int
+cmp_double(const void* a, const void* b) {
+	return NUM_COMPARE(*(const double*)a, *(const double*)b);
+}
+
+static void
+run(unsigned props, const char* name, const char* keys, size_t n, double* lat) {
+	U32_Map  m;
+	uint32_t i = 0;
+
+	map_construct(&m, 16, props);
+
+	double total = bench_now();
+	for (; i < n; ++i) {
+		double start = bench_now();
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+		lat[i] = bench_now() - start;
+	}
+	total = bench_now() - total;
+
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%-18s %8.0f %8.0f %8.0f %8.0f %10.0f %8.1f\n",
+	       name,
+	       lat[n / 2] * 1e9,
+	       lat[n - n / 100] * 1e9,
+	       lat[n - n / 1000] * 1e9,
+	       lat[n - n / 10000] * 1e9,
+	       lat[n - 1] * 1e9,
+	       total * 1e9 / n);
+
+	map_destroy(&m);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 22;
+	size_t   n      = (size_t)1 << log2_n;
+	char*    keys   = bench_keys(n, KEY_LEN, 4);
+	double*  lat    = heap_alloc(n * sizeof(*lat));
+
+	printf("%zu inserts, ns (includes ~20ns of clock overhead)\n", n);
+	printf("%-18s %8s %8s %8s %8s %10s %8s\n",
+	       "growth",
+	       "p50",
+	       "p99",
+	       "p999",
+	       "p9999",
+	       "max",
+	       "mean");
+	run(MAP_PROP_DEFAULT, "linear", keys, n, lat);
+	run(MAP_PROP_INCREMENTAL, "linear incremental", keys, n, lat);
+	run(MAP_PROP_GROUP, "group", keys, n, lat);
+	run(MAP_PROP_GROUP | MAP_PROP_INCREMENTAL, "group incremental", keys, n, lat);
+
+	free(lat);
+	free(keys);
+}
@@ -0,0 +1,80 @@
+/**
+ * Linear probing vs MAP_PROP_GROUP at 50, 75 and 90% load.
+ *
+ * usage: bench/map_layout [log2 capacity]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static void
+run(unsigned layout, size_t cap, double load, const char* keys, const char* misses) {
+	size_t   n     = (size_t)(cap * load);
+	U32_Map  m;
+	uint32_t i = 0;
+
+	map_construct(&m, cap, layout);
+
+	double start = bench_now();
+	for (i = 0; i < n; ++i) {
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+	double insert = bench_now() - start;
+
+	/* stride through the keys so hits are not in insertion order */
+	size_t   stride = 7919;
+	uint64_t sum    = 0;
+	start           = bench_now();
+	for (i = 0; i < n; ++i) {
+		size_t    k   = (i * stride) % n;
+		uint32_t* val = map_nget(&m, &keys[k * KEY_LEN], KEY_LEN);
+		sum += *val;
+	}
+	double hit = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		bench_consume(map_nget(&m, &misses[i * KEY_LEN], KEY_LEN));
+	}
+	double miss = bench_now() - start;
+	bench_consume(&sum);
+
+	printf("%-7s %3.0f%% %10zu %10.1f %10.1f %10.1f\n",
+	       (layout & MAP_PROP_GROUP) ? "group" : "linear",
+	       load * 100,
+	       n,
+	       insert * 1e9 / n,
+	       hit * 1e9 / n,
+	       miss * 1e9 / n);
+
+	map_destroy(&m);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_cap = (argc > 1) ? atoi(argv[1]) : 21;
+	size_t   cap      = (size_t)1 << log2_cap;
+
+	char* keys   = bench_keys(cap, KEY_LEN, 1);
+	char* misses = bench_keys(cap, KEY_LEN, 2);
+
+	printf("capacity %zu, %d byte keys, ns/op\n", cap, KEY_LEN);
+	printf("%-7s %4s %10s %10s %10s %10s\n", "layout", "load", "keys", "insert", "hit", "miss");
+
+	double   loads[]   = {.50, .75, .90};
+	unsigned layouts[] = {MAP_PROP_DEFAULT, MAP_PROP_GROUP};
+	unsigned i         = 0;
+	for (; i < ARRAY_LEN(loads); ++i) {
+		unsigned j = 0;
+		for (; j < ARRAY_LEN(layouts); ++j) {
+			run(layouts[j], cap, loads[i], keys, misses);
+		}
+	}
+
+	free(keys);
+	free(misses);
+}
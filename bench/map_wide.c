@@ -0,0 +1,171 @@
+/**
+ * Stress past the 32 bit limits rather than a timing. A Map of
+ * 4 KB pages is filled past 2 GB of values, which any build
+ * must handle, then read back, thinned from the end and shrunk.
+ *
+ * Built with make bench WIDE=1 it also sizes a Vec(uint8_t)
+ * past 2^32 elements without touching most of it, and works
+ * at either side of 2^31 and 2^32. Then it pushes a Vec one
+ * byte at a time past 2^log2: 2^31 by default. make stress
+ * WIDE=1 pushes past 2^32, which needs over 4 GB of memory.
+ * Each step prints its time and exits non-zero on a wrong
+ * value. A Map past 2^32 values needs well over 100 GB, so
+ * val_idx itself is only checked here for its width.
+ *
+ * usage: bench/map_wide [values MB] [log2 bytes]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define PAGE 4096
+
+struct page {
+	uint64_t n;
+	char fill[PAGE - sizeof(uint64_t)];
+};
+
+typedef Map(struct page) Page_Map;
+
+static int
+fail(const char* what, size_t i) {
+	fprintf(stderr, "map_wide: %s wrong at %zu\n", what, i);
+	return 1;
+}
+
+static int
+pages(size_t mb) {
+	size_t   n    = mb * (1 << 20) / PAGE;
+	char     key[32];
+	Page_Map m;
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+
+	struct page p = {0};
+	double      start = bench_now();
+	size_t      i     = 0;
+	for (; i < n; ++i) {
+		p.n = i;
+		map_nset(&m, key, sprintf(key, "page %zu", i), p);
+	}
+	printf("%-24s %10zu %10.1f\n", "set", n, (bench_now() - start) * 1e3);
+
+	start = bench_now();
+	for (i = 0; i < n; ++i) {
+		struct page* found = map_nget(&m, key, sprintf(key, "page %zu", i));
+		if (found == NULL || found->n != i) {
+			return fail("get", i);
+		}
+	}
+	printf("%-24s %10zu %10.1f\n", "get", n, (bench_now() - start) * 1e3);
+
+	/* removing from the front moves the last values over it */
+	start = bench_now();
+	for (i = 0; i < n / 2; ++i) {
+		map_nremove(&m, key, sprintf(key, "page %zu", i));
+	}
+	map_shrink_to_fit(&m);
+	for (i = n / 2; i < n; ++i) {
+		struct page* found = map_nget(&m, key, sprintf(key, "page %zu", i));
+		if (found == NULL || found->n != i) {
+			return fail("remove", i);
+		}
+	}
+	printf("%-24s %10zu %10.1f\n", "remove, shrink, get", n / 2, (bench_now() - start) * 1e3);
+	map_destroy(&m);
+	return 0;
+}
+
+#ifdef VEC_WIDE
+/* only the pages written to are ever backed */
+static int
+sparse(void) {
+	size_t n = ((size_t)1 << 32) + 16;
+	Vec(uint8_t) v;
+	vec_construct(&v);
+	vec_reserve(&v, n + 16);
+	vec_resize(&v, n);
+
+	size_t edges[] = {(1UL << 31) - 1, 1UL << 31, (1UL << 32) - 1, 1UL << 32, n - 1};
+	size_t i       = 0;
+	for (; i < ARRAY_LEN(edges); ++i) {
+		vec_at(v, edges[i]) = edges[i] % 251;
+	}
+	for (i = 0; i < ARRAY_LEN(edges); ++i) {
+		if (*(uint8_t*)vec_iter_at_(&v, edges[i], 1) != edges[i] % 251) {
+			return fail("sparse vec_iter_at", edges[i]);
+		}
+	}
+
+	vec_push_back(&v, 7);
+	if (v.len != (vec_int)n + 1 || *vec_back(v) != 7) {
+		return fail("sparse vec_push_back", n);
+	}
+	/* n - 1 moves down to n - 5, then back up to n - 3 */
+	vec_erase_at_(&v, n - 8, 4, 1);
+	if (v.len != (vec_int)n - 3 || vec_at(v, n - 5) != (n - 1) % 251) {
+		return fail("sparse vec_erase_at", n - 5);
+	}
+	vec_insert_at_(&v, n - 6, "xy", 2, 1);
+	if (v.len != (vec_int)n - 1 || vec_at(v, n - 6) != 'x' || vec_at(v, n - 3) != (n - 1) % 251
+	    || *vec_back(v) != 7) {
+		return fail("sparse vec_insert_at", n - 3);
+	}
+	printf("%-24s %10zu %10s\n", "vec past 2^32, sparse", n, "ok");
+	vec_destroy(&v);
+	return 0;
+}
+
+static int
+bytes(unsigned log2_n) {
+	size_t n = ((size_t)1 << log2_n) + 16;
+	Vec(uint8_t) v;
+	vec_construct(&v);
+
+	double start = bench_now();
+	size_t i     = 0;
+	for (; i < n; ++i) {
+		vec_push_back(&v, (uint8_t)(i % 251));
+	}
+	printf("%-24s %10zu %10.1f\n", "vec push", n, (bench_now() - start) * 1e3);
+
+	/* either side of 2^31 and 2^32 */
+	size_t edges[] = {(1UL << 31) - 1, 1UL << 31, (1UL << 32) - 1, 1UL << 32, n - 1};
+	for (i = 0; i < ARRAY_LEN(edges); ++i) {
+		size_t at = edges[i];
+		if (at < n && (vec_at(v, at) != at % 251 || *(uint8_t*)vec_iter_at_(&v, at, 1) != at % 251)) {
+			return fail("vec_at", at);
+		}
+	}
+
+	vec_erase_at_(&v, 0, 1 << 20, 1);
+	if (v.len != (vec_int)(n - (1 << 20)) || vec_at(v, v.len - 1) != (n - 1) % 251) {
+		return fail("vec_erase_at", n - 1);
+	}
+	vec_destroy(&v);
+	return 0;
+}
+#endif
+
+int
+main(int argc, char** argv) {
+	size_t   mb     = (argc > 1) ? atol(argv[1]) : 2304;
+	unsigned log2_n = (argc > 2) ? atoi(argv[2]) : 31;
+
+	printf("map_idx %zu bytes, vec_int %zu bytes, %zu byte entries\n",
+	       sizeof(map_idx),
+	       sizeof(vec_int),
+	       sizeof(_Entry));
+	printf("%-24s %10s %10s\n", "", "count", "ms");
+
+	if (pages(mb) != 0) {
+		return 1;
+	}
+#ifdef VEC_WIDE
+	if (sparse() != 0 || bytes(log2_n) != 0) {
+		return 1;
+	}
+#else
+	(void)log2_n;
+#endif
+	return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * Startup cost of rebuilding a Map by inserting every key vs
+ * map_open on a saved image, then a pass of lookups on each.
+ * The first pass on the image includes its page faults. The
+ * file is in the page cache, as it is for a restart.
+ *
+ * usage: bench/mapfile [log2 keys] [path]
+ */
+
+#include <sys/stat.h>
+#include "bench.h"
+#include "map.h"
+#include "mapfile.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static double
+lookups(const U32_Map* m, const char* keys, size_t n, const size_t* order) {
+	uint64_t sum   = 0;
+	double   start = bench_now();
+	size_t   i     = 0;
+	for (; i < n; ++i) {
+		sum += *(uint32_t*)map_nget(m, &keys[order[i] * KEY_LEN], KEY_LEN);
+	}
+	double elapsed = bench_now() - start;
+	bench_consume(&sum);
+	return elapsed;
+}
+
+static void
+run(unsigned props, const char* name, const char* keys, size_t n, const size_t* order, const char* path) {
+	U32_Map m;
+	size_t  i = 0;
+
+	double start = bench_now();
+	map_construct(&m, 16, props);
+	for (; i < n; ++i) {
+		map_nset(&m, &keys[i * KEY_LEN], KEY_LEN, i);
+	}
+	double build = bench_now() - start;
+	double live  = lookups(&m, keys, n, order);
+
+	start = bench_now();
+	if (map_save(&m, path)) {
+		exit(EXIT_FAILURE);
+	}
+	double save = bench_now() - start;
+	map_destroy(&m);
+
+	struct stat st;
+	stat(path, &st);
+
+	U32_Map opened;
+	start = bench_now();
+	if (map_open(&opened, path)) {
+		exit(EXIT_FAILURE);
+	}
+	double open  = bench_now() - start;
+	double cold  = lookups(&opened, keys, n, order);
+	double warm  = lookups(&opened, keys, n, order);
+	map_destroy(&opened);
+
+	printf("%-16s %9.2f %9.2f %9.3f %9.2f %9.2f %9.2f %8.1f\n",
+	       name,
+	       build * 1e3,
+	       save * 1e3,
+	       open * 1e3,
+	       cold * 1e3,
+	       warm * 1e3,
+	       live * 1e3,
+	       (double)st.st_size / n);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned    log2_n = (argc > 1) ? atoi(argv[1]) : 20;
+	const char* path   = (argc > 2) ? argv[2] : "/tmp/bench_mapfile.img";
+	size_t      n      = (size_t)1 << log2_n;
+	char*       keys   = bench_keys(n, KEY_LEN, 12);
+
+	size_t*  order = heap_alloc(n * sizeof(*order));
+	uint64_t seed  = 5;
+	size_t   i     = 0;
+	for (; i < n; ++i) {
+		order[i] = i;
+	}
+	for (i = n - 1; i > 0; --i) {
+		size_t j = bench_rand(&seed) % (i + 1);
+		size_t t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	printf("%zu keys of %d bytes, ms (lookups are one pass over every key)\n", n, KEY_LEN);
+	printf("%-16s %9s %9s %9s %9s %9s %9s %8s\n",
+	       "layout", "rebuild", "save", "open", "1st pass", "2nd pass", "live", "B/key");
+	run(MAP_PROP_DEFAULT, "linear", keys, n, order, path);
+	run(MAP_PROP_GROUP, "group", keys, n, order, path);
+	run(MAP_PROP_GROUP | MAP_PROP_FASTHASH, "group+fasthash", keys, n, order, path);
+
+	remove(path);
+	free(order);
+	free(keys);
+}
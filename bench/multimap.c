@@ -0,0 +1,132 @@
+/**
+ * Build then scan every group of a multimap: Multimap vs a Map
+ * of Vecs vs a Map of linked lists (the chain most hash joins
+ * fall back to). Rows arrive with keys in random order.
+ *
+ * usage: bench/multimap [log2 rows] [log2 keys]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+typedef Vec(uint32_t) U32_Vec;
+typedef Map(U32_Vec) Vec_Map;
+typedef Map(uint32_t) U32_Map;
+typedef Multimap(uint32_t) U32_Multimap;
+
+static void
+report(const char* name, size_t rows, double build, double scan) {
+	printf("%-10s %10.1f %10.1f\n", name, build * 1e9 / rows, scan * 1e9 / rows);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_rows = (argc > 1) ? atoi(argv[1]) : 23;
+	unsigned log2_keys = (argc > 2) ? atoi(argv[2]) : 16;
+	size_t   rows      = (size_t)1 << log2_rows;
+	size_t   n_keys    = (size_t)1 << log2_keys;
+	char*    keys      = bench_keys(n_keys, KEY_LEN, 10);
+	uint32_t* row_key  = heap_alloc(rows * sizeof(*row_key));
+	uint64_t seed      = 11;
+	size_t   i         = 0;
+	uint64_t sum       = 0;
+
+	for (; i < rows; ++i) {
+		row_key[i] = bench_rand(&seed) % n_keys;
+	}
+
+	printf("%zu rows, %zu keys, ns/row\n", rows, n_keys);
+	printf("%-10s %10s %10s\n", "storage", "build", "scan");
+
+	{
+		U32_Multimap m;
+		multimap_construct(&m, n_keys, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+		double start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			multimap_nset(&m, &keys[row_key[i] * KEY_LEN], KEY_LEN, i);
+		}
+		double build = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < n_keys; ++i) {
+			Multimap_Iter it  = multimap_nget(&m, &keys[i * KEY_LEN], KEY_LEN);
+			unsigned      len = 0;
+			uint32_t*     run = NULL;
+			while ((run = multimap_iter_run(&it, &len))) {
+				unsigned j = 0;
+				for (; j < len; ++j) {
+					sum += run[j];
+				}
+			}
+		}
+		report("Multimap", rows, build, bench_now() - start);
+		multimap_destroy(&m);
+	}
+
+	{
+		Vec_Map m;
+		map_construct(&m, n_keys, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+		double start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			const char* key = &keys[row_key[i] * KEY_LEN];
+			map_idx     idx = _map_declare(&m, key, KEY_LEN);
+			U32_Vec*    v   = NULL;
+			if (idx == _NONE) {
+				v = vec_add_one(&m.values);
+				vec_construct(v);
+			} else {
+				v = &m.values.data[idx];
+			}
+			uint32_t val = i;
+			vec_push_back(v, val);
+		}
+		double build = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < n_keys; ++i) {
+			U32_Vec* v = map_nget(&m, &keys[i * KEY_LEN], KEY_LEN);
+			int      j = 0;
+			for (; v && j < v->len; ++j) {
+				sum += v->data[j];
+			}
+		}
+		report("Map of Vec", rows, build, bench_now() - start);
+		for (i = 0; i < (size_t)m.values.len; ++i) {
+			vec_destroy(&m.values.data[i]);
+		}
+		map_destroy(&m);
+	}
+
+	{
+		/* head of each chain in the map, links in next[] */
+		U32_Map   m;
+		uint32_t* next = heap_alloc(rows * sizeof(*next));
+		map_construct(&m, n_keys, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+		double start = bench_now();
+		for (i = 0; i < rows; ++i) {
+			const char* key  = &keys[row_key[i] * KEY_LEN];
+			uint32_t*   head = map_nget(&m, key, KEY_LEN);
+			next[i]          = (head) ? *head : UINT32_MAX;
+			map_nset(&m, key, KEY_LEN, i);
+		}
+		double build = bench_now() - start;
+
+		start = bench_now();
+		for (i = 0; i < n_keys; ++i) {
+			uint32_t* head = map_nget(&m, &keys[i * KEY_LEN], KEY_LEN);
+			uint32_t  row  = (head) ? *head : UINT32_MAX;
+			for (; row != UINT32_MAX; row = next[row]) {
+				sum += row;
+			}
+		}
+		report("chained", rows, build, bench_now() - start);
+		free(next);
+		map_destroy(&m);
+	}
+
+	bench_consume(&sum);
+	free(row_key);
+	free(keys);
+}
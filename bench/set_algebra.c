@@ -0,0 +1,133 @@
+/**
+ * set_union / set_intersect / set_difference vs the loop they
+ * replace: set_nhas on one set and set_nadd into the result for
+ * each key of the other. Both sets hold n keys, half of them
+ * shared. They are filled in unrelated orders, so neither
+ * finds its keys laid out in the order it looks them up.
+ * In place runs write into a fresh copy of a, and the copy
+ * is not timed. With FNV both sets hash alike and stored
+ * hashes carry over. MAP_PROP_FASTHASH seeds each set apart
+ * unless b is built with set_construct_like, so the last
+ * layout hashes every key again.
+ *
+ * usage: bench/set_algebra [log2 keys] [threads]
+ */
+
+#include "bench.h"
+#include "map.h"
+
+#define KEY_LEN 16
+
+/* keys begin to begin + n, added in an order picked by stride */
+static void
+fill(Set* s, const char* keys, size_t begin, size_t n, size_t stride, unsigned props, const Set* like) {
+	if (like != NULL) {
+		set_construct_like(s, like, n);
+	} else {
+		set_construct(s, n, props);
+	}
+	size_t i = 0;
+	for (; i < n; ++i) {
+		set_nadd(s, &keys[(begin + i * stride % n) * KEY_LEN], KEY_LEN);
+	}
+}
+
+/* op: 0 union, 1 intersect, 2 difference */
+static double
+run_loop(int op, const Set* a, const Set* b, const char* keys, size_t n, unsigned props, size_t* size) {
+	double start = bench_now();
+	Set    dst;
+	set_construct(&dst, n, props);
+	size_t i = 0;
+	if (op == 0) {
+		for (i = 0; i < n; ++i) {
+			set_nadd(&dst, &keys[i * KEY_LEN], KEY_LEN);
+		}
+		for (i = n / 2; i < n + n / 2; ++i) {
+			if (!set_nhas(a, &keys[i * KEY_LEN], KEY_LEN)) {
+				set_nadd(&dst, &keys[i * KEY_LEN], KEY_LEN);
+			}
+		}
+	} else {
+		for (i = 0; i < n; ++i) {
+			bool in_b = set_nhas(b, &keys[i * KEY_LEN], KEY_LEN);
+			if (in_b == (op == 1)) {
+				set_nadd(&dst, &keys[i * KEY_LEN], KEY_LEN);
+			}
+		}
+	}
+	double time = bench_now() - start;
+	*size       = set_size(&dst);
+	set_destroy(&dst);
+	return time;
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n  = (argc > 1) ? atoi(argv[1]) : 22;
+	unsigned threads = (argc > 2) ? atoi(argv[2]) : 4;
+	size_t   n       = (size_t)1 << log2_n;
+	char*    keys    = bench_keys(n + n / 2, KEY_LEN, 11);
+
+	int (*ops[])(Set*, const Set*, const Set*, unsigned) = {
+	    set_union,
+	    set_intersect,
+	    set_difference,
+	};
+	unsigned layouts[] = {
+	    MAP_PROP_GROUP,
+	    MAP_PROP_GROUP | MAP_PROP_FASTHASH,
+	    MAP_PROP_GROUP | MAP_PROP_FASTHASH,
+	};
+	const char* op_names[] = {"union", "intersect", "difference"};
+	const char* names[]    = {"group", "fasthash, like", "fasthash"};
+
+	printf("%zu keys each, %zu shared, ms\n", n, n / 2);
+	printf("%-15s %-11s %8s %8s %8s %8s\n", "", "", "loop", "algebra", "in place", "threads");
+
+	unsigned l = 0;
+	for (; l < ARRAY_LEN(layouts); ++l) {
+		Set a, b;
+		fill(&a, keys, 0, n, 1, layouts[l], NULL);
+		fill(&b, keys, n / 2, n, 7919, layouts[l], (l == 1) ? &a : NULL);
+
+		int op = 0;
+		for (; op < 3; ++op) {
+			size_t want = 0;
+			double loop = run_loop(op, &a, &b, keys, n, layouts[l], &want);
+
+			Set    dst;
+			double start   = bench_now();
+			ops[op](&dst, &a, &b, 1);
+			double algebra = bench_now() - start;
+			if (set_size(&dst) != want) {
+				fprintf(stderr, "set_algebra: %s is off\n", op_names[op]);
+				return 1;
+			}
+			set_destroy(&dst);
+
+			Set copy;
+			fill(&copy, keys, 0, n, 1, layouts[l], &a);
+			start = bench_now();
+			ops[op](&copy, &copy, &b, 1);
+			double in_place = bench_now() - start;
+			set_destroy(&copy);
+
+			start = bench_now();
+			ops[op](&dst, &a, &b, threads);
+			double parallel = bench_now() - start;
+			set_destroy(&dst);
+
+			printf("%-15s %-11s %8.0f %8.0f %8.0f %8.0f\n",
+			       names[l],
+			       op_names[op],
+			       loop * 1e3,
+			       algebra * 1e3,
+			       in_place * 1e3,
+			       parallel * 1e3);
+		}
+		set_destroy(&a);
+		set_destroy(&b);
+	}
+	free(keys);
+}
@@ -0,0 +1,143 @@
+/**
+ * Mixed read/write throughput over thread count, Shard_Map vs
+ * one Map behind a global mutex. Readers look up a random key,
+ * writers set one. Half of the key space is there up front so
+ * reads hit about half the time and the map keeps growing.
+ *
+ * usage: bench/shardmap [log2 keys] [ops per thread] [shards]
+ */
+
+#include <pthread.h>
+#include "bench.h"
+#include "map.h"
+#include "shardmap.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+typedef Shard_Map(uint32_t) U32_Shard_Map;
+
+struct locked_map {
+	pthread_mutex_t lock;
+	U32_Map map;
+};
+
+struct worker {
+	void* map;
+	const char* keys;
+	size_t n_keys;
+	size_t ops;
+	unsigned read_percent;
+	uint64_t seed;
+	pthread_t thread;
+};
+
+static void*
+run_locked(void* arg) {
+	struct worker*     w = arg;
+	struct locked_map* m = w->map;
+	size_t             i = 0;
+	for (; i < w->ops; ++i) {
+		uint64_t    r   = bench_rand(&w->seed);
+		const char* key = &w->keys[(r >> 8) % w->n_keys * KEY_LEN];
+		uint32_t    val = 0;
+		pthread_mutex_lock(&m->lock);
+		if (r % 100 < w->read_percent) {
+			uint32_t* found = map_nget(&m->map, key, KEY_LEN);
+			if (found != NULL) {
+				val = *found;
+			}
+		} else {
+			map_nset(&m->map, key, KEY_LEN, (uint32_t)i);
+		}
+		pthread_mutex_unlock(&m->lock);
+		bench_consume(&val);
+	}
+	return NULL;
+}
+
+static void*
+run_sharded(void* arg) {
+	struct worker* w = arg;
+	U32_Shard_Map* m = w->map;
+	size_t         i = 0;
+	for (; i < w->ops; ++i) {
+		uint64_t    r   = bench_rand(&w->seed);
+		const char* key = &w->keys[(r >> 8) % w->n_keys * KEY_LEN];
+		uint32_t    val = 0;
+		if (r % 100 < w->read_percent) {
+			shardmap_nget(m, key, KEY_LEN, &val);
+		} else {
+			shardmap_nset(m, key, KEY_LEN, (uint32_t)i);
+		}
+		bench_consume(&val);
+	}
+	return NULL;
+}
+
+static double
+run(void* (*fn)(void*), void* map, unsigned threads, unsigned read_percent,
+    const char* keys, size_t n_keys, size_t ops) {
+	struct worker workers[64];
+	unsigned      i = 0;
+
+	double start = bench_now();
+	for (; i < threads; ++i) {
+		workers[i] = (struct worker) {map, keys, n_keys, ops, read_percent, i + 1, 0};
+		pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+	}
+	for (i = 0; i < threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	return threads * ops / (bench_now() - start) / 1e6;
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n = (argc > 1) ? atoi(argv[1]) : 20;
+	size_t   ops    = (argc > 2) ? atoi(argv[2]) : 1000000;
+	unsigned shards = (argc > 3) ? atoi(argv[3]) : 64;
+	size_t   n_keys = (size_t)1 << log2_n;
+	char*    keys   = bench_keys(n_keys, KEY_LEN, 6);
+
+	unsigned thread_counts[] = {1, 2, 4, 8, 16, 32};
+	unsigned read_percents[] = {0, 50, 90, 99, 100};
+
+	printf("%zu keys, %zu ops per thread, %u shards, Mops/s\n", n_keys, ops, shards);
+	printf("%7s %6s %10s %10s %8s\n", "threads", "read%", "mutex", "sharded", "speedup");
+
+	unsigned i = 0;
+	for (; i < ARRAY_LEN(read_percents); ++i) {
+		unsigned j = 0;
+		for (; j < ARRAY_LEN(thread_counts); ++j) {
+			struct locked_map locked;
+			U32_Shard_Map     sharded;
+			size_t            k = 0;
+
+			pthread_mutex_init(&locked.lock, NULL);
+			map_construct(&locked.map, n_keys, MAP_PROP_GROUP);
+			shardmap_construct(&sharded, shards, n_keys, MAP_PROP_GROUP);
+			for (; k < n_keys / 2; ++k) {
+				map_nset(&locked.map, &keys[k * KEY_LEN], KEY_LEN, k);
+				shardmap_nset(&sharded, &keys[k * KEY_LEN], KEY_LEN, k);
+			}
+
+			double mutex = run(run_locked, &locked, thread_counts[j], read_percents[i],
+			                   keys, n_keys, ops);
+			double shard = run(run_sharded, &sharded, thread_counts[j], read_percents[i],
+			                   keys, n_keys, ops);
+			printf("%7u %6u %10.2f %10.2f %8.2f\n",
+			       thread_counts[j],
+			       read_percents[i],
+			       mutex,
+			       shard,
+			       shard / mutex);
+
+			map_destroy(&locked.map);
+			pthread_mutex_destroy(&locked.lock);
+			shardmap_destroy(&sharded);
+		}
+	}
+
+	free(keys);
+}
@@ -0,0 +1,107 @@
+/**
+ * Top-K of a Zipf-like stream: Topk vs counting every key in a
+ * Map(uint32_t) and sorting its counts. Reports updates per
+ * second, memory, and how many of the true top K were found.
+ *
+ * usage: bench/topk [log2 updates] [log2 keys] [K] [capacity]
+ */
+
+#include <math.h>
+#include "bench.h"
+#include "map.h"
+#include "topk.h"
+
+#define KEY_LEN 16
+
+typedef Map(uint32_t) U32_Map;
+
+static int
+cmp_desc(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x < y) - (x > y);
+}
+
+int
+main(int argc, char** argv) {
+	unsigned log2_n    = (argc > 1) ? atoi(argv[1]) : 24;
+	unsigned log2_keys = (argc > 2) ? atoi(argv[2]) : 20;
+	size_t   k         = (argc > 3) ? atoi(argv[3]) : 100;
+	size_t   capacity  = (argc > 4) ? atoi(argv[4]) : 1000;
+	size_t   n         = (size_t)1 << log2_n;
+	size_t   n_keys    = (size_t)1 << log2_keys;
+	char*    keys      = bench_keys(n_keys, KEY_LEN, 4);
+
+	/* Zipf(1) by inverting its approximate CDF */
+	uint32_t* stream = heap_alloc(n * sizeof(*stream));
+	uint32_t* truth  = calloc(n_keys, sizeof(*truth));
+	uint64_t  seed   = 2;
+	double    h_n    = log(n_keys) + .5772;
+	size_t    i      = 0;
+	for (; i < n; ++i) {
+		double   u   = (bench_rand(&seed) >> 11) * (1.0 / (1UL << 53));
+		uint32_t key = (uint32_t)exp(u * h_n - .5772);
+		stream[i]    = (key < n_keys) ? key : n_keys - 1;
+		++truth[stream[i]];
+	}
+
+	/* the K-th largest true count */
+	uint32_t* sorted = heap_alloc(n_keys * sizeof(*sorted));
+	memcpy(sorted, truth, n_keys * sizeof(*sorted));
+	qsort(sorted, n_keys, sizeof(*sorted), cmp_desc);
+	uint32_t kth = sorted[k - 1];
+
+	U32_Map m;
+	double  start = bench_now();
+	map_construct(&m, 16, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	for (i = 0; i < n; ++i) {
+		uint32_t  zero  = 0;
+		uint32_t* count = map_nget(&m, &keys[stream[i] * KEY_LEN], KEY_LEN);
+		if (count == NULL) {
+			map_nset(&m, &keys[stream[i] * KEY_LEN], KEY_LEN, zero);
+			count = map_nget(&m, &keys[stream[i] * KEY_LEN], KEY_LEN);
+		}
+		++*count;
+	}
+	memcpy(sorted, m.values.data, m.values.len * sizeof(*sorted));
+	qsort(sorted, m.values.len, sizeof(*sorted), cmp_desc);
+	double map_time = bench_now() - start;
+	size_t map_mem  = m._table._entries.len * (sizeof(_Entry) + 1) + m._table._keybuf.len
+	                 + m.values._cap * sizeof(uint32_t) * 2;
+	map_destroy(&m);
+
+	Topk t;
+	start = bench_now();
+	topk_construct(&t, capacity, MAP_PROP_GROUP | MAP_PROP_FASTHASH);
+	for (i = 0; i < n; ++i) {
+		topk_nadd(&t, &keys[stream[i] * KEY_LEN], KEY_LEN, 1);
+	}
+	Topk_Item* items = heap_alloc(k * sizeof(*items));
+	size_t     found = topk_list(&t, items, k);
+	double     time  = bench_now() - start;
+	size_t     mem   = t._map._table._entries.len * (sizeof(_Entry) + 1)
+	             + t._map._table._keybuf.len
+	             + t._map.values._cap * (sizeof(struct _Topk_Counter) + sizeof(uint32_t))
+	             + t._heap._cap * sizeof(struct _Topk_Node);
+
+	/* hits: listed keys whose true count reaches the K-th */
+	size_t hits = 0;
+	for (i = 0; i < found; ++i) {
+		size_t j = 0;
+		for (; j < n_keys && memcmp(&keys[j * KEY_LEN], items[i].key, KEY_LEN) != 0; ++j)
+			;
+		hits += (j < n_keys && truth[j] >= kth);
+	}
+
+	printf("%zu updates over %zu keys, top %zu, capacity %zu\n", n, n_keys, k, capacity);
+	printf("%-6s %10s %12s %8s\n", "", "Mupd/s", "bytes", "top K");
+	printf("%-6s %10.1f %12zu %8zu\n", "map", n / map_time / 1e6, map_mem, k);
+	printf("%-6s %10.1f %12zu %8zu\n", "topk", n / time / 1e6, mem, hits);
+
+	topk_destroy(&t);
+	free(items);
+	free(sorted);
+	free(truth);
+	free(stream);
+	free(keys);
+}
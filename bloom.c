@@ -0,0 +1,180 @@
+#include "bloom.h"
+#include <stdio.h>
+#include <math.h>
+#include "map.h"
+#include "util.h"
+
+/* bits in a block: one cache line */
+#define _BLOOM_BLOCK_BITS  512
+#define _BLOOM_BLOCK_WORDS 8
+
+const unsigned _BLOOM_MAX_K = 16;
+
+/* Build the words of key's block that must be set */
+static inline const uint64_t*
+_bloom_want(const Bloom*, uint64_t hash, uint64_t* want);
+double _bloom_fp(double bits_per_key, unsigned k);
+
+
+void
+bloom_construct(Bloom* restrict b, size_t capacity, double fp_rate) {
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	if (fp_rate <= 0 || fp_rate >= 1) {
+		fp_rate = .01;
+	}
+
+	/**
+	 * Start from the optimum for a plain filter. Some blocks
+	 * get more than their share of keys, which costs more the
+	 * lower fp_rate is, so add bits until the estimate for
+	 * blocks meets fp_rate. Fewer bits per key suit blocks.
+	 * Past _BLOOM_MAX_K only bits are added, and never more
+	 * than a block per key.
+	 */
+	double   bits_per_key = -log(fp_rate) / (M_LN2 * M_LN2);
+	unsigned k            = _BLOOM_MAX_K;
+	for (; bits_per_key < _BLOOM_BLOCK_BITS; bits_per_key *= 1.05) {
+		unsigned plain_k = (unsigned)(bits_per_key * M_LN2 + .5);
+		unsigned max_k   = (plain_k < _BLOOM_MAX_K) ? plain_k + 1 : _BLOOM_MAX_K;
+		unsigned try_k   = (plain_k > 3) ? plain_k - 2 : 1;
+		double   best    = 1;
+		if (try_k > max_k) {
+			try_k = max_k;
+		}
+		for (; try_k <= max_k; ++try_k) {
+			double fp = _bloom_fp(bits_per_key, try_k);
+			if (fp < best) {
+				best = fp;
+				k    = try_k;
+			}
+		}
+		if (best <= fp_rate) {
+			break;
+		}
+	}
+	if (bits_per_key > _BLOOM_BLOCK_BITS) {
+		bits_per_key = _BLOOM_BLOCK_BITS;
+	}
+
+	*b = (Bloom) {
+	    ._block_count = (size_t)(capacity * bits_per_key / _BLOOM_BLOCK_BITS) + 1,
+	    .capacity     = capacity,
+	    .fp_rate      = fp_rate,
+	    ._k           = k,
+	};
+
+	b->_blocks = aligned_alloc(64, bloom_bytes(b));
+	if (b->_blocks == NULL) {
+		perror("aligned_alloc");
+		abort();
+	}
+	memset(b->_blocks, 0, bloom_bytes(b));
+}
+
+void
+bloom_destroy(Bloom* restrict b) {
+	heap_free(b->_blocks);
+}
+
+void
+bloom_clear(Bloom* restrict b) {
+	memset(b->_blocks, 0, bloom_bytes(b));
+	b->size = 0;
+}
+
+bool
+bloom_add_hash(Bloom* restrict b, uint64_t hash) {
+	uint64_t  want[_BLOOM_BLOCK_WORDS];
+	uint64_t* block = (uint64_t*)_bloom_want(b, hash, want);
+	uint64_t  seen  = 0;
+	unsigned  i     = 0;
+	for (; i < _BLOOM_BLOCK_WORDS; ++i) {
+		seen |= want[i] & ~block[i];
+		block[i] |= want[i];
+	}
+	++b->size;
+	return seen == 0;
+}
+
+bool
+bloom_nadd(Bloom* restrict b, const char* restrict key, unsigned n) {
+	return bloom_add_hash(b, _hash_fast(key, &n, 0));
+}
+
+bool
+bloom_has_hash(const Bloom* restrict b, uint64_t hash) {
+	uint64_t        want[_BLOOM_BLOCK_WORDS];
+	const uint64_t* block = _bloom_want(b, hash, want);
+	uint64_t        miss  = 0;
+	unsigned        i     = 0;
+	for (; i < _BLOOM_BLOCK_WORDS; ++i) {
+		miss |= want[i] & ~block[i];
+	}
+	return miss == 0;
+}
+
+bool
+bloom_nhas(const Bloom* restrict b, const char* restrict key, unsigned n) {
+	return bloom_has_hash(b, _hash_fast(key, &n, 0));
+}
+
+/* Internal */
+
+static inline uint64_t
+_bloom_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * Expected false positive rate of a blocked filter. The number
+ * of keys in a block is Poisson, and within a block it is a
+ * plain Bloom filter of _BLOOM_BLOCK_BITS bits.
+ */
+double
+_bloom_fp(double bits_per_key, unsigned k) {
+	double   mean   = _BLOOM_BLOCK_BITS / bits_per_key;
+	double   p_keys = exp(-mean);
+	double   clear  = pow(1 - 1.0 / _BLOOM_BLOCK_BITS, k);
+	double   left   = 1; /* chance a bit is still clear */
+	double   fp     = 0;
+	unsigned j      = 0;
+	for (; j < mean * 4 + 32; ++j) {
+		fp += p_keys * pow(1 - left, k);
+		p_keys *= mean / (j + 1);
+		left *= clear;
+	}
+	return fp;
+}
+
+/**
+ * The block comes from the high bits of one mix. Each bit
+ * position is 9 fresh bits of further mixes, so two keys in a
+ * block rarely pick the same positions. (Double hashing would
+ * match all k whenever two keys match in 18 bits.)
+ */
+static inline const uint64_t*
+_bloom_want(const Bloom* b, uint64_t hash, uint64_t* want) {
+	uint64_t mixed = _bloom_mix(hash);
+	size_t   block = (size_t)(((__uint128_t)mixed * b->_block_count) >> 64);
+	__builtin_prefetch(&b->_blocks[block * _BLOOM_BLOCK_WORDS]);
+
+	uint64_t h = 0;
+	unsigned i = 0;
+	memset(want, 0, _BLOOM_BLOCK_WORDS * sizeof(*want));
+	for (; i < b->_k; ++i) {
+		if (i % 7 == 0) {
+			h = _bloom_mix(mixed + i);
+		}
+		unsigned bit = h % _BLOOM_BLOCK_BITS;
+		want[bit / 64] |= (uint64_t)1 << (bit % 64);
+		h >>= 9;
+	}
+	return &b->_blocks[block * _BLOOM_BLOCK_WORDS];
+}
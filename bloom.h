@@ -0,0 +1,59 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * Blocked Bloom filter. Each key sets k bits inside a single
+ * 64 byte block, so a lookup costs one cache miss however
+ * large the filter is. It answers "definitely not" or "maybe".
+ * Keys cannot be removed.
+ *
+ * The filter is sized up front from the expected number of
+ * keys and the false positive rate wanted, at most a block per
+ * key. Past capacity it keeps working, but false positives
+ * climb.
+ *
+ * Keys may be given as bytes, hashed with wyhash under a fixed
+ * seed of 0, or as a 64 bit hash from elsewhere (Set passes
+ * the hash its table already computed). The hash is remixed,
+ * so a weak hash is fine as long as distinct keys rarely share
+ * all 64 bits.
+ */
+struct Bloom {
+	uint64_t* _blocks; /* 8 words per block */
+	size_t _block_count;
+	size_t capacity;
+	size_t size; /* adds, including repeats */
+	double fp_rate;
+	unsigned _k; /* bits per key */
+};
+typedef struct Bloom Bloom;
+
+void bloom_construct(Bloom* restrict, size_t capacity, double fp_rate);
+void bloom_destroy(Bloom* restrict);
+void bloom_clear(Bloom* restrict);
+
+/**
+ * Add a key. Returns true if every bit was already set, that
+ * is, the key was probably added before. For deduplicating a
+ * stream, drop an item when this returns true.
+ */
+bool bloom_add_hash(Bloom* restrict, uint64_t hash);
+bool bloom_nadd(Bloom* restrict, const char* restrict key, unsigned len);
+#define bloom_add(B_, KEY_) bloom_nadd(B_, KEY_, strlen(KEY_))
+
+/**
+ * false if the key was never added. true if it probably was.
+ */
+bool bloom_has_hash(const Bloom* restrict, uint64_t hash);
+bool bloom_nhas(const Bloom* restrict, const char* restrict key, unsigned len);
+#define bloom_has(B_, KEY_) bloom_nhas(B_, KEY_, strlen(KEY_))
+
+/* bytes taken by the bits */
+#define bloom_bytes(B_) ((B_)->_block_count * 64)
+
+#endif /* BLOOM_H */
@@ -0,0 +1,502 @@
+#include "btree.h"
+#include "util.h"
+
+#define _BTREE_KEYBUF_START 1024
+
+enum _Btree_End {
+	_BTREE_END_NONE,
+	_BTREE_END_BEFORE, /* stop at the first key not less than _end */
+	_BTREE_END_PREFIX, /* stop at the first key not starting with _end */
+};
+
+typedef struct _Btree_Node _Btree_Node;
+typedef struct _Btree_Key  _Btree_Key;
+
+/* A key as a node holds it */
+struct _Btree_Slot {
+	uint64_t prefix;
+	uint64_t key_idx;
+	uint32_t key_len;
+};
+typedef struct _Btree_Slot _Btree_Slot;
+
+_Btree_Node* _btree_new_node(const Btree*, bool leaf);
+void _btree_free_node(_Btree_Node*, unsigned height);
+_Btree_Key _btree_key(const Btree*, const char* key, unsigned n, bool trim);
+_Btree_Node* _btree_seek(const Btree*, const _Btree_Key*, unsigned* pos, _Btree_Node** path, unsigned* path_idx);
+uint64_t _btree_store_key(Btree*, const char* key, unsigned n);
+void _btree_insert_at(Btree*, _Btree_Node*, unsigned pos, _Btree_Slot, const void* payload);
+_Btree_Node* _btree_split(Btree*, _Btree_Node*, _Btree_Slot* sep);
+static inline void _btree_prefetch_walk(const _Btree_Node*, unsigned elem_size);
+static inline int _btree_cmp(const uint8_t* keybuf, unsigned props, const _Btree_Node*, unsigned i, const _Btree_Key*);
+
+
+void
+btree_construct_(void* gen_t, const unsigned elem_size, const unsigned props) {
+	Btree* t = gen_t;
+	*t       = (Btree) {
+	    ._keybuf    = {.data = heap_alloc(_BTREE_KEYBUF_START), .len = _BTREE_KEYBUF_START},
+	    ._height    = 1,
+	    ._elem_size = elem_size,
+	    .props      = props,
+	};
+	t->_root = _btree_new_node(t, true);
+}
+
+void
+btree_destroy(void* gen_t) {
+	Btree* t = gen_t;
+	_btree_free_node(t->_root, t->_height);
+	heap_free(t->_keybuf.data);
+}
+
+void
+btree_clear(void* gen_t) {
+	Btree* t = gen_t;
+	_btree_free_node(t->_root, t->_height);
+	t->_root        = _btree_new_node(t, true);
+	t->_height      = 1;
+	t->_keybuf_head = 0;
+	t->size         = 0;
+}
+
+void*
+btree_nset_(void* gen_t, const char* restrict key, unsigned n, const void* data) {
+	Btree*       t = gen_t;
+	_Btree_Key   q = _btree_key(t, key, n, true);
+	_Btree_Node* path[_BTREE_MAX_HEIGHT];
+	unsigned     path_idx[_BTREE_MAX_HEIGHT];
+	unsigned     pos  = 0;
+	_Btree_Node* leaf = _btree_seek(t, &q, &pos, path, path_idx);
+
+	if (pos < leaf->count && _btree_cmp(t->_keybuf.data, t->props, leaf, pos, &q) == 0) {
+		void* val = &leaf->_tail[pos * t->_elem_size];
+		memcpy(val, data, t->_elem_size);
+		return val;
+	}
+
+	_Btree_Slot slot = {q.prefix, _btree_store_key(t, q.key, q.n), q.n};
+	++t->size;
+
+	_Btree_Node* node    = leaf;
+	_Btree_Node* child   = NULL;
+	const void*  payload = data;
+	void*        val     = NULL;
+	unsigned     level   = t->_height - 1;
+	for (;;) {
+		_Btree_Node* right = NULL;
+		_Btree_Slot  sep;
+		if (node->count == _BTREE_ORDER) {
+			right = _btree_split(t, node, &sep);
+		}
+
+		/* an inner node's separator left both halves */
+		_Btree_Node* dest = node;
+		if (right != NULL && pos > node->count) {
+			dest = right;
+			pos -= node->count + !node->leaf;
+		}
+		_btree_insert_at(t, dest, pos, slot, payload);
+		if (val == NULL) {
+			val = &dest->_tail[pos * t->_elem_size];
+		}
+		if (right == NULL) {
+			return val;
+		}
+
+		/* hand the separator and new node up a level */
+		slot    = sep;
+		child   = right;
+		payload = &child;
+
+		if (level == 0) {
+			_Btree_Node* root = _btree_new_node(t, false);
+			((_Btree_Node**)root->_tail)[0] = node;
+			_btree_insert_at(t, root, 0, slot, payload);
+			t->_root = root;
+			++t->_height;
+			return val;
+		}
+		--level;
+		node = path[level];
+		pos  = path_idx[level];
+	}
+}
+
+void*
+btree_nget(const void* gen_t, const char* restrict key, unsigned n) {
+	const Btree* t    = gen_t;
+	_Btree_Key   q    = _btree_key(t, key, n, true);
+	unsigned     pos  = 0;
+	_Btree_Node* leaf = _btree_seek(t, &q, &pos, NULL, NULL);
+	if (pos < leaf->count && _btree_cmp(t->_keybuf.data, t->props, leaf, pos, &q) == 0) {
+		return &leaf->_tail[pos * t->_elem_size];
+	}
+	return NULL;
+}
+
+bool
+btree_nremove(void* gen_t, const char* restrict key, unsigned n) {
+	Btree*       t    = gen_t;
+	_Btree_Key   q    = _btree_key(t, key, n, true);
+	unsigned     pos  = 0;
+	_Btree_Node* leaf = _btree_seek(t, &q, &pos, NULL, NULL);
+	if (pos >= leaf->count || _btree_cmp(t->_keybuf.data, t->props, leaf, pos, &q) != 0) {
+		return false;
+	}
+
+	unsigned after = leaf->count - pos - 1;
+	memmove(&leaf->prefix[pos], &leaf->prefix[pos + 1], after * sizeof(uint64_t));
+	memmove(&leaf->key_idx[pos], &leaf->key_idx[pos + 1], after * sizeof(uint64_t));
+	memmove(&leaf->key_len[pos], &leaf->key_len[pos + 1], after * sizeof(uint32_t));
+	memmove(&leaf->_tail[pos * t->_elem_size],
+	        &leaf->_tail[(pos + 1) * t->_elem_size],
+	        after * t->_elem_size);
+	--leaf->count;
+	--t->size;
+	return true;
+}
+
+Btree_Iter
+btree_begin(const void* gen_t) {
+	const Btree*       t    = gen_t;
+	const _Btree_Node* node = t->_root;
+	unsigned           h    = 1;
+	for (; h < t->_height; ++h) {
+		node = ((_Btree_Node**)node->_tail)[0];
+	}
+	return (Btree_Iter) {
+	    ._node      = node,
+	    ._keybuf    = t->_keybuf.data,
+	    ._elem_size = t->_elem_size,
+	    ._props     = t->props,
+	};
+}
+
+Btree_Iter
+btree_nlower_bound(const void* gen_t, const char* restrict key, unsigned n) {
+	const Btree* t   = gen_t;
+	_Btree_Key   q   = _btree_key(t, key, n, true);
+	unsigned     pos = 0;
+	Btree_Iter   it  = btree_begin(t);
+	it._node         = _btree_seek(t, &q, &pos, NULL, NULL);
+	it._idx          = pos;
+	return it;
+}
+
+Btree_Iter
+btree_nrange(const void* gen_t, const char* lo, unsigned lo_len, const char* hi, unsigned hi_len) {
+	const Btree* t = gen_t;
+	Btree_Iter   it = btree_nlower_bound(t, lo, lo_len);
+	it._end         = _btree_key(t, hi, hi_len, true);
+	it._end_kind    = _BTREE_END_BEFORE;
+	return it;
+}
+
+Btree_Iter
+btree_nprefix(const void* gen_t, const char* prefix, unsigned n) {
+	const Btree* t  = gen_t;
+	_Btree_Key   q  = _btree_key(t, prefix, n, false);
+	unsigned     pos = 0;
+	Btree_Iter   it = btree_begin(t);
+	it._node        = _btree_seek(t, &q, &pos, NULL, NULL);
+	it._idx         = pos;
+	it._end         = q;
+	it._end_kind    = _BTREE_END_PREFIX;
+	return it;
+}
+
+void*
+btree_iter_next(Btree_Iter* it) {
+	while (it->_node != NULL && it->_idx >= it->_node->count) {
+		it->_node = it->_node->next;
+		it->_idx  = 0;
+		/* leaves are not laid out in order, so fetch one ahead */
+		if (it->_node != NULL && it->_node->next != NULL) {
+			_btree_prefetch_walk(it->_node->next, it->_elem_size);
+		}
+	}
+	if (it->_node == NULL) {
+		return NULL;
+	}
+
+	const _Btree_Node* node = it->_node;
+	unsigned           i    = it->_idx;
+	const char*        key  = (const char*)&it->_keybuf[node->key_idx[i]];
+	unsigned           len  = node->key_len[i];
+	const _Btree_Key*  end  = &it->_end;
+
+	bool done = false;
+	switch (it->_end_kind) {
+	case _BTREE_END_BEFORE:
+		done = (_btree_cmp(it->_keybuf, it->_props, node, i, end) >= 0);
+		break;
+	case _BTREE_END_PREFIX:
+		done = (len < end->n);
+		if (!done && (it->_props & MAP_PROP_NOCASE)) {
+			unsigned j = 0;
+			for (; !done && j < end->n; ++j) {
+				done = ((unsigned char)key[j] != _fold_byte(end->key[j]));
+			}
+		} else if (!done) {
+			done = (memcmp(key, end->key, end->n) != 0);
+		}
+		break;
+	default:
+		break;
+	}
+	if (done) {
+		it->_node = NULL;
+		return NULL;
+	}
+
+	it->key     = key;
+	it->key_len = len;
+	++it->_idx;
+	return (void*)&node->_tail[i * it->_elem_size];
+}
+
+/* Internal */
+
+_Btree_Node*
+_btree_new_node(const Btree* t, bool leaf) {
+	size_t tail = (leaf) ? _BTREE_ORDER * t->_elem_size
+	                     : (_BTREE_ORDER + 1) * sizeof(_Btree_Node*);
+	_Btree_Node* node = heap_alloc(sizeof(*node) + tail);
+	node->next        = NULL;
+	node->count       = 0;
+	node->leaf        = leaf;
+	return node;
+}
+
+void
+_btree_free_node(_Btree_Node* node, unsigned height) {
+	if (height > 1) {
+		unsigned i = 0;
+		for (; i <= node->count; ++i) {
+			_btree_free_node(((_Btree_Node**)node->_tail)[i], height - 1);
+		}
+	}
+	heap_free(node);
+}
+
+/**
+ * q for key, folded per props. trim is false for prefixes,
+ * whose trailing spaces count.
+ */
+_Btree_Key
+_btree_key(const Btree* t, const char* key, unsigned n, bool trim) {
+	if (trim && (t->props & MAP_PROP_RTRIM)) {
+		while (n > 0 && key[n - 1] == ' ') {
+			--n;
+		}
+	}
+
+	uint8_t bytes[8] = {0};
+	memcpy(bytes, key, (n < 8) ? n : 8);
+	if (t->props & MAP_PROP_NOCASE) {
+		unsigned i = 0;
+		for (; i < 8; ++i) {
+			bytes[i] = _fold_byte(bytes[i]);
+		}
+	}
+	uint64_t prefix;
+	memcpy(&prefix, bytes, sizeof(prefix));
+	return (_Btree_Key) {key, n, __builtin_bswap64(prefix)};
+}
+
+/**
+ * Order of the stored key at i against q. Equal prefixes are
+ * equal bytes up to the shorter key or 8, whichever is first.
+ */
+static inline int
+_btree_cmp(const uint8_t* keybuf, unsigned props, const _Btree_Node* node, unsigned i, const _Btree_Key* q) {
+	if (node->prefix[i] != q->prefix) {
+		return (node->prefix[i] < q->prefix) ? -1 : 1;
+	}
+
+	unsigned len = node->key_len[i];
+	unsigned min = (len < q->n) ? len : q->n;
+	if (min > 8) {
+		const uint8_t* key   = &keybuf[node->key_idx[i]];
+		const uint8_t* q_key = (const uint8_t*)q->key;
+		if (props & MAP_PROP_NOCASE) {
+			unsigned j = 8;
+			for (; j < min; ++j) {
+				int diff = key[j] - _fold_byte(q_key[j]);
+				if (diff != 0) {
+					return diff;
+				}
+			}
+		} else {
+			int diff = memcmp(key + 8, q_key + 8, min - 8);
+			if (diff != 0) {
+				return diff;
+			}
+		}
+	}
+	return NUM_COMPARE(len, q->n);
+}
+
+/**
+ * Everything a search of node reads but the key offsets, all
+ * at once, so the child pointer or value does not wait for the
+ * search to miss again.
+ */
+static inline void
+_btree_prefetch(const Btree* t, const _Btree_Node* node, bool leaf) {
+	size_t tail = (leaf) ? _BTREE_ORDER * t->_elem_size
+	                     : (_BTREE_ORDER + 1) * sizeof(_Btree_Node*);
+	if (tail > 512) {
+		tail = 512;
+	}
+	size_t i = 0;
+	for (; i < sizeof(node->prefix); i += 64) {
+		__builtin_prefetch((const char*)node->prefix + i);
+	}
+	for (i = 0; i < sizeof(node->key_len); i += 64) {
+		__builtin_prefetch((const char*)node->key_len + i);
+	}
+	for (i = 0; i < tail; i += 64) {
+		__builtin_prefetch(node->_tail + i);
+	}
+}
+
+/* What a walk reads of a leaf */
+static inline void
+_btree_prefetch_walk(const _Btree_Node* node, unsigned elem_size) {
+	size_t i = 0;
+	for (; i < sizeof(node->key_idx) + sizeof(node->key_len); i += 64) {
+		__builtin_prefetch((const char*)node->key_idx + i);
+	}
+	for (i = 0; i < _BTREE_ORDER * elem_size && i < 512; i += 64) {
+		__builtin_prefetch(node->_tail + i);
+	}
+}
+
+/**
+ * Leaf where q is or belongs, and in pos, the first key there
+ * not less than q. If path is set, it gets each inner node on
+ * the way down and path_idx the child taken.
+ */
+_Btree_Node*
+_btree_seek(const Btree* t, const _Btree_Key* q, unsigned* pos, _Btree_Node** path, unsigned* path_idx) {
+	_Btree_Node* node  = t->_root;
+	unsigned     level = 0;
+	for (;;) {
+		/**
+		 * Count the prefixes below q's without branching, then
+		 * compare whole keys only where the prefix ties. inner:
+		 * first key greater than q. leaf: not less.
+		 */
+		unsigned lo = 0;
+		unsigned i  = 0;
+		for (; i < node->count; ++i) {
+			lo += (node->prefix[i] < q->prefix);
+		}
+		unsigned hi = lo;
+		while (hi < node->count && node->prefix[hi] == q->prefix) {
+			++hi;
+		}
+		int stop = (node->leaf) ? 0 : 1;
+		while (lo < hi) {
+			unsigned mid = (lo + hi) / 2;
+			if (_btree_cmp(t->_keybuf.data, t->props, node, mid, q) < stop) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		if (node->leaf) {
+			*pos = lo;
+			return node;
+		}
+		if (path != NULL) {
+			path[level]     = node;
+			path_idx[level] = lo;
+		}
+		++level;
+		node = ((_Btree_Node**)node->_tail)[lo];
+		_btree_prefetch(t, node, level == t->_height - 1);
+	}
+}
+
+uint64_t
+_btree_store_key(Btree* t, const char* key, unsigned n) {
+	while (t->_keybuf_head + n > (size_t)t->_keybuf.len) {
+		t->_keybuf.len *= 2;
+		t->_keybuf.data = heap_resize(t->_keybuf.data, t->_keybuf.len);
+	}
+
+	uint64_t idx  = t->_keybuf_head;
+	uint8_t* dest = &t->_keybuf.data[idx];
+	if (t->props & MAP_PROP_NOCASE) {
+		unsigned i = 0;
+		for (; i < n; ++i) {
+			dest[i] = _fold_byte(key[i]);
+		}
+	} else {
+		memcpy(dest, key, n);
+	}
+	t->_keybuf_head += n;
+	return idx;
+}
+
+/**
+ * Put slot into node at pos. payload is the value for a leaf,
+ * or for an inner node, a pointer to the child that goes right
+ * of the key.
+ */
+void
+_btree_insert_at(Btree* t, _Btree_Node* node, unsigned pos, _Btree_Slot slot, const void* payload) {
+	unsigned after = node->count - pos;
+	memmove(&node->prefix[pos + 1], &node->prefix[pos], after * sizeof(uint64_t));
+	memmove(&node->key_idx[pos + 1], &node->key_idx[pos], after * sizeof(uint64_t));
+	memmove(&node->key_len[pos + 1], &node->key_len[pos], after * sizeof(uint32_t));
+	node->prefix[pos]  = slot.prefix;
+	node->key_idx[pos] = slot.key_idx;
+	node->key_len[pos] = slot.key_len;
+
+	if (node->leaf) {
+		uint8_t* vals = node->_tail;
+		memmove(&vals[(pos + 1) * t->_elem_size], &vals[pos * t->_elem_size], after * t->_elem_size);
+		memcpy(&vals[pos * t->_elem_size], payload, t->_elem_size);
+	} else {
+		_Btree_Node** children = (_Btree_Node**)node->_tail;
+		memmove(&children[pos + 2], &children[pos + 1], after * sizeof(*children));
+		children[pos + 1] = *(_Btree_Node* const*)payload;
+	}
+	++node->count;
+}
+
+/**
+ * Move the upper half of a full node into a new right sibling
+ * and return it. The separator for the parent goes to sep. A
+ * leaf's separator is a copy of its right half's first key.
+ * An inner node's middle key moves up, out of both halves.
+ */
+_Btree_Node*
+_btree_split(Btree* t, _Btree_Node* node, _Btree_Slot* sep) {
+	_Btree_Node* right = _btree_new_node(t, node->leaf);
+	unsigned     half  = _BTREE_ORDER / 2;
+	unsigned     from  = (node->leaf) ? half : half + 1;
+	unsigned     moved = _BTREE_ORDER - from;
+
+	memcpy(right->prefix, &node->prefix[from], moved * sizeof(uint64_t));
+	memcpy(right->key_idx, &node->key_idx[from], moved * sizeof(uint64_t));
+	memcpy(right->key_len, &node->key_len[from], moved * sizeof(uint32_t));
+	if (node->leaf) {
+		memcpy(right->_tail, &node->_tail[from * t->_elem_size], moved * t->_elem_size);
+		right->next = node->next;
+		node->next  = right;
+	} else {
+		memcpy(right->_tail,
+		       &((_Btree_Node**)node->_tail)[from],
+		       (moved + 1) * sizeof(_Btree_Node*));
+	}
+	right->count = moved;
+	node->count  = half;
+	*sep         = (_Btree_Slot) {node->prefix[half], node->key_idx[half], node->key_len[half]};
+	return right;
+}
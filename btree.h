@@ -0,0 +1,135 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "map.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Btree is an ordered map: a B+-tree with wide nodes over keys
+ * kept in a _keybuf, as Map keeps them. MAP_PROP_NOCASE and
+ * MAP_PROP_RTRIM mean what they do for Map. Keys are stored
+ * folded and trimmed, and ordered as slice_compare_nocase /
+ * slice_compare would order the trimmed keys, except that a
+ * nul byte does not end a key.
+ *
+ * Each node keeps the first 8 bytes of its keys as big endian
+ * integers next to each other, so a search mostly compares
+ * integers and only reads _keybuf to break a tie. Values live
+ * in the leaves. Leaves are linked for iteration.
+ *
+ * Removing a key does not merge nodes or free its bytes in
+ * _keybuf, since separators in inner nodes may still point at
+ * them. A tree that shrinks a lot is best rebuilt.
+ */
+#define _BTREE_ORDER      32 /* keys per node */
+#define _BTREE_MAX_HEIGHT 16
+
+struct _Btree_Node {
+	uint64_t prefix[_BTREE_ORDER];
+	uint64_t key_idx[_BTREE_ORDER];
+	uint32_t key_len[_BTREE_ORDER];
+	struct _Btree_Node* next; /* leaf: right sibling */
+	uint16_t count;
+	uint16_t leaf;
+	/* inner: count + 1 children. leaf: count values */
+	uint8_t _tail[] __attribute__((aligned(16)));
+};
+
+/* A key being looked for, as it came in */
+struct _Btree_Key {
+	const char* key;
+	unsigned n;
+	uint64_t prefix; /* folded like stored keys */
+};
+
+#define Btree(T_)                                           \
+	struct {                                            \
+		struct _Btree_Node* _root;                  \
+		Byte_Slice _keybuf;                         \
+		size_t _keybuf_head;                        \
+		T_* _type; /* never set, see typeof */      \
+		size_t size;                                \
+		unsigned _height; /* 1 while root is a leaf */ \
+		unsigned _elem_size;                        \
+		unsigned props;                             \
+	}
+typedef Btree(uint8_t) Btree;
+
+/**
+ * Walks keys in order. After btree_iter_next returns a value,
+ * key and key_len hold its key as stored. Iterators and the
+ * pointers they hand out are good until the tree changes.
+ */
+struct Btree_Iter {
+	const struct _Btree_Node* _node;
+	const uint8_t* _keybuf;
+	struct _Btree_Key _end;
+	unsigned _idx;
+	unsigned _elem_size;
+	unsigned _props;
+	int _end_kind;
+	const char* key; /* not nul-terminated */
+	unsigned key_len;
+};
+typedef struct Btree_Iter Btree_Iter;
+
+void btree_construct_(void*, const unsigned elem_size, const unsigned props);
+#define btree_construct(T_, PROPS_) btree_construct_(T_, sizeof(*(T_)->_type), PROPS_)
+void btree_destroy(void*);
+void btree_clear(void*);
+
+/**
+ * Add or replace key's value with a copy of data. Returns a
+ * pointer to the value in the tree.
+ */
+void* btree_nset_(void*, const char* key, unsigned key_len, const void* data);
+#define btree_nset(T_, KEY_, KL_, ITEM_)                    \
+	{                                                   \
+		__typeof__(*(T_)->_type) item_ = ITEM_;     \
+		btree_nset_(T_, KEY_, KL_, &item_);         \
+	}
+#define btree_set(T_, KEY_, ITEM_) btree_nset(T_, KEY_, strlen(KEY_), ITEM_)
+
+/**
+ * Return NULL if no match or pointer to value. The pointer is
+ * good until the tree changes.
+ */
+void* btree_nget(const void*, const char* key, unsigned key_len);
+#define btree_get(T_, KEY_) btree_nget(T_, KEY_, strlen(KEY_))
+
+/**
+ * Remove key and its value. Returns false if key was not there.
+ */
+bool btree_nremove(void*, const char* key, unsigned key_len);
+#define btree_remove(T_, KEY_) btree_nremove(T_, KEY_, strlen(KEY_))
+
+#define btree_size(T_) ((T_)->size)
+
+/**
+ * btree_begin walks every key.
+ * btree_nlower_bound starts at the first key not less than key.
+ * btree_nrange walks keys from lo up to, not including, hi.
+ * btree_nprefix walks keys that start with prefix. Trailing
+ *   spaces in prefix count even with MAP_PROP_RTRIM.
+ * Keys given to btree_nrange and btree_nprefix must outlive
+ * the iterator.
+ */
+Btree_Iter btree_begin(const void*);
+Btree_Iter btree_nlower_bound(const void*, const char* key, unsigned key_len);
+#define btree_lower_bound(T_, KEY_) btree_nlower_bound(T_, KEY_, strlen(KEY_))
+Btree_Iter btree_nrange(const void*, const char* lo, unsigned lo_len, const char* hi, unsigned hi_len);
+#define btree_range(T_, LO_, HI_) btree_nrange(T_, LO_, strlen(LO_), HI_, strlen(HI_))
+Btree_Iter btree_nprefix(const void*, const char* prefix, unsigned len);
+#define btree_prefix(T_, PREFIX_) btree_nprefix(T_, PREFIX_, strlen(PREFIX_))
+
+/* The next value or NULL at the end */
+void* btree_iter_next(Btree_Iter*);
+
+#endif /* BTREE_H */
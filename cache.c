@@ -0,0 +1,192 @@
+#include "cache.h"
+#include "util.h"
+
+void _cache_evict(Cache*);
+void _cache_drop(Cache*, _Entry*);
+
+
+void
+cache_construct_(void* gen_c, const unsigned elem_size, size_t capacity, const unsigned props) {
+	Cache* c = gen_c;
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	*c = (Cache) {
+	    .capacity   = capacity,
+	    ._elem_size = elem_size,
+	};
+	/* never holds more than capacity keys */
+	map_construct_(&c->_map, elem_size, capacity, props);
+	vec_construct(&c->_ref);
+	vec_reserve(&c->_ref, capacity);
+}
+
+void
+cache_destroy(void* gen_c) {
+	Cache* c = gen_c;
+	cache_clear(c);
+	map_destroy(&c->_map);
+	vec_destroy(&c->_ref);
+}
+
+void
+cache_clear(void* gen_c) {
+	Cache* c = gen_c;
+	if (c->_on_evict != NULL) {
+		const _Table* t = &c->_map._table;
+		map_idx       i = 0;
+		for (; i < (map_idx)c->_map.values.len; ++i) {
+			const _Entry* e = _rev_entry(t, i);
+			c->_on_evict((const char*)_entry_key(t, e),
+			             e->key_len,
+			             vec_iter_at_(&c->_map.values, i, c->_elem_size),
+			             c->_evict_data);
+		}
+	}
+	map_clear(&c->_map);
+	vec_clear(&c->_ref);
+	c->_hand = 0;
+}
+
+void
+cache_on_evict(void* gen_c, evict_fn on_evict, void* data) {
+	Cache* c       = gen_c;
+	c->_on_evict   = on_evict;
+	c->_evict_data = data;
+}
+
+void*
+cache_nget(void* gen_c, const char* restrict key, unsigned n) {
+	Cache*        c    = gen_c;
+	const _Table* t    = &c->_map._table;
+	uint64_t      hash = t->hash__(key, &n, t->seed);
+	void*         val  = _cache_get_hashed(c, key, n, hash);
+	if (val != NULL) {
+		++c->hits;
+	} else {
+		++c->misses;
+	}
+	return val;
+}
+
+void*
+cache_nput_(void* gen_c, const char* restrict key, unsigned n, const void* data) {
+	Cache*        c    = gen_c;
+	const _Table* t    = &c->_map._table;
+	uint64_t      hash = t->hash__(key, &n, t->seed);
+	return _cache_put_hashed(c, key, n, hash, data);
+}
+
+bool
+cache_nremove(void* gen_c, const char* restrict key, unsigned n) {
+	Cache*        c    = gen_c;
+	const _Table* t    = &c->_map._table;
+	uint64_t      hash = t->hash__(key, &n, t->seed);
+	return _cache_remove_hashed(c, key, n, hash);
+}
+
+void*
+_cache_get_hashed(void* gen_c, const char* key, unsigned n, uint64_t hash) {
+	Cache*  c = gen_c;
+	_Entry* e = _table_find(&c->_map._table, key, n, hash);
+	if (e->val_idx == _NONE) {
+		return NULL;
+	}
+
+	/**
+	 * Shard_Cache gets here under a read lock. Only the sweep
+	 * clears the byte, and it holds the write lock. Skipping
+	 * the store when it is set keeps hot lines from bouncing.
+	 */
+	uint8_t* ref = &c->_ref.data[e->val_idx];
+	if (!__atomic_load_n(ref, __ATOMIC_RELAXED)) {
+		__atomic_store_n(ref, 1, __ATOMIC_RELAXED);
+	}
+	return vec_iter_at_(&c->_map.values, e->val_idx, c->_elem_size);
+}
+
+void*
+_cache_put_hashed(void* gen_c, const char* key, unsigned n, uint64_t hash, const void* data) {
+	Cache*  c = gen_c;
+	_Entry* e = _table_find(&c->_map._table, key, n, hash);
+	if (e->val_idx != _NONE) {
+		void* val = vec_iter_at_(&c->_map.values, e->val_idx, c->_elem_size);
+		if (c->_on_evict != NULL) {
+			const _Table* t = &c->_map._table;
+			c->_on_evict((const char*)_entry_key(t, e),
+			             e->key_len,
+			             val,
+			             c->_evict_data);
+		}
+		memcpy(val, data, c->_elem_size);
+		c->_ref.data[e->val_idx] = 1;
+		return val;
+	}
+
+	if (cache_size(c) >= c->capacity) {
+		_cache_evict(c);
+	}
+
+	/* new keys start unreferenced so one pass of scans can not
+	 * push out everything that was hit
+	 */
+	_map_declare_hashed(&c->_map, key, n, hash);
+	vec_push_back_(&c->_map.values, data, c->_elem_size);
+	vec_push_back(&c->_ref, 0);
+	return vec_back_(&c->_map.values, c->_elem_size);
+}
+
+bool
+_cache_remove_hashed(void* gen_c, const char* key, unsigned n, uint64_t hash) {
+	Cache*  c = gen_c;
+	_Entry* e = _table_find(&c->_map._table, key, n, hash);
+	if (e->val_idx == _NONE) {
+		return false;
+	}
+	_cache_drop(c, e);
+	return true;
+}
+
+/* Internal */
+
+/* Sweep to the first unreferenced value and drop it */
+void
+_cache_evict(Cache* c) {
+	uint8_t* ref = c->_ref.data;
+	size_t   len = c->_ref.len;
+	size_t   i   = c->_hand;
+	for (;; ++i) {
+		if (i >= len) {
+			i = 0;
+		}
+		if (!ref[i]) {
+			break;
+		}
+		ref[i] = 0;
+	}
+
+	/**
+	 * The last value, the newest, moves into i. Stepping past
+	 * it gives it a full turn of the hand, as it would have
+	 * had at the end.
+	 */
+	c->_hand = i + 1;
+	_cache_drop(c, _rev_entry(&c->_map._table, i));
+}
+
+void
+_cache_drop(Cache* c, _Entry* e) {
+	map_idx idx = e->val_idx;
+	if (c->_on_evict != NULL) {
+		const _Table* t = &c->_map._table;
+		c->_on_evict((const char*)_entry_key(t, e),
+		             e->key_len,
+		             vec_iter_at_(&c->_map.values, idx, c->_elem_size),
+		             c->_evict_data);
+	}
+
+	/* _map_remove_entry moves the last value into idx */
+	c->_ref.data[idx] = c->_ref.data[c->_ref.len - 1];
+	--c->_ref.len;
+	_map_remove_entry(&c->_map, e, c->_elem_size);
+}
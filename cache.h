@@ -0,0 +1,95 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "map.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Cache is a Map that holds at most capacity keys and makes
+ * room by evicting with CLOCK, an approximation of LRU. Each
+ * value has a referenced byte in _ref, kept at the value's
+ * index the way _rev is, so recency costs no allocation or
+ * pointer chase. A hit sets the byte. To evict, a hand sweeps
+ * the values, clearing set bytes, and takes the first value
+ * whose byte was clear.
+ *
+ * Keys follow the same MAP_PROP_* rules as a Map built with
+ * the same props. A Cache is not thread safe. See Shard_Cache.
+ */
+
+/**
+ * Called with a value on its way out and its key as stored.
+ * The value is gone when this returns, so this is where to
+ * free what it owns. Evictions, replacements, removes, clear
+ * and destroy all come through here.
+ */
+typedef void (*evict_fn)(const char* key, unsigned key_len, void* val, void* data);
+
+#define Cache(T_)                                     \
+	struct {                                      \
+		Map _map;                             \
+		Vec(uint8_t) _ref; /* by value index */ \
+		T_* _type; /* never set, see typeof */ \
+		size_t _hand;                         \
+		size_t capacity;                      \
+		size_t hits;                          \
+		size_t misses;                        \
+		evict_fn _on_evict;                   \
+		void* _evict_data;                    \
+		unsigned _elem_size;                  \
+	}
+typedef Cache(uint8_t) Cache;
+
+void cache_construct_(void*, const unsigned elem_size, size_t capacity, const unsigned props);
+#define cache_construct(C_, CAPACITY_, PROPS_) \
+	cache_construct_(C_, sizeof(*(C_)->_type), CAPACITY_, PROPS_)
+void cache_destroy(void*);
+void cache_clear(void*);
+
+/* on_evict may be NULL. data is passed through to it. */
+void cache_on_evict(void*, evict_fn on_evict, void* data);
+
+/**
+ * Return NULL on a miss or pointer to value. The pointer is
+ * good until the next put or remove. Counts a hit or miss.
+ */
+void* cache_nget(void*, const char* key, unsigned key_len);
+#define cache_get(C_, KEY_) cache_nget(C_, KEY_, strlen(KEY_))
+
+/**
+ * Add or replace key's value with a copy of data, evicting a
+ * key first if the cache is full. Returns a pointer to the
+ * value in the cache, good until the next put or remove.
+ */
+void* cache_nput_(void*, const char* key, unsigned key_len, const void* data);
+#define cache_nput(C_, KEY_, KL_, ITEM_)                \
+	{                                               \
+		__typeof__(*(C_)->_type) item_ = ITEM_; \
+		cache_nput_(C_, KEY_, KL_, &item_);     \
+	}
+#define cache_put(C_, KEY_, ITEM_) cache_nput(C_, KEY_, strlen(KEY_), ITEM_)
+
+/**
+ * Remove key and its value. Returns false if key was not there.
+ */
+bool cache_nremove(void*, const char* key, unsigned key_len);
+#define cache_remove(C_, KEY_) cache_nremove(C_, KEY_, strlen(KEY_))
+
+#define cache_size(C_) ((C_)->_map._table.size)
+
+/**
+ * Internal, for Shard_Cache: the same with key's hash from the
+ * table's hash__ and n already trimmed by it.
+ */
+void* _cache_get_hashed(void*, const char* key, unsigned n, uint64_t hash);
+void* _cache_put_hashed(void*, const char* key, unsigned n, uint64_t hash, const void* data);
+bool _cache_remove_hashed(void*, const char* key, unsigned n, uint64_t hash);
+
+#endif /* CACHE_H */
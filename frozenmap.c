@@ -0,0 +1,323 @@
+#include "frozenmap.h"
+#include <string.h>
+#include "util.h"
+
+/* average keys per bucket */
+const unsigned _FROZEN_LAMBDA = 4;
+
+/* give up on a bucket after this many displacements */
+const uint32_t _FROZEN_MAX_DISP = 1 << 28;
+
+/* golden ratio, steps the displacement through the hash */
+const uint64_t _FROZEN_STEP = 0x9e3779b97f4a7c15UL;
+
+/* A key to place, pulled out of the source table */
+struct _Frozen_Key {
+	uint64_t hash;
+	const uint8_t* key;
+	const uint8_t* value;
+	uint32_t key_len;
+	uint32_t bucket;
+};
+
+/* record: key length, padding, value, key bytes */
+#define _FROZEN_HEADER 8
+
+size_t _frozen_collect(const _Table*, const void* values, unsigned elem_size, struct _Frozen_Key*);
+int _frozen_place(struct _Frozen*, struct _Frozen_Key*, size_t n, uint32_t* disp, uint32_t* slot_of);
+
+
+int
+map_freeze_(void* gen_f, const _Table* t, const void* values, unsigned elem_size) {
+	Frozen_Map*     fm = gen_f;
+	struct _Frozen* f  = &fm->_frozen;
+	size_t          n  = t->size;
+
+	*f = (struct _Frozen) {
+	    .size       = n,
+	    ._buckets   = n / _FROZEN_LAMBDA + 1,
+	    .hash__     = t->hash__,
+	    .seed       = t->seed,
+	    .props      = t->props,
+	    ._elem_size = elem_size,
+	};
+
+	struct _Frozen_Key* keys    = heap_alloc((n + 1) * sizeof(*keys));
+	uint32_t*           disp    = heap_alloc(f->_buckets * sizeof(*disp));
+	uint32_t*           slot_of = heap_alloc((n + 1) * sizeof(*slot_of));
+	_frozen_collect(t, values, elem_size, keys);
+
+	if (_frozen_place(f, keys, n, disp, slot_of)) {
+		heap_free(keys);
+		heap_free(disp);
+		heap_free(slot_of);
+		f->_data = NULL;
+		return Result_Fail;
+	}
+
+	/* one allocation: displacements, offsets, then records */
+	size_t   record_bytes = 0;
+	size_t   i            = 0;
+	uint32_t* key_at      = heap_alloc((n + 1) * sizeof(*key_at));
+	for (; i < n; ++i) {
+		key_at[slot_of[i]] = i;
+		record_bytes += (_FROZEN_HEADER + elem_size + keys[i].key_len + 7) & ~(size_t)7;
+	}
+
+	size_t disp_bytes   = f->_buckets * sizeof(uint32_t);
+	size_t offset_bytes = ((n + 1) * sizeof(uint32_t) + 7) & ~(size_t)7;
+	disp_bytes          = (disp_bytes + 7) & ~(size_t)7;
+	f->_data            = heap_alloc(disp_bytes + offset_bytes + record_bytes);
+
+	memcpy(f->_data, disp, f->_buckets * sizeof(uint32_t));
+	uint32_t* offsets = (uint32_t*)(f->_data + disp_bytes);
+	uint8_t*  records = f->_data + disp_bytes + offset_bytes;
+	size_t    off     = 0;
+
+	/* records go in slot order so the offsets only grow */
+	for (i = 0; i < n; ++i) {
+		const struct _Frozen_Key* k   = &keys[key_at[i]];
+		uint8_t*                  rec = records + off;
+		offsets[i]                    = off / 8;
+		memset(rec, 0, _FROZEN_HEADER);
+		memcpy(rec, &k->key_len, sizeof(k->key_len));
+		if (elem_size != 0) {
+			memcpy(rec + _FROZEN_HEADER, k->value, elem_size);
+		}
+		memcpy(rec + _FROZEN_HEADER + elem_size, k->key, k->key_len);
+		off += (_FROZEN_HEADER + elem_size + k->key_len + 7) & ~(size_t)7;
+	}
+	offsets[n] = off / 8;
+
+	f->_disp    = (const uint32_t*)f->_data;
+	f->_offsets = offsets;
+	f->_records = records;
+
+	heap_free(key_at);
+	heap_free(keys);
+	heap_free(disp);
+	heap_free(slot_of);
+	return Result_Ok;
+}
+
+void
+frozenmap_destroy(void* gen_f) {
+	Frozen_Map* fm = gen_f;
+	heap_free(fm->_frozen._data);
+}
+
+/* Internal */
+
+/* [0, range) from the high bits of x */
+static inline size_t
+_frozen_range(uint64_t x, size_t range) {
+	return (size_t)(((__uint128_t)x * range) >> 64);
+}
+
+static inline uint64_t
+_frozen_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* FNV-1 barely touches the high bits for the last byte, so mix */
+static inline size_t
+_frozen_bucket(uint64_t hash, size_t buckets) {
+	return _frozen_range(_frozen_mix(hash ^ _FROZEN_STEP), buckets);
+}
+
+static inline size_t
+_frozen_slot(uint64_t hash, uint32_t disp, size_t n) {
+	return _frozen_range(_frozen_mix(hash + disp * _FROZEN_STEP), n);
+}
+
+void*
+frozenmap_nget(const void* gen_f, const char* key, unsigned n) {
+	const Frozen_Map*     fm = gen_f;
+	const struct _Frozen* f  = &fm->_frozen;
+	if (f->size == 0) {
+		return NULL;
+	}
+
+	uint64_t hash = f->hash__(key, &n, f->seed);
+	uint32_t disp = f->_disp[_frozen_bucket(hash, f->_buckets)];
+	size_t   slot = _frozen_slot(hash, disp, f->size);
+
+	uint8_t* rec     = (uint8_t*)f->_records + (size_t)f->_offsets[slot] * 8;
+	uint32_t key_len = 0;
+	memcpy(&key_len, rec, sizeof(key_len));
+	if (key_len != n) {
+		return NULL;
+	}
+
+	/* stored keys are already folded and trimmed */
+	const uint8_t* stored = rec + _FROZEN_HEADER + f->_elem_size;
+	if (!(f->props & MAP_PROP_NOCASE)) {
+		if (memcmp(stored, key, n) != 0) {
+			return NULL;
+		}
+	} else {
+		unsigned i = 0;
+		for (; i < n; ++i) {
+			if (stored[i] != _fold_byte(key[i])) {
+				return NULL;
+			}
+		}
+	}
+	return rec + _FROZEN_HEADER;
+}
+
+/* Pull every live key out of t. Maps go in value order. */
+size_t
+_frozen_collect(const _Table* t, const void* values, unsigned elem_size, struct _Frozen_Key* keys) {
+	size_t n = 0;
+	if (t->_rev.data != NULL) {
+		ssize_t i = 0;
+		for (; i < t->_rev.len; ++i) {
+			const _Entry* e = _rev_entry(t, i);
+			keys[n++]       = (struct _Frozen_Key) {
+                            .hash    = e->hash,
+                            .key     = _entry_key(t, e),
+                            .value   = (const uint8_t*)values + (size_t)i * elem_size,
+                            .key_len = e->key_len,
+                        };
+		}
+		return n;
+	}
+
+	const _Entry_Slice tables[] = {t->_entries, t->_old_entries};
+	unsigned           j        = 0;
+	for (; j < ARRAY_LEN(tables); ++j) {
+		ssize_t i = 0;
+		for (; i < tables[j].len; ++i) {
+			const _Entry* e = &tables[j].data[i];
+			if (e->val_idx == _NONE || e->val_idx == _MOVED) {
+				continue;
+			}
+			keys[n++] = (struct _Frozen_Key) {
+			    .hash    = e->hash,
+			    .key     = _entry_key(t, e),
+			    .value   = NULL,
+			    .key_len = e->key_len,
+			};
+		}
+	}
+	return n;
+}
+
+/**
+ * Place the biggest buckets first while the table is empty.
+ * For each bucket, try displacements until all of its keys
+ * land on free slots distinct from each other.
+ */
+int
+_frozen_place(struct _Frozen* f, struct _Frozen_Key* keys, size_t n, uint32_t* disp, uint32_t* slot_of) {
+	size_t    buckets = f->_buckets;
+	uint32_t* start   = heap_alloc((buckets + 1) * sizeof(*start));
+	uint32_t* members = heap_alloc((n + 1) * sizeof(*members));
+	uint64_t* taken   = heap_alloc((n / 64 + 1) * sizeof(*taken));
+	memset(start, 0, (buckets + 1) * sizeof(*start));
+	memset(taken, 0, (n / 64 + 1) * sizeof(*taken));
+
+	/* counting sort keys by bucket */
+	size_t i = 0;
+	for (; i < n; ++i) {
+		keys[i].bucket = _frozen_bucket(keys[i].hash, buckets);
+		++start[keys[i].bucket + 1];
+	}
+	unsigned max_size = 0;
+	for (i = 0; i < buckets; ++i) {
+		if (start[i + 1] > max_size) {
+			max_size = start[i + 1];
+		}
+		start[i + 1] += start[i];
+	}
+	uint32_t* fill = heap_alloc((buckets + 1) * sizeof(*fill));
+	memcpy(fill, start, (buckets + 1) * sizeof(*fill));
+	for (i = 0; i < n; ++i) {
+		members[fill[keys[i].bucket]++] = i;
+	}
+
+	/* then buckets by size, largest first */
+	uint32_t* by_size = heap_alloc((buckets + 1) * sizeof(*by_size));
+	uint32_t* counts  = heap_alloc((max_size + 2) * sizeof(*counts));
+	memset(counts, 0, (max_size + 2) * sizeof(*counts));
+	for (i = 0; i < buckets; ++i) {
+		++counts[max_size - (start[i + 1] - start[i]) + 1];
+	}
+	unsigned s = 0;
+	for (; s <= max_size; ++s) {
+		counts[s + 1] += counts[s];
+	}
+	for (i = 0; i < buckets; ++i) {
+		by_size[counts[max_size - (start[i + 1] - start[i])]++] = i;
+	}
+
+	size_t* slots  = heap_alloc((max_size + 1) * sizeof(*slots));
+	int     result = Result_Ok;
+	for (i = 0; i < buckets && result == Result_Ok; ++i) {
+		uint32_t b    = by_size[i];
+		uint32_t size = start[b + 1] - start[b];
+		uint32_t d    = 0;
+		disp[b]       = 0;
+		if (size == 0) {
+			continue;
+		}
+
+		/* keys with one hash share a slot under every displacement */
+		uint32_t j = 1;
+		for (; j < size && result == Result_Ok; ++j) {
+			uint32_t k = 0;
+			for (; k < j; ++k) {
+				if (keys[members[start[b] + j]].hash == keys[members[start[b] + k]].hash) {
+					result = Result_Fail;
+					break;
+				}
+			}
+		}
+		if (result != Result_Ok) {
+			break;
+		}
+
+		for (; d < _FROZEN_MAX_DISP; ++d) {
+			for (j = 0; j < size; ++j) {
+				slots[j] = _frozen_slot(keys[members[start[b] + j]].hash, d, n);
+				if (taken[slots[j] / 64] & ((uint64_t)1 << (slots[j] % 64))) {
+					break;
+				}
+				uint32_t k = 0;
+				for (; k < j && slots[k] != slots[j]; ++k)
+					;
+				if (k < j) {
+					break;
+				}
+			}
+			if (j == size) {
+				break;
+			}
+		}
+		if (d == _FROZEN_MAX_DISP) {
+			result = Result_Fail;
+			break;
+		}
+
+		disp[b] = d;
+		for (j = 0; j < size; ++j) {
+			taken[slots[j] / 64] |= (uint64_t)1 << (slots[j] % 64);
+			slot_of[members[start[b] + j]] = slots[j];
+		}
+	}
+
+	heap_free(slots);
+	heap_free(counts);
+	heap_free(by_size);
+	heap_free(fill);
+	heap_free(taken);
+	heap_free(members);
+	heap_free(start);
+	return result;
+}
@@ -0,0 +1,67 @@
+#ifndef FROZENMAP_H
+#define FROZENMAP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "map.h"
+
+/**
+ * Frozen_Map is an immutable copy of a finished Map or Set,
+ * placed with a minimal perfect hash (CHD: hash, displace and
+ * compress). Keys are grouped into buckets of about 4. Each
+ * bucket stores the displacement that sent all of its keys to
+ * free slots, so a lookup reads the bucket's displacement,
+ * then the slot's record offset, then the one record where
+ * key can be. There is no probing and no empty slot.
+ *
+ * A record is the key length, the value and the key bytes, so
+ * a hit usually touches a single cache line. The displacements,
+ * offsets and records share one allocation.
+ *
+ * Keys hash the same as in the source map: same hash__, seed
+ * and props.
+ */
+struct _Frozen {
+	uint8_t* _data;
+	const uint32_t* _disp;    /* per bucket */
+	const uint32_t* _offsets; /* per slot, in 8 byte units */
+	const uint8_t* _records;
+	size_t _buckets;
+	size_t size;
+	hash_fn hash__;
+	uint64_t seed;
+	unsigned props;
+	unsigned _elem_size;
+};
+
+#define Frozen_Map(T_)                                \
+	struct {                                      \
+		struct _Frozen _frozen;               \
+		T_* _type; /* never set, see typeof */ \
+	}
+typedef Frozen_Map(uint8_t) Frozen_Map;
+
+/**
+ * Build f from a Map or Set. The source is not changed and may
+ * be destroyed afterwards. Returns Result_Fail if no perfect
+ * hash is found, which takes two keys with the same 64 bit
+ * hash.
+ */
+int map_freeze_(void* f, const _Table*, const void* values, unsigned elem_size);
+#define map_freeze(F_, M_) \
+	map_freeze_(F_, &(M_)->_table, (M_)->values.data, vec_elem_size((M_)->values))
+#define set_freeze(F_, S_) map_freeze_(F_, &(S_)->_table, NULL, 0)
+
+void frozenmap_destroy(void*);
+
+/**
+ * Return NULL if no match or pointer to value. For a frozen
+ * Set, the pointer is only good for comparing to NULL.
+ */
+void* frozenmap_nget(const void*, const char* key, unsigned key_len);
+#define frozenmap_get(F_, KEY_)    frozenmap_nget(F_, KEY_, strlen(KEY_))
+#define frozenmap_nhas(F_, KEY_, KL_) (frozenmap_nget(F_, KEY_, KL_) != NULL)
+#define frozenmap_has(F_, KEY_)    (frozenmap_nget(F_, KEY_, strlen(KEY_)) != NULL)
+#define frozenmap_size(F_)         ((F_)->_frozen.size)
+
+#endif /* FROZENMAP_H */
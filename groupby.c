@@ -0,0 +1,247 @@
+#include "groupby.h"
+#include <stdio.h>
+#include <pthread.h>
+#include "util.h"
+
+struct _Groupby_Worker {
+	Group_By* g;
+	const char* const* keys;
+	const unsigned* lens;
+	const uint8_t* values;
+	size_t n;
+	combine_fn combine;
+	pthread_barrier_t* barrier;
+	unsigned* next_part;
+	unsigned tid;
+};
+
+void* _groupby_work(void*);
+void _groupby_fold(Map* dst, const Map* src, unsigned elem_size, combine_fn);
+unsigned _groupby_part_of(const Group_By*, uint64_t hash);
+uint64_t _groupby_hash(const Group_By*, const char* key, unsigned* n);
+
+
+void
+groupby_construct_(void* gen_g,
+                   const unsigned elem_size,
+                   unsigned threads,
+                   size_t limit,
+                   const unsigned props) {
+	Group_By* g = gen_g;
+	if (threads == 0) {
+		threads = 1;
+	}
+	g->_threads   = threads;
+	g->_elem_size = elem_size;
+
+	/* a few partitions per thread evens out the merge */
+	g->_part_bits = 0;
+	while (threads > 1 && (1U << g->_part_bits) < 4 * threads && g->_part_bits < 16) {
+		++g->_part_bits;
+	}
+	unsigned parts = 1U << g->_part_bits;
+
+	g->_parts  = heap_alloc(parts * sizeof(Map));
+	g->_locals = heap_alloc(((threads - 1) * parts + 1) * sizeof(Map));
+	unsigned i = 0;
+	for (; i < parts; ++i) {
+		map_construct_(&g->_parts[i], elem_size, limit / parts + 1, props);
+		/* one hash for every Map */
+		g->_parts[i]._table.seed = g->_parts[0]._table.seed;
+	}
+	for (i = 0; i < (threads - 1) * parts; ++i) {
+		map_construct_(&g->_locals[i], elem_size, limit / parts + 1, props);
+		g->_locals[i]._table.seed = g->_parts[0]._table.seed;
+	}
+}
+
+void
+groupby_destroy(void* gen_g) {
+	Group_By* g     = gen_g;
+	unsigned  parts = 1U << g->_part_bits;
+	unsigned  i     = 0;
+	for (; i < parts; ++i) {
+		map_destroy(&g->_parts[i]);
+	}
+	for (i = 0; i < (g->_threads - 1) * parts; ++i) {
+		map_destroy(&g->_locals[i]);
+	}
+	heap_free(g->_parts);
+	heap_free(g->_locals);
+}
+
+void
+groupby_clear(void* gen_g) {
+	Group_By* g = gen_g;
+	unsigned  i = 0;
+	for (; i < (1U << g->_part_bits); ++i) {
+		map_clear(&g->_parts[i]);
+	}
+}
+
+void
+groupby_run(void* gen_g,
+            const char* const* keys,
+            const unsigned* lens,
+            const void* values,
+            size_t n,
+            combine_fn combine) {
+	Group_By*              g         = gen_g;
+	unsigned               threads   = g->_threads;
+	unsigned               next_part = 0;
+	pthread_barrier_t      barrier;
+	struct _Groupby_Worker workers[threads];
+	pthread_t              ids[threads];
+
+	/* small runs are not worth starting threads for */
+	if (n < 1024 * (size_t)threads) {
+		threads = 1;
+	}
+	if (threads > 1) {
+		pthread_barrier_init(&barrier, NULL, threads);
+	}
+
+	unsigned i = 0;
+	for (; i < threads; ++i) {
+		workers[i] = (struct _Groupby_Worker) {
+		    .g         = g,
+		    .keys      = keys,
+		    .lens      = lens,
+		    .values    = values,
+		    .n         = n,
+		    .combine   = combine,
+		    .barrier   = (threads > 1) ? &barrier : NULL,
+		    .next_part = &next_part,
+		    .tid       = i,
+		};
+	}
+	for (i = 1; i < threads; ++i) {
+		int ret = pthread_create(&ids[i], NULL, _groupby_work, &workers[i]);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			abort();
+		}
+	}
+	_groupby_work(&workers[0]);
+	for (i = 1; i < threads; ++i) {
+		pthread_join(ids[i], NULL);
+	}
+
+	if (threads > 1) {
+		pthread_barrier_destroy(&barrier);
+	}
+}
+
+void*
+groupby_nget(const void* gen_g, const char* restrict key, unsigned n) {
+	const Group_By* g    = gen_g;
+	uint64_t        hash = _groupby_hash(g, key, &n);
+	const Map*      m    = &g->_parts[_groupby_part_of(g, hash)];
+	_Entry*         e    = _table_find(&m->_table, key, n, hash);
+	if (e->val_idx == _NONE) {
+		return NULL;
+	}
+	return vec_iter_at_(&m->values, e->val_idx, g->_elem_size);
+}
+
+size_t
+groupby_size(const void* gen_g) {
+	const Group_By* g    = gen_g;
+	size_t          size = 0;
+	unsigned        i    = 0;
+	for (; i < (1U << g->_part_bits); ++i) {
+		size += g->_parts[i]._table.size;
+	}
+	return size;
+}
+
+/* Internal */
+
+uint64_t
+_groupby_hash(const Group_By* g, const char* key, unsigned* n) {
+	const _Table* t = &g->_parts[0]._table;
+	return t->hash__(key, n, t->seed);
+}
+
+static inline uint64_t
+_groupby_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* mixed first, as _shard_of does */
+unsigned
+_groupby_part_of(const Group_By* g, uint64_t hash) {
+	if (g->_part_bits == 0) {
+		return 0;
+	}
+	return _groupby_mix(hash) >> (64 - g->_part_bits);
+}
+
+/* Every group of src folded into dst. Keeps src's hashes. */
+void
+_groupby_fold(Map* dst, const Map* src, unsigned elem_size, combine_fn combine) {
+	const _Table* t = &src->_table;
+	vec_int       i = 0;
+	for (; i < src->values.len; ++i) {
+		const _Entry*  e   = _rev_entry(t, i);
+		const char*    key = (const char*)_entry_key(t, e);
+		const uint8_t* val = vec_iter_at_(&src->values, i, elem_size);
+		map_idx        idx = _map_declare_hashed(dst, key, e->key_len, e->hash);
+		if (idx == _NONE) {
+			vec_push_back_(&dst->values, val, elem_size);
+		} else {
+			combine(vec_iter_at_(&dst->values, idx, elem_size), val);
+		}
+	}
+}
+
+/**
+ * Fold this thread's chunk into its Maps, wait for the others,
+ * then merge whole partitions until none are left.
+ */
+void*
+_groupby_work(void* arg) {
+	struct _Groupby_Worker* w         = arg;
+	Group_By*               g         = w->g;
+	unsigned                parts     = 1U << g->_part_bits;
+	unsigned                elem_size = g->_elem_size;
+	unsigned                threads   = (w->barrier) ? g->_threads : 1;
+	Map*                    maps      = (w->tid == 0) ? g->_parts
+	                                                  : &g->_locals[(w->tid - 1) * parts];
+
+	size_t i   = w->n * w->tid / threads;
+	size_t end = w->n * (w->tid + 1) / threads;
+	for (; i < end; ++i) {
+		unsigned       n    = (w->lens) ? w->lens[i] : strlen(w->keys[i]);
+		uint64_t       hash = _groupby_hash(g, w->keys[i], &n);
+		Map*           m    = &maps[_groupby_part_of(g, hash)];
+		const uint8_t* val  = &w->values[i * elem_size];
+		map_idx        idx  = _map_declare_hashed(m, w->keys[i], n, hash);
+		if (idx == _NONE) {
+			vec_push_back_(&m->values, val, elem_size);
+		} else {
+			w->combine(vec_iter_at_(&m->values, idx, elem_size), val);
+		}
+	}
+
+	if (threads == 1) {
+		return NULL;
+	}
+	pthread_barrier_wait(w->barrier);
+
+	unsigned part = 0;
+	while ((part = __atomic_fetch_add(w->next_part, 1, __ATOMIC_RELAXED)) < parts) {
+		unsigned t = 1;
+		for (; t < threads; ++t) {
+			Map* local = &g->_locals[(t - 1) * parts + part];
+			_groupby_fold(&g->_parts[part], local, elem_size, w->combine);
+			map_clear(local);
+		}
+	}
+	return NULL;
+}
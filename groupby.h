@@ -0,0 +1,84 @@
+#ifndef GROUPBY_H
+#define GROUPBY_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "map.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Group_By aggregates rows of (key, value) on several threads
+ * without sharing a Map between them. A key's partition is
+ * picked from the mixed hash, as in Shard_Map, so partitions
+ * never hold the same key.
+ *
+ * groupby_run splits the rows into one chunk per thread. Each
+ * thread folds its chunk into a Map per partition. Then the
+ * threads take partitions one at a time and fold every
+ * thread's Map for it into the result. Thread 0 folds its
+ * chunk straight into the result, so one thread costs no more
+ * than a single Map. Keys are hashed once, when first read.
+ *
+ * combine folds val into acc, the value already held for the
+ * key. A key's first value is copied in as is. combine runs
+ * on several threads at once, never for the same key.
+ */
+typedef void (*combine_fn)(void* acc, const void* val);
+
+#define Group_By(T_)                                             \
+	struct {                                                 \
+		Map* _parts;  /* the result, one Map per partition */ \
+		Map* _locals; /* [thread - 1][partition] */       \
+		T_* _type;    /* never set, see typeof */         \
+		unsigned _part_bits;                             \
+		unsigned _threads;                               \
+		unsigned _elem_size;                             \
+	}
+typedef Group_By(uint8_t) Group_By;
+
+/**
+ * threads is the number of threads a run uses, counting the
+ * caller. limit is the expected number of groups.
+ */
+void groupby_construct_(void*,
+                        const unsigned elem_size,
+                        unsigned threads,
+                        size_t limit,
+                        const unsigned props);
+#define groupby_construct(G_, THREADS_, LIMIT_, PROPS_) \
+	groupby_construct_(G_, sizeof(*(G_)->_type), THREADS_, LIMIT_, PROPS_)
+void groupby_destroy(void*);
+void groupby_clear(void*);
+
+/**
+ * Fold n rows into the groups. Row i is keys[i] and the value
+ * at values + i * elem_size. lens may be NULL for nul-terminated
+ * keys. Runs add to what earlier runs left.
+ */
+void groupby_run(void*,
+                 const char* const* keys,
+                 const unsigned* lens,
+                 const void* values,
+                 size_t n,
+                 combine_fn);
+
+/**
+ * Return NULL if no group or pointer to its value. Only call
+ * between runs.
+ */
+void* groupby_nget(const void*, const char* key, unsigned key_len);
+#define groupby_get(G_, KEY_) groupby_nget(G_, KEY_, strlen(KEY_))
+
+/**
+ * The result is groupby_parts Maps of disjoint keys. Read them
+ * like any other Map, for example from a thread each.
+ */
+#define groupby_parts(G_)   (1U << (G_)->_part_bits)
+#define groupby_part(G_, I_) (&(G_)->_parts[I_])
+size_t groupby_size(const void*);
+
+#endif /* GROUPBY_H */
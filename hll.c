@@ -0,0 +1,283 @@
+#include "hll.h"
+#include <stdio.h>
+#include <math.h>
+#include "util.h"
+
+/* register bits of a sparse pair */
+#define _HLL_SPARSE_P 25
+
+/* every sketch hashes with the same seed so they can merge */
+const uint64_t _HLL_SEED = 0;
+
+static inline uint64_t _hll_mix(uint64_t);
+static inline uint32_t _hll_pair(uint64_t hash);
+void _hll_add_pair(Hll*, uint32_t pair);
+void _hll_compact(Hll*);
+void _hll_densify(Hll*);
+size_t _hll_distinct_pairs(const uint32_t*, size_t n, uint32_t* out);
+double _hll_estimate(const size_t* counts, double m, unsigned q);
+
+
+void
+hll_construct(Hll* restrict h, unsigned precision, unsigned props) {
+	if (precision < HLL_PRECISION_MIN) {
+		precision = HLL_PRECISION_MIN;
+	}
+	if (precision > HLL_PRECISION_MAX) {
+		precision = HLL_PRECISION_MAX;
+	}
+	*h = (Hll) {
+	    .hash__    = _table_hash_fn(props),
+	    .precision = precision,
+	    .props     = props,
+	};
+	vec_construct(&h->_sparse);
+}
+
+void
+hll_destroy(Hll* restrict h) {
+	heap_free(h->_registers);
+	vec_destroy(&h->_sparse);
+}
+
+void
+hll_clear(Hll* restrict h) {
+	heap_free(h->_registers);
+	vec_clear(&h->_sparse);
+}
+
+void
+hll_nadd(Hll* restrict h, const char* restrict key, unsigned n) {
+	uint64_t hash = _hll_mix(h->hash__(key, &n, _HLL_SEED));
+	_hll_add_pair(h, _hll_pair(hash));
+}
+
+int
+hll_merge(Hll* restrict dst, const Hll* restrict src) {
+	if (dst->precision != src->precision || dst->props != src->props) {
+		fprintf(stderr, "hll_merge: sketches differ in precision or props\n");
+		return Result_Fail;
+	}
+
+	if (src->_registers == NULL) {
+		vec_int i = 0;
+		for (; i < src->_sparse.len; ++i) {
+			_hll_add_pair(dst, src->_sparse.data[i]);
+		}
+		return Result_Ok;
+	}
+
+	if (dst->_registers == NULL) {
+		_hll_densify(dst);
+	}
+	size_t m = (size_t)1 << dst->precision;
+	size_t i = 0;
+	for (; i < m; ++i) {
+		if (src->_registers[i] > dst->_registers[i]) {
+			dst->_registers[i] = src->_registers[i];
+		}
+	}
+	return Result_Ok;
+}
+
+double
+hll_count(const Hll* restrict h) {
+	size_t counts[64 + 2] = {0};
+
+	if (h->_registers != NULL) {
+		size_t m = (size_t)1 << h->precision;
+		size_t i = 0;
+		for (; i < m; ++i) {
+			++counts[h->_registers[i]];
+		}
+		return _hll_estimate(counts, m, 64 - h->precision);
+	}
+
+	/* sparse is a sketch with 2^25 registers, mostly zero */
+	uint32_t* pairs    = heap_alloc((h->_sparse.len + 1) * sizeof(*pairs));
+	size_t    distinct = _hll_distinct_pairs(h->_sparse.data, h->_sparse.len, pairs);
+	size_t    i        = 0;
+	for (; i < distinct; ++i) {
+		++counts[pairs[i] & 63];
+	}
+	counts[0] = ((size_t)1 << _HLL_SPARSE_P) - distinct;
+	heap_free(pairs);
+	return _hll_estimate(counts, (size_t)1 << _HLL_SPARSE_P, 64 - _HLL_SPARSE_P);
+}
+
+size_t
+hll_bytes(const Hll* restrict h) {
+	if (h->_registers != NULL) {
+		return (size_t)1 << h->precision;
+	}
+	return h->_sparse._cap * sizeof(uint32_t);
+}
+
+/* Internal */
+
+static inline uint64_t
+_hll_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Position of the first set bit in the top width bits of w, from 1 */
+static inline unsigned
+_hll_rank(uint64_t w, unsigned width) {
+	if (w == 0) {
+		return width + 1;
+	}
+	unsigned rank = __builtin_clzll(w) + 1;
+	return (rank > width) ? width + 1 : rank;
+}
+
+/* Top _HLL_SPARSE_P bits pick the register, the rest the rank */
+static inline uint32_t
+_hll_pair(uint64_t hash) {
+	uint32_t idx  = hash >> (64 - _HLL_SPARSE_P);
+	uint32_t rank = _hll_rank(hash << _HLL_SPARSE_P, 64 - _HLL_SPARSE_P);
+	return idx << 6 | rank;
+}
+
+/**
+ * The dense register and rank the hash behind pair would have
+ * had. Register bits past precision are the start of the rank.
+ */
+static inline void
+_hll_set_register(Hll* h, uint32_t pair) {
+	unsigned extra = _HLL_SPARSE_P - h->precision;
+	uint32_t idx   = pair >> 6;
+	uint32_t low   = idx & ((1U << extra) - 1);
+	unsigned rank  = extra + (pair & 63);
+	if (low != 0) {
+		rank = _hll_rank((uint64_t)low << (64 - extra), extra);
+	}
+	uint8_t* reg = &h->_registers[idx >> extra];
+	if (rank > *reg) {
+		*reg = rank;
+	}
+}
+
+/* sparse takes as many bytes as registers at this length */
+static inline size_t
+_hll_sparse_limit(const Hll* h) {
+	return ((size_t)1 << h->precision) / sizeof(uint32_t);
+}
+
+void
+_hll_add_pair(Hll* h, uint32_t pair) {
+	if (h->_registers != NULL) {
+		_hll_set_register(h, pair);
+		return;
+	}
+
+	*(uint32_t*)vec_add_one(&h->_sparse) = pair;
+	if ((size_t)h->_sparse.len < _hll_sparse_limit(h)) {
+		return;
+	}
+	_hll_compact(h);
+	/* keep room so compacting stays rare */
+	if ((size_t)h->_sparse.len > _hll_sparse_limit(h) / 2) {
+		_hll_densify(h);
+	}
+}
+
+static int
+_hll_cmp(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/* Sorted pairs, keeping the highest rank of each register */
+size_t
+_hll_distinct_pairs(const uint32_t* pairs, size_t n, uint32_t* out) {
+	if (n == 0) {
+		return 0;
+	}
+	memmove(out, pairs, n * sizeof(*pairs));
+	qsort(out, n, sizeof(*out), _hll_cmp);
+
+	size_t len = 0;
+	size_t i   = 0;
+	for (; i < n; ++i) {
+		if (i + 1 < n && out[i + 1] >> 6 == out[i] >> 6) {
+			continue;
+		}
+		out[len++] = out[i];
+	}
+	return len;
+}
+
+void
+_hll_compact(Hll* h) {
+	h->_sparse.len = _hll_distinct_pairs(h->_sparse.data, h->_sparse.len, h->_sparse.data);
+}
+
+void
+_hll_densify(Hll* h) {
+	size_t m      = (size_t)1 << h->precision;
+	h->_registers = heap_alloc(m);
+	memset(h->_registers, 0, m);
+
+	vec_int i = 0;
+	for (; i < h->_sparse.len; ++i) {
+		_hll_set_register(h, h->_sparse.data[i]);
+	}
+	vec_destroy(&h->_sparse);
+	vec_construct(&h->_sparse);
+}
+
+/* Ertl's sigma and tau, as series run until they stop changing */
+static double
+_hll_sigma(double x) {
+	if (x == 1) {
+		return INFINITY;
+	}
+	double y = 1;
+	double z = x;
+	double prev;
+	do {
+		x *= x;
+		prev = z;
+		z += x * y;
+		y += y;
+	} while (z != prev);
+	return z;
+}
+
+static double
+_hll_tau(double x) {
+	if (x == 0 || x == 1) {
+		return 0;
+	}
+	double y = 1;
+	double z = 1 - x;
+	double prev;
+	do {
+		x = sqrt(x);
+		prev = z;
+		y *= .5;
+		z -= (1 - x) * (1 - x) * y;
+	} while (z != prev);
+	return z / 3;
+}
+
+/**
+ * counts[k] is the number of registers holding k, for m
+ * registers that hold at most q + 1.
+ */
+double
+_hll_estimate(const size_t* counts, double m, unsigned q) {
+	double   z = m * _hll_tau(1 - counts[q + 1] / m);
+	unsigned k = q;
+	for (; k >= 1; --k) {
+		z = .5 * (z + counts[k]);
+	}
+	z += m * _hll_sigma(counts[0] / m);
+	return m * m / (2 * M_LN2) / z;
+}
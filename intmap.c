@@ -0,0 +1,219 @@
+#include "intmap.h"
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+/* Fibonacci hashing: 2^64 / golden ratio */
+const uint64_t _INT_FIB = 0x9e3779b97f4a7c15UL;
+
+/* No key bytes to compare, so probes are cheap; keep them short */
+const double _INT_FULL_PERCENT = .8;
+
+/* _rev holds 32 bit slot indices. Full, this keeps every value
+ * index below _INT_NONE. */
+const size_t _INT_MAX_LEN = (size_t)1 << 32;
+
+typedef Int_Map_(uint64_t, uint8_t) _Int_Map;
+
+void _int_table_construct(_Int_Table*, size_t len, unsigned key_size);
+void _int_table_grow(_Int_Table*);
+size_t _int_table_find(const _Int_Table*, uint64_t key);
+
+
+void
+intmap_construct_(void* gen_m, const unsigned elem_size, const unsigned key_size, size_t limit) {
+	_Int_Map* m   = gen_m;
+	size_t    len = 8;
+	while (len * _INT_FULL_PERCENT < limit) {
+		len *= 2;
+	}
+	_int_table_construct(&m->_table, len, key_size);
+	vec_construct_(&m->values, elem_size);
+	vec_reserve_(&m->values, limit, elem_size);
+	vec_construct(&m->_table._rev);
+	vec_reserve(&m->_table._rev, limit);
+}
+
+void
+intmap_destroy(void* gen_m) {
+	_Int_Map* m = gen_m;
+	heap_free(m->_table._slots);
+	vec_destroy(&m->_table._rev);
+	vec_destroy(&m->values);
+}
+
+void
+intmap_clear(void* gen_m) {
+	_Int_Map*   m = gen_m;
+	_Int_Table* t = &m->_table;
+	memset(t->_slots, -1, t->_len * t->_key_size * 2);
+	vec_clear(&t->_rev);
+	vec_clear(&m->values);
+	t->size = 0;
+}
+
+/* Internal */
+
+/* Slot accessors. ks is a constant wherever they are inlined */
+static inline uint64_t
+_slot_key(const _Int_Table* t, size_t i, unsigned ks) {
+	if (ks == 4) {
+		return ((const struct _Int_Slot32*)t->_slots)[i].key;
+	}
+	return ((const struct _Int_Slot64*)t->_slots)[i].key;
+}
+
+static inline uint32_t*
+_slot_val(const _Int_Table* t, size_t i, unsigned ks) {
+	if (ks == 4) {
+		return &((struct _Int_Slot32*)t->_slots)[i].val_idx;
+	}
+	return &((struct _Int_Slot64*)t->_slots)[i].val_idx;
+}
+
+static inline void
+_slot_set(_Int_Table* t, size_t i, uint64_t key, uint32_t val_idx, unsigned ks) {
+	if (ks == 4) {
+		((struct _Int_Slot32*)t->_slots)[i] = (struct _Int_Slot32) {key, val_idx};
+	} else {
+		((struct _Int_Slot64*)t->_slots)[i] = (struct _Int_Slot64) {key, val_idx};
+	}
+}
+
+static inline size_t
+_int_home(const _Int_Table* t, uint64_t key) {
+	return (size_t)((key * _INT_FIB) >> t->_shift);
+}
+
+/* Returns the slot holding key or the free slot it belongs in */
+static inline __attribute__((always_inline)) size_t
+_int_find(const _Int_Table* t, uint64_t key, unsigned ks) {
+	size_t mask = t->_len - 1;
+	size_t i    = _int_home(t, key);
+	for (;;) {
+		if (*_slot_val(t, i, ks) == _INT_NONE || _slot_key(t, i, ks) == key) {
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+size_t
+_int_table_find(const _Int_Table* t, uint64_t key) {
+	if (t->_key_size == 4) {
+		return _int_find(t, (uint32_t)key, 4);
+	}
+	return _int_find(t, key, 8);
+}
+
+void
+_int_table_construct(_Int_Table* t, size_t len, unsigned key_size) {
+	if (len > _INT_MAX_LEN) {
+		fputs("intmap: size past 32 bit value indices\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	t->_len      = len;
+	t->_key_size = key_size;
+	t->_shift    = 64 - __builtin_ctzl(len);
+	t->size      = 0;
+	t->_slots    = heap_alloc(len * key_size * 2);
+	memset(t->_slots, -1, len * key_size * 2);
+}
+
+/* Double the table. Slots are refilled in value order. */
+void
+_int_table_grow(_Int_Table* t) {
+	_Int_Table old = *t;
+	_int_table_construct(t, old._len * 2, old._key_size);
+	t->size = old.size;
+
+	unsigned ks = t->_key_size;
+	ssize_t  i  = 0;
+	for (; i < t->_rev.len; ++i) {
+		uint64_t key = _slot_key(&old, t->_rev.data[i], ks);
+		size_t   idx = _int_table_find(t, key);
+		_slot_set(t, idx, key, i, ks);
+		t->_rev.data[i] = idx;
+	}
+	heap_free(old._slots);
+}
+
+uint32_t
+_intmap_declare(void* gen_m, uint64_t key) {
+	_Int_Map*   m  = gen_m;
+	_Int_Table* t  = &m->_table;
+	unsigned    ks = t->_key_size;
+
+	if (t->size + 1 > t->_len * _INT_FULL_PERCENT) {
+		_int_table_grow(t);
+	}
+
+	size_t   idx     = _int_table_find(t, key);
+	uint32_t val_idx = *_slot_val(t, idx, ks);
+	if (val_idx != _INT_NONE) {
+		return val_idx;
+	}
+
+	/* new value at this point */
+	_slot_set(t, idx, key, t->_rev.len, ks);
+	*(uint32_t*)vec_add_one(&t->_rev) = idx;
+	++t->size;
+	return _INT_NONE;
+}
+
+void*
+intmap_get_(const void* gen_m, uint64_t key, unsigned elem_size) {
+	const _Int_Map* m       = gen_m;
+	size_t          idx     = _int_table_find(&m->_table, key);
+	uint32_t        val_idx = *_slot_val(&m->_table, idx, m->_table._key_size);
+
+	if (val_idx == _INT_NONE) {
+		return NULL;
+	}
+	return vec_iter_at_(&m->values, val_idx, elem_size);
+}
+
+bool
+intmap_remove_(void* gen_m, uint64_t key, unsigned elem_size) {
+	_Int_Map*   m    = gen_m;
+	_Int_Table* t    = &m->_table;
+	unsigned    ks   = t->_key_size;
+	size_t      mask = t->_len - 1;
+	size_t      i    = _int_table_find(t, key);
+
+	uint32_t idx = *_slot_val(t, i, ks);
+	if (idx == _INT_NONE) {
+		return false;
+	}
+
+	/* fill the hole in values with the last value */
+	uint32_t last = m->values.len - 1;
+	if (idx != last) {
+		vec_set_one_at_(&m->values, idx, vec_back_(&m->values, elem_size), elem_size);
+		*_slot_val(t, t->_rev.data[last], ks) = idx;
+		t->_rev.data[idx]                     = t->_rev.data[last];
+	}
+	--m->values.len;
+	--t->_rev.len;
+	--t->size;
+
+	/* backward shift so probes never need tombstones */
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		uint32_t next_val = *_slot_val(t, j, ks);
+		if (next_val == _INT_NONE) {
+			break;
+		}
+		/* j may move to i unless its home is cyclically in (i, j] */
+		uint64_t next_key = _slot_key(t, j, ks);
+		size_t   home     = _int_home(t, next_key);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			_slot_set(t, i, next_key, next_val, ks);
+			t->_rev.data[next_val] = i;
+			i                      = j;
+		}
+	}
+	*_slot_val(t, i, ks) = _INT_NONE;
+	return true;
+}
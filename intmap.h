@@ -0,0 +1,95 @@
+#ifndef INTMAP_H
+#define INTMAP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "map.h"
+
+/**
+ * Maps keyed by 32 or 64 bit integers. Keys live in the slot
+ * itself, so there is no key buffer, no byte hashing and no
+ * memcmp. A slot is just the key and its value's index: 8
+ * bytes for 32 bit keys and 16 for 64 bit keys. Keys are
+ * placed by Fibonacci hashing and linear probing.
+ *
+ * Values are kept dense in values like Map, including the
+ * move of the last value on remove. Value indices stay 32 bit
+ * under MAP_WIDE to keep slots small, so a map holds at most
+ * .8 * 2^32 keys. Past that it exits, as Vec does past
+ * VEC_INT_MAX.
+ */
+#define _INT_NONE ((uint32_t)-1)
+
+struct _Int_Slot32 {
+	uint32_t key;
+	uint32_t val_idx; /* _INT_NONE if free */
+};
+
+struct _Int_Slot64 {
+	uint64_t key;
+	uint32_t val_idx; /* _INT_NONE if free */
+};
+
+/* You should not touch it. */
+struct _Int_Table {
+	void* _slots;
+	size_t _len; /* power of 2 */
+	Vec(uint32_t) _rev; /* slot index of each value */
+	size_t size;
+	unsigned _shift; /* 64 - log2(_len) */
+	unsigned _key_size;
+};
+typedef struct _Int_Table _Int_Table;
+
+#define Int_Map_(K_, T_)                                    \
+	struct {                                            \
+		Vec(T_) values;                             \
+		_Int_Table _table;                          \
+		K_* _key; /* never set, only for sizeof */  \
+	}
+#define Int32_Map(T_) Int_Map_(uint32_t, T_)
+#define Int64_Map(T_) Int_Map_(uint64_t, T_)
+
+void intmap_construct_(void*, const unsigned elem_size, const unsigned key_size, size_t limit);
+#define intmap_construct(M_, LIMIT_) \
+	intmap_construct_(M_, vec_elem_size((M_)->values), sizeof(*(M_)->_key), LIMIT_)
+void intmap_destroy(void*);
+void intmap_clear(void*);
+
+/**
+ * declare key into map without adding data. This is
+ * just a helper function. You should not call it.
+ * Returns idx or _INT_NONE of sent key.
+ */
+uint32_t _intmap_declare(void*, uint64_t key);
+
+/**
+ * Add key + data pair to map
+ */
+#define intmap_set(M_, KEY_, ITEM_)                                 \
+	{                                                           \
+		uint32_t idx_ = _intmap_declare(M_, KEY_);          \
+		if (idx_ == _INT_NONE) {                            \
+			vec_push_back(&(M_)->values, ITEM_);        \
+		} else {                                            \
+			vec_set_one_at(&(M_)->values, idx_, ITEM_); \
+		}                                                   \
+	}
+
+/**
+ * Return NULL if no match or pointer to value. Like Map,
+ * lookups do not write, so they are safe from many threads.
+ */
+void* intmap_get_(const void*, uint64_t key, unsigned elem_size);
+#define intmap_get(M_, KEY_) intmap_get_(M_, KEY_, vec_elem_size((M_)->values))
+
+/**
+ * Remove key and its value. The last value is moved into the
+ * removed value's place. Returns false if key was not there.
+ */
+bool intmap_remove_(void*, uint64_t key, unsigned elem_size);
+#define intmap_remove(M_, KEY_) intmap_remove_(M_, KEY_, vec_elem_size((M_)->values))
+
+#define intmap_size(M_) ((M_)->_table.size)
+
+#endif /* INTMAP_H */
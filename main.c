@@ -1,8 +1,24 @@
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include <locale.h>
 #include "vec.h"
 #include "util.h"
 #include "map.h"
+#include "shardmap.h"
+#include "intmap.h"
+#include "frozenmap.h"
+#include "mapfile.h"
+#include "bloom.h"
+#include "hll.h"
+#include "topk.h"
+#include "groupby.h"
+#include "btree.h"
+#include "art.h"
+#include "cache.h"
+#include "shardcache.h"
 
 int one = 1;
 int two = 2;
@@ -28,10 +44,10 @@ void sets(Int_Map* m)
 	map_set(m, "test ", test_);
 }
 
-void test_map_basic()
+void test_map_basic(unsigned layout)
 {
 	Int_Map m;
-	map_construct(&m, 20, MAP_PROP_DEFAULT);
+	map_construct(&m, 20, MAP_PROP_DEFAULT | layout);
 
 	sets(&m);
 
@@ -56,10 +72,10 @@ void test_map_basic()
 	map_destroy(&m);
 }
 
-void test_map_nocase()
+void test_map_nocase(unsigned layout)
 {
 	Int_Map m;
-	map_construct(&m, 20, MAP_PROP_NOCASE);
+	map_construct(&m, 20, MAP_PROP_NOCASE | layout);
 
 	sets(&m);
 
@@ -81,13 +97,21 @@ void test_map_nocase()
 	void* no_match = map_get(&m, "no");
 	assert(no_match == NULL);
 
+	/* only ASCII folds, whatever the locale */
+	setlocale(LC_CTYPE, "");
+	map_set(&m, "\xc0LPHA", 1);
+	map_set(&m, "\xe0lpha", 2);
+	assert(*(int*)map_get(&m, "\xc0lpha") == 1);
+	assert(*(int*)map_get(&m, "\xe0LPHA") == 2);
+	setlocale(LC_CTYPE, "C");
+
 	map_destroy(&m);
 }
 
-void test_map_rtrim()
+void test_map_rtrim(unsigned layout)
 {
 	Int_Map m;
-	map_construct(&m, 20, MAP_PROP_RTRIM);
+	map_construct(&m, 20, MAP_PROP_RTRIM | layout);
 
 	sets(&m);
 	
@@ -112,10 +136,10 @@ void test_map_rtrim()
 	map_destroy(&m);
 }
 
-void test_map_nocase_rtrim()
+void test_map_nocase_rtrim(unsigned layout)
 {
 	Int_Map m;
-	map_construct(&m, 20, MAP_PROP_RTRIM | MAP_PROP_NOCASE);
+	map_construct(&m, 20, MAP_PROP_RTRIM | MAP_PROP_NOCASE | layout);
 
 	sets(&m);
 	
@@ -140,10 +164,1895 @@ void test_map_nocase_rtrim()
 	map_destroy(&m);
 }
 
+void test_map_grow(unsigned layout)
+{
+	Int_Map m;
+	map_construct(&m, 2, layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		map_set(&m, key, i);
+	}
+	assert(m.values.len == 10000);
+	for (i = 0; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		int* val = map_get(&m, key);
+		assert(val && *val == i);
+	}
+	assert(map_get(&m, "key10000") == NULL);
+
+	map_destroy(&m);
+}
+
+/* key number c of length len, distinct for each (len, c) */
+int inline_key(char* key, int len, int c, bool upper)
+{
+	int copies = (len == 0) ? 1 : (len == 1) ? 26 : 50;
+	int i = 0;
+	for (; i < len; ++i) {
+		int letter = (i == 0) ? c % 26 : (i == 1) ? c / 26 : i % 26;
+		key[i] = (upper ? 'A' : 'a') + letter;
+	}
+	return copies;
+}
+
+void test_map_inline_keys(unsigned layout)
+{
+	/* every key length around MAP_INLINE_KEY, NOCASE folded */
+	enum { LONGEST = MAP_INLINE_KEY * 3 + 5 };
+	char key[LONGEST + 1];
+	Int_Map m;
+	map_construct(&m, 2, MAP_PROP_NOCASE | layout);
+
+	size_t long_bytes = 0;
+	int len = 0;
+	for (; len <= LONGEST; ++len) {
+		int c = 0;
+		for (; c < inline_key(key, len, c, true); ++c) {
+			map_nset(&m, key, len, len * 100 + c);
+			long_bytes += (len > MAP_INLINE_KEY) ? len : 0;
+		}
+	}
+	assert(m._table._keybuf_head == long_bytes);
+
+	for (len = 0; len <= LONGEST; ++len) {
+		int c = 0;
+		for (; c < inline_key(key, len, c, false); ++c) {
+			int* val = map_nget(&m, key, len);
+			assert(val && *val == len * 100 + c);
+			_Entry* e = _rev_entry(&m._table, val - m.values.data);
+			assert(e->key_len == (unsigned)len);
+			assert(memcmp(_entry_key(&m._table, e), key, len) == 0);
+			/* one byte more must miss */
+			key[len] = '#';
+			assert(map_nget(&m, key, len + 1) == NULL);
+		}
+	}
+
+	/* removing inline keys leaves the key buffer alone */
+	for (len = 0; len <= MAP_INLINE_KEY; ++len) {
+		inline_key(key, len, 0, false);
+		assert(map_nremove(&m, key, len));
+		assert(map_nget(&m, key, len) == NULL);
+	}
+	assert(m._table._keybuf_head - m._table._keybuf_waste == long_bytes);
+	inline_key(key, LONGEST, 0, false);
+	assert(map_nremove(&m, key, LONGEST));
+	assert(m._table._keybuf_head - m._table._keybuf_waste == long_bytes - LONGEST);
+
+	map_destroy(&m);
+}
+
+void test_set(unsigned layout)
+{
+	Set s;
+	set_construct(&s, 2, MAP_PROP_NOCASE | layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 1000; ++i) {
+		sprintf(key, "Key%d", i);
+		set_add(&s, key);
+		set_add(&s, key);
+	}
+	assert(set_size(&s) == 1000);
+	for (i = 0; i < 1000; ++i) {
+		sprintf(key, "kEY%d", i);
+		assert(set_has(&s, key));
+	}
+	assert(!set_has(&s, "key1000"));
+
+	set_clear(&s);
+	assert(set_size(&s) == 0);
+	assert(!set_has(&s, "key0"));
+
+	set_destroy(&s);
+}
+
+/* a holds even numbers below 30000, b multiples of 3 below 60000 */
+void set_algebra_fill(Set* a, Set* b, unsigned layout, unsigned b_layout)
+{
+	set_construct(a, 16, MAP_PROP_NOCASE | layout);
+	set_construct(b, 16, MAP_PROP_NOCASE | b_layout);
+	char key[32];
+	int i = 0;
+	for (; i < 60000; ++i) {
+		sprintf(key, (i % 4) ? "Key%d" : "KEY%d", i);
+		if (i % 2 == 0 && i < 30000) {
+			set_add(a, key);
+		}
+		if (i % 3 == 0) {
+			set_add(b, key);
+		}
+	}
+}
+
+/* op: 0 union, 1 intersect, 2 difference */
+void set_algebra_check(const Set* s, int op)
+{
+	char key[32];
+	size_t size = 0;
+	int i = 0;
+	for (; i < 60000; ++i) {
+		bool in_a = i % 2 == 0 && i < 30000;
+		bool in_b = i % 3 == 0;
+		bool want = (op == 0) ? in_a || in_b : (op == 1) ? in_a && in_b : in_a && !in_b;
+		sprintf(key, "key%d", i);
+		assert(set_has(s, key) == want);
+		size += want;
+	}
+	assert(set_size(s) == size);
+}
+
+void test_set_algebra(unsigned layout)
+{
+	int (*ops[])(Set*, const Set*, const Set*, unsigned) = {
+		set_union,
+		set_intersect,
+		set_difference,
+	};
+	/* b alike, then hashing differently so hashes can not carry */
+	unsigned b_layouts[] = {layout, layout ^ MAP_PROP_FASTHASH};
+	unsigned threads[] = {1, 4};
+	unsigned l = 0;
+	for (; l < 2; ++l) {
+		unsigned t = 0;
+		for (; t < 2; ++t) {
+			int op = 0;
+			for (; op < 3; ++op) {
+				Set a, b, dst;
+				set_algebra_fill(&a, &b, layout, b_layouts[l]);
+				assert(ops[op](&dst, &a, &b, threads[t]) == Result_Ok);
+				set_algebra_check(&dst, op);
+				set_destroy(&dst);
+
+				/* in place, either side */
+				set_filter(&a, .01);
+				assert(ops[op](&a, &a, &b, threads[t]) == Result_Ok);
+				set_algebra_check(&a, op);
+				set_destroy(&a);
+				set_destroy(&b);
+
+				set_algebra_fill(&a, &b, layout, b_layouts[l]);
+				assert(ops[op](&b, &a, &b, threads[t]) == Result_Ok);
+				set_algebra_check(&b, op);
+				set_destroy(&a);
+				set_destroy(&b);
+			}
+		}
+	}
+
+	Set a, b, dst;
+	set_construct(&a, 16, MAP_PROP_NOCASE | layout);
+	set_construct(&b, 16, layout);
+	assert(set_union(&dst, &a, &b, 1) == Result_Fail);
+	set_destroy(&a);
+	set_destroy(&b);
+}
+
+void test_map_remove(unsigned layout)
+{
+	Int_Map m;
+	map_construct(&m, 2, MAP_PROP_RTRIM | layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		map_set(&m, key, i);
+	}
+	assert(!map_remove(&m, "nope"));
+	for (i = 0; i < 10000; i += 2) {
+		sprintf(key, "key%d  ", i);
+		assert(map_remove(&m, key));
+	}
+	assert(m.values.len == 5000);
+	for (i = 0; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		int* val = map_get(&m, key);
+		if (i % 2) {
+			assert(val && *val == i);
+		} else {
+			assert(val == NULL);
+		}
+	}
+
+	/* churn at a steady size against a reference */
+	static bool present[2000];
+	memset(present, 0, sizeof(present));
+	map_clear(&m);
+	uint64_t rng = 7;
+	for (i = 0; i < 200000; ++i) {
+		rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+		int k = (rng >> 33) % 2000;
+		sprintf(key, "churn%d", k);
+		if (present[k]) {
+			assert(map_remove(&m, key));
+		} else {
+			map_set(&m, key, k);
+		}
+		present[k] = !present[k];
+	}
+	int count = 0;
+	for (i = 0; i < 2000; ++i) {
+		sprintf(key, "churn%d", i);
+		int* val = map_get(&m, key);
+		assert(present[i] == (val != NULL));
+		assert(!val || *val == i);
+		count += present[i];
+	}
+	assert(m.values.len == count);
+	assert(m._table._keybuf_head - m._table._keybuf_waste < 2000 * 10);
+
+	/* remove while an incremental grow is half way */
+	static bool removed[4000];
+	memset(removed, 0, sizeof(removed));
+	map_clear(&m);
+	for (i = 0; i < 4000; ++i) {
+		sprintf(key, "mid%d", i);
+		map_set(&m, key, i);
+		if (i % 3 == 0) {
+			sprintf(key, "mid%d", i / 2);
+			assert(map_remove(&m, key) != removed[i / 2]);
+			removed[i / 2] = true;
+		}
+	}
+	for (i = 0; i < 4000; ++i) {
+		sprintf(key, "mid%d", i);
+		int* val = map_get(&m, key);
+		assert(removed[i] == (val == NULL));
+		assert(!val || *val == i);
+	}
+
+	map_destroy(&m);
+
+	Set s;
+	set_construct(&s, 2, layout);
+	set_add(&s, "a");
+	set_add(&s, "b");
+	assert(set_remove(&s, "a"));
+	assert(!set_remove(&s, "a"));
+	assert(!set_has(&s, "a"));
+	assert(set_has(&s, "b"));
+	assert(set_size(&s) == 1);
+	set_destroy(&s);
+}
+
+void* readonly_reader(void* arg)
+{
+	const Int_Map* m = arg;
+	char key[32];
+	int i = 0;
+	for (; i < 1000; ++i) {
+		sprintf(key, "KEY%d   ", i);
+		const int* val = map_get(m, key);
+		assert(val && *val == i);
+	}
+	return NULL;
+}
+
+/* long and short keys, so both kinds of key storage are moved */
+void compact_key(char* key, int i)
+{
+	sprintf(key, (i % 2) ? "c%d" : "compact key %d", i);
+}
+
+void test_map_compact(unsigned layout)
+{
+	enum { KEYS = 20000 };
+	static bool present[KEYS * 2];
+	memset(present, 0, sizeof(present));
+	char key[32];
+	Int_Map m;
+	map_construct(&m, 2, layout);
+
+	int i = 0;
+	for (; i < KEYS; ++i) {
+		compact_key(key, i);
+		map_set(&m, key, i);
+		present[i] = true;
+	}
+	size_t big_slots = m._table._entries.len;
+	for (i = 0; i < KEYS; ++i) {
+		if (i % 10 != 0) {
+			compact_key(key, i);
+			assert(map_remove(&m, key));
+			present[i] = false;
+		}
+	}
+
+	/* a few slots at a time, with inserts and removes in between */
+	int calls = 0;
+	for (; !map_compact(&m, 64); ++calls) {
+		if (calls % 4 == 0) {
+			compact_key(key, KEYS + calls);
+			map_set(&m, key, KEYS + calls);
+			present[KEYS + calls] = true;
+		}
+		if (calls % 4 == 2) {
+			compact_key(key, calls * 10);
+			assert(map_remove(&m, key) == present[calls * 10]);
+			present[calls * 10] = false;
+		}
+	}
+	assert(calls > 10);
+	assert(map_compact(&m, 64));
+
+	size_t key_bytes = 0;
+	int count = 0;
+	for (i = 0; i < KEYS * 2; ++i) {
+		compact_key(key, i);
+		int* val = map_get(&m, key);
+		assert(present[i] == (val != NULL));
+		assert(!val || *val == i);
+		count += present[i];
+		key_bytes += (present[i] && strlen(key) > MAP_INLINE_KEY) ? strlen(key) : 0;
+	}
+	assert(m.values.len == count);
+	assert((size_t)m._table._entries.len * 4 <= big_slots);
+	/* removes during the compaction may have left some waste */
+	assert(m._table._keybuf_head - m._table._keybuf_waste == key_bytes);
+
+	/* everything back after a clear */
+	map_clear(&m);
+	map_shrink_to_fit(&m);
+	assert(m._table._entries.len <= _GROUP_WIDTH);
+	assert(m.values._cap == 1);
+	map_set(&m, "again", 1);
+	assert(*(int*)map_get(&m, "again") == 1);
+
+	/* reserve up front and the table is never moved */
+	map_reserve(&m, KEYS);
+	_Entry* entries = m._table._entries.data;
+	for (i = 0; i < KEYS; ++i) {
+		compact_key(key, i);
+		map_set(&m, key, i);
+	}
+	assert(m._table._entries.data == entries);
+	assert(*(int*)map_get(&m, "c19999") == 19999);
+	map_destroy(&m);
+
+	Set s;
+	set_construct(&s, 2, layout);
+	for (i = 0; i < KEYS; ++i) {
+		compact_key(key, i);
+		set_add(&s, key);
+	}
+	for (i = 0; i < KEYS - 10; ++i) {
+		compact_key(key, i);
+		assert(set_remove(&s, key));
+	}
+	set_shrink_to_fit(&s);
+	assert(set_size(&s) == 10);
+	assert(s._table._entries.len <= _GROUP_WIDTH);
+	for (i = 0; i < KEYS; ++i) {
+		compact_key(key, i);
+		assert(set_has(&s, key) == (i >= KEYS - 10));
+	}
+	set_destroy(&s);
+}
+
+struct iter_sums {
+	long sum[64];
+	int count[64];
+};
+
+void iter_scan_fn(Map_Iter* it, unsigned range, void* data)
+{
+	struct iter_sums* sums = data;
+	char key[32];
+	int* val = NULL;
+	while ((val = map_iter_next(it)) != NULL) {
+		compact_key(key, *val);
+		assert(it->key_len == strlen(key) && memcmp(it->key, key, it->key_len) == 0);
+		sums->sum[range] += *val;
+		++sums->count[range];
+		*val += 1000000;
+	}
+}
+
+/* data counts the times each value is seen */
+void iter_count_fn(Map_Iter* it, unsigned range, void* data)
+{
+	(void)range;
+	int* seen = data;
+	int* val = NULL;
+	while ((val = map_iter_next(it)) != NULL) {
+		++seen[*val];
+	}
+}
+
+void test_map_iter(unsigned layout)
+{
+	enum { KEYS = 20000 };
+	char key[32];
+	Int_Map m;
+	map_construct(&m, 2, layout);
+
+	int i = 0;
+	for (; i < KEYS; ++i) {
+		compact_key(key, i);
+		map_set(&m, key, i);
+	}
+
+	/* insertion order while nothing is removed */
+	Map_Iter it = map_iter(&m);
+	int* val = NULL;
+	for (i = 0; (val = map_iter_next(&it)) != NULL; ++i) {
+		compact_key(key, i);
+		assert(*val == i && it.idx == (map_idx)i);
+		assert(it.key_len == strlen(key) && memcmp(it.key, key, it.key_len) == 0);
+	}
+	assert(i == KEYS);
+	assert(map_iter_next(&it) == NULL);
+
+	it = map_iter_range(&m, 100, 110);
+	for (i = 100; (val = map_iter_next(&it)) != NULL; ++i) {
+		assert(*val == i);
+	}
+	assert(i == 110);
+
+	/* after removes, and part way through a compaction */
+	for (i = 0; i < KEYS; i += 3) {
+		compact_key(key, i);
+		assert(map_remove(&m, key));
+	}
+	int calls = 0;
+	for (; calls < 2; ++calls) {
+		int count = 0;
+		it = map_iter(&m);
+		while ((val = map_iter_next(&it)) != NULL) {
+			compact_key(key, *val);
+			assert(*val % 3 != 0);
+			assert(it.key_len == strlen(key) && memcmp(it.key, key, it.key_len) == 0);
+			assert(map_get(&m, key) == val);
+			++count;
+		}
+		assert(count == m.values.len);
+		map_compact(&m, 64);
+	}
+
+	/* ranges on threads, writing to their own values */
+	struct iter_sums sums = {{0}, {0}};
+	unsigned ranges = map_scan(&m, 3, iter_scan_fn, &sums);
+	assert(ranges == 3);
+	long sum = 0;
+	int count = 0;
+	unsigned r = 0;
+	for (; r < ranges; ++r) {
+		assert(sums.count[r] > 0);
+		sum += sums.sum[r];
+		count += sums.count[r];
+	}
+	assert(count == m.values.len);
+	for (i = 0; i < KEYS; ++i) {
+		compact_key(key, i);
+		val = map_get(&m, key);
+		assert((val != NULL) == (i % 3 != 0));
+		assert(!val || *val == i + 1000000);
+		sum -= (val) ? i : 0;
+	}
+	assert(sum == 0);
+
+	/* a length that is no multiple of threads * 64 */
+	enum { ODD = 8193 };
+	static int seen[ODD];
+	memset(seen, 0, sizeof(seen));
+	map_clear(&m);
+	for (i = 0; i < ODD; ++i) {
+		compact_key(key, i);
+		map_set(&m, key, i);
+	}
+	assert(map_scan(&m, 2, iter_count_fn, seen) == 2);
+	for (i = 0; i < ODD; ++i) {
+		assert(seen[i] == 1);
+	}
+
+	/* small maps stay on the calling thread */
+	map_clear(&m);
+	compact_key(key, 7);
+	map_set(&m, key, 7);
+	memset(&sums, 0, sizeof(sums));
+	assert(map_scan(&m, 4, iter_scan_fn, &sums) == 1);
+	assert(sums.count[0] == 1);
+	map_destroy(&m);
+
+	Set s;
+	set_construct(&s, 2, layout);
+	Set_Iter si = set_iter(&s);
+	assert(set_iter_next(&si) == NULL);
+	for (i = 0; i < KEYS; ++i) {
+		compact_key(key, i);
+		set_add(&s, key);
+	}
+	for (i = 0; i < KEYS; i += 2) {
+		compact_key(key, i);
+		assert(set_remove(&s, key));
+	}
+	for (calls = 0; calls < 2; ++calls) {
+		Set seen;
+		set_construct(&seen, 2, MAP_PROP_DEFAULT);
+		si = set_iter(&s);
+		while (set_iter_next(&si) != NULL) {
+			assert(set_nhas(&s, si.key, si.key_len));
+			assert(!set_nhas(&seen, si.key, si.key_len));
+			set_nadd(&seen, si.key, si.key_len);
+		}
+		assert(set_size(&seen) == set_size(&s));
+		set_destroy(&seen);
+		set_compact(&s, 64);
+	}
+	set_destroy(&s);
+}
+
+void test_map_batch(unsigned layout)
+{
+	Int_Map m;
+	Set s;
+	map_construct(&m, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+	set_construct(&s, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+
+	char buf[100][32];
+	const char* keys[100];
+	unsigned lens[100];
+	int i = 0;
+	for (; i < 100; ++i) {
+		if (i % 3 == 0) {
+			sprintf(buf[i], "key%d", i);
+			map_set(&m, buf[i], i);
+			set_add(&s, buf[i]);
+		}
+		/* look up with different case and trailing spaces */
+		sprintf(buf[i], "KEY%d  ", i);
+		keys[i] = buf[i];
+		lens[i] = strlen(buf[i]);
+	}
+
+	int* vals[100];
+	uint64_t hits[2];
+	assert(map_nget_batch(&m, keys, lens, 100, vals) == 34);
+	assert(set_nhas_batch(&s, keys, NULL, 100, hits) == 34);
+	for (i = 0; i < 100; ++i) {
+		assert(vals[i] == map_get(&m, keys[i]));
+		assert((vals[i] != NULL) == (i % 3 == 0));
+		assert(vals[i] == NULL || *vals[i] == i);
+		assert(!!(hits[i / 64] & ((uint64_t)1 << (i % 64))) == (i % 3 == 0));
+	}
+
+	map_destroy(&m);
+	set_destroy(&s);
+}
+
+void test_map_readonly(unsigned layout)
+{
+	Int_Map m;
+	map_construct(&m, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 1000; ++i) {
+		sprintf(key, "key%d", i);
+		map_set(&m, key, i);
+	}
+
+	/* misses with long keys must not grow or write the key buffer */
+	Byte_Slice keybuf = m._table._keybuf;
+	size_t head = m._table._keybuf_head;
+	char long_key[4096];
+	memset(long_key, 'x', sizeof(long_key));
+	assert(map_nget(&m, long_key, sizeof(long_key)) == NULL);
+	assert(m._table._keybuf.data == keybuf.data);
+	assert(m._table._keybuf.len == keybuf.len);
+	assert(m._table._keybuf_head == head);
+
+	pthread_t readers[4];
+	for (i = 0; i < 4; ++i) {
+		pthread_create(&readers[i], NULL, readonly_reader, &m);
+	}
+	for (i = 0; i < 4; ++i) {
+		pthread_join(readers[i], NULL);
+	}
+
+	map_destroy(&m);
+}
+
+typedef Shard_Map(int) Int_Shard_Map;
+typedef Shard_Cache(int) Int_Shard_Cache;
+
+struct shard_worker {
+	Int_Shard_Map* m;
+	int id;
+	int inserted;
+};
+
+void* shardmap_worker(void* arg)
+{
+	struct shard_worker* w = arg;
+	char key[32];
+	int i = 0;
+	for (; i < 2000; ++i) {
+		/* every worker races on the same keys */
+		sprintf(key, "key%d", i);
+		int val = -1;
+		if (shardmap_get_or_insert(w->m, key, w->id * 10000 + i, &val)) {
+			++w->inserted;
+		}
+		assert(val % 10000 == i);
+		assert(shardmap_get(w->m, key, &val));
+		assert(val % 10000 == i);
+	}
+	return NULL;
+}
+
+void test_shardmap(unsigned layout)
+{
+	Int_Shard_Map m;
+	shardmap_construct(&m, 8, 16, MAP_PROP_NOCASE | layout);
+
+	struct shard_worker workers[4];
+	pthread_t threads[4];
+	int i = 0;
+	for (; i < 4; ++i) {
+		workers[i] = (struct shard_worker) {&m, i, 0};
+		pthread_create(&threads[i], NULL, shardmap_worker, &workers[i]);
+	}
+	int inserted = 0;
+	for (i = 0; i < 4; ++i) {
+		pthread_join(threads[i], NULL);
+		inserted += workers[i].inserted;
+	}
+	/* each key was inserted by exactly one worker */
+	assert(inserted == 2000);
+	assert(shardmap_size(&m) == 2000);
+
+	int val = 0;
+	assert(shardmap_get(&m, "KEY7", &val));
+	assert(val % 10000 == 7);
+	assert(!shardmap_get(&m, "key2000", NULL));
+
+	shardmap_set(&m, "key7", 42);
+	assert(shardmap_get(&m, "key7", &val));
+	assert(val == 42);
+	assert(!shardmap_get_or_insert(&m, "key7", 0, &val));
+	assert(val == 42);
+
+	assert(shardmap_remove(&m, "key7"));
+	assert(!shardmap_remove(&m, "key7"));
+	assert(!shardmap_get(&m, "key7", NULL));
+	assert(shardmap_size(&m) == 1999);
+
+	shardmap_clear(&m);
+	assert(shardmap_size(&m) == 0);
+
+	/* keys differing only in the last bytes still spread out */
+	char key[16];
+	for (i = 0; i < 256; ++i) {
+		sprintf(key, "k%d", i);
+		shardmap_set(&m, key, i);
+	}
+	for (i = 0; i < 8; ++i) {
+		size_t size = m._shards[i].map._table.size;
+		assert(size > 8 && size < 64);
+	}
+	shardmap_destroy(&m);
+}
+
+void test_intmap()
+{
+	Int64_Map(int) m;
+	Int32_Map(int) m32;
+	intmap_construct(&m, 2);
+	intmap_construct(&m32, 2);
+
+	/* spread the ids out and include the extremes */
+	uint64_t i = 0;
+	for (; i < 10000; ++i) {
+		intmap_set(&m, i * 0x9e3779b97f4a7c15UL, (int)i);
+		intmap_set(&m32, (uint32_t)(i * 2654435761U), (int)i);
+	}
+	intmap_set(&m, UINT64_MAX, -1);
+	intmap_set(&m, 0, -2); /* i == 0 above */
+	assert(intmap_size(&m) == 10001);
+	assert(intmap_size(&m32) == 10000);
+
+	for (i = 1; i < 10000; ++i) {
+		int* val = intmap_get(&m, i * 0x9e3779b97f4a7c15UL);
+		assert(val && *val == (int)i);
+		val = intmap_get(&m32, (uint32_t)(i * 2654435761U));
+		assert(val && *val == (int)i);
+	}
+	assert(*(int*)intmap_get(&m, UINT64_MAX) == -1);
+	assert(*(int*)intmap_get(&m, 0) == -2);
+	assert(intmap_get(&m, 12345) == NULL);
+
+	/* only the low 32 bits count for a 32 bit map */
+	assert(intmap_get(&m32, ((uint64_t)1 << 32) | 2654435761U) != NULL);
+
+	for (i = 0; i < 10000; i += 2) {
+		assert(intmap_remove(&m, i * 0x9e3779b97f4a7c15UL));
+		assert(!intmap_remove(&m, i * 0x9e3779b97f4a7c15UL));
+		assert(intmap_remove(&m32, (uint32_t)(i * 2654435761U)));
+	}
+	assert(intmap_size(&m) == 5001);
+	assert(m.values.len == 5001);
+	for (i = 0; i < 10000; ++i) {
+		int* val = intmap_get(&m, i * 0x9e3779b97f4a7c15UL);
+		assert((i % 2) ? (val && *val == (int)i) : val == NULL);
+		val = intmap_get(&m32, (uint32_t)(i * 2654435761U));
+		assert((i % 2) ? (val && *val == (int)i) : val == NULL);
+	}
+	assert(*(int*)intmap_get(&m, UINT64_MAX) == -1);
+
+	intmap_clear(&m);
+	assert(intmap_size(&m) == 0);
+	assert(intmap_get(&m, UINT64_MAX) == NULL);
+	intmap_set(&m, 7, 7);
+	assert(*(int*)intmap_get(&m, 7) == 7);
+
+	intmap_destroy(&m);
+	intmap_destroy(&m32);
+}
+
+void test_multimap(unsigned layout)
+{
+	Multimap(int) m;
+	multimap_construct(&m, 2, MAP_PROP_NOCASE | layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 7000; ++i) {
+		sprintf(key, "key%d", i % 7);
+		multimap_set(&m, key, i);
+	}
+	multimap_set(&m, "ONE", 1);
+	assert(multimap_size(&m) == 8);
+
+	for (i = 0; i < 7; ++i) {
+		sprintf(key, "KEY%d", i);
+		Multimap_Iter it = multimap_get(&m, key);
+		assert(it.count == 1000);
+
+		/* values come back in insertion order */
+		int expect = i;
+		int* val = NULL;
+		while ((val = multimap_iter_next(&it))) {
+			assert(*val == expect);
+			expect += 7;
+		}
+		assert(expect == i + 7000);
+
+		it = multimap_get(&m, key);
+		expect = i;
+		unsigned len = 0;
+		unsigned runs = 0;
+		while ((val = multimap_iter_run(&it, &len))) {
+			unsigned j = 0;
+			for (; j < len; ++j, expect += 7) {
+				assert(val[j] == expect);
+			}
+			++runs;
+		}
+		assert(expect == i + 7000);
+		assert(runs < 10);
+	}
+
+	Multimap_Iter it = multimap_get(&m, "one");
+	assert(it.count == 1);
+	assert(*(int*)multimap_iter_next(&it) == 1);
+	assert(multimap_iter_next(&it) == NULL);
+
+	it = multimap_get(&m, "missing");
+	assert(it.count == 0);
+	assert(multimap_iter_next(&it) == NULL);
+
+	multimap_clear(&m);
+	assert(multimap_size(&m) == 0);
+	multimap_set(&m, "a", 3);
+	it = multimap_get(&m, "a");
+	assert(it.count == 1 && *(int*)multimap_iter_next(&it) == 3);
+
+	multimap_destroy(&m);
+}
+
+typedef Vec(Const_Char_Slice) Field_Vec;
+
+void test_compositemap(unsigned layout)
+{
+	Compositemap(int) m;
+	compositemap_construct(&m, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+
+	Const_Char_Slice ab_c[] = {{"ab", 2}, {"c", 1}};
+	Const_Char_Slice a_bc[] = {{"a", 1}, {"bc", 2}};
+	Const_Char_Slice padded[] = {{"AB  ", 4}, {"C ", 2}};
+	Const_Char_Slice abc[] = {{"abc", 3}};
+	Const_Char_Slice none[1];
+
+	compositemap_nset(&m, ab_c, 2, 1);
+	compositemap_nset(&m, a_bc, 2, 2);
+	compositemap_nset(&m, abc, 1, 3);
+	compositemap_nset(&m, none, 0, 4);
+	assert(m._table.size == 4);
+
+	assert(*(int*)compositemap_nget(&m, ab_c, 2) == 1);
+	assert(*(int*)compositemap_nget(&m, a_bc, 2) == 2);
+	assert(*(int*)compositemap_nget(&m, abc, 1) == 3);
+	assert(*(int*)compositemap_nget(&m, none, 0) == 4);
+
+	/* case and trailing spaces are per field */
+	assert(*(int*)compositemap_nget(&m, padded, 2) == 1);
+	compositemap_nset(&m, padded, 2, 5);
+	assert(*(int*)compositemap_nget(&m, ab_c, 2) == 5);
+	assert(m._table.size == 4);
+
+	Field_Vec key;
+	vec_construct(&key);
+	char buf[3][32];
+	int i = 0;
+	for (; i < 1000; ++i) {
+		vec_clear(&key);
+		sprintf(buf[0], "%d", i);
+		sprintf(buf[1], "x%d", i % 10);
+		sprintf(buf[2], "%s", (i % 2) ? "odd" : "even");
+		int j = 0;
+		for (; j < 3; ++j) {
+			Const_Char_Slice field = {buf[j], strlen(buf[j])};
+			vec_push_back(&key, field);
+		}
+		compositemap_set(&m, &key, i);
+	}
+	assert(m._table.size == 1004);
+	for (i = 0; i < 1000; ++i) {
+		sprintf(buf[0], "%d", i);
+		sprintf(buf[1], "X%d  ", i % 10);
+		sprintf(buf[2], "%s", (i % 2) ? "ODD" : "EVEN");
+		int j = 0;
+		for (; j < 3; ++j) {
+			key.data[j] = (Const_Char_Slice) {buf[j], strlen(buf[j])};
+		}
+		int* val = compositemap_get(&m, &key);
+		assert(val && *val == i);
+		if (i % 3 == 0) {
+			assert(compositemap_remove(&m, &key));
+			assert(compositemap_get(&m, &key) == NULL);
+		}
+	}
+	assert(m._table.size == 1004 - 334);
+	assert(compositemap_nremove(&m, none, 0));
+	assert(!compositemap_nremove(&m, none, 0));
+	assert(compositemap_nremove(&m, abc, 1));
+
+	vec_destroy(&key);
+	compositemap_destroy(&m);
+}
+
+void test_frozenmap(unsigned layout)
+{
+	Int_Map m;
+	Set s;
+	map_construct(&m, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+	set_construct(&s, 2, layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 5000; ++i) {
+		sprintf(key, "key%d", i);
+		map_set(&m, key, i);
+		set_add(&s, key);
+	}
+	/* holes in values and tombstones must not leak through */
+	for (i = 0; i < 5000; i += 5) {
+		sprintf(key, "key%d", i);
+		map_remove(&m, key);
+		set_remove(&s, key);
+	}
+
+	Frozen_Map(int) fm;
+	Frozen_Map fs;
+	assert(map_freeze(&fm, &m) == Result_Ok);
+	assert(set_freeze(&fs, &s) == Result_Ok);
+	map_destroy(&m);
+	set_destroy(&s);
+	assert(frozenmap_size(&fm) == 4000);
+	assert(frozenmap_size(&fs) == 4000);
+
+	for (i = 0; i < 5000; ++i) {
+		sprintf(key, "KEY%d  ", i);
+		int* val = frozenmap_get(&fm, key);
+		assert((i % 5) ? (val && *val == i) : val == NULL);
+		sprintf(key, "key%d", i);
+		assert(frozenmap_has(&fs, key) == (i % 5 != 0));
+	}
+	assert(frozenmap_get(&fm, "key") == NULL);
+	assert(!frozenmap_has(&fs, "KEY1"));
+
+	frozenmap_destroy(&fm);
+	frozenmap_destroy(&fs);
+
+	/* empty */
+	set_construct(&s, 2, layout);
+	assert(set_freeze(&fs, &s) == Result_Ok);
+	assert(!frozenmap_has(&fs, "a"));
+	frozenmap_destroy(&fs);
+	set_destroy(&s);
+}
+
+void test_mapfile(unsigned layout)
+{
+	Int_Map m;
+	Set s;
+	map_construct(&m, 2, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+	set_construct(&s, 2, layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 3000; ++i) {
+		sprintf(key, "key%d", i);
+		map_set(&m, key, i);
+		set_add(&s, key);
+	}
+	for (i = 0; i < 3000; i += 3) {
+		sprintf(key, "key%d", i);
+		map_remove(&m, key);
+		set_remove(&s, key);
+	}
+
+	char map_path[] = "/tmp/utiltest_map_XXXXXX";
+	char set_path[] = "/tmp/utiltest_set_XXXXXX";
+	close(mkstemp(map_path));
+	close(mkstemp(set_path));
+	assert(map_save(&m, map_path) == Result_Ok);
+	assert(set_save(&s, set_path) == Result_Ok);
+	map_destroy(&m);
+	set_destroy(&s);
+
+	Int_Map om;
+	Set os;
+	assert(map_open(&om, map_path) == Result_Ok);
+	assert(set_open(&os, set_path) == Result_Ok);
+	assert(om.values.len == 2000);
+	assert(set_size(&os) == 2000);
+
+	for (i = 0; i < 3000; ++i) {
+		sprintf(key, "KEY%d ", i);
+		int* val = map_get(&om, key);
+		assert((i % 3) ? (val && *val == i) : val == NULL);
+		sprintf(key, "key%d", i);
+		assert(set_has(&os, key) == (i % 3 != 0));
+	}
+	assert(map_get(&om, "key") == NULL);
+
+	/* the values and reverse index came along too */
+	Frozen_Map(int) fm;
+	assert(map_freeze(&fm, &om) == Result_Ok);
+	assert(*(int*)frozenmap_get(&fm, "key2") == 2);
+	frozenmap_destroy(&fm);
+
+	map_destroy(&om);
+	set_destroy(&os);
+	remove(map_path);
+	remove(set_path);
+}
+
+#ifdef MAP_STATS
+void test_map_stats(unsigned layout)
+{
+	Int_Map m;
+	Set s;
+	map_construct(&m, 2, layout);
+	set_construct(&s, 2, layout);
+
+	char key[32];
+	int i = 0;
+	for (; i < 1000; ++i) {
+		sprintf(key, "map stats test key %d", i);
+		map_set(&m, key, i);
+		set_add(&s, key);
+	}
+
+	Map_Stats before;
+	map_stats(&m, &before);
+	for (i = 0; i < 2000; ++i) {
+		sprintf(key, "map stats test key %d", i);
+		map_get(&m, key);
+	}
+
+	Map_Stats st;
+	map_stats(&m, &st);
+	size_t hits = 0;
+	size_t misses = 0;
+	for (i = 0; i < MAP_STATS_PROBES; ++i) {
+		hits += st.hit_probes[i] - before.hit_probes[i];
+		misses += st.miss_probes[i] - before.miss_probes[i];
+	}
+	assert(hits == 1000);
+	assert(misses >= 1000);
+	assert(st.grows > 0);
+	assert(st.size == 1000);
+	assert(st.clusters > 0 && st.max_cluster > 0);
+	assert(st.entries_used <= st.entries_alloc);
+	/* longer than MAP_INLINE_KEY, so each one is in _keybuf */
+	assert(st.keybuf_used == 10 * 20 + 90 * 21 + 900 * 22);
+	assert(st.values_used == 1000 * sizeof(int));
+	assert(st.values_used <= st.values_alloc);
+
+	for (i = 0; i < 100; ++i) {
+		sprintf(key, "map stats test key %d", i);
+		map_remove(&m, key);
+	}
+	map_stats(&m, &st);
+	assert(st.size == 900);
+	assert(st.keybuf_waste > 0);
+
+	set_stats(&s, &st);
+	assert(st.size == 1000);
+	assert(st.values_used == 0);
+
+	FILE* null = fopen("/dev/null", "w");
+	map_stats_print(&st, null);
+	fclose(null);
+
+	map_destroy(&m);
+	set_destroy(&s);
+}
+#endif
+
+void test_bloom()
+{
+	Bloom b;
+	bloom_construct(&b, 10000, .01);
+
+	/* a new key is rarely mistaken for a repeat */
+	char key[32];
+	int repeats = 0;
+	int i = 0;
+	for (; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		repeats += bloom_add(&b, key);
+	}
+	assert(repeats < 100);
+	for (i = 0; i < 10000; ++i) {
+		sprintf(key, "key%d", i);
+		assert(bloom_has(&b, key));
+		/* a second add reports the repeat */
+		assert(bloom_add(&b, key));
+	}
+
+	int false_positives = 0;
+	for (i = 0; i < 100000; ++i) {
+		sprintf(key, "other%d", i);
+		false_positives += bloom_has(&b, key);
+	}
+	assert(false_positives < 2000);
+
+	bloom_clear(&b);
+	assert(!bloom_has(&b, "key1"));
+	bloom_destroy(&b);
+
+	/* past the largest k, bits are added instead */
+	bloom_construct(&b, 100000, 1e-6);
+	assert(b._k > 1 && b._k <= 16);
+	for (i = 0; i < 100000; ++i) {
+		sprintf(key, "key%d", i);
+		bloom_add(&b, key);
+	}
+	false_positives = 0;
+	for (i = 0; i < 1000000; ++i) {
+		sprintf(key, "other%d", i);
+		false_positives += bloom_has(&b, key);
+	}
+	assert(false_positives < 10);
+	bloom_destroy(&b);
+}
+
+void test_set_filter(unsigned layout)
+{
+	Set s;
+	set_construct(&s, 2, MAP_PROP_NOCASE | layout);
+	set_add(&s, "before");
+	set_filter(&s, .01);
+	assert(set_has(&s, "BEFORE"));
+
+	/* grows through several rebuilds of the filter */
+	char key[32];
+	int i = 0;
+	for (; i < 5000; ++i) {
+		sprintf(key, "key%d", i);
+		set_add(&s, key);
+	}
+	for (i = 0; i < 10000; ++i) {
+		sprintf(key, "KEY%d", i);
+		assert(set_has(&s, key) == (i < 5000));
+	}
+	assert(set_remove(&s, "key7"));
+	assert(!set_has(&s, "key7"));
+
+	set_clear(&s);
+	assert(!set_has(&s, "key1"));
+	set_add(&s, "key1");
+	assert(set_has(&s, "key1"));
+	set_destroy(&s);
+}
+
+void test_hll()
+{
+	Hll h;
+	hll_construct(&h, 12, MAP_PROP_DEFAULT);
+	assert(hll_count(&h) == 0);
+
+	/* sparse is close to exact */
+	char key[32];
+	int i = 0;
+	for (; i < 3000; ++i) {
+		sprintf(key, "key%d", i % 300);
+		hll_add(&h, key);
+	}
+	assert(fabs(hll_count(&h) - 300) < 3);
+
+	/* dense: 3 standard errors of 1.6% */
+	for (i = 0; i < 200000; ++i) {
+		sprintf(key, "key%d", i);
+		hll_add(&h, key);
+	}
+	assert(hll_bytes(&h) == 4096);
+	assert(fabs(hll_count(&h) - 200000) < 200000 * .05);
+
+	/* merging sketches built apart, sparse and dense */
+	Hll parts[4];
+	for (i = 0; i < 4; ++i) {
+		hll_construct(&parts[i], 12, MAP_PROP_DEFAULT);
+	}
+	for (i = 0; i < 100000; ++i) {
+		sprintf(key, "key%d", i);
+		hll_add(&parts[(i < 100) ? 0 : 1 + i % 3], key);
+	}
+	Hll all;
+	hll_construct(&all, 12, MAP_PROP_DEFAULT);
+	assert(hll_merge(&all, &parts[0]) == Result_Ok);
+	assert(fabs(hll_count(&all) - 100) < 1);
+	for (i = 1; i < 4; ++i) {
+		assert(hll_merge(&all, &parts[i]) == Result_Ok);
+	}
+	assert(fabs(hll_count(&all) - 100000) < 100000 * .05);
+	assert(hll_merge(&parts[0], &all) == Result_Ok);
+	assert(fabs(hll_count(&parts[0]) - hll_count(&all)) < 1);
+	for (i = 0; i < 4; ++i) {
+		hll_destroy(&parts[i]);
+	}
+	hll_destroy(&all);
+
+	hll_clear(&h);
+	assert(hll_count(&h) == 0);
+	hll_destroy(&h);
+
+	/* same notion of equal keys as a Set with the same props */
+	Set s;
+	set_construct(&s, 16, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	hll_construct(&h, 14, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	const char* words[] = {"Key", "key  ", "KEY", "other", "Other ", "k ey"};
+	for (i = 0; i < (int)ARRAY_LEN(words); ++i) {
+		set_add(&s, words[i]);
+		hll_add(&h, words[i]);
+	}
+	assert(set_size(&s) == 3);
+	assert(fabs(hll_count(&h) - 3) < .5);
+	set_destroy(&s);
+	hll_destroy(&h);
+}
+
+/* key i shows up 1000 / i times, spread over the stream */
+void topk_stream(Topk* t, int parity)
+{
+	char key[32];
+	int round = 0;
+	for (; round < 1000; ++round) {
+		if (parity >= 0 && round % 2 != parity) {
+			continue;
+		}
+		int i = 1;
+		for (; i <= 2000 && round < 1000 / i; ++i) {
+			sprintf(key, (round % 3) ? "key%d" : "KEY%d", i);
+			topk_add(t, key);
+		}
+	}
+}
+
+void topk_check(const Topk* t)
+{
+	Topk_Item items[100];
+	size_t n = topk_list(t, items, 100);
+	assert(n == 100);
+	char key[32];
+	size_t i = 0;
+	for (; i < n; ++i) {
+		assert(items[i].key_len < sizeof(key));
+		memcpy(key, items[i].key, items[i].key_len);
+		key[items[i].key_len] = '\0';
+		uint64_t truth = 1000 / atoi(key + 3);
+		assert(items[i].count - items[i].error <= truth);
+		assert(truth <= items[i].count);
+		assert(items[i].error <= topk_total(t) / t->capacity);
+		if (i < 10) {
+			assert(truth == 1000 / (i + 1));
+		}
+	}
+}
+
+void test_topk(unsigned layout)
+{
+	Topk t;
+	topk_construct(&t, 100, MAP_PROP_NOCASE | layout);
+	topk_stream(&t, -1);
+	assert(topk_size(&t) == 100);
+	topk_check(&t);
+
+	/* halves counted apart, then merged */
+	Topk halves[2];
+	topk_construct(&halves[0], 100, MAP_PROP_NOCASE | layout);
+	topk_construct(&halves[1], 100, MAP_PROP_NOCASE);
+	topk_stream(&halves[0], 0);
+	topk_stream(&halves[1], 1);
+	assert(topk_merge(&halves[0], &halves[1]) == Result_Ok);
+	assert(topk_total(&halves[0]) == topk_total(&t));
+	topk_check(&halves[0]);
+	topk_destroy(&halves[0]);
+	topk_destroy(&halves[1]);
+
+	topk_clear(&t);
+	assert(topk_size(&t) == 0);
+	topk_add(&t, "a");
+	Topk_Item item;
+	assert(topk_list(&t, &item, 1) == 1);
+	assert(item.count == 1 && item.error == 0);
+	topk_destroy(&t);
+}
+
+void add_long(void* acc, const void* val)
+{
+	*(long*)acc += *(const long*)val;
+}
+
+void test_groupby(unsigned layout)
+{
+	enum { ROWS = 50000, GROUPS = 1000 };
+	char (*keys)[16] = malloc(ROWS * sizeof(*keys));
+	const char** key_ptrs = malloc(ROWS * sizeof(*key_ptrs));
+	long* values = malloc(ROWS * sizeof(*values));
+	int i = 0;
+	for (; i < ROWS; ++i) {
+		/* skewed: low groups show up far more often */
+		int group = (i % 7) ? i % 13 : i % GROUPS;
+		sprintf(keys[i], (i % 2) ? "group%d" : "GROUP%d  ", group);
+		key_ptrs[i] = keys[i];
+		values[i] = i;
+	}
+
+	Map(long) serial;
+	map_construct(&serial, 16, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+	for (i = 0; i < ROWS; ++i) {
+		long* sum = map_get(&serial, keys[i]);
+		if (sum == NULL) {
+			map_set(&serial, keys[i], values[i]);
+		} else {
+			*sum += values[i];
+		}
+	}
+
+	unsigned threads[] = {1, 3, 4};
+	unsigned t = 0;
+	for (; t < ARRAY_LEN(threads); ++t) {
+		Group_By(long) g;
+		groupby_construct(&g, threads[t], 16, MAP_PROP_NOCASE | MAP_PROP_RTRIM | layout);
+
+		/* two runs add up to one */
+		groupby_run(&g, key_ptrs, NULL, values, ROWS / 2, add_long);
+		groupby_run(&g, &key_ptrs[ROWS / 2], NULL, &values[ROWS / 2], ROWS - ROWS / 2, add_long);
+		assert(groupby_size(&g) == serial._table.size);
+		assert(groupby_size(&g) == GROUPS);
+
+		size_t total = 0;
+		unsigned p = 0;
+		for (; p < groupby_parts(&g); ++p) {
+			Map* part = groupby_part(&g, p);
+			total += part->_table.size;
+			int32_t j = 0;
+			for (; j < part->values.len; ++j) {
+				_Entry* e = _rev_entry(&part->_table, j);
+				char key[16] = "";
+				memcpy(key, _entry_key(&part->_table, e), e->key_len);
+				long* want = map_get(&serial, key);
+				assert(want != NULL);
+				assert(((long*)part->values.data)[j] == *want);
+			}
+		}
+		assert(total == GROUPS);
+
+		long* sum = groupby_get(&g, "Group0 ");
+		assert(sum != NULL && *sum == *(long*)map_get(&serial, "group0"));
+		assert(groupby_get(&g, "group1000") == NULL);
+
+		groupby_clear(&g);
+		assert(groupby_size(&g) == 0);
+		groupby_run(&g, key_ptrs, NULL, values, 10, add_long);
+		assert(groupby_size(&g) == 10);
+		groupby_destroy(&g);
+	}
+
+	/* keys differing only in the last bytes still spread out */
+	Group_By(long) g;
+	groupby_construct(&g, 4, 1024, layout);
+	for (i = 0; i < 1024; ++i) {
+		sprintf(keys[i], "k%d", i);
+	}
+	groupby_run(&g, key_ptrs, NULL, values, 1024, add_long);
+	assert(groupby_parts(&g) == 16);
+	for (t = 0; t < groupby_parts(&g); ++t) {
+		size_t size = groupby_part(&g, t)->_table.size;
+		assert(size > 16 && size < 160);
+	}
+	groupby_destroy(&g);
+
+	map_destroy(&serial);
+	free(values);
+	free(key_ptrs);
+	free(keys);
+}
+
+void count_evict(const char* key, unsigned key_len, void* val, void* data)
+{
+	int* evicted = data;
+	char buf[32];
+	memcpy(buf, key, key_len);
+	buf[key_len] = '\0';
+	/* values are the number in their key */
+	assert(atoi(&buf[3]) == *(int*)val);
+	/* shards evict under their own locks */
+	__atomic_fetch_add(evicted, 1, __ATOMIC_RELAXED);
+}
+
+void test_cache(unsigned layout)
+{
+	Cache(int) c;
+	cache_construct(&c, 3, MAP_PROP_NOCASE | layout);
+	int evicted = 0;
+	cache_on_evict(&c, count_evict, &evicted);
+	cache_put(&c, "key1", 1);
+	cache_put(&c, "key2", 2);
+	cache_put(&c, "key3", 3);
+	assert(*(int*)cache_get(&c, "KEY1") == 1);
+
+	/* key1 was hit, so the hand passes it and takes key2 */
+	cache_put(&c, "key4", 4);
+	assert(evicted == 1);
+	assert(cache_get(&c, "key2") == NULL);
+	assert(cache_get(&c, "key1") != NULL);
+	assert(cache_size(&c) == 3);
+	assert(c.hits == 2 && c.misses == 1);
+
+	/* replacing hands the old value out too */
+	cache_put(&c, "key3", 3);
+	assert(evicted == 2 && cache_size(&c) == 3);
+	assert(cache_remove(&c, "key3"));
+	assert(!cache_remove(&c, "key3"));
+	assert(evicted == 3 && cache_size(&c) == 2);
+	cache_clear(&c);
+	assert(evicted == 5 && cache_size(&c) == 0);
+	cache_destroy(&c);
+
+	/* a hot set that fits stays put under a stream of cold keys */
+	cache_construct(&c, 100, layout);
+	evicted = 0;
+	cache_on_evict(&c, count_evict, &evicted);
+	char key[32];
+	int i = 0;
+	for (; i < 10000; ++i) {
+		int k = (i % 2) ? i / 2 % 50 : 1000 + i;
+		sprintf(key, "key%d", k);
+		int* val = cache_get(&c, key);
+		if (val == NULL) {
+			cache_put(&c, key, k);
+		} else {
+			assert(*val == k);
+		}
+		assert(cache_size(&c) <= 100);
+	}
+	assert(c.hits + c.misses == 10000);
+	assert(c.misses - evicted == cache_size(&c));
+	for (i = 0; i < 50; ++i) {
+		sprintf(key, "key%d", i);
+		assert(cache_get(&c, key) != NULL);
+	}
+	cache_destroy(&c);
+	assert(evicted == 5050);
+}
+
+struct cache_worker {
+	Int_Shard_Cache* c;
+	int id;
+};
+
+void* shardcache_worker(void* arg)
+{
+	struct cache_worker* w = arg;
+	char key[32];
+	uint64_t seed = w->id + 1;
+	int i = 0;
+	for (; i < 20000; ++i) {
+		seed = seed * 6364136223846793005UL + 1;
+		int k = (seed >> 33) % 500;
+		sprintf(key, "key%d", k);
+		int val = -1;
+		if (shardcache_get(w->c, key, &val)) {
+			assert(val == k);
+		} else {
+			shardcache_put(w->c, key, k);
+		}
+	}
+	return NULL;
+}
+
+void test_shardcache(unsigned layout)
+{
+	Int_Shard_Cache c;
+	shardcache_construct(&c, 8, 200, layout);
+	int evicted = 0;
+	shardcache_on_evict(&c, count_evict, &evicted);
+
+	struct cache_worker workers[4];
+	pthread_t threads[4];
+	int i = 0;
+	for (; i < 4; ++i) {
+		workers[i] = (struct cache_worker) {&c, i};
+		pthread_create(&threads[i], NULL, shardcache_worker, &workers[i]);
+	}
+	for (i = 0; i < 4; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	/* 8 shards of 25 */
+	assert(shardcache_size(&c) <= 200);
+	assert(shardcache_hits(&c) + shardcache_misses(&c) == 80000);
+	assert(shardcache_hits(&c) > 0);
+	/* every eviction made room for a miss */
+	assert(evicted > 0);
+	assert(evicted + shardcache_size(&c) <= shardcache_misses(&c));
+
+	shardcache_put(&c, "key7", 7);
+	int val = 0;
+	assert(shardcache_get(&c, "key7", &val) && val == 7);
+	assert(shardcache_remove(&c, "key7"));
+	assert(!shardcache_get(&c, "key7", NULL));
+
+	shardcache_clear(&c);
+	assert(shardcache_size(&c) == 0);
+	shardcache_destroy(&c);
+
+	/* keys differing only in the last bytes still spread out */
+	char key[16];
+	shardcache_construct(&c, 8, 2048, layout);
+	for (i = 0; i < 256; ++i) {
+		sprintf(key, "k%d", i);
+		shardcache_put(&c, key, i);
+	}
+	for (i = 0; i < 8; ++i) {
+		size_t size = c._shards[i].cache._map._table.size;
+		assert(size > 8 && size < 64);
+	}
+	shardcache_destroy(&c);
+}
+
+int slice_cmp_nocase(const void* a, const void* b)
+{
+	return slice_compare_nocase(a, b);
+}
+
+void test_btree()
+{
+	Btree(int) t;
+	btree_construct(&t, MAP_PROP_DEFAULT);
+	char key[32];
+	int i = 0;
+	for (; i < 5000; ++i) {
+		int k = i * 7919 % 5000;
+		sprintf(key, "k%05d", k);
+		btree_set(&t, key, k);
+	}
+	assert(btree_size(&t) == 5000);
+	for (i = 0; i < 5000; ++i) {
+		sprintf(key, "k%05d", i);
+		int* val = btree_get(&t, key);
+		assert(val != NULL && *val == i);
+	}
+	assert(btree_get(&t, "k5000") == NULL);
+	assert(btree_get(&t, "k") == NULL);
+
+	/* in order */
+	Btree_Iter it = btree_begin(&t);
+	int* val = NULL;
+	for (i = 0; (val = btree_iter_next(&it)) != NULL; ++i) {
+		assert(*val == i);
+		sprintf(key, "k%05d", i);
+		assert(it.key_len == 6 && memcmp(it.key, key, 6) == 0);
+	}
+	assert(i == 5000);
+
+	it = btree_lower_bound(&t, "k02500x");
+	assert(*(int*)btree_iter_next(&it) == 2501);
+	it = btree_lower_bound(&t, "l");
+	assert(btree_iter_next(&it) == NULL);
+
+	it = btree_range(&t, "k01000", "k01010");
+	for (i = 0; (val = btree_iter_next(&it)) != NULL; ++i) {
+		assert(*val == 1000 + i);
+	}
+	assert(i == 10);
+
+	it = btree_prefix(&t, "k012");
+	for (i = 0; (val = btree_iter_next(&it)) != NULL; ++i) {
+		assert(*val == 1200 + i);
+	}
+	assert(i == 100);
+
+	/* odd keys out */
+	for (i = 1; i < 5000; i += 2) {
+		sprintf(key, "k%05d", i);
+		assert(btree_remove(&t, key));
+		assert(!btree_remove(&t, key));
+	}
+	assert(btree_size(&t) == 2500);
+	it = btree_begin(&t);
+	for (i = 0; (val = btree_iter_next(&it)) != NULL; ++i) {
+		assert(*val == 2 * i);
+	}
+	assert(i == 2500);
+	btree_set(&t, "k00001", 1);
+	it = btree_lower_bound(&t, "k00000 ");
+	assert(*(int*)btree_iter_next(&it) == 1);
+
+	btree_clear(&t);
+	assert(btree_size(&t) == 0);
+	it = btree_begin(&t);
+	assert(btree_iter_next(&it) == NULL);
+	btree_destroy(&t);
+
+	/* same keys as a Map with the same props, in slice_compare_nocase order */
+	btree_construct(&t, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	Set s;
+	set_construct(&s, 16, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	uint64_t seed = 1;
+	for (i = 0; i < 20000; ++i) {
+		seed = seed * 6364136223846793005UL + 1;
+		unsigned len = 1 + (seed >> 60);
+		unsigned j = 0;
+		for (; j < len; ++j) {
+			seed = seed * 6364136223846793005UL + 1;
+			key[j] = "aAbB\x7f\xe9z_  "[(seed >> 33) % (j ? 10 : 8)];
+		}
+		btree_nset(&t, key, len, i);
+		set_nadd(&s, key, len);
+		assert(btree_size(&t) == set_size(&s));
+	}
+
+	Slice* sorted = malloc(btree_size(&t) * sizeof(*sorted));
+	it = btree_begin(&t);
+	for (i = 0; btree_iter_next(&it) != NULL; ++i) {
+		sorted[i] = (Slice) {(void*)it.key, it.key_len};
+		assert(btree_nget(&t, it.key, it.key_len) != NULL);
+		assert(set_nhas(&s, it.key, it.key_len));
+	}
+	assert(i == (int)btree_size(&t));
+	for (i = 1; i < (int)btree_size(&t); ++i) {
+		assert(slice_cmp_nocase(&sorted[i - 1], &sorted[i]) < 0);
+	}
+	free(sorted);
+	set_destroy(&s);
+	btree_destroy(&t);
+
+	btree_construct(&t, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	btree_set(&t, "Some longer key  ", 1);
+	btree_set(&t, "SOME LONGER KEY", 2);
+	btree_set(&t, "some longer keys", 3);
+	btree_set(&t, "some", 4);
+	assert(btree_size(&t) == 3);
+	assert(*(int*)btree_get(&t, "some longer key ") == 2);
+	it = btree_prefix(&t, "SOME ");
+	assert(*(int*)btree_iter_next(&it) == 2);
+	assert(*(int*)btree_iter_next(&it) == 3);
+	assert(btree_iter_next(&it) == NULL);
+
+	/* only ASCII folds, whatever the locale, as for Map */
+	setlocale(LC_CTYPE, "");
+	btree_set(&t, "\xc0LPHA", 5);
+	btree_set(&t, "\xe0lpha", 6);
+	assert(btree_size(&t) == 5);
+	assert(*(int*)btree_get(&t, "\xc0lpha") == 5);
+	assert(*(int*)btree_get(&t, "\xe0LPHA") == 6);
+	setlocale(LC_CTYPE, "C");
+	btree_destroy(&t);
+}
+
+int slice_cmp_bytes(const void* a, const void* b)
+{
+	const Slice* l = a;
+	const Slice* r = b;
+	unsigned len = (l->len < r->len) ? l->len : r->len;
+	int cmp = memcmp(l->data, r->data, len);
+	return (cmp) ? cmp : (int)l->len - (int)r->len;
+}
+
+void test_art()
+{
+	Art(int) t;
+	art_construct(&t, MAP_PROP_DEFAULT);
+	char key[32];
+	int i = 0;
+	for (; i < 5000; ++i) {
+		int k = i * 7919 % 5000;
+		sprintf(key, "/usr/%d/%05d", k % 3, k);
+		art_set(&t, key, k);
+	}
+	assert(art_size(&t) == 5000);
+	for (i = 0; i < 5000; ++i) {
+		sprintf(key, "/usr/%d/%05d", i % 3, i);
+		int* val = art_get(&t, key);
+		assert(val != NULL && *val == i);
+	}
+	assert(art_get(&t, "/usr/0/00000x") == NULL);
+	assert(art_get(&t, "/usr/0/") == NULL);
+	assert(art_get(&t, "") == NULL);
+
+	/* keys that end inside others */
+	art_set(&t, "/usr/", -1);
+	art_set(&t, "/usr/1/", -2);
+	art_set(&t, "", -3);
+	assert(art_size(&t) == 5003);
+	unsigned len = 0;
+	assert(*(int*)art_longest_prefix(&t, "/usr/1/00001", &len) == 1 && len == 12);
+	assert(*(int*)art_longest_prefix(&t, "/usr/1/000019", &len) == 1 && len == 12);
+	assert(*(int*)art_longest_prefix(&t, "/usr/1/0000", &len) == -2 && len == 7);
+	assert(*(int*)art_longest_prefix(&t, "/usr/4", &len) == -1 && len == 5);
+	assert(*(int*)art_longest_prefix(&t, "/var", &len) == -3 && len == 0);
+	assert(art_remove(&t, ""));
+	assert(art_longest_prefix(&t, "/var", NULL) == NULL);
+
+	/* in byte order, a key before the keys it is a prefix of */
+	Art_Iter it = art_begin(&t);
+	int* val = art_iter_next(&it);
+	assert(*val == -1 && it.key_len == 5);
+	for (i = 0; (val = art_iter_next(&it)) != NULL; ++i) {
+		if (i == 1667) {
+			assert(*val == -2);
+			continue;
+		}
+		int k = i - (i > 1667);
+		k = (k < 1667) ? k * 3 : (k < 3334) ? (k - 1667) * 3 + 1 : (k - 3334) * 3 + 2;
+		assert(*val == k);
+		sprintf(key, "/usr/%d/%05d", k % 3, k);
+		assert(it.key_len == strlen(key) && memcmp(it.key, key, it.key_len) == 0);
+	}
+	assert(i == 5001);
+	art_iter_destroy(&it);
+
+	it = art_prefix(&t, "/usr/2/012");
+	for (i = 0; (val = art_iter_next(&it)) != NULL; ++i) {
+		assert(*val % 3 == 2 && *val / 100 == 12);
+	}
+	assert(i == 33);
+	art_iter_destroy(&it);
+	it = art_prefix(&t, "/usr/1");
+	for (i = 0; art_iter_next(&it) != NULL; ++i)
+		;
+	assert(i == 1668);
+	art_iter_destroy(&it);
+	it = art_prefix(&t, "/usr/3");
+	assert(art_iter_next(&it) == NULL);
+	art_iter_destroy(&it);
+
+	/* removing everything but one key folds the tree to a leaf */
+	size_t bytes = art_bytes(&t);
+	for (i = 1; i < 5000; ++i) {
+		sprintf(key, "/usr/%d/%05d", i % 3, i);
+		assert(art_remove(&t, key));
+		assert(!art_remove(&t, key));
+	}
+	assert(art_remove(&t, "/usr/1/"));
+	assert(art_remove(&t, "/usr/"));
+	assert(art_size(&t) == 1);
+	assert(art_bytes(&t) < bytes / 1000);
+	assert(*(int*)art_get(&t, "/usr/0/00000") == 0);
+	it = art_begin(&t);
+	assert(*(int*)art_iter_next(&it) == 0);
+	assert(it.key_len == 12 && memcmp(it.key, "/usr/0/00000", 12) == 0);
+	assert(art_iter_next(&it) == NULL);
+	art_iter_destroy(&it);
+	art_clear(&t);
+	assert(art_size(&t) == 0 && art_bytes(&t) == 0);
+	it = art_begin(&t);
+	assert(art_iter_next(&it) == NULL);
+	art_iter_destroy(&it);
+	art_destroy(&t);
+
+	/* same keys as a Set with the same props, removing as we go */
+	art_construct(&t, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	Set s;
+	set_construct(&s, 16, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	uint64_t seed = 1;
+	for (i = 0; i < 20000; ++i) {
+		seed = seed * 6364136223846793005UL + 1;
+		unsigned len = 1 + (seed >> 60);
+		unsigned j = 0;
+		for (; j < len; ++j) {
+			seed = seed * 6364136223846793005UL + 1;
+			key[j] = "aAbB\x7f\xe9z_  "[(seed >> 33) % (j ? 10 : 8)];
+		}
+		art_nset(&t, key, len, i);
+		set_nadd(&s, key, len);
+		assert(art_nget(&t, key, len) != NULL);
+		if (i % 3 == 0) {
+			assert(art_nremove(&t, key, len));
+			set_nremove(&s, key, len);
+		}
+		assert(art_size(&t) == set_size(&s));
+	}
+
+	/* it.key is only good until the next call, so keep a copy */
+	char prev[32];
+	unsigned prev_len = 0;
+	it = art_begin(&t);
+	for (i = 0; art_iter_next(&it) != NULL; ++i) {
+		assert(art_nget(&t, it.key, it.key_len) != NULL);
+		assert(set_nhas(&s, it.key, it.key_len));
+		Slice a = {prev, prev_len};
+		Slice b = {(void*)it.key, it.key_len};
+		assert(i == 0 || slice_cmp_bytes(&a, &b) < 0);
+		memcpy(prev, it.key, it.key_len);
+		prev_len = it.key_len;
+	}
+	assert(i == (int)art_size(&t));
+	art_iter_destroy(&it);
+	set_destroy(&s);
+	art_destroy(&t);
+
+	art_construct(&t, MAP_PROP_NOCASE | MAP_PROP_RTRIM);
+	art_set(&t, "Some longer key  ", 1);
+	art_set(&t, "SOME LONGER KEY", 2);
+	art_set(&t, "some longer keys", 3);
+	art_set(&t, "some", 4);
+	assert(art_size(&t) == 3);
+	assert(*(int*)art_get(&t, "some longer key ") == 2);
+	assert(*(int*)art_longest_prefix(&t, "SOME LONGER KEYCHAIN", NULL) == 2);
+	it = art_prefix(&t, "SOME ");
+	assert(*(int*)art_iter_next(&it) == 2);
+	assert(*(int*)art_iter_next(&it) == 3);
+	assert(art_iter_next(&it) == NULL);
+	art_iter_destroy(&it);
+
+	/* only ASCII folds, whatever the locale, as for Map */
+	setlocale(LC_CTYPE, "");
+	art_set(&t, "\xc0LPHA", 5);
+	art_set(&t, "\xe0lpha", 6);
+	assert(art_size(&t) == 5);
+	assert(*(int*)art_get(&t, "\xc0lpha") == 5);
+	assert(*(int*)art_get(&t, "\xe0LPHA") == 6);
+	setlocale(LC_CTYPE, "C");
+	art_destroy(&t);
+}
+
+void test_vec_bytes()
+{
+	/* byte offsets past 2 GB, reserved but never touched */
+	struct big {
+		char b[1 << 20];
+	};
+	Vec(struct big) v;
+	vec_construct(&v);
+	vec_reserve(&v, 2100);
+	assert(v._cap == 2101);
+	assert((size_t)((char*)vec_iter_at_(&v, 2100, sizeof(struct big)) - (char*)v.data) == (size_t)2100 << 20);
+	vec_resize(&v, 2100);
+	assert((size_t)((char*)vec_back_(&v, sizeof(struct big)) - (char*)v.data) == (size_t)2099 << 20);
+	assert((size_t)((char*)vec_end(v) - (char*)v.data) == (size_t)2100 << 20);
+	vec_destroy(&v);
+}
+
+void test_hash_fast()
+{
+	char upper[200];
+	char lower[200];
+	unsigned i = 0;
+	for (; i < sizeof(upper); ++i) {
+		upper[i] = "AbCdEfGhIjKlMnOpQrStUvWxYz[@`{0123"[i % 35];
+		lower[i] = tolower(upper[i]);
+	}
+
+	unsigned n = 0;
+	for (; n < 150; ++n) {
+		unsigned n0 = n;
+		unsigned n1 = n;
+		uint64_t seed = n * 7;
+		assert(_hash_fast(lower, &n0, seed) == _hash_fast_nocase(upper, &n1, seed));
+		assert(_hash_fast(lower, &n0, seed) != _hash_fast(lower, &n0, seed + 1));
+
+		/* pad with spaces and make sure rtrim finds the original length */
+		char padded[200];
+		memcpy(padded, upper, n);
+		unsigned pad = n % 23;
+		memset(&padded[n], ' ', pad);
+		n0 = n;
+		n1 = n + pad;
+		assert(_hash_fast_rtrim(upper, &n0, seed) == _hash_fast_rtrim(padded, &n1, seed));
+		assert(n1 == n || upper[n - 1] == ' ');
+		n1 = n + pad;
+		assert(_hash_fast_nocase(lower, &n0, seed)
+		       == _hash_fast_nocase_rtrim(padded, &n1, seed));
+	}
+}
+
 int main(void)
 {
-	test_map_basic();
-	test_map_nocase();
-	test_map_rtrim();
-	test_map_nocase_rtrim();
+	test_vec_bytes();
+	test_hash_fast();
+	test_intmap();
+	test_bloom();
+	test_hll();
+	test_btree();
+	test_art();
+
+	unsigned layouts[] = {
+		MAP_PROP_DEFAULT,
+		MAP_PROP_GROUP,
+		MAP_PROP_FASTHASH,
+		MAP_PROP_GROUP | MAP_PROP_FASTHASH,
+		MAP_PROP_INCREMENTAL,
+		MAP_PROP_GROUP | MAP_PROP_INCREMENTAL,
+	};
+	unsigned i = 0;
+	for (; i < ARRAY_LEN(layouts); ++i) {
+		test_map_basic(layouts[i]);
+		test_map_nocase(layouts[i]);
+		test_map_rtrim(layouts[i]);
+		test_map_nocase_rtrim(layouts[i]);
+		test_map_grow(layouts[i]);
+		test_map_inline_keys(layouts[i]);
+		test_set(layouts[i]);
+		test_set_algebra(layouts[i]);
+		test_map_readonly(layouts[i]);
+		test_map_batch(layouts[i]);
+		test_map_remove(layouts[i]);
+		test_map_compact(layouts[i]);
+		test_map_iter(layouts[i]);
+		test_shardmap(layouts[i]);
+		test_multimap(layouts[i]);
+		test_compositemap(layouts[i]);
+		test_frozenmap(layouts[i]);
+		test_mapfile(layouts[i]);
+		test_set_filter(layouts[i]);
+		test_topk(layouts[i]);
+		test_groupby(layouts[i]);
+		test_cache(layouts[i]);
+		test_shardcache(layouts[i]);
+#ifdef MAP_STATS
+		test_map_stats(layouts[i]);
+#endif
+	}
 }
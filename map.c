@@ -1,77 +1,148 @@
 #include "map.h"
+#include "bloom.h"
 #include <string.h>
-#include <ctype.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* hashing based on FNV-1 */
 const uint64_t _FNV1_INIT = 14695981039346656037UL;
 const uint64_t _PRIME     = 1099511628211UL;
 
+/* wyhash constants */
+const uint64_t _WYP0 = 0xa0761d6478bd642fUL;
+const uint64_t _WYP1 = 0xe7037ed1a0b428dbUL;
+const uint64_t _WYP2 = 0x8ebc6af09c88c6e3UL;
+const uint64_t _WYP3 = 0x589965cc75374cc3UL;
+
 const double _FULL_PERCENT = .9;
 
+/* MAP_PROP_INCREMENTAL: old slots moved per insert or remove */
+const unsigned _MIGRATE_STEP = 16;
+
+/* MAP_PROP_INCREMENTAL: start clearing the next table at this load */
+const double   _PREPARE_PERCENT = .6;
+const unsigned _PREPARE_STEP    = 8; /* slots cleared per insert */
+
+/* MAP_PROP_INCREMENTAL: smaller tables grow all at once */
+const ssize_t _INCREMENTAL_MIN = 64;
+
+/* largest chained multimap run, in values */
+const uint32_t _MULTI_RUN_MAX = 1 << 16;
+
+/* keys in flight per pass of a batch lookup */
+#define _BATCH_WIDTH 16
+
+/* slots ahead of a set algebra scan to prefetch keys from */
+#define _SCAN_AHEAD 16
+
 unsigned long _next_power_of_2(unsigned long n);
 
-_Entry* _get_entry(_Entry_Slice* entries,
-    Byte_Slice*                  keybuf,
-    hash_fn                      hash__,
-    size_t                       keybuf_head,
-    const char*                  key,
-    unsigned*                    key_len,
-    uint64_t*                    hash);
+void _table_construct(_Table*, size_t start_size, const unsigned props);
+void _table_destroy(_Table*);
+void _table_clear(_Table*);
+void _table_occupy(_Table*, _Entry*);
+void _table_erase(_Table*, _Entry*);
+void _table_compact_keys(_Table*);
+void _table_reserve(_Table*, size_t limit);
+bool _table_compact(_Table*, size_t slots);
+void _table_prepare(_Table*, size_t slots);
+void _table_find_batch(const _Table*,
+                       const char* const* keys,
+                       const unsigned* lens,
+                       size_t n,
+                       _Entry** out);
+void _table_store_key(_Table*, _Entry*, const char* key, unsigned n);
+void _table_copy_key(_Table*, _Entry*, const uint8_t* key, unsigned n);
+_Entry* _table_find_stored(const _Table*, const uint8_t* key, unsigned n, uint64_t hash);
+void _set_build_filter(Set*, double fp_rate);
+void _set_filter_add(Set*, uint64_t hash);
+bool _set_alike(const Set*, const Set*, const char* name);
+void _set_add_new(Set*, const _Table* src, const _Entry*);
+void _set_scan(const _Table* src, const _Table* other, uint64_t* bits, bool mark_other, unsigned threads);
+void _set_erase_marked(Set*, const uint64_t* bits, bool marked);
+static void* _map_scan_range(void*);
+static inline const _Entry* _table_slot(const _Table*, size_t i);
 
-/* Hash functions */
-uint64_t _hash(uint8_t* keybuf, const char* restrict key, unsigned* n);
-uint64_t _hash_nocase(uint8_t* keybuf, const char* restrict key, unsigned* n);
-uint64_t _hash_rtrim(uint8_t* keybuf, const char* restrict key, unsigned* n);
-uint64_t _hash_nocase_rtrim(uint8_t* keybuf, const char* restrict key, unsigned* n);
+uint64_t _map_seed(const void*);
+/**
+ * Composite keys are stored as a 4 byte length and the folded,
+ * trimmed bytes of each field. The probe is never encoded.
+ * Its trimmed field lengths come from hashing.
+ */
+struct _Fields {
+	const Const_Char_Slice* fields;
+	const unsigned* lens;
+	unsigned count;
+};
+
+uint64_t _fields_hash(const _Table*, const Const_Char_Slice*, unsigned count, unsigned* lens, unsigned* n);
+void _table_store_fields(_Table*, _Entry*, const struct _Fields*, unsigned n);
+_Entry* _table_find_fields(const _Table*, const struct _Fields*, unsigned n, uint64_t hash);
+uint64_t _multi_new_run(Multimap*, uint32_t cap, unsigned elem_size);
+void _multi_free_run(Multimap*, uint64_t run);
+
+#ifdef MAP_STATS
+void _table_stats(const _Table*, Map_Stats*);
+#endif
 
 
 void
 set_construct(Set* restrict s, size_t start_size, const unsigned props) {
-	start_size = _next_power_of_2(start_size);
-	*s         = (Set) {
-            ._entries = slice_new(_Entry, start_size),
-            ._keybuf  = slice_new(char, start_size),
-        };
-
-	switch (props) {
-	case MAP_PROP_NOCASE:
-		s->hash__ = _hash_nocase;
-		break;
-	case MAP_PROP_RTRIM:
-		s->hash__ = _hash_rtrim;
-		break;
-	case MAP_PROP_NOCASE | MAP_PROP_RTRIM:
-		s->hash__ = _hash_nocase_rtrim;
-		break;
-	default:
-		s->hash__ = _hash;
-	}
+	_table_construct(&s->_table, start_size, props);
+	s->_filter = NULL;
+}
 
-	memset(s->_entries.data, -1, sizeof(_Entry) * start_size);
+void
+set_construct_like(Set* restrict s, const Set* restrict like, size_t start_size) {
+	set_construct(s, start_size, like->_table.props);
+	s->_table.seed = like->_table.seed;
 }
 
 void
 set_destroy(Set* restrict s) {
-	heap_free(s->_entries.data);
-	heap_free(s->_keybuf.data);
+	_table_destroy(&s->_table);
+	if (s->_filter != NULL) {
+		bloom_destroy(s->_filter);
+		heap_free(s->_filter);
+	}
 }
 
 void
 set_clear(Set* restrict s) {
-	s->_keybuf_head = 0;
-	memset(s->_entries.data, -1, sizeof(_Entry) * s->_entries.len);
+	_table_clear(&s->_table);
+	if (s->_filter != NULL) {
+		bloom_clear(s->_filter);
+	}
+}
+
+/* A filter keeps its size; it only ever errs toward a probe */
+void
+set_reserve(Set* restrict s, size_t limit) {
+	_table_reserve(&s->_table, limit);
+}
+
+bool
+set_compact(Set* restrict s, size_t slots) {
+	return _table_compact(&s->_table, slots);
+}
+
+void
+set_shrink_to_fit(Set* restrict s) {
+	while (!_table_compact(&s->_table, (size_t)-1)) {
+		/* a grow in progress finishes first */
+	}
 }
 
 void
 set_nadd(Set* restrict s, const char* restrict key, unsigned n) {
+	_Table*  t    = &s->_table;
 	uint64_t hash = 0;
-	_Entry*  e    = _get_entry(&s->_entries,
-            &s->_keybuf,
-            s->hash__,
-            s->_keybuf_head,
-            key,
-            &n,
-            &hash);
+	_Entry*  e    = _get_entry(t, key, &n, &hash);
 
 	if (e->val_idx != _NONE) {
 		return;
@@ -79,106 +150,322 @@ set_nadd(Set* restrict s, const char* restrict key, unsigned n) {
 
 	/* new value */
 	e->val_idx = 0;
-	e->key_idx = s->_keybuf_head;
-	e->key_len = n;
 	e->hash    = hash;
-	s->_keybuf_head += n;
-	if (++s->map_size > _FULL_PERCENT * s->_entries.len) {
-		_map_grow_entries(&s->_entries);
-	}
+	_table_store_key(t, e, key, n);
+	_table_occupy(t, e);
+	_set_filter_add(s, hash);
 }
 
 bool
-set_nhas(Set* restrict s, const char* restrict key, unsigned n) {
-	uint64_t hash  = 0;
-	_Entry*  entry = _get_entry(&s->_entries,
-            &s->_keybuf,
-            s->hash__,
-            s->_keybuf_head,
-            key,
-            &n,
-            &hash);
-	return (entry->val_idx != _NONE);
+set_nhas(const Set* restrict s, const char* restrict key, unsigned n) {
+	const _Table* t    = &s->_table;
+	uint64_t      hash = t->hash__(key, &n, t->seed);
+	if (s->_filter != NULL && !bloom_has_hash(s->_filter, hash)) {
+		return false;
+	}
+	return (_table_find(t, key, n, hash)->val_idx != _NONE);
 }
 
 void
-map_construct_(
-    void* gen_m, const unsigned elem_size, size_t start_size, const unsigned props) {
-	Map* m     = gen_m;
-	start_size = _next_power_of_2(start_size);
-	*m         = (Map) {
-            ._entries = slice_new(_Entry, start_size),
-            ._keybuf  = slice_new(char, start_size),
-        };
+set_filter(Set* restrict s, double fp_rate) {
+	if (s->_filter == NULL) {
+		s->_filter = new (Bloom);
+	} else {
+		bloom_destroy(s->_filter);
+	}
+	_set_build_filter(s, fp_rate);
+}
 
-	switch (props) {
-	case MAP_PROP_NOCASE:
-		m->hash__ = _hash_nocase;
-		break;
-	case MAP_PROP_RTRIM:
-		m->hash__ = _hash_rtrim;
-		break;
-	case MAP_PROP_NOCASE | MAP_PROP_RTRIM:
-		m->hash__ = _hash_nocase_rtrim;
-		break;
-	default:
-		m->hash__ = _hash;
+size_t
+set_nhas_batch(const Set* restrict s,
+               const char* const* keys,
+               const unsigned* lens,
+               size_t n,
+               uint64_t* hits) {
+	_Entry* found[_BATCH_WIDTH];
+	size_t  count = 0;
+	size_t  i     = 0;
+
+	memset(hits, 0, (n + 63) / 64 * sizeof(*hits));
+	for (; i < n; i += _BATCH_WIDTH) {
+		size_t width = (n - i < _BATCH_WIDTH) ? n - i : _BATCH_WIDTH;
+		_table_find_batch(&s->_table, &keys[i], lens ? &lens[i] : NULL, width, found);
+
+		size_t j = 0;
+		for (; j < width; ++j) {
+			if (found[j]->val_idx != _NONE) {
+				hits[(i + j) / 64] |= (uint64_t)1 << ((i + j) % 64);
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+bool
+set_nremove(Set* restrict s, const char* restrict key, unsigned n) {
+	uint64_t hash = 0;
+	_Entry*  e    = _get_entry(&s->_table, key, &n, &hash);
+	if (e->val_idx == _NONE) {
+		return false;
+	}
+	_table_erase(&s->_table, e);
+	return true;
+}
+
+int
+set_union(Set* dst, const Set* a, const Set* b, unsigned threads) {
+	if (!_set_alike(a, b, "set_union")) {
+		return Result_Fail;
+	}
+	if (dst == b) {
+		const Set* tmp = a;
+		a              = b;
+		b              = tmp;
+	}
+	if (dst != a) {
+		/* start from a copy of the larger, then add the smaller */
+		if (a->_table.size < b->_table.size) {
+			const Set* tmp = a;
+			a              = b;
+			b              = tmp;
+		}
+		set_construct_like(dst, a, (a->_table.size + b->_table.size) / _FULL_PERCENT + 1);
+		const _Table* src = &a->_table;
+		size_t        i   = 0;
+		for (; i < (size_t)(src->_entries.len + src->_old_entries.len); ++i) {
+			const _Entry* e = _table_slot(src, i);
+			if (e->val_idx != _NONE && e->val_idx != _MOVED) {
+				_set_add_new(dst, src, e);
+			}
+		}
+	}
+
+	/* dst is now a. Add what of b it lacks. */
+	const _Table* src  = &b->_table;
+	size_t        len  = src->_entries.len + src->_old_entries.len;
+	uint64_t*     bits = heap_alloc((len + 63) / 64 * sizeof(*bits));
+	_set_scan(src, &dst->_table, bits, false, threads);
+	size_t i = 0;
+	for (; i < len; ++i) {
+		const _Entry* e = _table_slot(src, i);
+		if (e->val_idx != _NONE && e->val_idx != _MOVED && !(bits[i / 64] >> (i % 64) & 1)) {
+			_set_add_new(dst, src, e);
+		}
+	}
+	heap_free(bits);
+	return Result_Ok;
+}
+
+int
+set_intersect(Set* dst, const Set* a, const Set* b, unsigned threads) {
+	if (!_set_alike(a, b, "set_intersect")) {
+		return Result_Fail;
+	}
+	const Set* small = (a->_table.size <= b->_table.size) ? a : b;
+	const Set* large = (small == a) ? b : a;
+
+	if (dst == large) {
+		/* mark what small finds in dst and drop the rest */
+		_table_migrate(&dst->_table, (size_t)-1);
+		uint64_t* bits = heap_alloc((dst->_table._entries.len + 63) / 64 * sizeof(*bits));
+		_set_scan(&small->_table, &dst->_table, bits, true, threads);
+		_set_erase_marked(dst, bits, false);
+		heap_free(bits);
+		return Result_Ok;
+	}
+
+	if (dst == small) {
+		_table_migrate(&dst->_table, (size_t)-1);
+	}
+	const _Table* src  = &small->_table;
+	size_t        len  = src->_entries.len + src->_old_entries.len;
+	uint64_t*     bits = heap_alloc((len + 63) / 64 * sizeof(*bits));
+	_set_scan(src, &large->_table, bits, false, threads);
+	if (dst == small) {
+		_set_erase_marked(dst, bits, false);
+		heap_free(bits);
+		return Result_Ok;
+	}
+
+	set_construct_like(dst, small, small->_table.size / _FULL_PERCENT + 1);
+	size_t i = 0;
+	for (; i < len; ++i) {
+		if (bits[i / 64] >> (i % 64) & 1) {
+			_set_add_new(dst, src, _table_slot(src, i));
+		}
+	}
+	heap_free(bits);
+	return Result_Ok;
+}
+
+int
+set_difference(Set* dst, const Set* a, const Set* b, unsigned threads) {
+	if (!_set_alike(a, b, "set_difference")) {
+		return Result_Fail;
+	}
+
+	if (dst == b) {
+		/* the result is made of a's keys, so build it apart */
+		Set result;
+		set_difference(&result, a, b, threads);
+		double fp_rate = (dst->_filter != NULL) ? dst->_filter->fp_rate : 0;
+		set_destroy(dst);
+		*dst = result;
+		if (fp_rate > 0) {
+			set_filter(dst, fp_rate);
+		}
+		return Result_Ok;
+	}
+
+	if (dst == a) {
+		/* either way, mark what to drop from dst */
+		_table_migrate(&dst->_table, (size_t)-1);
+		uint64_t* bits = heap_alloc((dst->_table._entries.len + 63) / 64 * sizeof(*bits));
+		if (b->_table.size < dst->_table.size) {
+			_set_scan(&b->_table, &dst->_table, bits, true, threads);
+		} else {
+			_set_scan(&dst->_table, &b->_table, bits, false, threads);
+		}
+		_set_erase_marked(dst, bits, true);
+		heap_free(bits);
+		return Result_Ok;
+	}
+
+	const _Table* src  = &a->_table;
+	size_t        len  = src->_entries.len + src->_old_entries.len;
+	uint64_t*     bits = heap_alloc((len + 63) / 64 * sizeof(*bits));
+	_set_scan(src, &b->_table, bits, false, threads);
+	set_construct_like(dst, a, a->_table.size / _FULL_PERCENT + 1);
+	size_t i = 0;
+	for (; i < len; ++i) {
+		const _Entry* e = _table_slot(src, i);
+		if (e->val_idx != _NONE && e->val_idx != _MOVED && !(bits[i / 64] >> (i % 64) & 1)) {
+			_set_add_new(dst, src, e);
+		}
+	}
+	heap_free(bits);
+	return Result_Ok;
+}
+
+Set_Iter
+set_iter(const Set* s) {
+	return (Set_Iter) {&s->_table, 0, NULL, 0};
+}
+
+const char*
+set_iter_next(Set_Iter* it) {
+	const _Table* t   = it->_table;
+	size_t        len = t->_entries.len + t->_old_entries.len;
+	for (; it->_slot < len; ++it->_slot) {
+		/* slots are in order, but their keys are not */
+		if (it->_slot + _SCAN_AHEAD < len) {
+			const _Entry* ahead = _table_slot(t, it->_slot + _SCAN_AHEAD);
+			if (ahead->val_idx != _NONE && ahead->val_idx != _MOVED
+			    && ahead->key_len > MAP_INLINE_KEY) {
+				__builtin_prefetch(_entry_key(t, ahead));
+			}
+		}
+		const _Entry* e = _table_slot(t, it->_slot);
+		if (e->val_idx != _NONE && e->val_idx != _MOVED) {
+			++it->_slot;
+			it->key     = (const char*)_entry_key(t, e);
+			it->key_len = e->key_len;
+			return it->key;
+		}
 	}
+	return NULL;
+}
 
-	memset(m->_entries.data, -1, sizeof(_Entry) * start_size);
+void
+map_construct_(
+    void* gen_m, const unsigned elem_size, size_t start_size, const unsigned props) {
+	Map* m = gen_m;
+	_table_construct(&m->_table, start_size, props);
 	vec_construct_(&m->values, elem_size);
-	vec_reserve_(&m->values, start_size / 2, elem_size);
+	vec_reserve_(&m->values, m->_table._entries.len / 2, elem_size);
+	vec_construct(&m->_table._rev);
+	vec_reserve(&m->_table._rev, m->_table._entries.len / 2);
 }
 
 void
 map_destroy(void* gen_m) {
 	Map* m = gen_m;
-	heap_free(m->_entries.data);
-	heap_free(m->_keybuf.data);
-	vec_destroy(&m->values);
+	/* an opened image holds the values too */
+	if (m->_table._image == NULL) {
+		vec_destroy(&m->values);
+	}
+	_table_destroy(&m->_table);
 }
 
 void
 map_clear(void* gen_m) {
 	Map* m = gen_m;
 	vec_clear(&m->values);
-	m->_keybuf_head = 0;
-	memset(m->_entries.data, -1, sizeof(_Entry) * m->_entries.len);
+	_table_clear(&m->_table);
+}
+
+void
+map_reserve_(void* gen_m, size_t limit, unsigned elem_size) {
+	Map* m = gen_m;
+	if (m->_table._image != NULL) {
+		return;
+	}
+	_table_reserve(&m->_table, limit);
+	vec_reserve_(&m->values, limit, elem_size);
+	vec_reserve(&m->_table._rev, limit);
+}
+
+bool
+map_compact_(void* gen_m, size_t slots, unsigned elem_size) {
+	Map* m = gen_m;
+	if (!_table_compact(&m->_table, slots)) {
+		return false;
+	}
+	if (m->_table._image == NULL) {
+		vec_shrink_to_fit_(&m->values, elem_size);
+		vec_shrink_to_fit(&m->_table._rev);
+	}
+	return true;
+}
+
+void
+map_shrink_to_fit_(void* gen_m, unsigned elem_size) {
+	while (!map_compact_(gen_m, (size_t)-1, elem_size)) {
+		/* a grow in progress finishes first */
+	}
 }
 
-uint32_t
+map_idx
 _map_declare(void* gen_m, const char* restrict key, unsigned n) {
 	Map*     m    = gen_m;
-	uint64_t hash = 0;
-	_Entry*  e    = _get_entry(&m->_entries,
-            &m->_keybuf,
-            m->hash__,
-            m->_keybuf_head,
-            key,
-            &n,
-            &hash);
+	uint64_t hash = m->_table.hash__(key, &n, m->_table.seed);
+	return _map_declare_hashed(m, key, n, hash);
+}
+
+map_idx
+_map_declare_hashed(void* gen_m, const char* restrict key, unsigned n, uint64_t hash) {
+	Map*    m = gen_m;
+	_Table* t = &m->_table;
+	_Entry* e = _table_find(t, key, n, hash);
 
 	if (e->val_idx != _NONE) {
 		return e->val_idx;
 	}
 
 	/* new value at this point */
-	e->key_idx = m->_keybuf_head;
-	e->key_len = n;
 	e->val_idx = m->values.len;
 	e->hash    = hash;
-	m->_keybuf_head += n;
-	if (m->values.len > _FULL_PERCENT * m->_entries.len) {
-		_map_grow_entries(&m->_entries);
-	}
+	_table_store_key(t, e, key, n);
+	_table_occupy(t, e);
 	return _NONE;
 }
 
-uint32_t
+map_idx
 map_nset_(
     void* gen_m, const char* restrict key, unsigned n, const void* data, int elem_size) {
-	Map*     m   = gen_m;
-	uint32_t idx = _map_declare(m, key, n);
+	Map*    m   = gen_m;
+	map_idx idx = _map_declare(m, key, n);
 	if (idx == _NONE) {
 		vec_push_back_(&m->values, data, elem_size);
 	} else {
@@ -188,17 +475,11 @@ map_nset_(
 }
 
 void*
-map_nget_(void* gen_m, const char* restrict key, unsigned n, unsigned elem_size) {
-	Map* m = gen_m;
+map_nget_(const void* gen_m, const char* restrict key, unsigned n, unsigned elem_size) {
+	const Map* m = gen_m;
 
 	uint64_t hash = 0;
-	_Entry*  e    = _get_entry(&m->_entries,
-            &m->_keybuf,
-            m->hash__,
-            m->_keybuf_head,
-            key,
-            &n,
-            &hash);
+	_Entry*  e    = _get_entry(&m->_table, key, &n, &hash);
 
 	if (e->val_idx == _NONE) { /* new value */
 		return NULL;
@@ -207,135 +488,1792 @@ map_nget_(void* gen_m, const char* restrict key, unsigned n, unsigned elem_size)
 	return vec_iter_at_(&m->values, e->val_idx, elem_size);
 }
 
+size_t
+map_nget_batch_(const void* gen_m,
+                const char* const* keys,
+                const unsigned* lens,
+                size_t n,
+                void** out,
+                unsigned elem_size) {
+	const Map* m = gen_m;
+	_Entry*    found[_BATCH_WIDTH];
+	size_t     count = 0;
+	size_t     i     = 0;
+
+	for (; i < n; i += _BATCH_WIDTH) {
+		size_t width = (n - i < _BATCH_WIDTH) ? n - i : _BATCH_WIDTH;
+		_table_find_batch(&m->_table, &keys[i], lens ? &lens[i] : NULL, width, found);
+
+		/* values are one more miss, so prefetch them all first */
+		size_t j = 0;
+		for (; j < width; ++j) {
+			if (found[j]->val_idx != _NONE) {
+				__builtin_prefetch(
+				    (char*)m->values.data + (size_t)found[j]->val_idx * elem_size);
+			}
+		}
+		for (j = 0; j < width; ++j) {
+			out[i + j] = NULL;
+			if (found[j]->val_idx != _NONE) {
+				out[i + j] = vec_iter_at_(&m->values, found[j]->val_idx, elem_size);
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+bool
+map_nremove_(void* gen_m, const char* restrict key, unsigned n, unsigned elem_size) {
+	Map*     m    = gen_m;
+	uint64_t hash = 0;
+	_Entry*  e    = _get_entry(&m->_table, key, &n, &hash);
+
+	if (e->val_idx == _NONE) {
+		return false;
+	}
+	_map_remove_entry(m, e, elem_size);
+	return true;
+}
 
 void
-_map_grow_entries(_Entry_Slice* old_entries) {
-	size_t old_start_size = old_entries->len;
-	size_t new_start_size = _next_power_of_2(old_start_size + 1);
+_map_remove_entry(void* gen_m, _Entry* e, unsigned elem_size) {
+	Map*    m = gen_m;
+	_Table* t = &m->_table;
 
-	_Entry_Slice new_entries = slice_new(_Entry, new_start_size);
-	memset(new_entries.data, -1, sizeof(struct _Entry) * new_start_size);
+	/* fill the hole in values with the last value */
+	map_idx idx  = e->val_idx;
+	map_idx last = m->values.len - 1;
+	if (idx != last) {
+		vec_set_one_at_(&m->values, idx, vec_back_(&m->values, elem_size), elem_size);
+		_rev_entry(t, last)->val_idx = idx;
+		t->_rev.data[idx]            = t->_rev.data[last];
+	}
+	--m->values.len;
+	--t->_rev.len;
 
-	size_t i = 0;
-	for (; i < old_start_size; ++i) {
-		if (old_entries->data[i].val_idx == _NONE) {
-			continue;
+	_table_erase(t, e);
+}
+
+Map_Iter
+map_iter_range_(const void* gen_m, size_t begin, size_t end, unsigned elem_size) {
+	const Map* m = gen_m;
+	if (end > (size_t)m->values.len) {
+		end = m->values.len;
+	}
+	return (Map_Iter) {
+	    ._table     = &m->_table,
+	    ._values    = m->values.data,
+	    ._elem_size = elem_size,
+	    ._next      = begin,
+	    ._end       = end,
+	    .idx        = _NONE,
+	};
+}
+
+void*
+map_iter_next(Map_Iter* it) {
+	if (it->_next >= it->_end) {
+		return NULL;
+	}
+
+	/**
+	 * values and _rev are read in order, but each entry is
+	 * wherever its key hashed to, and a long key is elsewhere
+	 * again. Fetch entries ahead, then the keys of entries
+	 * fetched earlier, so neither waits on the other.
+	 */
+	const _Table* t = it->_table;
+	if (it->_next + _SCAN_AHEAD < it->_end) {
+		map_idx slot = t->_rev.data[it->_next + _SCAN_AHEAD];
+		if (slot < (map_idx)t->_entries.len) {
+			__builtin_prefetch(&t->_entries.data[slot]);
+		}
+	}
+	if (it->_next + _SCAN_AHEAD / 2 < it->_end) {
+		const _Entry* ahead = _rev_entry(t, it->_next + _SCAN_AHEAD / 2);
+		if (ahead->key_len > MAP_INLINE_KEY) {
+			__builtin_prefetch(_entry_key(t, ahead));
 		}
+	}
+
+	it->idx         = it->_next++;
+	const _Entry* e = _rev_entry(t, it->idx);
+	it->key         = (const char*)_entry_key(t, e);
+	it->key_len     = e->key_len;
+	return it->_values + (size_t)it->_elem_size * it->idx;
+}
+
+struct _Map_Scan {
+	Map_Iter it;
+	map_scan_fn fn;
+	void* data;
+	unsigned range;
+	pthread_t thread;
+	bool started;
+};
 
-		size_t idx = (size_t)(old_entries->data[i].hash & (new_start_size - 1));
-		struct _Entry* dest_entry = &new_entries.data[idx];
+unsigned
+map_scan_(const void* gen_m, unsigned threads, map_scan_fn fn, void* data, unsigned elem_size) {
+	const Map* m   = gen_m;
+	size_t     len = m->values.len;
+	if (threads > 64) {
+		threads = 64;
+	}
+	if (threads <= 1 || len < 4096 * (size_t)threads) {
+		Map_Iter it = map_iter_range_(m, 0, len, elem_size);
+		fn(&it, 0, data);
+		return 1;
+	}
 
-		while (dest_entry->val_idx != _NONE) {
-			idx        = (idx + 1) % new_start_size;
-			dest_entry = &new_entries.data[idx];
+	/* 64 values at a time, so ranges seldom write to one line */
+	struct _Map_Scan scans[64];
+	size_t           chunk = ((len + threads - 1) / threads + 63) & ~(size_t)63;
+	unsigned         i     = 0;
+	for (; i < threads; ++i) {
+		size_t begin   = chunk * i;
+		size_t end     = (i == threads - 1) ? len : begin + chunk;
+		scans[i].it    = map_iter_range_(m, begin, end, elem_size);
+		scans[i].fn    = fn;
+		scans[i].data  = data;
+		scans[i].range = i;
+		/* without a thread, the range is scanned here */
+		scans[i].started = (pthread_create(&scans[i].thread, NULL, _map_scan_range, &scans[i]) == 0);
+		if (!scans[i].started) {
+			_map_scan_range(&scans[i]);
+		}
+	}
+	for (i = 0; i < threads; ++i) {
+		if (scans[i].started) {
+			pthread_join(scans[i].thread, NULL);
 		}
-		*dest_entry = old_entries->data[i];
 	}
+	return threads;
+}
 
-	heap_free(old_entries->data);
-	*old_entries = new_entries;
+#ifdef MAP_STATS
+void
+map_stats_(const void* gen_m, Map_Stats* out, unsigned elem_size) {
+	const Map* m = gen_m;
+	_table_stats(&m->_table, out);
+	out->values_used  = (size_t)m->values.len * elem_size;
+	out->values_alloc = (size_t)m->values._cap * elem_size;
 }
 
-uint64_t
-_hash(uint8_t* keybuf, const char* restrict key, unsigned* n) {
-	uint64_t hash = _FNV1_INIT;
-	unsigned i    = 0;
+void
+set_stats(const Set* restrict s, Map_Stats* out) {
+	_table_stats(&s->_table, out);
+}
 
-	for (; i < *n; ++i, ++keybuf) {
-		*keybuf = key[i];
-		hash *= _PRIME;
-		hash ^= (uint64_t)*keybuf;
+void
+map_stats_print(const Map_Stats* s, FILE* f) {
+	size_t slots = (s->slots != 0) ? s->slots : 1;
+	fprintf(f, "size %zu, slots %zu (%.1f%% full), tombstones %zu\n",
+	        s->size, s->slots, 100.0 * s->size / slots, s->tombs);
+	fprintf(f, "clusters %zu, longest %zu, average %.2f\n",
+	        s->clusters, s->max_cluster,
+	        (s->clusters != 0) ? (double)(s->size + s->tombs) / s->clusters : 0.0);
+	fprintf(f, "grows %zu, %.3f ms\n", s->grows, s->grow_seconds * 1e3);
+
+	fprintf(f, "%-8s %12s %12s\n", "probes", "hits", "misses");
+	unsigned i = 0;
+	for (; i < MAP_STATS_PROBES; ++i) {
+		if (s->hit_probes[i] == 0 && s->miss_probes[i] == 0) {
+			continue;
+		}
+		fprintf(f, "%7u%c %12zu %12zu\n",
+		        i + 1, (i + 1 == MAP_STATS_PROBES) ? '+' : ' ',
+		        s->hit_probes[i], s->miss_probes[i]);
 	}
 
-	return hash;
+	fprintf(f, "%-8s %12s %12s\n", "bytes", "used", "allocated");
+	fprintf(f, "%-8s %12zu %12zu\n", "entries", s->entries_used, s->entries_alloc);
+	fprintf(f, "%-8s %12zu %12zu (%zu removed)\n",
+	        "keybuf", s->keybuf_used, s->keybuf_alloc, s->keybuf_waste);
+	fprintf(f, "%-8s %12zu %12zu\n", "values", s->values_used, s->values_alloc);
 }
+#endif /* MAP_STATS */
 
-uint64_t
-_hash_nocase(uint8_t* keybuf, const char* restrict key, unsigned* n) {
-	uint64_t hash = _FNV1_INIT;
-	unsigned i    = 0;
 
-	for (; i < *n; ++i, ++keybuf) {
-		*keybuf = tolower(key[i]);
-		hash *= _PRIME;
-		hash ^= (uint64_t)*keybuf;
+void
+multimap_construct_(void* gen_m, const unsigned elem_size, size_t start_size, const unsigned props) {
+	Multimap* m = gen_m;
+	map_construct(&m->_map, start_size, props);
+	m->_runs      = (Byte_Slice)slice_new(uint8_t, 64 + start_size * elem_size);
+	m->_runs_head = 0;
+	memset(m->_free_runs, -1, sizeof(m->_free_runs));
+}
+
+void
+multimap_destroy(void* gen_m) {
+	Multimap* m = gen_m;
+	map_destroy(&m->_map);
+	heap_free(m->_runs.data);
+}
+
+void
+multimap_clear(void* gen_m) {
+	Multimap* m = gen_m;
+	map_clear(&m->_map);
+	m->_runs_head = 0;
+	memset(m->_free_runs, -1, sizeof(m->_free_runs));
+}
+
+void
+multimap_nset_(
+    void* gen_m, const char* restrict key, unsigned n, const void* data, unsigned elem_size) {
+	Multimap* m   = gen_m;
+	map_idx   idx = _map_declare(&m->_map, key, n);
+
+	struct _Multi_Group* group = NULL;
+	if (idx == _NONE) {
+		uint64_t run = _multi_new_run(m, _MULTI_RUN_MIN, elem_size);
+		group        = vec_add_one(&m->_map.values);
+		*group       = (struct _Multi_Group) {run, run, 0, 0, _MULTI_RUN_MIN};
+	} else {
+		group = &m->_map.values.data[idx];
 	}
 
-	return hash;
+	if (group->tail_len == group->tail_cap && group->tail_cap < _MULTI_RUN_CHAIN) {
+		/* still small: move to a run twice the size */
+		uint64_t run = _multi_new_run(m, group->tail_cap * 2, elem_size);
+		memcpy(&m->_runs.data[run + sizeof(struct _Multi_Run)],
+		       &m->_runs.data[group->tail + sizeof(struct _Multi_Run)],
+		       (size_t)group->count * elem_size);
+		_multi_free_run(m, group->tail);
+		group->head = run;
+		group->tail = run;
+		group->tail_cap *= 2;
+	} else if (group->tail_len == group->tail_cap) {
+		uint32_t cap = (group->tail_cap < _MULTI_RUN_MAX) ? group->tail_cap * 2 : group->tail_cap;
+		uint64_t run = _multi_new_run(m, cap, elem_size);
+		((struct _Multi_Run*)&m->_runs.data[group->tail])->next = run;
+		group->tail     = run;
+		group->tail_len = 0;
+		group->tail_cap = cap;
+	}
+
+	uint8_t* values = &m->_runs.data[group->tail + sizeof(struct _Multi_Run)];
+	memcpy(values + (size_t)group->tail_len * elem_size, data, elem_size);
+	++group->tail_len;
+	++group->count;
 }
 
-uint64_t
-_hash_rtrim(uint8_t* keybuf, const char* restrict key, unsigned* n) {
-	unsigned last_not_space_n    = *n;
-	uint64_t hash                = _FNV1_INIT;
-	uint64_t last_not_space_hash = hash;
-	unsigned i                   = 0;
+Multimap_Iter
+multimap_nget_(const void* gen_m, const char* restrict key, unsigned n, unsigned elem_size) {
+	const Multimap* m = gen_m;
 
-	for (; i < *n; ++i, ++keybuf) {
-		*keybuf = key[i];
-		hash *= _PRIME;
-		hash ^= (uint64_t)*keybuf;
-		if (*keybuf != ' ') {
-			last_not_space_hash = hash;
-			last_not_space_n    = i + 1;
-		}
+	Multimap_Iter it = {
+	    ._runs      = m->_runs.data,
+	    ._run       = _MULTI_END,
+	    ._elem_size = elem_size,
+	};
+
+	const struct _Multi_Group* group = map_nget(&m->_map, key, n);
+	if (group != NULL) {
+		it._run  = group->head;
+		it._left = group->count;
+		it.count = group->count;
+	}
+	return it;
+}
+
+void*
+multimap_iter_next(Multimap_Iter* it) {
+	if (it->_left == 0) {
+		return NULL;
 	}
+	const struct _Multi_Run* run = (const struct _Multi_Run*)&it->_runs[it->_run];
+	if (it->_idx == run->cap) {
+		it->_run = run->next;
+		it->_idx = 0;
+		run      = (const struct _Multi_Run*)&it->_runs[it->_run];
+	}
+	--it->_left;
+	return (uint8_t*)(run + 1) + (size_t)it->_idx++ * it->_elem_size;
+}
 
-	*n = last_not_space_n;
-	return last_not_space_hash;
+void*
+multimap_iter_run(Multimap_Iter* it, unsigned* len) {
+	if (it->_left == 0) {
+		*len = 0;
+		return NULL;
+	}
+	const struct _Multi_Run* run = (const struct _Multi_Run*)&it->_runs[it->_run];
+
+	/* A group this small is one run, so the length is known
+	 * without waiting on the run header. Scans of many small
+	 * groups can then overlap their misses.
+	 */
+	if (it->_idx == 0 && it->_left <= _MULTI_RUN_CHAIN) {
+		*len      = it->_left;
+		it->_left = 0;
+		return (uint8_t*)(run + 1);
+	}
+
+	if (it->_idx == run->cap) {
+		it->_run = run->next;
+		it->_idx = 0;
+		run      = (const struct _Multi_Run*)&it->_runs[it->_run];
+	}
+	*len = run->cap - it->_idx;
+	if (*len > it->_left) {
+		*len = it->_left;
+	}
+	void* values = (uint8_t*)(run + 1) + (size_t)it->_idx * it->_elem_size;
+	it->_left -= *len;
+	it->_idx += *len;
+	return values;
 }
 
+/* Small runs come from the free lists first */
+static inline unsigned
+_multi_free_list(uint32_t cap) {
+	return __builtin_ctz(cap) - __builtin_ctz(_MULTI_RUN_MIN);
+}
+
+/* Carve a run out of _runs. Runs start on 16 byte boundaries. */
 uint64_t
-_hash_nocase_rtrim(uint8_t* keybuf, const char* restrict key, unsigned* n) {
-	unsigned last_not_space_n    = *n;
-	uint64_t hash                = _FNV1_INIT;
-	uint64_t last_not_space_hash = hash;
-	unsigned i                   = 0;
+_multi_new_run(Multimap* m, uint32_t cap, unsigned elem_size) {
+	uint64_t off = _MULTI_END;
+	if (cap < _MULTI_RUN_CHAIN) {
+		uint64_t* free_run = &m->_free_runs[_multi_free_list(cap)];
+		if (*free_run != _MULTI_END) {
+			off       = *free_run;
+			*free_run = ((struct _Multi_Run*)&m->_runs.data[off])->next;
+		}
+	}
 
-	for (; i < *n; ++i, ++keybuf) {
-		*keybuf = tolower(key[i]);
-		hash *= _PRIME;
-		hash ^= (uint64_t)*keybuf;
-		if (*keybuf != ' ') {
-			last_not_space_hash = hash;
-			last_not_space_n    = i + 1;
+	if (off == _MULTI_END) {
+		off         = (m->_runs_head + 15) & ~(uint64_t)15;
+		size_t size = sizeof(struct _Multi_Run) + (size_t)cap * elem_size;
+		while (off + size > (size_t)m->_runs.len) {
+			m->_runs.len *= 2;
+			m->_runs.data = heap_resize(m->_runs.data, m->_runs.len);
 		}
+		m->_runs_head = off + size;
 	}
 
-	*n = last_not_space_n;
-	return last_not_space_hash;
+	struct _Multi_Run* run = (struct _Multi_Run*)&m->_runs.data[off];
+	*run                   = (struct _Multi_Run) {_MULTI_END, cap};
+	return off;
+}
+
+void
+_multi_free_run(Multimap* m, uint64_t off) {
+	struct _Multi_Run* run      = (struct _Multi_Run*)&m->_runs.data[off];
+	uint64_t*          free_run = &m->_free_runs[_multi_free_list(run->cap)];
+	run->next                   = *free_run;
+	*free_run                   = off;
 }
 
 
+map_idx
+_compositemap_declare(void* gen_m, const Const_Char_Slice* fields, unsigned count) {
+	Map*    m = gen_m;
+	_Table* t = &m->_table;
+
+	unsigned       lens[count + 1];
+	unsigned       n    = 0;
+	uint64_t       hash = _fields_hash(t, fields, count, lens, &n);
+	struct _Fields key  = {fields, lens, count};
+	_Entry*        e    = _table_find_fields(t, &key, n, hash);
+
+	if (e->val_idx != _NONE) {
+		return e->val_idx;
+	}
+
+	/* new value at this point */
+	e->val_idx = m->values.len;
+	e->hash    = hash;
+	_table_store_fields(t, e, &key, n);
+	_table_occupy(t, e);
+	return _NONE;
+}
+
+void*
+compositemap_nget_(const void*             gen_m,
+                   const Const_Char_Slice* fields,
+                   unsigned                count,
+                   unsigned                elem_size) {
+	const Map* m = gen_m;
+
+	unsigned       lens[count + 1];
+	unsigned       n    = 0;
+	uint64_t       hash = _fields_hash(&m->_table, fields, count, lens, &n);
+	struct _Fields key  = {fields, lens, count};
+	_Entry*        e    = _table_find_fields(&m->_table, &key, n, hash);
+
+	if (e->val_idx == _NONE) {
+		return NULL;
+	}
+	return vec_iter_at_(&m->values, e->val_idx, elem_size);
+}
+
+bool
+compositemap_nremove_(void*                   gen_m,
+                      const Const_Char_Slice* fields,
+                      unsigned                count,
+                      unsigned                elem_size) {
+	Map* m = gen_m;
+
+	unsigned       lens[count + 1];
+	unsigned       n    = 0;
+	uint64_t       hash = _fields_hash(&m->_table, fields, count, lens, &n);
+	struct _Fields key  = {fields, lens, count};
+	_Entry*        e    = _table_find_fields(&m->_table, &key, n, hash);
+
+	if (e->val_idx == _NONE) {
+		return false;
+	}
+	_map_remove_entry(m, e, elem_size);
+	return true;
+}
+
+
+/* Table */
+void
+_table_construct(_Table* t, size_t start_size, const unsigned props) {
+	if (props & MAP_PROP_GROUP && start_size < _GROUP_WIDTH) {
+		start_size = _GROUP_WIDTH;
+	}
+	start_size = _next_power_of_2(start_size);
+	*t         = (_Table) {
+            ._entries = slice_new(_Entry, start_size),
+            ._keybuf  = slice_new(char, start_size),
+            .props    = props,
+        };
+
+	t->hash__ = _table_hash_fn(props);
+	if (props & MAP_PROP_FASTHASH) {
+		t->seed = _map_seed(t);
+	}
+
+	memset(t->_entries.data, -1, sizeof(_Entry) * start_size);
+	if (props & MAP_PROP_GROUP) {
+		t->_ctrl = heap_alloc(start_size + _GROUP_WIDTH);
+		memset(t->_ctrl, _CTRL_EMPTY, start_size + _GROUP_WIDTH);
+	}
+#ifdef MAP_STATS
+	t->_stats = heap_alloc(sizeof(*t->_stats));
+	memset(t->_stats, 0, sizeof(*t->_stats));
+#endif
+}
+
+hash_fn
+_table_hash_fn(unsigned props) {
+	switch (props & (MAP_PROP_NOCASE | MAP_PROP_RTRIM | MAP_PROP_FASTHASH)) {
+	case MAP_PROP_NOCASE:
+		return _hash_nocase;
+	case MAP_PROP_RTRIM:
+		return _hash_rtrim;
+	case MAP_PROP_NOCASE | MAP_PROP_RTRIM:
+		return _hash_nocase_rtrim;
+	case MAP_PROP_FASTHASH:
+		return _hash_fast;
+	case MAP_PROP_FASTHASH | MAP_PROP_NOCASE:
+		return _hash_fast_nocase;
+	case MAP_PROP_FASTHASH | MAP_PROP_RTRIM:
+		return _hash_fast_rtrim;
+	case MAP_PROP_FASTHASH | MAP_PROP_NOCASE | MAP_PROP_RTRIM:
+		return _hash_fast_nocase_rtrim;
+	default:
+		return _hash;
+	}
+}
+
+void
+_table_destroy(_Table* t) {
+#ifdef MAP_STATS
+	heap_free(t->_stats);
+#endif
+	if (t->_image != NULL) {
+		munmap(t->_image, t->_image_len);
+		return;
+	}
+	heap_free(t->_entries.data);
+	heap_free(t->_ctrl);
+	heap_free(t->_old_entries.data);
+	heap_free(t->_old_ctrl);
+	heap_free(t->_next_entries.data);
+	heap_free(t->_next_ctrl);
+	heap_free(t->_keybuf.data);
+	heap_free(t->_old_keybuf.data);
+	vec_destroy(&t->_rev);
+}
+
+void
+_table_clear(_Table* t) {
+	heap_free(t->_old_entries.data);
+	heap_free(t->_old_ctrl);
+	t->_old_entries.len = 0;
+	heap_free(t->_old_keybuf.data);
+	t->_old_keybuf.len = 0;
+	heap_free(t->_next_entries.data);
+	heap_free(t->_next_ctrl);
+	t->_next_entries.len = 0;
+	t->_keybuf_head  = 0;
+	t->_keybuf_waste = 0;
+	t->_rev.len      = 0;
+	t->_tombs        = 0;
+	t->size          = 0;
+	memset(t->_entries.data, -1, sizeof(_Entry) * t->_entries.len);
+	if (t->_ctrl != NULL) {
+		memset(t->_ctrl, _CTRL_EMPTY, t->_entries.len + _GROUP_WIDTH);
+	}
+}
+
+#ifdef MAP_STATS
+static double
+_stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Lookups only read the table, so the counters are atomic */
+static inline void
+_stats_probe(const _Table* t, size_t probes, bool hit) {
+	if (t->_stats == NULL) {
+		return; /* opened by map_open */
+	}
+	if (probes > MAP_STATS_PROBES) {
+		probes = MAP_STATS_PROBES;
+	}
+	size_t* hist = (hit) ? t->_stats->hit_probes : t->_stats->miss_probes;
+	__atomic_fetch_add(&hist[probes - 1], 1, __ATOMIC_RELAXED);
+}
+
+static bool
+_stats_taken(const _Table* t, size_t idx) {
+	if (t->_ctrl != NULL) {
+		return t->_ctrl[idx] != _CTRL_EMPTY;
+	}
+	return t->_entries.data[idx].val_idx != _NONE;
+}
+
+void
+_table_stats(const _Table* t, Map_Stats* out) {
+	*out = (Map_Stats) {0};
+	if (t->_stats != NULL) {
+		*out = *t->_stats;
+	}
+	out->size  = t->size;
+	out->slots = t->_entries.len;
+	out->tombs = t->_tombs;
+
+	/* start after a free slot so no cluster wraps around */
+	size_t len   = t->_entries.len;
+	size_t start = 0;
+	while (start < len && _stats_taken(t, start)) {
+		++start;
+	}
+	if (start == len) {
+		out->clusters    = 1;
+		out->max_cluster = len;
+	} else {
+		size_t run = 0;
+		size_t i   = 1;
+		for (; i <= len; ++i) {
+			if (_stats_taken(t, (start + i) & (len - 1))) {
+				++run;
+				continue;
+			}
+			if (run != 0) {
+				++out->clusters;
+				out->max_cluster = (run > out->max_cluster) ? run : out->max_cluster;
+				run              = 0;
+			}
+		}
+	}
+
+	size_t ctrl = (t->_ctrl != NULL);
+	out->entries_used = t->size * (sizeof(_Entry) + ctrl) + t->_rev.len * sizeof(map_idx);
+	out->entries_alloc = (len + t->_old_entries.len + t->_next_entries.len) * sizeof(_Entry)
+	                   + (size_t)t->_rev._cap * sizeof(map_idx);
+	if (t->_ctrl != NULL) {
+		out->entries_alloc += len + _GROUP_WIDTH;
+	}
+	if (t->_old_ctrl != NULL) {
+		out->entries_alloc += t->_old_entries.len + _GROUP_WIDTH;
+	}
+	if (t->_next_ctrl != NULL) {
+		out->entries_alloc += t->_next_entries.len + _GROUP_WIDTH;
+	}
+	out->keybuf_used  = t->_keybuf_head - t->_keybuf_waste;
+	out->keybuf_waste = t->_keybuf_waste;
+	out->keybuf_alloc = t->_keybuf.len + t->_old_keybuf.len;
+}
+#else
+#define _stats_probe(T_, PROBES_, HIT_) (void)(PROBES_)
+#endif /* MAP_STATS */
+
+/* Control bytes */
+#define _ctrl_tag(HASH_) ((int8_t)((HASH_) >> 57))
+
+/* bit i is set if byte i of the group equals tag */
+static inline unsigned
+_group_match(const int8_t* group, int8_t tag) {
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+	unsigned mask = 0;
+	unsigned i    = 0;
+	for (; i < _GROUP_WIDTH; ++i) {
+		mask |= (unsigned)(group[i] == tag) << i;
+	}
+	return mask;
+#endif
+}
+
+/* bit i is set if byte i of the group is empty or deleted */
+static inline unsigned
+_group_free(const int8_t* group) {
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	unsigned mask = 0;
+	unsigned i    = 0;
+	for (; i < _GROUP_WIDTH; ++i) {
+		mask |= (unsigned)(group[i] < 0) << i;
+	}
+	return mask;
+#endif
+}
+
+static inline void
+_set_ctrl(_Table* t, size_t idx, int8_t tag) {
+	t->_ctrl[idx] = tag;
+	if (idx < _GROUP_WIDTH) {
+		t->_ctrl[t->_entries.len + idx] = tag;
+	}
+}
+
+/* first empty slot on the probe sequence of hash */
+static size_t
+_free_slot(const _Table* t, uint64_t hash) {
+	size_t mask = t->_entries.len - 1;
+	size_t idx  = (size_t)(hash & mask);
+
+	if (t->_ctrl == NULL) {
+		while (t->_entries.data[idx].val_idx != _NONE) {
+			idx = (idx + 1) & mask;
+		}
+		return idx;
+	}
+
+	size_t step = 0;
+	for (;;) {
+		unsigned empty = _group_match(&t->_ctrl[idx], _CTRL_EMPTY);
+		if (empty) {
+			return (idx + __builtin_ctz(empty)) & mask;
+		}
+		step += _GROUP_WIDTH;
+		idx = (idx + step) & mask;
+	}
+}
+
+/* Size the filter for the table's capacity and add every key */
+void
+_set_build_filter(Set* s, double fp_rate) {
+	_Table* t = &s->_table;
+	bloom_construct(s->_filter, t->_entries.len * _FULL_PERCENT, fp_rate);
+
+	const _Entry_Slice tables[] = {t->_entries, t->_old_entries};
+	unsigned           j        = 0;
+	for (; j < ARRAY_LEN(tables); ++j) {
+		ssize_t i = 0;
+		for (; i < tables[j].len; ++i) {
+			const _Entry* e = &tables[j].data[i];
+			if (e->val_idx != _NONE && e->val_idx != _MOVED) {
+				bloom_add_hash(s->_filter, e->hash);
+			}
+		}
+	}
+}
+
+void
+_set_filter_add(Set* s, uint64_t hash) {
+	if (s->_filter == NULL) {
+		return;
+	}
+	if (s->_table.size > s->_filter->capacity) {
+		/* the table has grown, so size the filter to match */
+		double fp_rate = s->_filter->fp_rate;
+		bloom_destroy(s->_filter);
+		_set_build_filter(s, fp_rate);
+	} else {
+		bloom_add_hash(s->_filter, hash);
+	}
+}
+
+bool
+_set_alike(const Set* a, const Set* b, const char* name) {
+	const unsigned keyed = MAP_PROP_NOCASE | MAP_PROP_RTRIM;
+	if ((a->_table.props ^ b->_table.props) & keyed) {
+		fprintf(stderr, "%s: key props differ\n", name);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Slot i of a table, counting the slots of the old table of
+ * MAP_PROP_INCREMENTAL after the current ones.
+ */
+static inline const _Entry*
+_table_slot(const _Table* t, size_t i) {
+	if (i < (size_t)t->_entries.len) {
+		return &t->_entries.data[i];
+	}
+	return &t->_old_entries.data[i - t->_entries.len];
+}
+
+/* e's hash as t computes it */
+static inline uint64_t
+_table_rehash_entry(const _Table* t, const _Table* src, const _Entry* e) {
+	if (t->hash__ == src->hash__ && t->seed == src->seed) {
+		return e->hash;
+	}
+	/* stored keys are folded and trimmed, so n stays put */
+	unsigned n = e->key_len;
+	return t->hash__((const char*)_entry_key(src, e), &n, t->seed);
+}
+
+/* Add e, a key of src that s does not have */
+void
+_set_add_new(Set* s, const _Table* src, const _Entry* e) {
+	_Table*  t    = &s->_table;
+	uint64_t hash = _table_rehash_entry(t, src, e);
+	_Entry*  slot = &t->_entries.data[_free_slot(t, hash)];
+	slot->val_idx = 0;
+	slot->hash    = hash;
+	_table_copy_key(t, slot, _entry_key(src, e), e->key_len);
+	_table_occupy(t, slot);
+	_set_filter_add(s, hash);
+}
+
+struct _Set_Scan {
+	const _Table* src;
+	const _Table* other;
+	uint64_t* bits;
+	size_t begin;
+	size_t end;
+	bool mark_other;
+	pthread_t thread;
+	bool started;
+};
+
+static void*
+_set_scan_range(void* arg) {
+	struct _Set_Scan* scan = arg;
+	size_t            i    = scan->begin;
+	for (; i < scan->end; ++i) {
+		/**
+		 * Slots are walked in hash order, so their keys are all
+		 * over _keybuf. Fetch ahead to keep the reads of keys
+		 * and of other from waiting on each other.
+		 */
+		if (i + _SCAN_AHEAD < scan->end) {
+			const _Entry* ahead = _table_slot(scan->src, i + _SCAN_AHEAD);
+			if (ahead->val_idx != _NONE && ahead->val_idx != _MOVED
+			    && ahead->key_len > MAP_INLINE_KEY) {
+				__builtin_prefetch(&scan->src->_keybuf.data[ahead->key_idx]);
+			}
+		}
+
+		const _Entry* e = _table_slot(scan->src, i);
+		if (e->val_idx == _NONE || e->val_idx == _MOVED) {
+			continue;
+		}
+		uint64_t       hash  = _table_rehash_entry(scan->other, scan->src, e);
+		const uint8_t* key   = _entry_key(scan->src, e);
+		_Entry*        found = _table_find_stored(scan->other, key, e->key_len, hash);
+		if (found->val_idx == _NONE) {
+			continue;
+		}
+		if (!scan->mark_other) {
+			scan->bits[i / 64] |= (uint64_t)1 << (i % 64);
+			continue;
+		}
+		/* another thread may be marking the same word */
+		size_t idx = found - scan->other->_entries.data;
+		__atomic_fetch_or(&scan->bits[idx / 64], (uint64_t)1 << (idx % 64), __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void*
+_map_scan_range(void* arg) {
+	struct _Map_Scan* scan = arg;
+	scan->fn(&scan->it, scan->range, scan->data);
+	return NULL;
+}
+
+/**
+ * Look up every key of src in other. Set bit i of bits if the
+ * key in src slot i is found or, with mark_other, the bit of
+ * the slot it is found in. mark_other needs other to be done
+ * migrating. Ranges are split on whole words of bits.
+ */
+void
+_set_scan(const _Table* src, const _Table* other, uint64_t* bits, bool mark_other, unsigned threads) {
+	size_t len = src->_entries.len + src->_old_entries.len;
+	size_t out = (mark_other) ? (size_t)other->_entries.len : len;
+	memset(bits, 0, (out + 63) / 64 * sizeof(*bits));
+
+	if (threads > 64) {
+		threads = 64;
+	}
+	if (threads <= 1 || len < 4096 * (size_t)threads) {
+		struct _Set_Scan scan = {src, other, bits, 0, len, mark_other, 0, false};
+		_set_scan_range(&scan);
+		return;
+	}
+
+	struct _Set_Scan scans[64];
+	size_t           chunk = (len / threads + 63) & ~(size_t)63;
+	unsigned         i     = 0;
+	for (; i < threads; ++i) {
+		size_t begin = chunk * i;
+		size_t end   = (begin + chunk < len) ? begin + chunk : len;
+		scans[i]     = (struct _Set_Scan) {src, other, bits, begin, end, mark_other, 0, false};
+		/* as in map_scan_, a range without a thread runs here */
+		scans[i].started = (pthread_create(&scans[i].thread, NULL, _set_scan_range, &scans[i]) == 0);
+		if (!scans[i].started) {
+			_set_scan_range(&scans[i]);
+		}
+	}
+	for (i = 0; i < threads; ++i) {
+		if (scans[i].started) {
+			pthread_join(scans[i].thread, NULL);
+		}
+	}
+}
+
+/**
+ * Erase the keys whose bit is marked (or whose bit is clear if
+ * marked is false). s must be done migrating. Linear probing
+ * shifts entries back into erased slots, so walk backwards
+ * from an empty slot: anything shifted has been seen already.
+ */
+void
+_set_erase_marked(Set* s, const uint64_t* bits, bool marked) {
+	_Table* t     = &s->_table;
+	size_t  len   = t->_entries.len;
+	size_t  start = 0;
+	if (t->_ctrl == NULL) {
+		while (t->_entries.data[start].val_idx != _NONE) {
+			++start;
+		}
+	}
+
+	size_t k = 1;
+	for (; k <= len; ++k) {
+		size_t  i = (start + len - k) & (len - 1);
+		_Entry* e = &t->_entries.data[i];
+		if (e->val_idx != _NONE && (bool)(bits[i / 64] >> (i % 64) & 1) == marked) {
+			_table_erase(t, e);
+		}
+	}
+}
+
+static inline void
+_table_reserve_keys(_Table* t, unsigned n) {
+	while (t->_keybuf_head + n > (size_t)t->_keybuf.len) {
+		t->_keybuf.len *= 2;
+		t->_keybuf.data = heap_resize(t->_keybuf.data, t->_keybuf.len);
+	}
+}
+
+/* Where n bytes of e's new key go. Sets e->key_len. */
+static inline uint8_t*
+_table_key_dest(_Table* t, _Entry* e, unsigned n) {
+	e->key_len = n;
+	if (n <= MAP_INLINE_KEY) {
+		/* whole, so images written by map_save do not vary */
+		memset(e->_key, 0, sizeof(e->_key));
+		return e->_key;
+	}
+	_table_reserve_keys(t, n);
+	e->key_idx = t->_keybuf_head;
+	t->_keybuf_head += n;
+	return &t->_keybuf.data[e->key_idx];
+}
+
+/* Copy a new key into e or the key buffer */
+void
+_table_store_key(_Table* t, _Entry* e, const char* key, unsigned n) {
+	uint8_t* dest = _table_key_dest(t, e, n);
+	if (t->props & MAP_PROP_NOCASE) {
+		unsigned i = 0;
+		for (; i < n; ++i) {
+			dest[i] = _fold_byte(key[i]);
+		}
+	} else {
+		memcpy(dest, key, n);
+	}
+}
+
+/* Copy a key stored by another table, so already folded */
+void
+_table_copy_key(_Table* t, _Entry* e, const uint8_t* key, unsigned n) {
+	memcpy(_table_key_dest(t, e, n), key, n);
+}
+
+/**
+ * Leave an old table entry that probes step over but never
+ * match. Its control byte, if any, stays full for the same
+ * reason.
+ */
+static inline void
+_bury(_Entry* e) {
+	memset(e, -1, sizeof(*e));
+	e->val_idx = _MOVED;
+}
+
+static inline bool
+_in_old(const _Table* t, const _Entry* e) {
+	return e >= t->_old_entries.data && e < t->_old_entries.data + t->_old_entries.len;
+}
+
+const uint8_t*
+_entry_key(const _Table* t, const _Entry* e) {
+	if (e->key_len <= MAP_INLINE_KEY) {
+		return e->_key;
+	}
+	if (t->_old_keybuf.data != NULL && _in_old(t, e)) {
+		return &t->_old_keybuf.data[e->key_idx];
+	}
+	return &t->_keybuf.data[e->key_idx];
+}
+
+/**
+ * Entry of a map value. While migrating, _rev may point into
+ * either table. The new table wins if its slot holds the value.
+ */
+_Entry*
+_rev_entry(const _Table* t, map_idx val_idx) {
+	map_idx slot = t->_rev.data[val_idx];
+	if (t->_old_entries.data != NULL
+	    && (slot >= (map_idx)t->_entries.len || t->_entries.data[slot].val_idx != val_idx)) {
+		/* map_compact: the old table can be the larger */
+		return &t->_old_entries.data[slot];
+	}
+	return &t->_entries.data[slot];
+}
+
+static inline void
+_place(_Table* t, size_t idx, const _Entry* e) {
+	t->_entries.data[idx] = *e;
+	if (t->_rev.data != NULL) {
+		t->_rev.data[e->val_idx] = idx;
+	}
+}
+
+/* Call after filling in a new entry from _get_entry */
+void
+_table_occupy(_Table* t, _Entry* e) {
+	size_t idx = e - t->_entries.data;
+	if (t->_rev.data != NULL) {
+		*(map_idx*)vec_add_one(&t->_rev) = idx;
+	}
+	if (t->_ctrl != NULL) {
+		if (t->_ctrl[idx] == _CTRL_DELETED) {
+			--t->_tombs;
+		}
+		_set_ctrl(t, idx, _ctrl_tag(e->hash));
+	}
+	if (++t->size + t->_tombs > _FULL_PERCENT * t->_entries.len) {
+		_table_migrate(t, (size_t)-1);
+		/* mostly tombstones: clean up without growing */
+		if (t->size < _FULL_PERCENT * t->_entries.len / 2) {
+			_table_rehash(t, t->_entries.len);
+		} else {
+			_map_grow_entries(t);
+		}
+	} else if (t->_old_entries.data != NULL) {
+		_table_migrate(t, _MIGRATE_STEP);
+	} else if (t->props & MAP_PROP_INCREMENTAL && t->_entries.len >= _INCREMENTAL_MIN
+	           && t->size > _PREPARE_PERCENT * t->_entries.len) {
+		_table_prepare(t, _PREPARE_STEP);
+	}
+}
+
+/**
+ * Remove an entry returned by _get_entry. Linear probing shifts
+ * the rest of the cluster back so no tombstone is left. Group
+ * probing only needs a tombstone if the slot sits in a run of
+ * full slots that may have made a probe skip past it.
+ */
+void
+_table_erase(_Table* t, _Entry* e) {
+	size_t mask = t->_entries.len - 1;
+	size_t i    = e - t->_entries.data;
+
+	/* map_compact frees the old key buffer whole */
+	bool old_key = t->_old_keybuf.data != NULL && _in_old(t, e);
+	if (e->key_len > MAP_INLINE_KEY && !old_key) {
+		t->_keybuf_waste += e->key_len;
+		if (e->key_idx + e->key_len == t->_keybuf_head) {
+			t->_keybuf_head -= e->key_len;
+			t->_keybuf_waste -= e->key_len;
+		}
+	}
+	--t->size;
+
+	if (_in_old(t, e)) {
+		/* old table is on its way out; just keep its probes intact */
+		_bury(e);
+	} else if (t->_ctrl != NULL) {
+		unsigned empty_after  = _group_match(&t->_ctrl[i], _CTRL_EMPTY);
+		unsigned empty_before = _group_match(&t->_ctrl[(i - _GROUP_WIDTH) & mask], _CTRL_EMPTY);
+		/* longest full run through i must be shorter than a group */
+		bool was_never_full = empty_before && empty_after
+		                      && __builtin_ctz(empty_after) + __builtin_clz(empty_before)
+		                                 - (32 - _GROUP_WIDTH)
+		                             < _GROUP_WIDTH;
+		if (was_never_full) {
+			_set_ctrl(t, i, _CTRL_EMPTY);
+		} else {
+			_set_ctrl(t, i, _CTRL_DELETED);
+			++t->_tombs;
+		}
+		memset(e, -1, sizeof(*e));
+	} else {
+		size_t j = i;
+		for (;;) {
+			j = (j + 1) & mask;
+			_Entry* next = &t->_entries.data[j];
+			if (next->val_idx == _NONE) {
+				break;
+			}
+			/* next may move to i unless its home is cyclically in (i, j] */
+			size_t home = (size_t)(next->hash & mask);
+			if (((j - home) & mask) >= ((j - i) & mask)) {
+				_place(t, i, next);
+				i = j;
+			}
+		}
+		memset(&t->_entries.data[i], -1, sizeof(_Entry));
+	}
+
+	if (t->_keybuf_waste > t->_keybuf_head / 2 && t->_keybuf_head > 4096
+	    && t->_old_keybuf.data == NULL) {
+		_table_compact_keys(t);
+	}
+	if (t->_old_entries.data != NULL) {
+		_table_migrate(t, _MIGRATE_STEP);
+	}
+}
+
+/* Rewrite the key buffer without the bytes of removed keys */
+void
+_table_compact_keys(_Table* t) {
+	Byte_Slice old_keybuf = t->_keybuf;
+	size_t     len        = old_keybuf.len;
+	while (len / 2 >= t->_keybuf_head - t->_keybuf_waste && len > 16) {
+		len /= 2;
+	}
+	t->_keybuf       = (Byte_Slice)slice_new(uint8_t, len);
+	t->_keybuf_head  = 0;
+	t->_keybuf_waste = 0;
+
+	/* Maps keep the keys in value order so they stay near each other */
+	ssize_t n = (t->_rev.data != NULL) ? t->_rev.len
+	                                   : t->_entries.len + t->_old_entries.len;
+	ssize_t i = 0;
+	for (; i < n; ++i) {
+		_Entry* e = NULL;
+		if (t->_rev.data != NULL) {
+			e = _rev_entry(t, i);
+		} else if (i < t->_entries.len) {
+			e = &t->_entries.data[i];
+		} else {
+			e = &t->_old_entries.data[i - t->_entries.len];
+		}
+		if (e->val_idx == _NONE || e->val_idx == _MOVED || e->key_len <= MAP_INLINE_KEY) {
+			continue;
+		}
+		memcpy(&t->_keybuf.data[t->_keybuf_head], &old_keybuf.data[e->key_idx], e->key_len);
+		e->key_idx = t->_keybuf_head;
+		t->_keybuf_head += e->key_len;
+	}
+
+	heap_free(old_keybuf.data);
+}
+
+void
+_map_grow_entries(_Table* t) {
+#ifdef MAP_STATS
+	double start = _stats_now();
+#endif
+	/* A tiny table can be completely full here, and a probe of
+	 * the old table relies on finding an empty slot. Small tables
+	 * are cheap to move at once anyway.
+	 */
+	if (!(t->props & MAP_PROP_INCREMENTAL) || t->_entries.len < _INCREMENTAL_MIN) {
+		_table_rehash(t, t->_entries.len * 2);
+	} else {
+		/* keep the current table around and move it over bit by bit */
+		_table_prepare(t, (size_t)-1);
+		t->_old_entries  = t->_entries;
+		t->_old_ctrl     = t->_ctrl;
+		t->_migrate_idx  = 0;
+		t->_tombs        = 0;
+		t->_entries      = t->_next_entries;
+		t->_ctrl         = t->_next_ctrl;
+		t->_next_entries = (_Entry_Slice) {0};
+		t->_next_ctrl    = NULL;
+	}
+#ifdef MAP_STATS
+	++t->_stats->grows;
+	t->_stats->grow_seconds += _stats_now() - start;
+#endif
+}
+
+/**
+ * Clearing a large new table takes as long as moving into it,
+ * so MAP_PROP_INCREMENTAL clears the next one a few slots at a
+ * time before it is needed.
+ */
+void
+_table_prepare(_Table* t, size_t slots) {
+	size_t next_len = t->_entries.len * 2;
+	if (t->_next_entries.data == NULL) {
+		t->_next_entries = (_Entry_Slice)slice_new(_Entry, next_len);
+		t->_next_ready   = 0;
+		if (t->_ctrl != NULL) {
+			t->_next_ctrl = heap_alloc(next_len + _GROUP_WIDTH);
+		}
+	}
+
+	size_t begin = t->_next_ready;
+	size_t end   = begin + slots;
+	if (end > next_len || end < begin) {
+		end = next_len;
+	}
+	if (begin == end) {
+		return;
+	}
+
+	memset(&t->_next_entries.data[begin], -1, sizeof(_Entry) * (end - begin));
+	if (t->_next_ctrl != NULL) {
+		size_t ctrl_end = (end == next_len) ? end + _GROUP_WIDTH : end;
+		memset(&t->_next_ctrl[begin], _CTRL_EMPTY, ctrl_end - begin);
+	}
+	t->_next_ready = end;
+}
+
+/* Move up to slots old table slots to the new table */
+void
+_table_migrate(_Table* t, size_t slots) {
+	if (t->_old_entries.data == NULL) {
+		return;
+	}
+
+	size_t end = t->_migrate_idx + slots;
+	if (end > (size_t)t->_old_entries.len || end < t->_migrate_idx) {
+		end = t->_old_entries.len;
+	}
+
+	for (; t->_migrate_idx < end; ++t->_migrate_idx) {
+		_Entry* e = &t->_old_entries.data[t->_migrate_idx];
+		if (e->val_idx == _NONE || e->val_idx == _MOVED) {
+			continue;
+		}
+		if (t->_old_keybuf.data != NULL && e->key_len > MAP_INLINE_KEY) {
+			/* map_compact: the key moves to the new buffer too */
+			_table_copy_key(t, e, &t->_old_keybuf.data[e->key_idx], e->key_len);
+		}
+		size_t idx = _free_slot(t, e->hash);
+		if (t->_ctrl != NULL) {
+			_set_ctrl(t, idx, _ctrl_tag(e->hash));
+		}
+		_place(t, idx, e);
+		_bury(e);
+	}
+
+	if (t->_migrate_idx == (size_t)t->_old_entries.len) {
+		heap_free(t->_old_entries.data);
+		heap_free(t->_old_ctrl);
+		t->_old_entries.len = 0;
+		heap_free(t->_old_keybuf.data);
+		t->_old_keybuf.len = 0;
+	}
+}
+
+void
+_table_rehash(_Table* t, size_t new_len) {
+	_table_migrate(t, (size_t)-1);
+	heap_free(t->_next_entries.data);
+	heap_free(t->_next_ctrl);
+	t->_next_entries.len = 0;
+	_Entry_Slice old_entries = t->_entries;
+
+	t->_entries = (_Entry_Slice)slice_new(_Entry, new_len);
+	memset(t->_entries.data, -1, sizeof(struct _Entry) * new_len);
+	if (t->_ctrl != NULL) {
+		t->_ctrl = heap_resize(t->_ctrl, new_len + _GROUP_WIDTH);
+		memset(t->_ctrl, _CTRL_EMPTY, new_len + _GROUP_WIDTH);
+		t->_tombs = 0;
+	}
+
+	ssize_t i = 0;
+	for (; i < old_entries.len; ++i) {
+		if (old_entries.data[i].val_idx == _NONE) {
+			continue;
+		}
+
+		size_t idx = _free_slot(t, old_entries.data[i].hash);
+		if (t->_ctrl != NULL) {
+			_set_ctrl(t, idx, _ctrl_tag(old_entries.data[i].hash));
+		}
+		_place(t, idx, &old_entries.data[i]);
+	}
+
+	heap_free(old_entries.data);
+}
+
+/* Smallest table that holds size keys without growing */
+static size_t
+_table_fit_len(const _Table* t, size_t size) {
+	size_t len = _next_power_of_2(size / _FULL_PERCENT + 1);
+	if (t->_ctrl != NULL && len < _GROUP_WIDTH) {
+		len = _GROUP_WIDTH;
+	}
+	return len;
+}
+
+static size_t
+_keybuf_fit_len(size_t bytes) {
+	size_t len = _next_power_of_2(bytes);
+	return (len < 16) ? 16 : len;
+}
+
+/* Whether compacting would give anything back */
+static bool
+_table_loose(const _Table* t) {
+	return (size_t)t->_entries.len > _table_fit_len(t, t->size)
+	       || (size_t)t->_keybuf.len > _keybuf_fit_len(t->_keybuf_head - t->_keybuf_waste);
+}
+
+void
+_table_reserve(_Table* t, size_t limit) {
+	if (t->_image != NULL) {
+		return;
+	}
+	size_t len = _table_fit_len(t, limit);
+	if (len > (size_t)t->_entries.len) {
+		_table_rehash(t, len);
+	}
+}
+
+/**
+ * Start moving to a right sized table and key buffer, and move
+ * up to slots old slots. This is the MAP_PROP_INCREMENTAL
+ * migration, except that each key is copied to the new key
+ * buffer as its entry moves.
+ */
+bool
+_table_compact(_Table* t, size_t slots) {
+	if (t->_image != NULL) {
+		return true;
+	}
+
+	/* a grow or an earlier call is still under way */
+	if (t->_old_entries.data != NULL) {
+		_table_migrate(t, slots);
+		return t->_old_entries.data == NULL && !_table_loose(t);
+	}
+
+	heap_free(t->_next_entries.data);
+	heap_free(t->_next_ctrl);
+	t->_next_entries.len = 0;
+	if (!_table_loose(t)) {
+		return true;
+	}
+
+	size_t len      = _table_fit_len(t, t->size);
+	size_t key_len  = _keybuf_fit_len(t->_keybuf_head - t->_keybuf_waste);
+	t->_old_entries = t->_entries;
+	t->_old_ctrl    = t->_ctrl;
+	t->_old_keybuf  = t->_keybuf;
+	t->_migrate_idx = 0;
+	t->_tombs       = 0;
+
+	t->_entries = (_Entry_Slice)slice_new(_Entry, len);
+	memset(t->_entries.data, -1, sizeof(_Entry) * len);
+	if (t->_old_ctrl != NULL) {
+		t->_ctrl = heap_alloc(len + _GROUP_WIDTH);
+		memset(t->_ctrl, _CTRL_EMPTY, len + _GROUP_WIDTH);
+	}
+	t->_keybuf       = (Byte_Slice)slice_new(uint8_t, key_len);
+	t->_keybuf_head  = 0;
+	t->_keybuf_waste = 0;
+
+	_table_migrate(t, slots);
+	return t->_old_entries.data == NULL;
+}
+
+uint64_t
+_hash(const char* restrict key, unsigned* n, uint64_t seed) {
+	(void)seed;
+	uint64_t hash = _FNV1_INIT;
+	unsigned i    = 0;
+
+	for (; i < *n; ++i) {
+		hash *= _PRIME;
+		hash ^= (uint64_t)(uint8_t)key[i];
+	}
+
+	return hash;
+}
+
+uint64_t
+_hash_nocase(const char* restrict key, unsigned* n, uint64_t seed) {
+	(void)seed;
+	uint64_t hash = _FNV1_INIT;
+	unsigned i    = 0;
+
+	for (; i < *n; ++i) {
+		hash *= _PRIME;
+		hash ^= (uint64_t)_fold_byte(key[i]);
+	}
+
+	return hash;
+}
+
+uint64_t
+_hash_rtrim(const char* restrict key, unsigned* n, uint64_t seed) {
+	(void)seed;
+	unsigned last_not_space_n    = *n;
+	uint64_t hash                = _FNV1_INIT;
+	uint64_t last_not_space_hash = hash;
+	unsigned i                   = 0;
+
+	for (; i < *n; ++i) {
+		hash *= _PRIME;
+		hash ^= (uint64_t)(uint8_t)key[i];
+		if (key[i] != ' ') {
+			last_not_space_hash = hash;
+			last_not_space_n    = i + 1;
+		}
+	}
+
+	*n = last_not_space_n;
+	return last_not_space_hash;
+}
+
+uint64_t
+_hash_nocase_rtrim(const char* restrict key, unsigned* n, uint64_t seed) {
+	(void)seed;
+	unsigned last_not_space_n    = *n;
+	uint64_t hash                = _FNV1_INIT;
+	uint64_t last_not_space_hash = hash;
+	unsigned i                   = 0;
+
+	for (; i < *n; ++i) {
+		hash *= _PRIME;
+		hash ^= (uint64_t)_fold_byte(key[i]);
+		if (key[i] != ' ') {
+			last_not_space_hash = hash;
+			last_not_space_n    = i + 1;
+		}
+	}
+
+	*n = last_not_space_n;
+	return last_not_space_hash;
+}
+
+
+/* Fast hashing */
+static inline uint64_t
+_wymix(uint64_t a, uint64_t b) {
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+/* lower case every ASCII byte in a word */
+static inline uint64_t
+_fold_word(uint64_t w) {
+	const uint64_t ones  = 0x0101010101010101UL;
+	uint64_t       low   = w & (0x7f * ones);
+	uint64_t       ge_a  = low + (0x80 - 'A') * ones;
+	uint64_t       gt_z  = low + (0x80 - 'Z' - 1) * ones;
+	uint64_t       upper = ge_a & ~gt_z & ~w & (0x80 * ones);
+	return w | (upper >> 2);
+}
+
+static inline uint64_t
+_read8(const uint8_t* p, bool fold) {
+	uint64_t w;
+	memcpy(&w, p, 8);
+	return fold ? _fold_word(w) : w;
+}
+
+static inline uint64_t
+_read4(const uint8_t* p, bool fold) {
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return fold ? _fold_word(w) : w;
+}
+
+static inline uint64_t
+_read3(const uint8_t* p, unsigned n, bool fold) {
+	uint64_t w = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+	return fold ? _fold_word(w) : w;
+}
+
+/* length with trailing spaces removed, 8 bytes at a time */
+static inline unsigned
+_rtrim_len(const uint8_t* p, unsigned n) {
+	const uint64_t spaces = 0x2020202020202020UL;
+	while (n >= 8) {
+		uint64_t w;
+		memcpy(&w, &p[n - 8], 8);
+		w ^= spaces;
+		if (w != 0) {
+			/* highest non-space byte is the last one */
+			return n - (__builtin_clzll(w) >> 3);
+		}
+		n -= 8;
+	}
+	while (n > 0 && p[n - 1] == ' ') {
+		--n;
+	}
+	return n;
+}
+
+/* wyhash (final version 4) with optional ASCII case folding */
+static inline __attribute__((always_inline)) uint64_t
+_wyhash(const uint8_t* p, unsigned n, uint64_t seed, bool fold) {
+	uint64_t a    = 0;
+	uint64_t b    = 0;
+	unsigned left = n;
+
+	seed ^= _wymix(seed ^ _WYP0, _WYP1);
+	if (n <= 16) {
+		if (n >= 4) {
+			unsigned off = (n >> 3) << 2;
+			a = (_read4(p, fold) << 32) | _read4(p + off, fold);
+			b = (_read4(p + n - 4, fold) << 32) | _read4(p + n - 4 - off, fold);
+		} else if (n > 0) {
+			a = _read3(p, n, fold);
+		}
+	} else {
+		if (left > 48) {
+			uint64_t see1 = seed;
+			uint64_t see2 = seed;
+			do {
+				seed = _wymix(_read8(p, fold) ^ _WYP1, _read8(p + 8, fold) ^ seed);
+				see1 = _wymix(_read8(p + 16, fold) ^ _WYP2, _read8(p + 24, fold) ^ see1);
+				see2 = _wymix(_read8(p + 32, fold) ^ _WYP3, _read8(p + 40, fold) ^ see2);
+				p += 48;
+				left -= 48;
+			} while (left > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (left > 16) {
+			seed = _wymix(_read8(p, fold) ^ _WYP1, _read8(p + 8, fold) ^ seed);
+			p += 16;
+			left -= 16;
+		}
+		a = _read8(p + left - 16, fold);
+		b = _read8(p + left - 8, fold);
+	}
+
+	a ^= _WYP1;
+	b ^= seed;
+	__uint128_t r = (__uint128_t)a * b;
+	a             = (uint64_t)r;
+	b             = (uint64_t)(r >> 64);
+	return _wymix(a ^ _WYP0 ^ n, b ^ _WYP1);
+}
+
+uint64_t
+_hash_fast(const char* restrict key, unsigned* n, uint64_t seed) {
+	return _wyhash((const uint8_t*)key, *n, seed, false);
+}
+
+uint64_t
+_hash_fast_nocase(const char* restrict key, unsigned* n, uint64_t seed) {
+	return _wyhash((const uint8_t*)key, *n, seed, true);
+}
+
+uint64_t
+_hash_fast_rtrim(const char* restrict key, unsigned* n, uint64_t seed) {
+	*n = _rtrim_len((const uint8_t*)key, *n);
+	return _wyhash((const uint8_t*)key, *n, seed, false);
+}
+
+uint64_t
+_hash_fast_nocase_rtrim(const char* restrict key, unsigned* n, uint64_t seed) {
+	*n = _rtrim_len((const uint8_t*)key, *n);
+	return _wyhash((const uint8_t*)key, *n, seed, true);
+}
+
+/* Different for every map so one map's order cannot cluster another */
+uint64_t
+_map_seed(const void* addr) {
+	static uint64_t counter = 0;
+	uint64_t        seed    = __atomic_add_fetch(&counter, _WYP0, __ATOMIC_RELAXED);
+	return _wymix(seed ^ (uintptr_t)addr, _WYP1 ^ (uint64_t)time(NULL));
+}
+
+/**
+ * Hash each field with the map's hash__, so NOCASE and RTRIM
+ * apply per field, and chain the results. lens gets each
+ * field's trimmed length and *n the encoded key length.
+ */
+uint64_t
+_fields_hash(const _Table*           t,
+             const Const_Char_Slice* fields,
+             unsigned                count,
+             unsigned*               lens,
+             unsigned*               n) {
+	uint64_t hash = t->seed ^ _WYP0;
+	unsigned i    = 0;
+	*n            = 0;
+	for (; i < count; ++i) {
+		lens[i]     = fields[i].len;
+		uint64_t fh = t->hash__(fields[i].data, &lens[i], t->seed);
+		hash        = _wymix(hash ^ fh, _WYP1 ^ lens[i]);
+		*n += sizeof(uint32_t) + lens[i];
+	}
+	return hash;
+}
+
+/* Encode a composite key into e or the key buffer */
+void
+_table_store_fields(_Table* t, _Entry* e, const struct _Fields* f, unsigned n) {
+	uint8_t* dest = _table_key_dest(t, e, n);
+	unsigned i    = 0;
+	for (; i < f->count; ++i) {
+		uint32_t len = f->lens[i];
+		memcpy(dest, &len, sizeof(len));
+		dest += sizeof(len);
+		if (t->props & MAP_PROP_NOCASE) {
+			unsigned j = 0;
+			for (; j < len; ++j) {
+				dest[j] = _fold_byte(f->fields[i].data[j]);
+			}
+		} else {
+			memcpy(dest, f->fields[i].data, len);
+		}
+		dest += len;
+	}
+}
+
+
+/* Stored keys are already folded and trimmed. Fold the probe here. */
+static inline bool
+_entry_eq_bytes(const _Table* t, const uint8_t* stored, const void* key, unsigned n) {
+	if (!(t->props & MAP_PROP_NOCASE)) {
+		/* use memcmp instead of strcmp in case non-char* key */
+		return memcmp(stored, key, n) == 0;
+	}
+
+	const uint8_t* probe = key;
+	unsigned       i     = 0;
+	for (; i < n; ++i) {
+		if (stored[i] != _fold_byte(probe[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline bool
+_entry_eq(const _Table* t, const _Entry* e, const void* key, unsigned n, uint64_t hash) {
+	if (e->hash != hash || e->key_len != n) {
+		return false;
+	}
+	return _entry_eq_bytes(t, _entry_key(t, e), key, n);
+}
+
+static inline bool
+_entry_eq_fields(const _Table* t, const _Entry* e, const void* key, unsigned n, uint64_t hash) {
+	if (e->hash != hash || e->key_len != n) {
+		return false;
+	}
+
+	const struct _Fields* f      = key;
+	const uint8_t*        stored = _entry_key(t, e);
+	unsigned              i      = 0;
+	for (; i < f->count; ++i) {
+		uint32_t len = 0;
+		memcpy(&len, stored, sizeof(len));
+		stored += sizeof(len);
+		if (len != f->lens[i] || !_entry_eq_bytes(t, stored, f->fields[i].data, len)) {
+			return false;
+		}
+		stored += len;
+	}
+	return true;
+}
+
+typedef bool (*_entry_eq_fn)(const _Table*, const _Entry*, const void*, unsigned, uint64_t);
+
+/**
+ * Find key in one table. If it is not there, return the slot
+ * an insert should use. eq is a constant wherever this is
+ * inlined, so each kind of key gets its own probe loop.
+ */
+static inline __attribute__((always_inline)) _Entry*
+_probe(const _Table*   t,
+       _Entry_Slice    entries,
+       const int8_t*   ctrl,
+       const void*     key,
+       unsigned        n,
+       uint64_t        hash,
+       _entry_eq_fn    eq) {
+	size_t mask   = entries.len - 1;
+	size_t idx    = (size_t)(hash & mask);
+	size_t probes = 1;
+
+	if (ctrl == NULL) {
+		_Entry* entry = &entries.data[idx];
+		while (entry->val_idx != _NONE && !eq(t, entry, key, n, hash)) {
+			idx   = (idx + 1) & mask;
+			entry = &entries.data[idx];
+			++probes;
+		}
+		_stats_probe(t, probes, entry->val_idx != _NONE);
+		return entry;
+	}
+
+	size_t step = 0;
+	int8_t tag  = _ctrl_tag(hash);
+
+	/* a hit is usually in the home slot, so overlap the two misses */
+	__builtin_prefetch(&entries.data[idx]);
+
+	/* reuse the first deleted slot along the way for an insert */
+	size_t insert_idx = (size_t)-1;
+
+	for (;;) {
+		const int8_t* group   = &ctrl[idx];
+		unsigned      matches = _group_match(group, tag);
+		for (; matches; matches &= matches - 1) {
+			_Entry* e = &entries.data[(idx + __builtin_ctz(matches)) & mask];
+			if (eq(t, e, key, n, hash)) {
+				_stats_probe(t, probes, true);
+				return e;
+			}
+		}
+
+		unsigned free_slots = _group_free(group);
+		if (free_slots && insert_idx == (size_t)-1) {
+			insert_idx = (idx + __builtin_ctz(free_slots)) & mask;
+		}
+		if (_group_match(group, _CTRL_EMPTY)) {
+			_stats_probe(t, probes, false);
+			return &entries.data[insert_idx];
+		}
+		step += _GROUP_WIDTH;
+		idx = (idx + step) & mask;
+		++probes;
+	}
+}
+
+static inline __attribute__((always_inline)) _Entry*
+_table_find_with(const _Table* t, const void* key, unsigned n, uint64_t hash, _entry_eq_fn eq) {
+	_Entry* e = _probe(t, t->_entries, t->_ctrl, key, n, hash, eq);
+	if (e->val_idx == _NONE && t->_old_entries.data != NULL) {
+		_Entry* old = _probe(t, t->_old_entries, t->_old_ctrl, key, n, hash, eq);
+		if (old->val_idx != _NONE) {
+			return old;
+		}
+	}
+	return e;
+}
+
+_Entry*
+_table_find(const _Table* t, const char* key, unsigned n, uint64_t hash) {
+	return _table_find_with(t, key, n, hash, _entry_eq);
+}
+
+/* Both keys are stored ones, so both are already folded */
+static inline bool
+_entry_eq_stored(const _Table* t, const _Entry* e, const void* key, unsigned n, uint64_t hash) {
+	if (e->hash != hash || e->key_len != n) {
+		return false;
+	}
+	return memcmp(_entry_key(t, e), key, n) == 0;
+}
+
+_Entry*
+_table_find_stored(const _Table* t, const uint8_t* key, unsigned n, uint64_t hash) {
+	return _table_find_with(t, key, n, hash, _entry_eq_stored);
+}
+
+_Entry*
+_table_find_fields(const _Table* t, const struct _Fields* key, unsigned n, uint64_t hash) {
+	return _table_find_with(t, key, n, hash, _entry_eq_fields);
+}
+
+/**
+ * Resolve up to _BATCH_WIDTH keys. Rather than taking each
+ * key's cache misses one after another, every pass issues the
+ * next miss for all of the keys: home slots (and control
+ * bytes), then the first tag match of each group, then the
+ * candidates' key bytes. By the final probe, most of what it
+ * touches is already in cache. Only the current table is
+ * prefetched; the old table of MAP_PROP_INCREMENTAL is rare.
+ */
+void
+_table_find_batch(const _Table*      t,
+                  const char* const* keys,
+                  const unsigned*    lens,
+                  size_t             n,
+                  _Entry**           out) {
+	uint64_t hashes[_BATCH_WIDTH];
+	unsigned ns[_BATCH_WIDTH];
+	_Entry*  candidates[_BATCH_WIDTH];
+	size_t   mask = t->_entries.len - 1;
+	size_t   i    = 0;
+
+	for (; i < n; ++i) {
+		ns[i]     = (lens) ? lens[i] : strlen(keys[i]);
+		hashes[i] = t->hash__(keys[i], &ns[i], t->seed);
+		size_t idx = hashes[i] & mask;
+		if (t->_ctrl != NULL) {
+			__builtin_prefetch(&t->_ctrl[idx]);
+		}
+		__builtin_prefetch(&t->_entries.data[idx]);
+	}
+
+	for (i = 0; i < n; ++i) {
+		size_t idx    = hashes[i] & mask;
+		candidates[i] = &t->_entries.data[idx];
+		if (t->_ctrl != NULL) {
+			unsigned matches = _group_match(&t->_ctrl[idx], _ctrl_tag(hashes[i]));
+			candidates[i]    = NULL;
+			if (matches) {
+				candidates[i] = &t->_entries.data[(idx + __builtin_ctz(matches)) & mask];
+				__builtin_prefetch(candidates[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (candidates[i] != NULL && candidates[i]->hash == hashes[i]
+		    && candidates[i]->key_len > MAP_INLINE_KEY) {
+			__builtin_prefetch(&t->_keybuf.data[candidates[i]->key_idx]);
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		out[i] = _table_find(t, keys[i], ns[i], hashes[i]);
+	}
+}
+
 _Entry*
-_get_entry(_Entry_Slice* entries,
-    Byte_Slice*          keybuf,
-    hash_fn              hash__,
-    size_t               keybuf_head,
-    const char*          key,
-    unsigned*            key_len,
-    uint64_t*            hash) {
-	while (keybuf_head + *key_len > (size_t)keybuf->len) {
-		keybuf->len *= 2;
-		keybuf->data = heap_resize(keybuf->data, keybuf->len);
-	}
-
-	*hash      = hash__(&keybuf->data[keybuf_head], key, key_len);
-	size_t idx = (size_t)(*hash & (entries->len - 1));
-
-	/* use memcmp instead of strcmp in case non-char* key */
-	_Entry* entry = &entries->data[idx];
-	while (entry->val_idx != _NONE
-	       && (entry->key_len != *key_len || entry->hash != *hash
-	           || memcmp(&keybuf->data[entry->key_idx],
-	                  &keybuf->data[keybuf_head],
-	                  *key_len)
-	                  != 0)) {
-		idx   = (idx + 1) % entries->len;
-		entry = &entries->data[idx];
-	}
-
-	return entry;
+_get_entry(const _Table* t, const char* key, unsigned* key_len, uint64_t* hash) {
+	*hash = t->hash__(key, key_len, t->seed);
+	return _table_find(t, key, *key_len, *hash);
 }
 
 unsigned long
@@ -9,48 +9,260 @@
 #define MAP_PROP_DEFAULT 0x00
 #define MAP_PROP_NOCASE  0x01
 #define MAP_PROP_RTRIM   0x02
+#define MAP_PROP_GROUP   0x04 /* probe control bytes 16 at a time */
+#define MAP_PROP_FASTHASH 0x08 /* seeded word-at-a-time hash */
+#define MAP_PROP_INCREMENTAL 0x10 /* grow a few slots per insert */
 
-#define _NONE ((uint32_t)-1)
+/**
+ * Value indices are 32 bit, so a Map holds fewer than 2^32 - 2
+ * values. Building with -DMAP_WIDE -DVEC_WIDE (make WIDE=1)
+ * makes them 64 bit, along with the length of every Vec, for
+ * maps past that or past 2^31 values. It costs 8 bytes per
+ * entry and per _rev slot. key_len stays 32 bit either way.
+ */
+#ifdef MAP_WIDE
+#ifndef VEC_WIDE
+#error "MAP_WIDE needs VEC_WIDE: values is a Vec"
+#endif
+typedef uint64_t map_idx;
+#else
+typedef uint32_t map_idx;
+#endif
+
+#define _NONE  ((map_idx)-1)
+#define _MOVED ((map_idx)-2) /* MAP_PROP_INCREMENTAL: gone from the old table */
+
+/**
+ * Keys up to MAP_INLINE_KEY bytes are kept in the entry itself,
+ * so a hit on one never reads _keybuf. The default of 8 uses the
+ * bytes of key_idx and leaves an entry at 24 bytes. Building
+ * with -DMAP_INLINE_KEY=16 (make INLINE_KEY=16) makes entries
+ * 32 bytes, two to a cache line.
+ */
+#ifndef MAP_INLINE_KEY
+#define MAP_INLINE_KEY 8
+#endif
 
 struct _Entry {
-	uint64_t hash;    /* store the calculated hash for resize */
-	uint64_t key_idx; /* index to start of key */
-	uint32_t val_idx; /* index for _entries */
+	uint64_t hash; /* store the calculated hash for resize */
+	union {
+		uint64_t key_idx; /* index to start of key */
+		uint8_t _key[MAP_INLINE_KEY];
+	};
+	map_idx val_idx; /* index for _entries */
 	uint32_t key_len;
 };
 typedef struct _Entry _Entry;
+_Static_assert(MAP_INLINE_KEY % 8 == 0, "MAP_INLINE_KEY must be a multiple of 8");
 typedef Slice(_Entry) _Entry_Slice;
 
-typedef uint64_t (*hash_fn)(uint8_t* keybuf, const char* key, unsigned* n);
+/**
+ * Hash the first *n bytes of key. MAP_PROP_RTRIM variants
+ * shorten *n to exclude trailing spaces. Keys are never
+ * copied here, so lookups do not write to the map. seed is
+ * ignored by the default FNV-1 hashes.
+ */
+typedef uint64_t (*hash_fn)(const char* key, unsigned* n, uint64_t seed);
 
-struct Set {
+/* FNV-1, one byte at a time */
+uint64_t _hash(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_nocase(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_rtrim(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_nocase_rtrim(const char* restrict key, unsigned* n, uint64_t seed);
+
+/**
+ * MAP_PROP_FASTHASH: wyhash style, 8 or 16 bytes at a time.
+ * Case folding (ASCII) and trailing space detection are done
+ * a word at a time as well.
+ */
+uint64_t _hash_fast(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_fast_nocase(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_fast_rtrim(const char* restrict key, unsigned* n, uint64_t seed);
+uint64_t _hash_fast_nocase_rtrim(const char* restrict key, unsigned* n, uint64_t seed);
+
+/**
+ * MAP_PROP_GROUP keeps a control byte per entry in _ctrl. A
+ * negative byte is a free slot. Otherwise, it holds the top
+ * 7 bits of the entry's hash. The first group of bytes is
+ * mirrored past the end so any group can be loaded at once.
+ */
+#define _GROUP_WIDTH  16
+#define _CTRL_EMPTY   ((int8_t)-128)
+#define _CTRL_DELETED ((int8_t)-2)
+
+/* Shared by Set and Map. You should not touch it. */
+struct _Table {
 	_Entry_Slice _entries;
+	int8_t* _ctrl; /* NULL unless MAP_PROP_GROUP */
 	hash_fn hash__;
+	uint64_t seed; /* per map for MAP_PROP_FASTHASH */
 	Byte_Slice _keybuf;
 	size_t _keybuf_head;
-	unsigned map_size;
+	size_t _keybuf_waste; /* bytes of removed keys */
+	Vec(map_idx) _rev;    /* Map only: entry index of each value */
+	size_t _tombs;        /* MAP_PROP_GROUP deleted slots */
+	size_t size;
+	unsigned props;
+
+	/* MAP_PROP_INCREMENTAL: table being migrated from */
+	_Entry_Slice _old_entries;
+	int8_t* _old_ctrl;
+	size_t _migrate_idx;
+	Byte_Slice _old_keybuf; /* map_compact: keys of _old_entries */
+
+	/* MAP_PROP_INCREMENTAL: next table, cleared ahead of time */
+	_Entry_Slice _next_entries;
+	int8_t* _next_ctrl;
+	size_t _next_ready;
+
+	/* map_open: everything above points into this mapping */
+	void* _image;
+	size_t _image_len;
+
+#ifdef MAP_STATS
+	struct Map_Stats* _stats; /* written by lookups too */
+#endif
+};
+typedef struct _Table _Table;
+
+struct Set {
+	_Table _table;
+	struct Bloom* _filter; /* NULL unless set_filter */
 };
 typedef struct Set Set;
 
-#define Map(T_)                    \
-	struct {                       \
-		Vec(T_) values;        \
-		hash_fn hash__;        \
-		_Entry_Slice _entries; \
-		Byte_Slice _keybuf;    \
-		size_t _keybuf_head;   \
+#define Map(T_)                \
+	struct {               \
+		Vec(T_) values; \
+		_Table _table;  \
 	}
 typedef Map(uint8_t) Map;
 
-void _map_grow_entries(_Entry_Slice* old_entries);
+void _map_grow_entries(_Table*);
+void _table_rehash(_Table*, size_t new_len);
+_Entry* _rev_entry(const _Table*, map_idx val_idx);
+
+/* Stored bytes of e's key, in the entry or in _keybuf */
+const uint8_t* _entry_key(const _Table*, const _Entry*);
+
+/**
+ * MAP_PROP_NOCASE folds ASCII letters only, whatever the locale,
+ * so the hashes, stored keys and compares always agree.
+ */
+static inline uint8_t
+_fold_byte(uint8_t c) {
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+void _table_migrate(_Table*, size_t slots);
+
+/* The hash__ for a set of MAP_PROP flags */
+hash_fn _table_hash_fn(unsigned props);
+
+/**
+ * Returns the matching entry or, if there is none, the free
+ * slot where key belongs (val_idx == _NONE). n and hash must
+ * come from the table's hash__. While MAP_PROP_INCREMENTAL is
+ * moving entries, a match may come from the old table. Lookups
+ * do not move entries themselves so they stay read-only.
+ */
+_Entry* _table_find(const _Table*, const char* key, unsigned n, uint64_t hash);
+_Entry* _get_entry(const _Table*, const char* key, unsigned* key_len, uint64_t* hash);
 
 void set_construct(Set* restrict, size_t limit, const unsigned props);
+
+/**
+ * A set with like's props and, for MAP_PROP_FASTHASH, its seed,
+ * so the two hash alike. See set_union.
+ */
+void set_construct_like(Set* restrict, const Set* restrict like, size_t limit);
 void set_destroy(Set* restrict);
 void set_clear(Set* restrict);
+
+/* See map_reserve, map_compact and map_shrink_to_fit */
+void set_reserve(Set* restrict, size_t limit);
+bool set_compact(Set* restrict, size_t slots);
+void set_shrink_to_fit(Set* restrict);
 void set_nadd(Set* restrict, const char* restrict key, unsigned len);
 #define set_add(S_, KEY_) set_nadd(S_, KEY_, strlen(KEY_))
-bool set_nhas(Set* restrict, const char* restrict key, unsigned len);
+
+/**
+ * Lookups never write to the set or allocate, so any number
+ * of threads may call set_nhas/map_nget on a map that is not
+ * being modified.
+ */
+bool set_nhas(const Set* restrict, const char* restrict key, unsigned len);
 #define set_has(S_, KEY_) set_nhas(S_, KEY_, strlen(KEY_))
+#define set_size(S_)      ((S_)->_table.size)
+
+/**
+ * Look up n keys at once. lens may be NULL for nul-terminated
+ * keys. Bit i of hits is set if keys[i] is in the set. hits
+ * must hold (n + 63) / 64 words. Returns the number of hits.
+ *
+ * Keys are resolved in small batches with their cache misses
+ * overlapped, which pays off once the set outgrows cache.
+ */
+size_t set_nhas_batch(const Set* restrict,
+                      const char* const* keys,
+                      const unsigned* lens,
+                      size_t n,
+                      uint64_t* hits);
+
+/**
+ * Put a blocked Bloom filter (see bloom.h) in front of set_nhas
+ * for sets that mostly see misses. A miss the filter catches
+ * costs one cache line instead of a probe and key compare. It
+ * takes about 1.6 * log2(1 / fp_rate) bits per key the table
+ * has room for, so around 10 bits at 1%. set_nadd keeps it
+ * current, and it is rebuilt from the stored hashes when the
+ * set outgrows it. Removed keys linger in it until then.
+ * set_nhas_batch does not use it.
+ */
+void set_filter(Set* restrict, double fp_rate);
+
+/**
+ * Remove key from the set. Returns false if it was not there.
+ */
+bool set_nremove(Set* restrict, const char* restrict key, unsigned len);
+#define set_remove(S_, KEY_) set_nremove(S_, KEY_, strlen(KEY_))
+
+/**
+ * Set algebra: dst becomes a | b, a & b or a - b. Keys move
+ * from table to table as stored, already folded and trimmed,
+ * and keep their stored hash when both tables hash alike (the
+ * same props and seed, see set_construct_like). Wherever the
+ * result allows, keys of the smaller set are looked up in the
+ * larger, not the other way around.
+ *
+ * dst may be a or b to work in place. Otherwise, dst is
+ * constructed here, like the set most of its keys come from
+ * and with its seed, so those hashes carry over. threads > 1
+ * splits the lookups across that many threads. Returns
+ * Result_Fail if a and b differ in MAP_PROP_NOCASE or
+ * MAP_PROP_RTRIM.
+ */
+int set_union(Set* dst, const Set* a, const Set* b, unsigned threads);
+int set_intersect(Set* dst, const Set* a, const Set* b, unsigned threads);
+int set_difference(Set* dst, const Set* a, const Set* b, unsigned threads);
+
+/**
+ * Walks a Set's keys in slot order. A Set keeps no values, so
+ * the slots are read in order and empty ones skipped. Keys are
+ * stored keys as with Map_Iter. Adding or removing keys ends
+ * a walk.
+ */
+struct Set_Iter {
+	const _Table* _table;
+	size_t _slot;
+	const char* key;
+	unsigned key_len;
+};
+typedef struct Set_Iter Set_Iter;
+
+Set_Iter set_iter(const Set*);
+
+/* Next key or NULL at the end. Sets key and key_len. */
+const char* set_iter_next(Set_Iter*);
 
 void map_construct_(void*, const unsigned elem_size, size_t limit, const unsigned props);
 #define map_construct(H_, LIMIT_, PROPS_) \
@@ -58,20 +270,45 @@ void map_construct_(void*, const unsigned elem_size, size_t limit, const unsigne
 void map_destroy(void*);
 void map_clear(void*);
 
+/**
+ * Make room for limit keys and their values up front, so the
+ * map does not grow again until it holds more than that.
+ */
+void map_reserve_(void*, size_t limit, unsigned elem_size);
+#define map_reserve(M_, LIMIT_) map_reserve_(M_, LIMIT_, vec_elem_size((M_)->values))
+
+/**
+ * Nothing a map allocates is given back by removing keys or by
+ * map_clear. map_compact moves the map to a table sized for the
+ * keys it has now and a key buffer holding only their bytes. It
+ * moves at most slots old slots per call and returns true once
+ * nothing is left to do, so a large map can be compacted a bit
+ * at a time. Between calls the map works as usual, and inserts
+ * and removes move it along as with MAP_PROP_INCREMENTAL.
+ *
+ * The values and their index are trimmed to length once the
+ * rest is done. map_shrink_to_fit does it all in one call.
+ */
+bool map_compact_(void*, size_t slots, unsigned elem_size);
+#define map_compact(M_, SLOTS_) map_compact_(M_, SLOTS_, vec_elem_size((M_)->values))
+void map_shrink_to_fit_(void*, unsigned elem_size);
+#define map_shrink_to_fit(M_) map_shrink_to_fit_(M_, vec_elem_size((M_)->values))
+
 /**
  * declare key into map without adding data. This is
  * just a helper function. You should not call it.
  * Returns idx or _NONE of sent key.
  */
-uint32_t _map_declare(void*, const char* key, unsigned key_len);
+map_idx _map_declare(void*, const char* key, unsigned key_len);
+map_idx _map_declare_hashed(void*, const char* key, unsigned key_len, uint64_t hash);
 
 /**
  * Add key + data pair to map
  */
-uint32_t map_nset_(void*, const char* key, unsigned key_len, const void* data, int elem_size);
+map_idx map_nset_(void*, const char* key, unsigned key_len, const void* data, int elem_size);
 #define map_nset(M_, KEY_, KL_, ITEM_)                              \
 	{                                                           \
-		uint32_t idx_ = _map_declare(M_, KEY_, KL_);        \
+		map_idx idx_ = _map_declare(M_, KEY_, KL_);         \
 		if (idx_ == _NONE) {                                \
 			vec_push_back(&(M_)->values, ITEM_);        \
 		} else {                                            \
@@ -83,45 +320,273 @@ uint32_t map_nset_(void*, const char* key, unsigned key_len, const void* data, i
 /**
  * Return NULL if no match or pointer to value
  */
-void* map_nget_(void*, const char* key, unsigned, unsigned elem_size);
+void* map_nget_(const void*, const char* key, unsigned, unsigned elem_size);
 #define map_nget(M_, KEY_, KL_) map_nget_(M_, KEY_, KL_, vec_elem_size((M_)->values))
 #define map_get(M_, KEY_)       map_nget_(M_, KEY_, strlen(KEY_), vec_elem_size((M_)->values))
 
-/** TODO **/
-#if 0
-typedef struct Map multimap;
-
-multimap* multimap_construct(multimap* restrict,
-                             const unsigned elem_size,
-                             size_t limit,
-                             const unsigned props);
-#define multimap_construct_(h_, T_, limit_, props_) \
-	multimap_construct(h_, sizeof(T_), limit_, props_)
-void multimap_destroy(multimap* restrict);
-void multimap_clear(multimap* restrict);
-void multimap_nset(multimap* restrict,
-                   const char* restrict key,
-                   void* restrict,
-                   unsigned);
-#define multimap_set(m_, key_, data_) multimap_nset(m_, key_, data_, strlen(key_))
-#define multimap_nget(m_, key_, n_)   map_nget(m_, key_, n_)
-#define multimap_get(m_, key_)        map_nget(m_, key_, strlen(key_))
-
-typedef struct Map compositemap;
-
-compositemap* compositemap_construct(compositemap* restrict,
-                                     const unsigned elem_size,
-                                     size_t limit,
-                                     const unsigned props);
-#define compositemap_construct_(h_, T_, limit_, props_) \
-	compositemap_construct(h_, sizeof(T_), limit_, props_)
-void compositemap_destroy(compositemap* restrict);
-void compositemap_clear(compositemap* restrict);
-void compositemap_set(compositemap* restrict,
-                      const struct vec* restrict key,
-                      void* restrict);
-void* compositemap_get(compositemap*, const struct vec* restrict key);
-
-#endif /* 0 */
+/**
+ * map_nget for n keys at once. out[i] is set to keys[i]'s value
+ * or NULL. lens may be NULL for nul-terminated keys. Returns
+ * the number of keys found. See set_nhas_batch.
+ */
+size_t map_nget_batch_(const void*,
+                       const char* const* keys,
+                       const unsigned* lens,
+                       size_t n,
+                       void** out,
+                       unsigned elem_size);
+#define map_nget_batch(M_, KEYS_, LENS_, N_, OUT_) \
+	map_nget_batch_(M_, KEYS_, LENS_, N_, (void**)(OUT_), vec_elem_size((M_)->values))
+
+/**
+ * Remove key and its value. The last value is moved into the
+ * removed value's place, so values stays dense but loses its
+ * insertion order. Returns false if key was not there.
+ */
+bool map_nremove_(void*, const char* key, unsigned, unsigned elem_size);
+#define map_nremove(M_, KEY_, KL_) \
+	map_nremove_(M_, KEY_, KL_, vec_elem_size((M_)->values))
+#define map_remove(M_, KEY_) \
+	map_nremove_(M_, KEY_, strlen(KEY_), vec_elem_size((M_)->values))
+void _map_remove_entry(void*, _Entry*, unsigned elem_size);
+
+/**
+ * Walks values front to back, which is insertion order until a
+ * remove moves the last value into a hole. Each key comes from
+ * its entry through _rev, so a walk reads values and _rev in
+ * order and touches one entry per value, never an empty slot.
+ * key is the stored key: not nul-terminated, and folded or
+ * trimmed for MAP_PROP_NOCASE and MAP_PROP_RTRIM. idx is the
+ * index in values of the value last returned.
+ *
+ * Adding or removing keys ends a walk. Writing to values does
+ * not.
+ */
+struct Map_Iter {
+	const _Table* _table;
+	uint8_t* _values;
+	unsigned _elem_size;
+	map_idx _next;
+	map_idx _end;
+	map_idx idx;
+	const char* key;
+	unsigned key_len;
+};
+typedef struct Map_Iter Map_Iter;
+
+/* map_iter_range walks values begin up to end */
+Map_Iter map_iter_range_(const void*, size_t begin, size_t end, unsigned elem_size);
+#define map_iter_range(M_, BEGIN_, END_) \
+	map_iter_range_(M_, BEGIN_, END_, vec_elem_size((M_)->values))
+#define map_iter(M_) map_iter_range(M_, 0, (M_)->values.len)
+
+/* Next value or NULL at the end. Sets key, key_len and idx. */
+void* map_iter_next(Map_Iter*);
+
+/**
+ * Split values into one range per thread and walk each on its
+ * own thread. fn is called once per range with an iterator
+ * over it and the range's number. Maps too small to be worth
+ * the threads are walked in one range on the calling thread.
+ * Returns the number of ranges, so results kept per range can
+ * be folded afterwards. The map must not change until
+ * map_scan returns, but fn may write to the values in its own
+ * range.
+ */
+typedef void (*map_scan_fn)(Map_Iter*, unsigned range, void* data);
+unsigned map_scan_(const void*, unsigned threads, map_scan_fn, void* data, unsigned elem_size);
+#define map_scan(M_, THREADS_, FN_, DATA_) \
+	map_scan_(M_, THREADS_, FN_, DATA_, vec_elem_size((M_)->values))
+
+#ifdef MAP_STATS
+#include <stdio.h>
+
+/**
+ * Build with -DMAP_STATS (make STATS=1) to see how a Map or
+ * Set behaves. Every translation unit must agree, since the
+ * switch changes _Table. Without it, none of this exists and
+ * nothing is recorded.
+ *
+ * hit_probes[i] counts lookups that found their key after
+ * looking at i + 1 slots, or groups of slots with
+ * MAP_PROP_GROUP. The last bucket holds everything longer.
+ * Inserts count as lookups. While MAP_PROP_INCREMENTAL is
+ * moving entries, a lookup can record a probe of each table.
+ * Counters are updated with relaxed atomics, so concurrent
+ * lookups stay safe.
+ */
+#define MAP_STATS_PROBES 16
+
+struct Map_Stats {
+	/* recorded as the map is used */
+	size_t hit_probes[MAP_STATS_PROBES];
+	size_t miss_probes[MAP_STATS_PROBES];
+	size_t grows; /* calls to _map_grow_entries */
+	double grow_seconds;
+
+	/* taken from the table by map_stats */
+	size_t size;
+	size_t slots;
+	size_t tombs;
+	size_t clusters; /* runs of taken slots */
+	size_t max_cluster;
+
+	/* bytes in use vs allocated. entries includes control
+	 * bytes, the value index and any table being migrated.
+	 */
+	size_t entries_used;
+	size_t entries_alloc;
+	size_t keybuf_used;
+	size_t keybuf_waste; /* removed keys not compacted yet */
+	size_t keybuf_alloc;
+	size_t values_used;
+	size_t values_alloc;
+};
+typedef struct Map_Stats Map_Stats;
+
+void map_stats_(const void*, Map_Stats*, unsigned elem_size);
+#define map_stats(M_, OUT_) map_stats_(M_, OUT_, vec_elem_size((M_)->values))
+void set_stats(const Set* restrict, Map_Stats*);
+void map_stats_print(const Map_Stats*, FILE*);
+#endif /* MAP_STATS */
+
+/**
+ * Multimap keeps every value set under a key, in insertion
+ * order. A key's values are stored in runs in one buffer. A
+ * small group is a single run that moves to a run twice its
+ * size when it fills, like a Vec. Runs it leaves behind are
+ * reused by other groups. Past _MULTI_RUN_CHAIN values, runs
+ * are linked instead, each twice as large as the last, so a
+ * group is always read with a few linear scans. Keys go in a
+ * Map whose values are the group headers.
+ */
+struct _Multi_Group {
+	uint64_t head; /* offsets of runs in _runs */
+	uint64_t tail;
+	size_t count;
+	uint32_t tail_len; /* here so adding never reads the run */
+	uint32_t tail_cap;
+};
+
+/* Values follow the header. Every run but the tail is full. */
+struct _Multi_Run {
+	uint64_t next; /* _MULTI_END if last, or next free run */
+	uint64_t cap;
+};
+#define _MULTI_END       ((uint64_t)-1)
+#define _MULTI_RUN_MIN   4
+#define _MULTI_RUN_CHAIN 64
+#define _MULTI_FREE_LISTS 4 /* one per run size below _MULTI_RUN_CHAIN */
+
+#define Multimap(T_)                                         \
+	struct {                                             \
+		Map(struct _Multi_Group) _map;               \
+		Byte_Slice _runs;                            \
+		size_t _runs_head;                           \
+		uint64_t _free_runs[_MULTI_FREE_LISTS];      \
+		T_* _type; /* never set, see typeof */       \
+	}
+typedef Multimap(uint8_t) Multimap;
+
+/**
+ * Walks one key's values. Pointers from an iterator are good
+ * until the next multimap_nset. count is the number of values
+ * under the key.
+ */
+struct Multimap_Iter {
+	const uint8_t* _runs;
+	uint64_t _run;
+	uint32_t _idx;
+	unsigned _elem_size;
+	size_t _left;
+	size_t count;
+};
+typedef struct Multimap_Iter Multimap_Iter;
+
+void multimap_construct_(void*, const unsigned elem_size, size_t limit, const unsigned props);
+#define multimap_construct(M_, LIMIT_, PROPS_) \
+	multimap_construct_(M_, sizeof(*(M_)->_type), LIMIT_, PROPS_)
+void multimap_destroy(void*);
+void multimap_clear(void*);
+
+/**
+ * Add data to the values under key
+ */
+void multimap_nset_(void*, const char* key, unsigned key_len, const void* data, unsigned elem_size);
+#define multimap_nset(M_, KEY_, KL_, ITEM_)                                 \
+	{                                                                   \
+		__typeof__(*(M_)->_type) item_ = ITEM_;                     \
+		multimap_nset_(M_, KEY_, KL_, &item_, sizeof(item_));       \
+	}
+#define multimap_set(M_, KEY_, ITEM_) multimap_nset(M_, KEY_, strlen(KEY_), ITEM_)
+
+/**
+ * Iterator over key's values. count is 0 if there are none.
+ */
+Multimap_Iter multimap_nget_(const void*, const char* key, unsigned key_len, unsigned elem_size);
+#define multimap_nget(M_, KEY_, KL_) multimap_nget_(M_, KEY_, KL_, sizeof(*(M_)->_type))
+#define multimap_get(M_, KEY_)       multimap_nget_(M_, KEY_, strlen(KEY_), sizeof(*(M_)->_type))
+
+/**
+ * multimap_iter_next returns the next value or NULL at the end.
+ * multimap_iter_run returns the next run of *len values that
+ * sit back to back, or NULL at the end.
+ */
+void* multimap_iter_next(Multimap_Iter*);
+void* multimap_iter_run(Multimap_Iter*, unsigned* len);
+
+/* number of distinct keys */
+#define multimap_size(M_) ((M_)->_map._table.size)
+
+/**
+ * Compositemap is a Map keyed by a list of fields. Fields are
+ * hashed one at a time and never joined into one string first.
+ * MAP_PROP_NOCASE and MAP_PROP_RTRIM apply to each field. A
+ * key is stored in _keybuf as each field's length followed by
+ * its bytes, so ("ab", "c") and ("a", "bc") stay apart.
+ *
+ * Construct, destroy and clear it as a Map.
+ */
+#define Compositemap(T_) Map(T_)
+typedef Map Compositemap;
+#define compositemap_construct map_construct
+#define compositemap_destroy   map_destroy
+#define compositemap_clear     map_clear
+
+map_idx _compositemap_declare(void*, const Const_Char_Slice* fields, unsigned count);
+
+/**
+ * The n variants take an array of count fields. The others take
+ * a Vec(Const_Char_Slice)*.
+ */
+#define compositemap_nset(M_, FIELDS_, COUNT_, ITEM_)                      \
+	{                                                                  \
+		map_idx idx_ = _compositemap_declare(M_, FIELDS_, COUNT_);  \
+		if (idx_ == _NONE) {                                       \
+			vec_push_back(&(M_)->values, ITEM_);               \
+		} else {                                                   \
+			vec_set_one_at(&(M_)->values, idx_, ITEM_);        \
+		}                                                          \
+	}
+#define compositemap_set(M_, VEC_, ITEM_) \
+	compositemap_nset(M_, (VEC_)->data, (VEC_)->len, ITEM_)
+
+void* compositemap_nget_(const void*,
+                         const Const_Char_Slice* fields,
+                         unsigned count,
+                         unsigned elem_size);
+#define compositemap_nget(M_, FIELDS_, COUNT_) \
+	compositemap_nget_(M_, FIELDS_, COUNT_, vec_elem_size((M_)->values))
+#define compositemap_get(M_, VEC_) \
+	compositemap_nget_(M_, (VEC_)->data, (VEC_)->len, vec_elem_size((M_)->values))
+
+bool compositemap_nremove_(void*,
+                           const Const_Char_Slice* fields,
+                           unsigned count,
+                           unsigned elem_size);
+#define compositemap_nremove(M_, FIELDS_, COUNT_) \
+	compositemap_nremove_(M_, FIELDS_, COUNT_, vec_elem_size((M_)->values))
+#define compositemap_remove(M_, VEC_) \
+	compositemap_nremove_(M_, (VEC_)->data, (VEC_)->len, vec_elem_size((M_)->values))
 
 #endif /* MAP_H */
@@ -0,0 +1,275 @@
+#include "mapfile.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
+
+#define _IMAGE_MAGIC   "UTILMAP1"
+#define _IMAGE_VERSION 2
+
+/* every section starts on a cache line */
+#define _IMAGE_ALIGN 64
+
+/* Offsets are from the start of the file. 0 means no section. */
+struct _Image_Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size; /* catches a different _Entry layout */
+	uint32_t props;
+	uint32_t elem_size;
+	uint32_t is_map;
+	uint32_t inline_key; /* MAP_INLINE_KEY it was saved with */
+	uint64_t seed;
+	uint64_t size;
+	uint64_t entries_len;
+	uint64_t keybuf_len;
+	uint64_t values_len;
+	uint64_t entries_off;
+	uint64_t ctrl_off;
+	uint64_t keybuf_off;
+	uint64_t values_off;
+	uint64_t rev_off;
+	uint64_t file_len;
+};
+
+int _image_save(const _Table*, const void* values, size_t values_len, unsigned elem_size, bool is_map, const char* path);
+int _image_open(_Table*, Vec* values, unsigned elem_size, bool is_map, const char* path);
+
+
+int
+map_save_(void* gen_m, const char* path, unsigned elem_size) {
+	Map* m = gen_m;
+	_table_migrate(&m->_table, (size_t)-1);
+	return _image_save(&m->_table, m->values.data, m->values.len, elem_size, true, path);
+}
+
+int
+set_save(Set* restrict s, const char* path) {
+	_table_migrate(&s->_table, (size_t)-1);
+	return _image_save(&s->_table, NULL, 0, 0, false, path);
+}
+
+int
+map_open_(void* gen_m, const char* path, unsigned elem_size) {
+	Map* m = gen_m;
+	return _image_open(&m->_table, (Vec*)&m->values, elem_size, true, path);
+}
+
+int
+set_open(Set* restrict s, const char* path) {
+	s->_filter = NULL;
+	return _image_open(&s->_table, NULL, 0, false, path);
+}
+
+/* Internal */
+
+static size_t
+_image_align(size_t off) {
+	return (off + _IMAGE_ALIGN - 1) & ~(size_t)(_IMAGE_ALIGN - 1);
+}
+
+/* Pad out to off, then write len bytes of data */
+static int
+_image_write(FILE* f, size_t* pos, uint64_t off, const void* data, size_t len) {
+	static const char zeros[_IMAGE_ALIGN];
+	if (off < *pos || fwrite(zeros, 1, off - *pos, f) != off - *pos) {
+		return Result_Fail;
+	}
+	if (len != 0 && fwrite(data, 1, len, f) != len) {
+		return Result_Fail;
+	}
+	*pos = off + len;
+	return Result_Ok;
+}
+
+int
+_image_save(const _Table* t,
+            const void* values,
+            size_t values_len,
+            unsigned elem_size,
+            bool is_map,
+            const char* path) {
+	struct _Image_Header h = {
+	    .version     = _IMAGE_VERSION,
+	    .entry_size  = sizeof(_Entry),
+	    .props       = t->props,
+	    .elem_size   = elem_size,
+	    .is_map      = is_map,
+	    .inline_key  = MAP_INLINE_KEY,
+	    .seed        = t->seed,
+	    .size        = t->size,
+	    .entries_len = t->_entries.len,
+	    .keybuf_len  = t->_keybuf_head,
+	    .values_len  = values_len,
+	};
+	memcpy(h.magic, _IMAGE_MAGIC, sizeof(h.magic));
+
+	size_t entries_bytes = t->_entries.len * sizeof(_Entry);
+	size_t ctrl_bytes    = (t->_ctrl != NULL) ? t->_entries.len + _GROUP_WIDTH : 0;
+	size_t values_bytes  = values_len * elem_size;
+	size_t rev_bytes     = t->_rev.len * sizeof(map_idx);
+
+	size_t off    = _image_align(sizeof(h));
+	h.entries_off = off;
+	off           = _image_align(off + entries_bytes);
+	if (ctrl_bytes != 0) {
+		h.ctrl_off = off;
+		off        = _image_align(off + ctrl_bytes);
+	}
+	h.keybuf_off = off;
+	off          = _image_align(off + h.keybuf_len);
+	if (h.is_map) {
+		h.values_off = off;
+		off          = _image_align(off + values_bytes);
+		h.rev_off    = off;
+		off          = _image_align(off + rev_bytes);
+	}
+	h.file_len = off;
+
+	/* write beside path so readers of the old file keep working */
+	char* tmp = heap_alloc(strlen(path) + 5);
+	sprintf(tmp, "%s.tmp", path);
+
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL) {
+		perror(tmp);
+		heap_free(tmp);
+		return Result_Fail;
+	}
+
+	size_t pos = 0;
+	int    ret = _image_write(f, &pos, 0, &h, sizeof(h));
+	if (ret == Result_Ok) {
+		ret = _image_write(f, &pos, h.entries_off, t->_entries.data, entries_bytes);
+	}
+	if (ret == Result_Ok && ctrl_bytes != 0) {
+		ret = _image_write(f, &pos, h.ctrl_off, t->_ctrl, ctrl_bytes);
+	}
+	if (ret == Result_Ok) {
+		ret = _image_write(f, &pos, h.keybuf_off, t->_keybuf.data, h.keybuf_len);
+	}
+	if (ret == Result_Ok && h.is_map) {
+		ret = _image_write(f, &pos, h.values_off, values, values_bytes);
+		if (ret == Result_Ok) {
+			ret = _image_write(f, &pos, h.rev_off, t->_rev.data, rev_bytes);
+		}
+	}
+	if (ret == Result_Ok) {
+		ret = _image_write(f, &pos, h.file_len, NULL, 0);
+	}
+	if (fclose(f) != 0) {
+		ret = Result_Fail;
+	}
+	if (ret == Result_Ok && rename(tmp, path) != 0) {
+		ret = Result_Fail;
+	}
+	if (ret != Result_Ok) {
+		perror(tmp);
+		remove(tmp);
+	}
+	heap_free(tmp);
+	return ret;
+}
+
+/* Section [off, off + len) lies within the file */
+static bool
+_image_fits(const struct _Image_Header* h, uint64_t off, uint64_t len) {
+	return off >= sizeof(*h) && off <= h->file_len && len <= h->file_len - off;
+}
+
+/* Returns NULL if h describes a file we can use */
+static const char*
+_image_check(const struct _Image_Header* h, size_t file_len, unsigned elem_size, bool is_map) {
+	if (memcmp(h->magic, _IMAGE_MAGIC, sizeof(h->magic)) != 0) {
+		return "not a map image";
+	}
+	if (h->version != _IMAGE_VERSION || h->entry_size != sizeof(_Entry)
+	    || h->inline_key != MAP_INLINE_KEY) {
+		return "map image from a different version";
+	}
+	if (h->file_len != file_len) {
+		return "map image is truncated";
+	}
+	if (h->is_map != is_map) {
+		return is_map ? "image is a set, not a map" : "image is a map, not a set";
+	}
+	if (is_map && h->elem_size != elem_size) {
+		return "map image has a different value size";
+	}
+
+	bool group = (h->props & MAP_PROP_GROUP);
+	if (h->entries_len == 0 || (h->entries_len & (h->entries_len - 1)) != 0
+	    || h->size > h->entries_len || group != (h->ctrl_off != 0)
+	    || !_image_fits(h, h->entries_off, h->entries_len * sizeof(_Entry))
+	    || (group && !_image_fits(h, h->ctrl_off, h->entries_len + _GROUP_WIDTH))
+	    || !_image_fits(h, h->keybuf_off, h->keybuf_len)) {
+		return "corrupt map image";
+	}
+	if (is_map
+	    && (h->values_len != h->size || h->values_len > VEC_INT_MAX
+	        || !_image_fits(h, h->values_off, h->values_len * elem_size)
+	        || !_image_fits(h, h->rev_off, h->values_len * sizeof(map_idx)))) {
+		return "corrupt map image";
+	}
+	return NULL;
+}
+
+int
+_image_open(_Table* t, Vec* values, unsigned elem_size, bool is_map, const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return Result_Fail;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		perror(path);
+		close(fd);
+		return Result_Fail;
+	}
+	if ((size_t)st.st_size < sizeof(struct _Image_Header)) {
+		fprintf(stderr, "%s: not a map image\n", path);
+		close(fd);
+		return Result_Fail;
+	}
+
+	/* shared, so every process opening path uses the same pages */
+	uint8_t* image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		perror(path);
+		return Result_Fail;
+	}
+
+	const struct _Image_Header* h   = (const struct _Image_Header*)image;
+	const char*                 err = _image_check(h, st.st_size, elem_size, is_map);
+	if (err != NULL) {
+		fprintf(stderr, "%s: %s\n", path, err);
+		munmap(image, st.st_size);
+		return Result_Fail;
+	}
+
+	*t = (_Table) {
+	    ._entries     = {(_Entry*)(image + h->entries_off), h->entries_len},
+	    ._ctrl        = (h->ctrl_off != 0) ? (int8_t*)(image + h->ctrl_off) : NULL,
+	    .hash__       = _table_hash_fn(h->props),
+	    .seed         = h->seed,
+	    ._keybuf      = {image + h->keybuf_off, h->keybuf_len},
+	    ._keybuf_head = h->keybuf_len,
+	    .size         = h->size,
+	    .props        = h->props,
+	    ._image       = image,
+	    ._image_len   = st.st_size,
+	};
+	if (is_map) {
+		t->_rev.data = (map_idx*)(image + h->rev_off);
+		t->_rev.len  = h->values_len;
+		t->_rev._cap = h->values_len;
+		*values      = (Vec) {image + h->values_off, h->values_len, h->values_len};
+	}
+	return Result_Ok;
+}
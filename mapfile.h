@@ -0,0 +1,42 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "map.h"
+
+/**
+ * Save a Map or Set to a file that map_open/set_open can map
+ * straight back in. The file is the table as it sits in memory:
+ * entries, control bytes, key buffer and values, each aligned
+ * to a cache line. Entries refer to keys and values by index,
+ * so nothing needs fixing up after the mapping moves. Opening
+ * is an mmap and a header check; pages fault in as lookups
+ * touch them and are shared by every process with the file
+ * open.
+ *
+ * Values are copied byte for byte, so they must not hold
+ * pointers. A file is only good on the architecture and build
+ * that wrote it.
+ *
+ * Saving finishes any MAP_PROP_INCREMENTAL move first. The file
+ * is written beside path and renamed over it, so processes that
+ * have the old file mapped are not disturbed.
+ *
+ * All return Result_Fail and print to stderr on failure.
+ */
+int map_save_(void*, const char* path, unsigned elem_size);
+#define map_save(M_, PATH_) map_save_(M_, PATH_, vec_elem_size((M_)->values))
+int set_save(Set* restrict, const char* path);
+
+/**
+ * Construct m from a saved file, mapped read-only. Only
+ * lookups (map_nget, set_nhas and their batch forms) and
+ * map_freeze are allowed on the result. Anything that writes
+ * faults. Release with map_destroy or set_destroy.
+ */
+int map_open_(void*, const char* path, unsigned elem_size);
+#define map_open(M_, PATH_) map_open_(M_, PATH_, vec_elem_size((M_)->values))
+int set_open(Set* restrict, const char* path);
+
+#endif /* MAPFILE_H */
@@ -0,0 +1,173 @@
+#include "shardcache.h"
+#include <stdio.h>
+#include "util.h"
+
+struct _Cache_Shard* _cache_shard_of(const Shard_Cache*, uint64_t hash);
+uint64_t _shardcache_hash(const Shard_Cache*, const char* key, unsigned* n);
+
+void
+shardcache_construct_(void* gen_c,
+                      const unsigned elem_size,
+                      unsigned shard_count,
+                      size_t capacity,
+                      const unsigned props) {
+	Shard_Cache* c  = gen_c;
+	c->_elem_size  = elem_size;
+	c->_shard_bits = 0;
+	while ((1U << c->_shard_bits) < shard_count && c->_shard_bits < 16) {
+		++c->_shard_bits;
+	}
+	shard_count = 1U << c->_shard_bits;
+
+	/* as with Shard_Map, keep each lock on its own line */
+	c->_shards = aligned_alloc(64, shard_count * sizeof(struct _Cache_Shard));
+	if (c->_shards == NULL) {
+		perror("aligned_alloc");
+		abort();
+	}
+
+	unsigned i = 0;
+	for (; i < shard_count; ++i) {
+		struct _Cache_Shard* sh = &c->_shards[i];
+		pthread_rwlock_init(&sh->lock, NULL);
+		cache_construct_(&sh->cache, elem_size, (capacity + shard_count - 1) / shard_count, props);
+		/* one hash for every shard */
+		sh->cache._map._table.seed = c->_shards[0].cache._map._table.seed;
+	}
+}
+
+void
+shardcache_destroy(void* gen_c) {
+	Shard_Cache* c = gen_c;
+	unsigned     i = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		cache_destroy(&c->_shards[i].cache);
+		pthread_rwlock_destroy(&c->_shards[i].lock);
+	}
+	heap_free(c->_shards);
+}
+
+void
+shardcache_clear(void* gen_c) {
+	Shard_Cache* c = gen_c;
+	unsigned     i = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		pthread_rwlock_wrlock(&c->_shards[i].lock);
+		cache_clear(&c->_shards[i].cache);
+		pthread_rwlock_unlock(&c->_shards[i].lock);
+	}
+}
+
+void
+shardcache_on_evict(void* gen_c, evict_fn on_evict, void* data) {
+	Shard_Cache* c = gen_c;
+	unsigned     i = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		pthread_rwlock_wrlock(&c->_shards[i].lock);
+		cache_on_evict(&c->_shards[i].cache, on_evict, data);
+		pthread_rwlock_unlock(&c->_shards[i].lock);
+	}
+}
+
+bool
+shardcache_nget_(void* gen_c, const char* restrict key, unsigned n, void* out) {
+	Shard_Cache*         c    = gen_c;
+	uint64_t             hash = _shardcache_hash(c, key, &n);
+	struct _Cache_Shard* sh   = _cache_shard_of(c, hash);
+
+	pthread_rwlock_rdlock(&sh->lock);
+	void* val = _cache_get_hashed(&sh->cache, key, n, hash);
+	if (val != NULL && out != NULL) {
+		memcpy(out, val, c->_elem_size);
+	}
+	pthread_rwlock_unlock(&sh->lock);
+
+	__atomic_fetch_add((val) ? &sh->cache.hits : &sh->cache.misses, 1, __ATOMIC_RELAXED);
+	return val != NULL;
+}
+
+void
+shardcache_nput_(void* gen_c, const char* restrict key, unsigned n, const void* data) {
+	Shard_Cache*         c    = gen_c;
+	uint64_t             hash = _shardcache_hash(c, key, &n);
+	struct _Cache_Shard* sh   = _cache_shard_of(c, hash);
+
+	pthread_rwlock_wrlock(&sh->lock);
+	_cache_put_hashed(&sh->cache, key, n, hash, data);
+	pthread_rwlock_unlock(&sh->lock);
+}
+
+bool
+shardcache_nremove(void* gen_c, const char* restrict key, unsigned n) {
+	Shard_Cache*         c    = gen_c;
+	uint64_t             hash = _shardcache_hash(c, key, &n);
+	struct _Cache_Shard* sh   = _cache_shard_of(c, hash);
+
+	pthread_rwlock_wrlock(&sh->lock);
+	bool found = _cache_remove_hashed(&sh->cache, key, n, hash);
+	pthread_rwlock_unlock(&sh->lock);
+	return found;
+}
+
+size_t
+shardcache_size(void* gen_c) {
+	Shard_Cache* c    = gen_c;
+	size_t       size = 0;
+	unsigned     i    = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		pthread_rwlock_rdlock(&c->_shards[i].lock);
+		size += cache_size(&c->_shards[i].cache);
+		pthread_rwlock_unlock(&c->_shards[i].lock);
+	}
+	return size;
+}
+
+size_t
+shardcache_hits(void* gen_c) {
+	Shard_Cache* c    = gen_c;
+	size_t       hits = 0;
+	unsigned     i    = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		hits += __atomic_load_n(&c->_shards[i].cache.hits, __ATOMIC_RELAXED);
+	}
+	return hits;
+}
+
+size_t
+shardcache_misses(void* gen_c) {
+	Shard_Cache* c      = gen_c;
+	size_t       misses = 0;
+	unsigned     i      = 0;
+	for (; i < (1U << c->_shard_bits); ++i) {
+		misses += __atomic_load_n(&c->_shards[i].cache.misses, __ATOMIC_RELAXED);
+	}
+	return misses;
+}
+
+/* Internal */
+
+uint64_t
+_shardcache_hash(const Shard_Cache* c, const char* key, unsigned* n) {
+	/* hash__ and seed are read only after construction */
+	const _Table* t = &c->_shards[0].cache._map._table;
+	return t->hash__(key, n, t->seed);
+}
+
+static inline uint64_t
+_cache_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+struct _Cache_Shard*
+_cache_shard_of(const Shard_Cache* c, uint64_t hash) {
+	if (c->_shard_bits == 0) {
+		return c->_shards;
+	}
+	/* mixed first, as _shard_of does */
+	return &c->_shards[_cache_mix(hash) >> (64 - c->_shard_bits)];
+}
@@ -0,0 +1,82 @@
+#ifndef SHARDCACHE_H
+#define SHARDCACHE_H
+
+#include <pthread.h>
+#include "cache.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Shard_Cache is a thread safe Cache split into a power of 2
+ * number of Caches, each behind its own read/write lock, the
+ * way Shard_Map splits a Map. Each shard evicts on its own, so
+ * capacity is divided between them and a skewed shard may
+ * evict a little early.
+ *
+ * A get only takes its shard's read lock: the referenced byte
+ * and the hit counters are written with relaxed atomics, so
+ * hits on one shard do not wait on each other. Values are
+ * copied in and out under the lock. The evict_fn runs under
+ * the write lock of the key's shard, so it must not call back
+ * into the cache.
+ */
+struct _Cache_Shard {
+	pthread_rwlock_t lock;
+	Cache cache;
+} __attribute__((aligned(64)));
+
+#define Shard_Cache(T_)                                \
+	struct {                                       \
+		struct _Cache_Shard* _shards;          \
+		T_* _type; /* never set, see typeof */ \
+		unsigned _shard_bits;                  \
+		unsigned _elem_size;                   \
+	}
+typedef Shard_Cache(uint8_t) Shard_Cache;
+
+/**
+ * shard_count is rounded up to a power of 2. capacity is for
+ * the whole cache, not a shard.
+ */
+void shardcache_construct_(void*,
+                           const unsigned elem_size,
+                           unsigned shard_count,
+                           size_t capacity,
+                           const unsigned props);
+#define shardcache_construct(C_, SHARDS_, CAPACITY_, PROPS_) \
+	shardcache_construct_(C_, sizeof(*(C_)->_type), SHARDS_, CAPACITY_, PROPS_)
+void shardcache_destroy(void*);
+void shardcache_clear(void*);
+void shardcache_on_evict(void*, evict_fn on_evict, void* data);
+
+/**
+ * Copy key's value into out. Returns false (out untouched) on
+ * a miss. out may be NULL to only test for key.
+ */
+bool shardcache_nget_(void*, const char* key, unsigned key_len, void* out);
+#define shardcache_nget(C_, KEY_, KL_, OUT_) shardcache_nget_(C_, KEY_, KL_, OUT_)
+#define shardcache_get(C_, KEY_, OUT_)       shardcache_nget_(C_, KEY_, strlen(KEY_), OUT_)
+
+/* Add or replace key's value with a copy of data */
+void shardcache_nput_(void*, const char* key, unsigned key_len, const void* data);
+#define shardcache_nput(C_, KEY_, KL_, ITEM_)           \
+	{                                               \
+		__typeof__(*(C_)->_type) item_ = ITEM_; \
+		shardcache_nput_(C_, KEY_, KL_, &item_); \
+	}
+#define shardcache_put(C_, KEY_, ITEM_) shardcache_nput(C_, KEY_, strlen(KEY_), ITEM_)
+
+bool shardcache_nremove(void*, const char* key, unsigned key_len);
+#define shardcache_remove(C_, KEY_) shardcache_nremove(C_, KEY_, strlen(KEY_))
+
+/**
+ * Sums over the shards. Each shard is read under its lock, but
+ * the totals are not a snapshot while other threads run.
+ */
+size_t shardcache_size(void*);
+size_t shardcache_hits(void*);
+size_t shardcache_misses(void*);
+
+#endif /* SHARDCACHE_H */
@@ -0,0 +1,191 @@
+#include "shardmap.h"
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+struct _Shard* _shard_of(const Shard_Map*, uint64_t hash);
+uint64_t _shardmap_hash(const Shard_Map*, const char* key, unsigned* n);
+
+void
+shardmap_construct_(void* gen_m,
+                    const unsigned elem_size,
+                    unsigned shard_count,
+                    size_t limit,
+                    const unsigned props) {
+	Shard_Map* m = gen_m;
+	m->_elem_size = elem_size;
+	m->_shard_bits = 0;
+	while ((1U << m->_shard_bits) < shard_count && m->_shard_bits < 16) {
+		++m->_shard_bits;
+	}
+	shard_count = 1U << m->_shard_bits;
+
+	/* shards sit on their own cache lines so their locks do
+	 * not bounce between cores. malloc does not promise 64.
+	 */
+	m->_shards = aligned_alloc(64, shard_count * sizeof(struct _Shard));
+	if (m->_shards == NULL) {
+		perror("aligned_alloc");
+		abort();
+	}
+
+	unsigned i = 0;
+	for (; i < shard_count; ++i) {
+		struct _Shard* sh = &m->_shards[i];
+		pthread_rwlock_init(&sh->lock, NULL);
+		map_construct_(&sh->map, elem_size, limit / shard_count + 1, props);
+		/* one hash for every shard */
+		sh->map._table.seed = m->_shards[0].map._table.seed;
+	}
+}
+
+void
+shardmap_destroy(void* gen_m) {
+	Shard_Map* m = gen_m;
+	unsigned   i = 0;
+	for (; i < (1U << m->_shard_bits); ++i) {
+		map_destroy(&m->_shards[i].map);
+		pthread_rwlock_destroy(&m->_shards[i].lock);
+	}
+	heap_free(m->_shards);
+}
+
+void
+shardmap_clear(void* gen_m) {
+	Shard_Map* m = gen_m;
+	unsigned   i = 0;
+	for (; i < (1U << m->_shard_bits); ++i) {
+		pthread_rwlock_wrlock(&m->_shards[i].lock);
+		map_clear(&m->_shards[i].map);
+		pthread_rwlock_unlock(&m->_shards[i].lock);
+	}
+}
+
+void
+shardmap_nset_(void* gen_m, const char* restrict key, unsigned n, const void* data) {
+	Shard_Map*     m    = gen_m;
+	uint64_t       hash = _shardmap_hash(m, key, &n);
+	struct _Shard* sh   = _shard_of(m, hash);
+
+	pthread_rwlock_wrlock(&sh->lock);
+	map_idx idx = _map_declare_hashed(&sh->map, key, n, hash);
+	if (idx == _NONE) {
+		vec_push_back_(&sh->map.values, data, m->_elem_size);
+	} else {
+		vec_set_one_at_(&sh->map.values, idx, data, m->_elem_size);
+	}
+	pthread_rwlock_unlock(&sh->lock);
+}
+
+bool
+shardmap_nget_(const void* gen_m, const char* restrict key, unsigned n, void* out) {
+	const Shard_Map* m    = gen_m;
+	uint64_t         hash = _shardmap_hash(m, key, &n);
+	struct _Shard*   sh   = _shard_of(m, hash);
+
+	pthread_rwlock_rdlock(&sh->lock);
+	_Entry* e     = _table_find(&sh->map._table, key, n, hash);
+	bool    found = (e->val_idx != _NONE);
+	if (found && out != NULL) {
+		memcpy(out, vec_iter_at_(&sh->map.values, e->val_idx, m->_elem_size), m->_elem_size);
+	}
+	pthread_rwlock_unlock(&sh->lock);
+	return found;
+}
+
+bool
+shardmap_nget_or_insert_(
+    void* gen_m, const char* restrict key, unsigned n, const void* data, void* out) {
+	Shard_Map*     m    = gen_m;
+	uint64_t       hash = _shardmap_hash(m, key, &n);
+	struct _Shard* sh   = _shard_of(m, hash);
+
+	/* Most calls find the key, so try under the read lock first */
+	pthread_rwlock_rdlock(&sh->lock);
+	_Entry* e = _table_find(&sh->map._table, key, n, hash);
+	if (e->val_idx != _NONE) {
+		if (out != NULL) {
+			memcpy(out,
+			       vec_iter_at_(&sh->map.values, e->val_idx, m->_elem_size),
+			       m->_elem_size);
+		}
+		pthread_rwlock_unlock(&sh->lock);
+		return false;
+	}
+	pthread_rwlock_unlock(&sh->lock);
+
+	/* Another writer may have added key between the locks */
+	pthread_rwlock_wrlock(&sh->lock);
+	map_idx idx      = _map_declare_hashed(&sh->map, key, n, hash);
+	bool    inserted = (idx == _NONE);
+	if (inserted) {
+		vec_push_back_(&sh->map.values, data, m->_elem_size);
+		idx = sh->map.values.len - 1;
+	}
+	if (out != NULL) {
+		memcpy(out, vec_iter_at_(&sh->map.values, idx, m->_elem_size), m->_elem_size);
+	}
+	pthread_rwlock_unlock(&sh->lock);
+	return inserted;
+}
+
+bool
+shardmap_nremove(void* gen_m, const char* restrict key, unsigned n) {
+	Shard_Map*     m    = gen_m;
+	uint64_t       hash = _shardmap_hash(m, key, &n);
+	struct _Shard* sh   = _shard_of(m, hash);
+
+	pthread_rwlock_wrlock(&sh->lock);
+	_Entry* e     = _table_find(&sh->map._table, key, n, hash);
+	bool    found = (e->val_idx != _NONE);
+	if (found) {
+		_map_remove_entry(&sh->map, e, m->_elem_size);
+	}
+	pthread_rwlock_unlock(&sh->lock);
+	return found;
+}
+
+size_t
+shardmap_size(const void* gen_m) {
+	const Shard_Map* m    = gen_m;
+	size_t           size = 0;
+	unsigned         i    = 0;
+	for (; i < (1U << m->_shard_bits); ++i) {
+		pthread_rwlock_rdlock(&m->_shards[i].lock);
+		size += m->_shards[i].map._table.size;
+		pthread_rwlock_unlock(&m->_shards[i].lock);
+	}
+	return size;
+}
+
+/* Internal */
+
+uint64_t
+_shardmap_hash(const Shard_Map* m, const char* key, unsigned* n) {
+	/* hash__ and seed are read only after construction */
+	const _Table* t = &m->_shards[0].map._table;
+	return t->hash__(key, n, t->seed);
+}
+
+static inline uint64_t
+_shard_mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * FNV-1 barely touches the high bits for the last byte, so keys
+ * like "id1", "id2" would share a shard. Mixed, the shard bits
+ * also say nothing of the tag or slot within the shard.
+ */
+struct _Shard*
+_shard_of(const Shard_Map* m, uint64_t hash) {
+	if (m->_shard_bits == 0) {
+		return m->_shards;
+	}
+	return &m->_shards[_shard_mix(hash) >> (64 - m->_shard_bits)];
+}
@@ -0,0 +1,94 @@
+#ifndef SHARDMAP_H
+#define SHARDMAP_H
+
+#include <pthread.h>
+#include "map.h"
+
+/* NOTE: The typed macros here use typeof which is a GNU
+ *       extension.
+ */
+
+/**
+ * Shard_Map splits one logical map into a power of 2 number of
+ * Maps, each behind its own read/write lock. A key's shard is
+ * picked from the high bits of its hash, mixed first so that
+ * keys differing only at the end spread out and the shard says
+ * nothing of the slot within it. Every shard shares one hash
+ * function and seed, so a key is hashed once.
+ *
+ * Values are copied in and out under the shard's lock. Unlike
+ * Map, no pointer into the map is ever handed out because
+ * another thread may move it.
+ */
+struct _Shard {
+	pthread_rwlock_t lock;
+	Map map;
+} __attribute__((aligned(64)));
+
+#define Shard_Map(T_)                                \
+	struct {                                     \
+		struct _Shard* _shards;              \
+		T_* _type; /* never set, see typeof */ \
+		unsigned _shard_bits;                \
+		unsigned _elem_size;                 \
+	}
+typedef Shard_Map(uint8_t) Shard_Map;
+
+/**
+ * shard_count is rounded up to a power of 2. limit is the
+ * expected size of the whole map, not of a shard.
+ */
+void shardmap_construct_(void*,
+                         const unsigned elem_size,
+                         unsigned shard_count,
+                         size_t limit,
+                         const unsigned props);
+#define shardmap_construct(M_, SHARDS_, LIMIT_, PROPS_) \
+	shardmap_construct_(M_, sizeof(*(M_)->_type), SHARDS_, LIMIT_, PROPS_)
+void shardmap_destroy(void*);
+void shardmap_clear(void*);
+
+/**
+ * Add or replace key's value with a copy of data
+ */
+void shardmap_nset_(void*, const char* key, unsigned key_len, const void* data);
+#define shardmap_nset(M_, KEY_, KL_, ITEM_)                 \
+	{                                                   \
+		__typeof__(*(M_)->_type) item_ = ITEM_;     \
+		shardmap_nset_(M_, KEY_, KL_, &item_);      \
+	}
+#define shardmap_set(M_, KEY_, ITEM_) shardmap_nset(M_, KEY_, strlen(KEY_), ITEM_)
+
+/**
+ * Copy key's value into out. Returns false (out untouched)
+ * if key is not there. out may be NULL to only test for key.
+ */
+bool shardmap_nget_(const void*, const char* key, unsigned key_len, void* out);
+#define shardmap_nget(M_, KEY_, KL_, OUT_) shardmap_nget_(M_, KEY_, KL_, OUT_)
+#define shardmap_get(M_, KEY_, OUT_)       shardmap_nget_(M_, KEY_, strlen(KEY_), OUT_)
+
+/**
+ * Insert data under key unless key is already there, as one
+ * atomic step. Either way, the value now in the map is copied
+ * into out (if not NULL). Returns true if data was inserted.
+ */
+bool shardmap_nget_or_insert_(
+    void*, const char* key, unsigned key_len, const void* data, void* out);
+#define shardmap_nget_or_insert(M_, KEY_, KL_, ITEM_, OUT_)           \
+	({                                                             \
+		__typeof__(*(M_)->_type) item_ = ITEM_;                \
+		shardmap_nget_or_insert_(M_, KEY_, KL_, &item_, OUT_); \
+	})
+#define shardmap_get_or_insert(M_, KEY_, ITEM_, OUT_) \
+	shardmap_nget_or_insert(M_, KEY_, strlen(KEY_), ITEM_, OUT_)
+
+bool shardmap_nremove(void*, const char* key, unsigned key_len);
+#define shardmap_remove(M_, KEY_) shardmap_nremove(M_, KEY_, strlen(KEY_))
+
+/**
+ * Sum of the shard sizes. Each shard is read under its lock,
+ * but the total is not a snapshot while writers are running.
+ */
+size_t shardmap_size(const void*);
+
+#endif /* SHARDMAP_H */
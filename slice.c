@@ -15,7 +15,7 @@ int slice_compare_nocase(const Slice* restrict sv0,
                               const Slice* restrict sv1)
 {
 	int len = (sv0->len > sv1->len) ? sv1->len : sv0->len;
-	int ret = num_compare_(sv0->len, sv1->len);
+	int ret = NUM_COMPARE(sv0->len, sv1->len);
 	int maybe_ret = strncasecmp(sv0->data, sv1->data, len);
 	if (maybe_ret) {
 		return maybe_ret;
@@ -26,7 +26,7 @@ int slice_compare_nocase(const Slice* restrict sv0,
 int slice_compare(const Slice* restrict sv0, const Slice* restrict sv1)
 {
 	int len = (sv0->len > sv1->len) ? sv1->len : sv0->len;
-	int ret = num_compare_(sv0->len, sv1->len);
+	int ret = NUM_COMPARE(sv0->len, sv1->len);
 	int maybe_ret = strncmp(sv0->data, sv1->data, len);
 	if (maybe_ret) {
 		return maybe_ret;
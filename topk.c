@@ -0,0 +1,227 @@
+#include "topk.h"
+#include <stdio.h>
+#include "util.h"
+
+typedef struct _Topk_Counter _Topk_Counter;
+typedef struct _Topk_Node    _Topk_Node;
+
+void _topk_push(Topk*, uint64_t count, uint64_t error);
+size_t _topk_items(const Topk*, Topk_Item* out);
+uint64_t _topk_floor(const Topk*);
+static void _topk_sift_up(Topk*, size_t i);
+static void _topk_sift_down(Topk*, size_t i);
+static int _topk_cmp(const void*, const void*);
+
+
+void
+topk_construct(Topk* restrict t, size_t capacity, const unsigned props) {
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	t->capacity = capacity;
+	t->total    = 0;
+	/* never grows past capacity + 1 keys */
+	map_construct(&t->_map, capacity + 1, props);
+	vec_construct(&t->_heap);
+	vec_reserve(&t->_heap, capacity);
+}
+
+void
+topk_destroy(Topk* restrict t) {
+	map_destroy(&t->_map);
+	vec_destroy(&t->_heap);
+}
+
+void
+topk_clear(Topk* restrict t) {
+	map_clear(&t->_map);
+	vec_clear(&t->_heap);
+	t->total = 0;
+}
+
+void
+topk_nadd(Topk* restrict t, const char* restrict key, unsigned n, uint64_t weight) {
+	t->total += weight;
+
+	map_idx idx = _map_declare(&t->_map, key, n);
+	if (idx != _NONE) {
+		map_idx heap_idx = t->_map.values.data[idx].heap_idx;
+		t->_heap.data[heap_idx].count += weight;
+		_topk_sift_down(t, heap_idx);
+		return;
+	}
+
+	_Topk_Counter* c = vec_add_one(&t->_map.values);
+	if ((size_t)t->_map.values.len <= t->capacity) {
+		_topk_push(t, weight, 0);
+		return;
+	}
+
+	/**
+	 * Full: key takes over the smallest counter. Removing the
+	 * old key moves the last value, which is key's new counter,
+	 * into the old counter's place at the top of the heap.
+	 */
+	_Topk_Node* min = &t->_heap.data[0];
+	*c              = (_Topk_Counter) {min->count, 0};
+	min->count += weight;
+	_map_remove_entry(&t->_map, _rev_entry(&t->_map._table, min->val_idx), sizeof(*c));
+	_topk_sift_down(t, 0);
+}
+
+size_t
+topk_list(const Topk* restrict t, Topk_Item* out, size_t n) {
+	size_t     size  = t->_map.values.len;
+	Topk_Item* items = heap_alloc((size + 1) * sizeof(*items));
+	_topk_items(t, items);
+	qsort(items, size, sizeof(*items), _topk_cmp);
+
+	if (n > size) {
+		n = size;
+	}
+	memcpy(out, items, n * sizeof(*out));
+	heap_free(items);
+	return n;
+}
+
+int
+topk_merge(Topk* restrict dst, const Topk* restrict src) {
+	const unsigned keyed = MAP_PROP_NOCASE | MAP_PROP_RTRIM;
+	if ((dst->_map._table.props ^ src->_map._table.props) & keyed) {
+		fprintf(stderr, "topk_merge: key props differ\n");
+		return Result_Fail;
+	}
+
+	/**
+	 * A key missing from a full summary may have been counted
+	 * as often as its smallest counter, so charge that as both
+	 * count and error. Then keep the largest counts.
+	 */
+	uint64_t   dst_floor = _topk_floor(dst);
+	uint64_t   src_floor = _topk_floor(src);
+	size_t     dst_size  = dst->_map.values.len;
+	size_t     src_size  = src->_map.values.len;
+	Topk_Item* items     = heap_alloc((dst_size + src_size + 1) * sizeof(*items));
+	size_t     len       = _topk_items(dst, items);
+	size_t     i         = 0;
+
+	for (; i < len; ++i) {
+		const _Topk_Counter* c = map_nget(&src->_map, items[i].key, items[i].key_len);
+		items[i].count += (c) ? src->_heap.data[c->heap_idx].count : src_floor;
+		items[i].error += (c) ? c->error : src_floor;
+	}
+	_topk_items(src, &items[len]);
+	for (i = 0; i < src_size; ++i) {
+		Topk_Item* item = &items[dst_size + i];
+		if (map_nget(&dst->_map, item->key, item->key_len) != NULL) {
+			continue;
+		}
+		item->count += dst_floor;
+		item->error += dst_floor;
+		items[len++] = *item;
+	}
+	qsort(items, len, sizeof(*items), _topk_cmp);
+
+	Topk merged;
+	topk_construct(&merged, dst->capacity, dst->_map._table.props);
+	merged.total = dst->total + src->total;
+	for (i = 0; i < len && i < dst->capacity; ++i) {
+		_map_declare(&merged._map, items[i].key, items[i].key_len);
+		vec_add_one(&merged._map.values);
+		_topk_push(&merged, items[i].count, items[i].error);
+	}
+
+	/* items point into dst until now */
+	heap_free(items);
+	topk_destroy(dst);
+	*dst = merged;
+	return Result_Ok;
+}
+
+/* Internal */
+
+/* Counter for the value just added, while there is room */
+void
+_topk_push(Topk* t, uint64_t count, uint64_t error) {
+	map_idx val_idx             = t->_map.values.len - 1;
+	t->_map.values.data[val_idx] = (_Topk_Counter) {error, t->_heap.len};
+	*(_Topk_Node*)vec_add_one(&t->_heap) = (_Topk_Node) {count, val_idx};
+	_topk_sift_up(t, t->_heap.len - 1);
+}
+
+/* Every counter and its key, in value order */
+size_t
+_topk_items(const Topk* t, Topk_Item* out) {
+	const _Table* table = &t->_map._table;
+	size_t        i     = 0;
+	for (; i < (size_t)t->_map.values.len; ++i) {
+		const _Entry*        e = _rev_entry(table, i);
+		const _Topk_Counter* c = &t->_map.values.data[i];
+		out[i]                 = (Topk_Item) {
+                    .key     = (const char*)_entry_key(table, e),
+                    .key_len = e->key_len,
+                    .count   = t->_heap.data[c->heap_idx].count,
+                    .error   = c->error,
+                };
+	}
+	return i;
+}
+
+/* The most an uncounted key could have been seen */
+uint64_t
+_topk_floor(const Topk* t) {
+	if ((size_t)t->_map.values.len < t->capacity) {
+		return 0;
+	}
+	return t->_heap.data[0].count;
+}
+
+/* Put node at i and point its counter there */
+static inline void
+_topk_set(Topk* t, size_t i, _Topk_Node node) {
+	t->_heap.data[i]                           = node;
+	t->_map.values.data[node.val_idx].heap_idx = i;
+}
+
+static void
+_topk_sift_up(Topk* t, size_t i) {
+	_Topk_Node node = t->_heap.data[i];
+	while (i > 0 && t->_heap.data[(i - 1) / 2].count > node.count) {
+		_topk_set(t, i, t->_heap.data[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	_topk_set(t, i, node);
+}
+
+static void
+_topk_sift_down(Topk* t, size_t i) {
+	_Topk_Node* heap = t->_heap.data;
+	_Topk_Node  node = heap[i];
+	size_t      len  = t->_heap.len;
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= len) {
+			break;
+		}
+		if (child + 1 < len && heap[child + 1].count < heap[child].count) {
+			++child;
+		}
+		if (heap[child].count >= node.count) {
+			break;
+		}
+		_topk_set(t, i, heap[child]);
+		i = child;
+	}
+	_topk_set(t, i, node);
+}
+
+/* highest count first, then the smaller error */
+static int
+_topk_cmp(const void* a, const void* b) {
+	const Topk_Item* x = a;
+	const Topk_Item* y = b;
+	if (x->count != y->count) {
+		return (x->count < y->count) ? 1 : -1;
+	}
+	return (x->error > y->error) - (x->error < y->error);
+}
@@ -0,0 +1,77 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "map.h"
+
+/**
+ * Topk finds the most frequent keys of a stream in bounded
+ * memory with the Space-Saving algorithm. It keeps capacity
+ * counters in a Map, so keys follow the same MAP_PROP_* rules
+ * as a Map built with the same props. A new key that finds
+ * every counter taken replaces the key with the smallest
+ * count, and inherits that count as its error. A min-heap of
+ * counters finds it in O(1) and keeps it in O(log capacity).
+ *
+ * Guarantees, with total the sum of all weights added:
+ *  - count - error <= true count <= count for every key listed
+ *  - error <= total / capacity
+ *  - a key whose true count is above total / capacity is listed
+ *
+ * A Topk is not thread safe. Give each thread its own and
+ * topk_merge them, which keeps the same guarantees.
+ */
+struct _Topk_Counter {
+	uint64_t error;
+	map_idx heap_idx;
+};
+
+/* counts live in the heap so sifting reads one array */
+struct _Topk_Node {
+	uint64_t count;
+	map_idx val_idx;
+};
+
+struct Topk {
+	Map(struct _Topk_Counter) _map;
+	Vec(struct _Topk_Node) _heap; /* smallest count first */
+	size_t capacity;
+	uint64_t total;
+};
+typedef struct Topk Topk;
+
+/* Keys are as stored: folded and trimmed per props */
+struct Topk_Item {
+	const char* key; /* not nul-terminated */
+	unsigned key_len;
+	uint64_t count; /* upper bound */
+	uint64_t error; /* count - error is a lower bound */
+};
+typedef struct Topk_Item Topk_Item;
+
+void topk_construct(Topk* restrict, size_t capacity, const unsigned props);
+void topk_destroy(Topk* restrict);
+void topk_clear(Topk* restrict);
+
+void topk_nadd(Topk* restrict, const char* restrict key, unsigned len, uint64_t weight);
+#define topk_add(T_, KEY_) topk_nadd(T_, KEY_, strlen(KEY_), 1)
+
+/**
+ * Fill out with up to n of the keys with the highest counts,
+ * highest first. Returns the number written. Keys point into
+ * t and are good until it changes.
+ */
+size_t topk_list(const Topk* restrict, Topk_Item* out, size_t n);
+
+/**
+ * Add everything counted by src to dst. Capacities may differ;
+ * dst keeps its own. Returns Result_Fail if props differ.
+ */
+int topk_merge(Topk* restrict dst, const Topk* restrict src);
+
+#define topk_size(T_)  ((T_)->_map._table.size)
+#define topk_total(T_) ((T_)->total)
+
+#endif /* TOPK_H */
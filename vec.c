@@ -38,9 +38,9 @@ vec_copy_(void* gen_dest, void* gen_src, int elem_size) {
 
 /** Iterators **/
 void*
-vec_iter_at_(const void* gen_v, int index, int elem_size) {
+vec_iter_at_(const void* gen_v, vec_int index, int elem_size) {
 	const Vec* v = gen_v;
-	return v->data + elem_size * index;
+	return v->data + (size_t)elem_size * index;
 }
 
 void*
@@ -60,12 +60,12 @@ vec_end_(const void* gen_v, int elem_size) {
 
 /** Resizing **/
 void
-vec_reserve_(void* gen_v, int alloc, int elem_size) {
+vec_reserve_(void* gen_v, vec_int alloc, int elem_size) {
 	Vec* v = gen_v;
 	if (v->_cap >= alloc + 1) {
 		return;
 	}
-	void* data = realloc(v->data, (alloc + 1) * elem_size);
+	void* data = realloc(v->data, (size_t)(alloc + 1) * elem_size);
 	if (!data) {
 		perror("realloc");
 		exit(EXIT_FAILURE);
@@ -75,22 +75,38 @@ vec_reserve_(void* gen_v, int alloc, int elem_size) {
 }
 
 void
-vec_resize_(void* gen_v, int n, int elem_size) {
+vec_resize_(void* gen_v, vec_int n, int elem_size) {
 	Vec* v = gen_v;
 	vec_reserve_(v, n, elem_size);
 	v->len = n;
 }
 
+/* Give back capacity past len, keeping room for the end marker */
 void
-vec_resize_and_zero_(void* gen_v, int len, int elem_size) {
-	Vec* v         = gen_v;
-	int  org_size  = v->len;
-	int  org_alloc = v->_cap;
+vec_shrink_to_fit_(void* gen_v, int elem_size) {
+	Vec* v = gen_v;
+	if (v->data == NULL || v->_cap <= v->len + 1) {
+		return;
+	}
+	void* data = realloc(v->data, (size_t)(v->len + 1) * elem_size);
+	if (!data) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	v->data = data;
+	v->_cap = v->len + 1;
+}
+
+void
+vec_resize_and_zero_(void* gen_v, vec_int len, int elem_size) {
+	Vec*    v         = gen_v;
+	vec_int org_size  = v->len;
+	vec_int org_alloc = v->_cap;
 	vec_reserve_(v, len, elem_size);
 	v->len = len;
 	if (org_alloc != v->_cap) {
-		int zero_size = v->_cap - org_size;
-		memset(&v->data[org_size], 0, zero_size * elem_size);
+		vec_int zero_size = v->_cap - org_size;
+		memset(vec_iter_at_(v, org_size, elem_size), 0, (size_t)zero_size * elem_size);
 	}
 }
 
@@ -99,15 +115,20 @@ void*
 vec_add_one_(void* gen_v, int elem_size) {
 	Vec* v = gen_v;
 	if (v->_cap <= ++v->len) {
-		vec_reserve_(v, v->_cap * 2, elem_size);
+		vec_int alloc = (v->_cap <= VEC_INT_MAX / 2) ? v->_cap * 2 : VEC_INT_MAX - 1;
+		if (v->len > alloc) {
+			fputs("vec: length past VEC_INT_MAX\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		vec_reserve_(v, alloc, elem_size);
 	}
-	return v->data + elem_size * (v->len - 1);
+	return v->data + (size_t)elem_size * (v->len - 1);
 }
 
 void*
 vec_add_one_front_(void* gen_v, int elem_size) {
-	Vec* v          = gen_v;
-	int  move_size_ = elem_size * (v->_cap - 1);
+	Vec*   v          = gen_v;
+	size_t move_size_ = (size_t)elem_size * (v->len + 1);
 	vec_add_one_(v, elem_size);
 	memmove(v->data + elem_size, v->data, move_size_);
 	return v->data;
@@ -121,23 +142,23 @@ vec_push_back_(void* gen_v, const void* item, int elem_size) {
 
 /** Assignment **/
 void
-vec_set_at_(void* gen_v, int idx, const void* src, int n, int elem_size) {
+vec_set_at_(void* gen_v, vec_int idx, const void* src, vec_int n, int elem_size) {
 	Vec*  v    = gen_v;
 	void* dest = vec_iter_at_(v, idx, elem_size);
-	memcpy(dest, src, elem_size * n);
+	memcpy(dest, src, (size_t)elem_size * n);
 }
 
 /** Insertion **/
 void
 vec_insert_iter_(
     void* gen_v, void* pos, const void* begin, const void* back, int elem_size) {
-	Vec* v          = gen_v;
-	int  idx        = vec_get_idx_(v, pos, elem_size);
-	int  iter_size  = _iter_size_(begin, back, elem_size);
-	int  iter_bytes = elem_size * iter_size;
+	Vec*    v          = gen_v;
+	vec_int idx        = vec_get_idx_(v, pos, elem_size);
+	vec_int iter_size  = _iter_size_(begin, back, elem_size);
+	size_t  iter_bytes = (size_t)elem_size * iter_size;
 
 	vec_resize_(v, v->len + iter_size, elem_size);
-	int move_bytes = elem_size * (v->_cap - idx - iter_size);
+	size_t move_bytes = (size_t)elem_size * (v->len - idx - iter_size + 1);
 
 	pos = vec_iter_at_(v, idx, elem_size);
 
@@ -147,87 +168,89 @@ vec_insert_iter_(
 
 void
 vec_insert_one_(void* gen_v, void* pos, const void* item, int elem_size) {
-	Vec* v = gen_v;
-	vec_add_one(v);
-	int move_bytes = elem_size * ((v->_cap - 1) - vec_get_idx_(v, pos, elem_size));
+	Vec*    v   = gen_v;
+	vec_int idx = vec_get_idx_(v, pos, elem_size);
+	vec_add_one_(v, elem_size);
+	size_t move_bytes = (size_t)elem_size * (v->len - idx);
+	pos               = vec_iter_at_(v, idx, elem_size);
 
 	memmove((uint8_t*)pos + elem_size, pos, move_bytes);
 	memcpy(pos, item, elem_size);
 }
 
 void
-vec_insert_one_at_(void* gen_v, int idx, const void* item, int elem_size) {
+vec_insert_one_at_(void* gen_v, vec_int idx, const void* item, int elem_size) {
 	Vec* v = gen_v;
-	vec_add_one(v);
-	int   move_bytes = elem_size * ((v->_cap - 1) - idx);
-	void* pos        = vec_iter_at_(v, idx, elem_size);
+	vec_add_one_(v, elem_size);
+	size_t move_bytes = (size_t)elem_size * (v->len - idx);
+	void*  pos        = vec_iter_at_(v, idx, elem_size);
 
 	memmove((uint8_t*)pos + elem_size, pos, move_bytes);
 	memcpy(pos, item, elem_size);
 }
 
 void
-vec_insert_at_(void* gen_v, int idx, const void* it, int n, int elem_size) {
+vec_insert_at_(void* gen_v, vec_int idx, const void* it, vec_int n, int elem_size) {
 	Vec*        v    = gen_v;
 	void*       pos  = vec_iter_at_(v, idx, elem_size);
-	const void* back = (const uint8_t*)it + ((n - 1) * elem_size);
+	const void* back = (const uint8_t*)it + (size_t)(n - 1) * elem_size;
 	vec_insert_iter_(v, pos, it, back, elem_size);
 }
 
 void
-vec_insert_(void* gen_v, void* pos, const void* it, int n, int elem_size) {
+vec_insert_(void* gen_v, void* pos, const void* it, vec_int n, int elem_size) {
 	if (n == 0) {
 		return;
 	}
 	Vec*        v    = gen_v;
-	const void* back = (const uint8_t*)it + elem_size * (n - 1);
+	const void* back = (const uint8_t*)it + (size_t)elem_size * (n - 1);
 	vec_insert_iter_(v, pos, it, back, elem_size);
 }
 
 /** Deletion **/
 void
 vec_erase_iter_(void* gen_v, void* begin, const void* back, int elem_size) {
-	Vec* v     = gen_v;
-	int  bytes = (const uint8_t*)vec_iter_at_(v, v->_cap - 1, elem_size)
-	            - (const uint8_t*)back;
+	Vec*   v     = gen_v;
+	size_t bytes = (const uint8_t*)vec_iter_at_(v, v->len, elem_size)
+	               - (const uint8_t*)back;
 	v->len -= _iter_size_(begin, back, elem_size);
 	memmove(begin, (uint8_t*)back + elem_size, bytes);
 }
 
 void
-vec_erase_at_(void* gen_v, int idx, int n, int elem_size) {
+vec_erase_at_(void* gen_v, vec_int idx, vec_int n, int elem_size) {
 	void*       begin = vec_iter_at_(gen_v, idx, elem_size);
 	const void* back  = vec_iter_at_(gen_v, idx + n - 1, elem_size);
 	vec_erase_iter_(gen_v, begin, back, elem_size);
 }
 
 void
-vec_erase_(void* gen_v, void* it, int n, int elem_size) {
+vec_erase_(void* gen_v, void* it, vec_int n, int elem_size) {
 	if (n == 0) {
 		return;
 	}
-	const void* back = (char*)it + elem_size * (n - 1);
+	const void* back = (char*)it + (size_t)elem_size * (n - 1);
 	vec_erase_iter_(gen_v, it, back, elem_size);
 }
 
 /** Appending **/
 void
-vec_append_(void* gen_v, const void* it, int n, int elem_size) {
-	Vec* v        = gen_v;
-	int  old_size = v->len;
-	vec_resize(v, v->len + n);
+vec_append_(void* gen_v, const void* it, vec_int n, int elem_size) {
+	Vec*    v        = gen_v;
+	vec_int old_size = v->len;
+	vec_resize_(v, v->len + n, elem_size);
 	void* end = vec_iter_at_(v, old_size, elem_size);
-	memcpy(end, it, n * elem_size);
+	memcpy(end, it, (size_t)n * elem_size);
 }
 
 void
 vec_extend_(void* gen_v, const void* vec_src, int elem_size) {
 	Vec*       v     = gen_v;
 	const Vec* src   = vec_src;
-	int        index = v->len;
-	vec_resize(v, v->len + src->len);
+	vec_int    index = v->len;
+	vec_resize_(v, v->len + src->len, elem_size);
 	void*  end   = vec_iter_at_(v, index, elem_size);
-	size_t bytes = elem_size * (src->len + 1);
+	size_t bytes = (size_t)elem_size * (src->len + 1);
 	memmove(end, vec_begin(*src), bytes);
 }
 
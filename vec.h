@@ -20,11 +20,23 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+/* Lengths and indices are 32 bit unless VEC_WIDE is defined,
+ * which lets a Vec hold more than 2^31 elements at the cost of
+ * 8 more bytes per Vec. Byte counts are size_t either way.
+ */
+#ifdef VEC_WIDE
+typedef int64_t vec_int;
+#define VEC_INT_MAX INT64_MAX
+#else
+typedef int32_t vec_int;
+#define VEC_INT_MAX INT32_MAX
+#endif
+
 #define Vec(T_)               \
 	struct {              \
 		T_*     data; \
-		int32_t len;  \
-		int32_t _cap; \
+		vec_int len;  \
+		vec_int _cap; \
 	}
 
 /* Base vector */
@@ -69,7 +81,7 @@ void vec_copy_(void* dest, void* src, int elem_size);
 
 
 /** Iterators **/
-void* vec_iter_at_(const void*, int idx, int elem_size);
+void* vec_iter_at_(const void*, vec_int idx, int elem_size);
 #define vec_iter_at(V_, IDX_) (&(V_).data[IDX_])
 
 #define vec_begin_(V_, _) vec_begin(*(V_))
@@ -83,28 +95,25 @@ void* vec_end_(const void*, int elem_size);
 
 
 /** Resizing **/
-void vec_reserve_(void*, int n, int elem_size);
+void vec_reserve_(void*, vec_int n, int elem_size);
 #define vec_reserve(V_, ALLOC_) vec_reserve_(V_, ALLOC_, vec_elem_size(*(V_)))
 
-void vec_resize_(void*, int n, int elem_size);
+void vec_resize_(void*, vec_int n, int elem_size);
 #define vec_resize(V_, N_)             \
 	{                              \
 		vec_reserve((V_), N_); \
 		(V_)->len = N_;        \
 	}
 
-void vec_resize_and_zero_(void*, int n, int elem_size);
+void vec_resize_and_zero_(void*, vec_int n, int elem_size);
 #define vec_resize_and_zero(V_, N_) vec_resize_and_zero_(V_, N_, vec_elem_size(*(V_)))
 
 /** Shrinking **/
 #define vec_clear(V_)    (V_)->len = 0
 #define vec_pop_back(V_) (V_)->len == 0 ? NULL : &(V_)->data[--(V_)->len]
 
-#define vec_shrink_to_fit(V_)                                              \
-	{                                                                  \
-		realloc_((V_)->data, ((V_)->len + 1) * vec_elem_size(V_)); \
-		(V_)->_cap = (V_)->len + 1;                                \
-	}
+void vec_shrink_to_fit_(void*, int elem_size);
+#define vec_shrink_to_fit(V_) vec_shrink_to_fit_(V_, vec_elem_size(*(V_)))
 
 /** Growing **/
 void* vec_add_one_(void*, int elem_size);
@@ -131,23 +140,23 @@ void vec_push_back_(void*, const void* item_ptr, int elem_size);
 #define vec_set_one_at_(V_, IDX_, src_, ES_) vec_set_at_(V_, IDX_, src_, 1, ES_)
 #define vec_set_one_at(V_, IDX_, ITEM_)      (V_)->data[IDX_] = ITEM_
 
-void vec_set_at_(void*, int idx, const void* src, int n, int elem_size);
+void vec_set_at_(void*, vec_int idx, const void* src, vec_int n, int elem_size);
 #define vec_set_at(V_, IDX_, src_, N_) \
-	memcpy(&(V_)->data[IDX_], src_, N_* vec_elem_size(*(V_)))
+	memcpy(&(V_)->data[IDX_], src_, (size_t)(N_)*vec_elem_size(*(V_)))
 
-#define vec_set_(V_, POS_, src_, N_, ES_) memcpy(POS_, src_, N_* ES_)
-#define vec_set(V_, POS_, src_, N_)       memcpy(POS_, src_, N_* vec_elem_size(*(V_)))
+#define vec_set_(V_, POS_, src_, N_, ES_) memcpy(POS_, src_, (size_t)(N_)*ES_)
+#define vec_set(V_, POS_, src_, N_)       memcpy(POS_, src_, (size_t)(N_)*vec_elem_size(*(V_)))
 
 /** Insertion **/
 void vec_insert_iter_(
     void*, void* pos, const void* begin, const void* back, int elem_size);
 #define vec_insert_iter(V_, POS_, BEGIN_, BACK_)                             \
 	{                                                                    \
-		int idx_       = vec_get_idx(*(V_), POS_);                   \
-		int iter_size_ = BEGIN_ - BACK_ + 1;                         \
+		vec_int idx_       = vec_get_idx(*(V_), POS_);               \
+		vec_int iter_size_ = BEGIN_ - BACK_ + 1;                     \
 		vec_resize(V_, (V_)->len + iter_size_);                      \
-		int move_bytes_ =                                            \
-		    vec_elem_size(*(V_)) * ((V_)->_cap - idx_ - iter_size_); \
+		size_t move_bytes_ = vec_elem_size(*(V_))                    \
+		                     * ((V_)->len - idx_ - iter_size_ + 1);  \
 		memmove(&POS_[iter_size_], POS_, move_bytes_);               \
 		memcpy(POS_, BEGIN_, iter_size_* vec_elem_size(*(V_)));      \
 	}
@@ -155,30 +164,30 @@ void vec_insert_iter_(
 void vec_insert_one_(void*, void* pos, const void* item, int elem_size);
 #define vec_insert_one(V_, POS_, ITEM_)                                           \
 	{                                                                         \
-		int idx_ = vec_get_idx(*(V_), POS_);                              \
+		vec_int idx_ = vec_get_idx(*(V_), POS_);                          \
 		vec_add_one(V_);                                                  \
-		int move_bytes_ = vec_elem_size(*(V_)) * ((V_)->_cap - 1 - idx_); \
+		size_t move_bytes_ = vec_elem_size(*(V_)) * ((V_)->len - idx_);  \
 		memmove(&POS_[1], POS_, move_bytes_);                             \
 		*(POS_) = ITEM_;                                                  \
 	}
 
-void vec_insert_one_at_(void*, int idx, const void* item, int elem_size);
+void vec_insert_one_at_(void*, vec_int idx, const void* item, int elem_size);
 #define vec_insert_one_at(V_, IDX_, ITEM_) \
 	vec_insert_one(V_, vec_iter_at(*(V_), IDX_), ITEM_)
 
-void vec_insert_at_(void*, int idx, const void* it, int n, int elem_size);
+void vec_insert_at_(void*, vec_int idx, const void* it, vec_int n, int elem_size);
 #define vec_insert_at(V_, IDX_, IT_, N_) \
 	vec_insert_iter(V_, vec_iter_at(*(V_), IDX_), IT_, &(IT_)[N_ - 1])
 
-void vec_insert_(void*, void* pos, const void* it, int n, int elem_size);
+void vec_insert_(void*, void* pos, const void* it, vec_int n, int elem_size);
 #define vec_insert(V_, POS_, IT_, N_) vec_insert_iter(V_, POS_, IT_, &(IT_)[N_ - 1])
 
 /** Deletion **/
 void vec_erase_iter_(void*, void* begin, const void* back, int elem_size);
 #define vec_erase_iter(V_, BEGIN_, BACK_)                                                \
 	{                                                                                \
-		int bytes_ =                                                             \
-		    vec_elem_size(*(V_)) * (vec_iter_at(*(V_), (V_)->_cap - 1) - BACK_); \
+		size_t bytes_ =                                                          \
+		    vec_elem_size(*(V_)) * (vec_iter_at(*(V_), (V_)->len) - BACK_);     \
 		(V_)->len -= (BACK_ - BEGIN_ + 1);                                       \
 		memmove(BEGIN_, &(BACK_)[1], bytes_);                                    \
 	}
@@ -189,7 +198,7 @@ void vec_erase_iter_(void*, void* begin, const void* back, int elem_size);
 #define vec_erase_one_(V_, IT_, ES_) vec_erase_iter_(V_, IT_, IT_, ES_)
 #define vec_erase_one(V_, IT_)       vec_erase_iter(V_, IT_, IT_)
 
-void vec_erase_at_(void*, int idx, int n, int elem_size);
+void vec_erase_at_(void*, vec_int idx, vec_int n, int elem_size);
 #define vec_erase_at(V_, IDX_, N_)                             \
 	{                                                      \
 		if (N_) {                                      \
@@ -199,7 +208,7 @@ void vec_erase_at_(void*, int idx, int n, int elem_size);
 		}                                              \
 	}
 
-void vec_erase_(void*, void* it, int n, int elem_size);
+void vec_erase_(void*, void* it, vec_int n, int elem_size);
 #define vec_erase(V_, IT_, N_)                                \
 	{                                                     \
 		if (N_) {                                     \
@@ -208,20 +217,20 @@ void vec_erase_(void*, void* it, int n, int elem_size);
 	}
 
 /** Appending **/
-void vec_append_(void*, const void* it, int n, int elem_size);
+void vec_append_(void*, const void* it, vec_int n, int elem_size);
 #define vec_append(V_, IT_, N_)                                                  \
 	{                                                                        \
-		int idx_ = (V_)->len;                                            \
+		vec_int idx_ = (V_)->len;                                        \
 		vec_resize(V_, idx_ + N_);                                       \
-		memcpy(vec_iter_at(*(V_), idx_), IT_, N_* vec_elem_size(*(V_))); \
+		memcpy(vec_iter_at(*(V_), idx_), IT_, (size_t)(N_)*vec_elem_size(*(V_))); \
 	}
 
 void vec_extend_(void*, const void* vec_src, int elem_size);
 #define vec_extend(v_dest_, v_src_)                                               \
 	{                                                                         \
-		int idx_ = (v_dest_)->len;                                        \
+		vec_int idx_ = (v_dest_)->len;                                    \
 		vec_resize(v_dest_, (v_dest_)->len + (v_src_).len);               \
-		int bytes = vec_elem_size(v_src_) * ((v_src_).len + 1);           \
+		size_t bytes = vec_elem_size(v_src_) * ((v_src_).len + 1);        \
 		memmove(vec_iter_at(*(v_dest_), idx_), vec_begin(v_src_), bytes); \
 	}
 